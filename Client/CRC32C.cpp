@@ -0,0 +1,211 @@
+/* Copyright (C) 2022-2026 Stefan-Mihai MOGA
+This file is part of IntelliDisk application developed by Stefan-Mihai MOGA.
+IntelliDisk is an alternative Windows version to the famous Microsoft OneDrive!
+
+IntelliDisk is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the Open
+Source Initiative, either version 3 of the License, or any later version.
+
+IntelliDisk is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+IntelliDisk. If not, see <http://www.opensource.org/licenses/gpl-3.0.html>*/
+
+#include "pch.h"
+#include "CRC32C.h"
+#include <array>
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#include <nmmintrin.h>
+#define CRC32C_HARDWARE_X86
+#elif defined(_M_ARM64)
+#include <intrin.h>
+#define CRC32C_HARDWARE_ARM64
+#endif
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#endif
+
+// Reflected Castagnoli polynomial
+constexpr uint32_t CRC32C_POLYNOMIAL = 0x82F63B78;
+
+typedef std::array<std::array<uint32_t, 256>, 8> CRC32C_TABLE;
+
+/**
+ * @brief Builds the slice-by-8 lookup tables at compile time
+ * @details Table 0 is the classic byte-wise table; table k advances a byte through k more zero bytes
+ * @return The eight 256-entry tables
+ */
+static constexpr CRC32C_TABLE BuildTables()
+{
+	CRC32C_TABLE pTable = {};
+	for (uint32_t nIndex = 0; nIndex < 256; nIndex++)
+	{
+		uint32_t nCRC = nIndex;
+		for (int nBit = 0; nBit < 8; nBit++)
+			nCRC = (nCRC & 1) ? ((nCRC >> 1) ^ CRC32C_POLYNOMIAL) : (nCRC >> 1);
+		pTable[0][nIndex] = nCRC;
+	}
+	for (uint32_t nIndex = 0; nIndex < 256; nIndex++)
+		for (size_t nSlice = 1; nSlice < 8; nSlice++)
+			pTable[nSlice][nIndex] = (pTable[nSlice - 1][nIndex] >> 8) ^ pTable[0][pTable[nSlice - 1][nIndex] & 0xFF];
+	return pTable;
+}
+
+static constexpr CRC32C_TABLE g_pCRC32CTable = BuildTables();
+
+/**
+ * @brief Portable CRC32C, processing eight bytes per step (slice-by-8)
+ * @param buffer Pointer to the buffer
+ * @param length Number of bytes to process
+ * @param nCRC Checksum of the preceding data
+ * @return The computed CRC32C value
+ */
+static uint32_t calcCRC32C_Software(const unsigned char* buffer, size_t length, uint32_t nCRC)
+{
+	nCRC = ~nCRC;
+	// Step 1: Advance byte by byte to an 8-byte boundary
+	while ((length > 0) && (((uintptr_t)buffer & 7) != 0))
+	{
+		nCRC = (nCRC >> 8) ^ g_pCRC32CTable[0][(nCRC ^ *buffer++) & 0xFF];
+		length--;
+	}
+	// Step 2: Eight table lookups per 64-bit word (little-endian)
+	while (length >= 8)
+	{
+		uint32_t nLow = 0, nHigh = 0;
+		memcpy(&nLow, buffer, sizeof(nLow));
+		memcpy(&nHigh, buffer + 4, sizeof(nHigh));
+		nLow ^= nCRC;
+		nCRC = g_pCRC32CTable[7][nLow & 0xFF] ^
+			g_pCRC32CTable[6][(nLow >> 8) & 0xFF] ^
+			g_pCRC32CTable[5][(nLow >> 16) & 0xFF] ^
+			g_pCRC32CTable[4][nLow >> 24] ^
+			g_pCRC32CTable[3][nHigh & 0xFF] ^
+			g_pCRC32CTable[2][(nHigh >> 8) & 0xFF] ^
+			g_pCRC32CTable[1][(nHigh >> 16) & 0xFF] ^
+			g_pCRC32CTable[0][nHigh >> 24];
+		buffer += 8;
+		length -= 8;
+	}
+	// Step 3: Remaining tail bytes
+	while (length-- > 0)
+		nCRC = (nCRC >> 8) ^ g_pCRC32CTable[0][(nCRC ^ *buffer++) & 0xFF];
+	return ~nCRC;
+}
+
+#if defined(CRC32C_HARDWARE_X86)
+/**
+ * @brief CRC32C using the SSE4.2 CRC32 instruction
+ * @param buffer Pointer to the buffer
+ * @param length Number of bytes to process
+ * @param nCRC Checksum of the preceding data
+ * @return The computed CRC32C value
+ */
+static uint32_t calcCRC32C_Hardware(const unsigned char* buffer, size_t length, uint32_t nCRC)
+{
+	nCRC = ~nCRC;
+	while ((length > 0) && (((uintptr_t)buffer & 7) != 0))
+	{
+		nCRC = _mm_crc32_u8(nCRC, *buffer++);
+		length--;
+	}
+#if defined(_M_X64)
+	unsigned __int64 nCRC64 = nCRC;
+	while (length >= 8)
+	{
+		nCRC64 = _mm_crc32_u64(nCRC64, *(const unsigned __int64*)buffer);
+		buffer += 8;
+		length -= 8;
+	}
+	nCRC = (uint32_t)nCRC64;
+#endif
+	while (length >= 4)
+	{
+		nCRC = _mm_crc32_u32(nCRC, *(const unsigned int*)buffer);
+		buffer += 4;
+		length -= 4;
+	}
+	while (length-- > 0)
+		nCRC = _mm_crc32_u8(nCRC, *buffer++);
+	return ~nCRC;
+}
+
+/**
+ * @brief Checks the SSE4.2 bit reported by CPUID leaf 1
+ * @return true if the CRC32 instruction is available
+ */
+static bool HasHardwareCRC32C()
+{
+	int pCPUInfo[4] = { 0, };
+	__cpuid(pCPUInfo, 1);
+	return (pCPUInfo[2] & (1 << 20)) != 0;
+}
+#elif defined(CRC32C_HARDWARE_ARM64)
+/**
+ * @brief CRC32C using the ARMv8 CRC32C instructions
+ * @param buffer Pointer to the buffer
+ * @param length Number of bytes to process
+ * @param nCRC Checksum of the preceding data
+ * @return The computed CRC32C value
+ */
+static uint32_t calcCRC32C_Hardware(const unsigned char* buffer, size_t length, uint32_t nCRC)
+{
+	nCRC = ~nCRC;
+	while ((length > 0) && (((uintptr_t)buffer & 7) != 0))
+	{
+		nCRC = __crc32cb(nCRC, *buffer++);
+		length--;
+	}
+	while (length >= 8)
+	{
+		nCRC = __crc32cd(nCRC, *(const unsigned __int64*)buffer);
+		buffer += 8;
+		length -= 8;
+	}
+	while (length-- > 0)
+		nCRC = __crc32cb(nCRC, *buffer++);
+	return ~nCRC;
+}
+
+/**
+ * @brief Asks Windows whether the ARMv8 CRC32 extension is present
+ * @return true if the CRC32C instructions are available
+ */
+static bool HasHardwareCRC32C()
+{
+	return IsProcessorFeaturePresent(PF_ARM_V8_CRC32_INSTRUCTIONS_AVAILABLE) != FALSE;
+}
+#endif
+
+typedef uint32_t (*CRC32C_FUNCTION)(const unsigned char*, size_t, uint32_t);
+
+/**
+ * @brief Picks the fastest implementation supported by the processor, once at startup
+ * @return Pointer to the selected implementation
+ */
+static CRC32C_FUNCTION SelectCRC32C()
+{
+#if defined(CRC32C_HARDWARE_X86) || defined(CRC32C_HARDWARE_ARM64)
+	if (HasHardwareCRC32C())
+		return calcCRC32C_Hardware;
+#endif
+	return calcCRC32C_Software;
+}
+
+static const CRC32C_FUNCTION g_pCalcCRC32C = SelectCRC32C();
+
+uint32_t calcCRC32C(const unsigned char* buffer, const size_t length, const uint32_t nCRC)
+{
+	return g_pCalcCRC32C(buffer, length, nCRC);
+}
+
+bool IsCRC32CAccelerated()
+{
+	return g_pCalcCRC32C != calcCRC32C_Software;
+}
@@ -0,0 +1,41 @@
+/* Copyright (C) 2022-2026 Stefan-Mihai MOGA
+This file is part of IntelliDisk application developed by Stefan-Mihai MOGA.
+IntelliDisk is an alternative Windows version to the famous Microsoft OneDrive!
+
+IntelliDisk is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the Open
+Source Initiative, either version 3 of the License, or any later version.
+
+IntelliDisk is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+IntelliDisk. If not, see <http://www.opensource.org/licenses/gpl-3.0.html>*/
+
+#pragma once
+
+#ifndef __CRC32C_H__
+#define __CRC32C_H__
+
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * @brief Calculates the CRC32C (Castagnoli) checksum of a buffer.
+ *        Uses the SSE4.2 or ARMv8 CRC instructions when the processor supports them,
+ *        otherwise a slice-by-8 table lookup.
+ * @param buffer Pointer to the buffer.
+ * @param length Number of bytes to process.
+ * @param nCRC Checksum of the preceding data, to continue a running checksum (0 to start).
+ * @return The computed CRC32C value.
+ */
+uint32_t calcCRC32C(const unsigned char* buffer, const size_t length, const uint32_t nCRC = 0);
+
+/**
+ * @brief Tells whether calcCRC32C runs on the processor's CRC instructions.
+ * @return true for the hardware path, false for the slice-by-8 fallback.
+ */
+bool IsCRC32CAccelerated();
+
+#endif
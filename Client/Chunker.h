@@ -0,0 +1,66 @@
+/* Copyright (C) 2022-2026 Stefan-Mihai MOGA
+This file is part of IntelliDisk application developed by Stefan-Mihai MOGA.
+IntelliDisk is an alternative Windows version to the famous Microsoft OneDrive!
+
+IntelliDisk is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the Open
+Source Initiative, either version 3 of the License, or any later version.
+
+IntelliDisk is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+IntelliDisk. If not, see <http://www.opensource.org/licenses/gpl-3.0.html>*/
+
+#pragma once
+
+#ifndef __CHUNKER_H__
+#define __CHUNKER_H__
+
+#include <cstdint>
+#include <cstddef>
+
+#define CHUNKER_MIN_SIZE 0x1000  // Default smallest chunk (4 KiB)
+#define CHUNKER_AVG_SIZE 0x4000  // Default average chunk (16 KiB)
+#define CHUNKER_MAX_SIZE 0xFFFB  // Default and upper bound of the largest chunk: one legacy packet (64 KiB - 5)
+
+/**
+ * @brief Content-defined chunker (FastCDC).
+ *        A gear hash runs over the data and a chunk ends where its top bits are zero, so the boundaries
+ *        depend on the content only: inserting bytes moves the chunks around the edit, not the ones after it.
+ *        Bytes below the minimum size are skipped without hashing; up to the average size a stricter mask
+ *        is used and after it a looser one, which keeps the chunk sizes close to the average.
+ *        Client and server may use different sizes; only the chunks they share deduplicate.
+ */
+class CContentChunker
+{
+public:
+	/**
+	 * @param nMinSize Smallest chunk, except the last one of a file.
+	 * @param nAvgSize Targeted average chunk (rounded down to a power of two).
+	 * @param nMaxSize Largest chunk, at most CHUNKER_MAX_SIZE.
+	 */
+	CContentChunker(const unsigned int nMinSize = CHUNKER_MIN_SIZE, const unsigned int nAvgSize = CHUNKER_AVG_SIZE, const unsigned int nMaxSize = CHUNKER_MAX_SIZE);
+
+	/**
+	 * @brief Finds the end of the chunk that starts at the beginning of a buffer.
+	 * @param buffer Pointer to the data.
+	 * @param length Number of bytes available; at least GetMaxSize() unless the data ends there.
+	 * @return Length of the chunk.
+	 */
+	size_t FindBoundary(const unsigned char* buffer, const size_t length) const;
+
+	unsigned int GetMinSize() const { return m_nMinSize; }
+	unsigned int GetAvgSize() const { return m_nAvgSize; }
+	unsigned int GetMaxSize() const { return m_nMaxSize; }
+
+private:
+	unsigned int m_nMinSize;  // Smallest chunk
+	unsigned int m_nAvgSize;  // Average chunk, where the mask changes
+	unsigned int m_nMaxSize;  // Largest chunk
+	uint64_t m_nMaskSmall;    // Mask below the average size (two bits more than the average needs)
+	uint64_t m_nMaskLarge;    // Mask above the average size (two bits less)
+};
+
+#endif
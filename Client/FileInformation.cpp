@@ -4,6 +4,8 @@
 
 #include "pch.h"
 #include "FileInformation.h"
+#include "FileSnapshot.h"
+#include <deque>
 
 #ifdef _DEBUG
 #undef THIS_FILE
@@ -414,7 +416,7 @@ CString CFileInformation::ConcPath(const CString& first, const CString& second)
 	return path;
 }
 
-int CFileInformation::EnumFiles(CString root, P_FI_List list)
+int CFileInformation::EnumFiles(CString root, CFileSnapshot* snapshot)
 {
 	WIN32_FIND_DATA ffd;
 	CString         path = ConcPath(root, _T("*.*"));
@@ -423,32 +425,187 @@ int CFileInformation::EnumFiles(CString root, P_FI_List list)
 	if (INVALID_HANDLE_VALUE == sh)
 		return 0;
 
+	const UINT nDirectory = snapshot->AddDirectory(root);
+
 	do
 	{
-		CFileInformation* pFDI = new CFileInformation(ffd, root);
+		CFileInformation fi(ffd, root);
 
-		if (pFDI->IsRootFile())
+		if (fi.IsRootFile())
 		{
-			delete pFDI;
+			continue;
 		}
-		else if (pFDI->IsDirectory())
+		else if (fi.IsDirectory())
 		{
-			list->AddTail(pFDI);
-			EnumFiles(ConcPath(root, pFDI->GetFileName()), list);
+			snapshot->Add(nDirectory, ffd);
+			EnumFiles(ConcPath(root, fi.GetFileName()), snapshot);
 		}
-		else if (pFDI->IsActualFile())
+		else if (fi.IsActualFile())
 		{
-			list->AddTail(pFDI);
+			snapshot->Add(nDirectory, ffd);
+		}
+	} while (FindNextFile(sh, &ffd));
+
+	FindClose(sh);
+
+	return (int)snapshot->GetCount();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Parallel Enumeration
+//////////////////////////////////////////////////////////////////////
+
+// Directories and partial snapshot of one walker thread;
+// the owner takes directories from the back (depth first), idle threads steal from the front
+typedef struct {
+	SRWLOCK             lock;
+	std::deque<CString> dirs;
+	CFileSnapshot       snapshot;
+} ENUM_WORKER;
+
+typedef struct {
+	std::vector<ENUM_WORKER>* workers;
+	volatile LONG*            pending;   // directories queued or being read
+	UINT                      index;
+} ENUM_THREAD;
+
+static BOOL PopDirectory(ENUM_WORKER& worker, CString& dir, BOOL back)
+{
+	BOOL found = FALSE;
+
+	AcquireSRWLockExclusive(&worker.lock);
+	if (!worker.dirs.empty())
+	{
+		if (back)
+		{
+			dir = worker.dirs.back();
+			worker.dirs.pop_back();
 		}
 		else
 		{
-			delete pFDI;
+			dir = worker.dirs.front();
+			worker.dirs.pop_front();
+		}
+		found = TRUE;
+	}
+	ReleaseSRWLockExclusive(&worker.lock);
+
+	return found;
+}
+
+// Reads one directory into the worker's snapshot and queues its subdirectories
+static void EnumDirectory(CString root, ENUM_WORKER& worker, volatile LONG* pending)
+{
+	WIN32_FIND_DATA ffd;
+	CString         path = CFileInformation::ConcPath(root, _T("*.*"));
+	HANDLE          sh = FindFirstFile(path, &ffd);
+
+	if (INVALID_HANDLE_VALUE == sh)
+		return;
+
+	const UINT nDirectory = worker.snapshot.AddDirectory(root);
+
+	do
+	{
+		CFileInformation fi(ffd, root);
+
+		if (fi.IsRootFile())
+		{
+			continue;
+		}
+		else if (fi.IsDirectory())
+		{
+			worker.snapshot.Add(nDirectory, ffd);
+			// counted before it is queued, so the walk cannot look finished while it waits
+			InterlockedIncrement(pending);
+			AcquireSRWLockExclusive(&worker.lock);
+			worker.dirs.push_back(CFileInformation::ConcPath(root, fi.GetFileName()));
+			ReleaseSRWLockExclusive(&worker.lock);
+		}
+		else if (fi.IsActualFile())
+		{
+			worker.snapshot.Add(nDirectory, ffd);
 		}
 	} while (FindNextFile(sh, &ffd));
 
 	FindClose(sh);
+}
 
-	return (int)list->GetCount();
+static DWORD WINAPI EnumFilesThread(LPVOID lpParam)
+{
+	ENUM_THREAD*              thread = (ENUM_THREAD*)lpParam;
+	std::vector<ENUM_WORKER>& workers = *thread->workers;
+	const UINT                count = (UINT)workers.size();
+	CString                   dir;
+
+	while (true)
+	{
+		BOOL found = PopDirectory(workers[thread->index], dir, TRUE);
+
+		for (UINT step = 1; !found && step < count; step++)
+			found = PopDirectory(workers[(thread->index + step) % count], dir, FALSE);
+
+		if (found)
+		{
+			EnumDirectory(dir, workers[thread->index], thread->pending);
+			InterlockedDecrement(thread->pending);
+		}
+		else if (*thread->pending == 0)
+			break; // every directory is read
+		else
+			SwitchToThread(); // others are still reading and may queue more
+	}
+
+	return 0;
+}
+
+// Walks the tree on several threads; the walk is bound by the latency of each directory read
+// (network shares, cold caches), so overlapping the reads helps more than the CPU count suggests
+int CFileInformation::EnumFiles(CString root, CFileSnapshot* snapshot, int threads)
+{
+	if (threads <= 0)
+	{
+		SYSTEM_INFO si;
+		GetSystemInfo(&si);
+		threads = (int)si.dwNumberOfProcessors;
+	}
+
+	if (threads <= 1)
+		return EnumFiles(root, snapshot);
+
+	threads = min(threads, MAXIMUM_WAIT_OBJECTS);
+
+	std::vector<ENUM_WORKER> workers(threads);
+	std::vector<ENUM_THREAD> params(threads);
+	std::vector<HANDLE>      handles;
+	volatile LONG            pending = 1;
+
+	for (int index = 0; index < threads; index++)
+	{
+		InitializeSRWLock(&workers[index].lock);
+		params[index] = { &workers, &pending, (UINT)index };
+	}
+	workers[0].dirs.push_back(root);
+
+	for (int index = 1; index < threads; index++)
+	{
+		HANDLE handle = CreateThread(nullptr, 0, EnumFilesThread, &params[index], 0, nullptr);
+		if (handle != nullptr)
+			handles.push_back(handle);
+	}
+
+	// the calling thread is the first walker, so the walk finishes even if no thread could be started
+	EnumFilesThread(&params[0]);
+
+	if (!handles.empty())
+		WaitForMultipleObjects((DWORD)handles.size(), handles.data(), TRUE, INFINITE);
+	for (HANDLE handle : handles)
+		CloseHandle(handle);
+
+	for (ENUM_WORKER& worker : workers)
+		snapshot->Append(worker.snapshot);
+
+	return (int)snapshot->GetCount();
 }
 
 int CFileInformation::EnumDirFiles(CString root, P_FI_List list)
@@ -695,194 +852,6 @@ BOOL CFileInformation::RemoveFiles(P_FI_List list)
 	return TRUE;
 }
 
-EFileAction CFileInformation::CompareFiles(P_FI_List oldList, P_FI_List newList, CFileInformation& fi)
-{
-	EFileAction       faType = faNone;
-	POSITION          newListPos = nullptr;
-	POSITION          oldListPos = nullptr;
-	CFileInformation* newFI = nullptr;
-	CFileInformation* oldFI = nullptr;
-	int               nNew = (int)newList->GetCount();
-	int               nOld = (int)oldList->GetCount();
-
-	if (nOld == nNew)
-	{
-		newListPos = newList->GetHeadPosition();
-		oldListPos = oldList->GetHeadPosition();
-		while (oldListPos != nullptr && newListPos != nullptr)
-		{
-			oldFI = oldList->GetNext(oldListPos);
-			newFI = newList->GetNext(newListPos);
-
-			if (*oldFI != *newFI)
-			{
-				fi = *newFI;
-				faType = faChange;
-				break;
-			}
-		}
-	}
-	else if (nOld > nNew)
-	{
-		BOOL isFind;
-
-		oldListPos = oldList->GetHeadPosition();
-		while (oldListPos != nullptr)
-		{
-			oldFI = oldList->GetNext(oldListPos);
-
-			isFind = TRUE;
-
-			newListPos = newList->GetHeadPosition();
-			while (newListPos != nullptr)
-			{
-				newFI = newList->GetNext(newListPos);
-
-				if (*oldFI == *newFI)
-				{
-					isFind = FALSE;
-					break;
-				}
-			}
-
-			if (isFind)
-			{
-				fi = *oldFI;
-				faType = faDelete;
-				break;
-			}
-		}
-	}
-	else if (nOld < nNew)
-	{
-		BOOL isFind;
-
-		newListPos = newList->GetHeadPosition();
-		while (newListPos != nullptr)
-		{
-			newFI = newList->GetNext(newListPos);
-
-			isFind = TRUE;
-
-			oldListPos = oldList->GetHeadPosition();
-			while (oldListPos != nullptr)
-			{
-				oldFI = oldList->GetNext(oldListPos);
-
-				if (*oldFI == *newFI)
-				{
-					isFind = FALSE;
-					break;
-				}
-			}
-
-			if (isFind)
-			{
-				fi = *newFI;
-				faType = faCreate;
-				break;
-			}
-		}
-	}
-
-	return faType;
-}
-
-EFileAction CFileInformation::CompareFiles(P_FI_List oldList, P_FI_List newList, P_FI_List outList)
-{
-	EFileAction faType = faNone;
-
-	POSITION newListPos = nullptr;
-	POSITION oldListPos = nullptr;
-
-	CFileInformation *newFI = nullptr;
-	CFileInformation *oldFI = nullptr;
-
-	int nNew = (int)newList->GetCount();
-	int nOld = (int)oldList->GetCount();
-
-	outList->RemoveAll();
-
-	if (nOld == nNew)
-	{
-		newListPos = newList->GetHeadPosition();
-		oldListPos = oldList->GetHeadPosition();
-		while (oldListPos != nullptr && newListPos != nullptr)
-		{
-			oldFI = oldList->GetNext(oldListPos);
-			newFI = newList->GetNext(newListPos);
-
-			if (*oldFI != *newFI)
-			{
-				outList->AddTail(newFI);
-				faType = faChange;
-			}
-		}
-	}
-	else if (nOld > nNew)
-	{
-		BOOL isFind;
-
-		oldListPos = oldList->GetHeadPosition();
-		while (oldListPos != nullptr)
-		{
-			oldFI = oldList->GetNext(oldListPos);
-
-			isFind = TRUE;
-
-			newListPos = newList->GetHeadPosition();
-			while (newListPos != nullptr)
-			{
-				newFI = newList->GetNext(newListPos);
-
-				if (*oldFI == *newFI)
-				{
-					isFind = FALSE;
-					break;
-				}
-			}
-
-			if (isFind)
-			{
-				outList->AddTail(oldFI);
-				faType = faDelete;
-			}
-		}
-	}
-	else if (nOld < nNew)
-	{
-		BOOL isFind;
-
-		newListPos = newList->GetHeadPosition();
-		while (newListPos != nullptr)
-		{
-			newFI = newList->GetNext(newListPos);
-
-			isFind = TRUE;
-
-			oldListPos = oldList->GetHeadPosition();
-			while (oldListPos != nullptr)
-			{
-				oldFI = oldList->GetNext(oldListPos);
-
-				if (*oldFI == *newFI)
-				{
-					isFind = FALSE;
-					break;
-				}
-			}
-
-			if (isFind)
-			{
-				outList->AddTail(newFI);
-				faType = faCreate;
-			}
-		}
-	}
-
-	return(faType);
-}
-
 BOOL CFileInformation::FindFilePath(CString root, CString& file)
 {
 	WIN32_FIND_DATA ffd;
@@ -22,16 +22,18 @@
 #include <afxtempl.h>	//for template collections
 
 class   CFileInformation;
+class   CFileSnapshot;
 typedef CTypedPtrList<CObList, CFileInformation*> FI_List;
 typedef FI_List* P_FI_List;
 
-typedef enum FileAction { faNone, faDelete, faCreate, faChange, } EFileAction;
+typedef enum FileAction { faNone, faDelete, faCreate, faChange, faRename, } EFileAction;
 typedef enum FileSize { fsBytes, fsKBytes, fsMBytes, } EFileSize;
 
 #define IS_NOTACT_FILE( action ) ( action == faNone   )
 #define IS_CREATE_FILE( action ) ( action == faCreate )
 #define IS_DELETE_FILE( action ) ( action == faDelete )
 #define IS_CHANGE_FILE( action ) ( action == faChange )
+#define IS_RENAME_FILE( action ) ( action == faRename )
 
 typedef UINT(*DirParsCallback)(CString path, LPVOID pData);
 
@@ -102,7 +104,8 @@ public:
 
 	static CString		ConcPath(const CString& first, const CString& second);
 	static int 			EnumDirFiles(CString root, P_FI_List list);
-	static int 			EnumFiles(CString root, P_FI_List list);
+	static int 			EnumFiles(CString root, CFileSnapshot* snapshot);
+	static int 			EnumFiles(CString root, CFileSnapshot* snapshot, int threads);
 	static int 			EnumDirFilesExt(CString root, CString ext, P_FI_List list);
 	static int 			EnumFilesExt(CString root, CString ext, P_FI_List list);
 	static void			CopyFiles(const P_FI_List oldList, P_FI_List newList);
@@ -111,8 +114,6 @@ public:
 	static void			SortFilesABC(P_FI_List list);
 	static BOOL			RemoveFiles(P_FI_List list);
 	static BOOL			FindFilePath(CString root, CString& file);
-	static EFileAction	CompareFiles(P_FI_List oldList, P_FI_List newList, CFileInformation& fi);
-	static EFileAction	CompareFiles(P_FI_List oldList, P_FI_List newList, P_FI_List outList);
 	static BOOL			FindFilePathOnDisk(CString& file);
 	static BOOL			FindFilePathOnCD(CString& file);
 	static void			CopyDir(CString oldRoot, CString newRoot);
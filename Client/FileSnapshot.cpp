@@ -0,0 +1,552 @@
+/* Copyright (C) 2022-2026 Stefan-Mihai MOGA
+This file is part of IntelliDisk application developed by Stefan-Mihai MOGA.
+IntelliDisk is an alternative Windows version to the famous Microsoft OneDrive!
+
+IntelliDisk is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the Open
+Source Initiative, either version 3 of the License, or any later version.
+
+IntelliDisk is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+IntelliDisk. If not, see <http://www.opensource.org/licenses/gpl-3.0.html>*/
+
+#include "pch.h"
+#include "FileSnapshot.h"
+
+#ifdef _DEBUG
+#undef THIS_FILE
+static char THIS_FILE[] = __FILE__;
+#define new DEBUG_NEW
+#endif
+
+const UINT NO_ENTRY = SNAPSHOT_NO_ENTRY;
+
+/**
+ * @brief Open-addressing table of entry numbers keyed by a 64-bit hash (linear probing, at most half full)
+ */
+class CEntryIndex
+{
+public:
+	CEntryIndex(const size_t nCount)
+	{
+		size_t nSize = 16;
+		while (nSize < 2 * nCount)
+			nSize *= 2;
+		m_pSlots.assign(nSize, NO_ENTRY);
+		m_nMask = nSize - 1;
+	}
+
+	void Insert(const ULONGLONG nHash, const UINT nEntry)
+	{
+		size_t nSlot = (size_t)nHash & m_nMask;
+		while (m_pSlots[nSlot] != NO_ENTRY)
+			nSlot = (nSlot + 1) & m_nMask;
+		m_pSlots[nSlot] = nEntry;
+	}
+
+	/**
+	 * @brief Finds the first entry accepted by bMatch among those stored in the probe sequence of nHash
+	 * @return The entry, or NO_ENTRY
+	 */
+	template <typename TMatch>
+	UINT Find(const ULONGLONG nHash, TMatch bMatch) const
+	{
+		for (size_t nSlot = (size_t)nHash & m_nMask; m_pSlots[nSlot] != NO_ENTRY; nSlot = (nSlot + 1) & m_nMask)
+		{
+			if (bMatch(m_pSlots[nSlot]))
+				return m_pSlots[nSlot];
+		}
+		return NO_ENTRY;
+	}
+
+private:
+	std::vector<UINT> m_pSlots;
+	size_t m_nMask;
+};
+
+/**
+ * @brief Finds the slot of the first entry accepted by bMatch in the probe sequence of nHash
+ * @return The slot, or the empty slot that ends the sequence
+ */
+template <typename TMatch>
+static size_t FindSlot(const std::vector<UINT>& pSlots, const ULONGLONG nHash, TMatch bMatch)
+{
+	const size_t nMask = pSlots.size() - 1;
+	size_t nSlot = (size_t)nHash & nMask;
+	while ((pSlots[nSlot] != NO_ENTRY) && !bMatch(pSlots[nSlot]))
+		nSlot = (nSlot + 1) & nMask;
+	return nSlot;
+}
+
+/**
+ * @brief Fills a table of nCount entries, sized so that it is at most half full after one more insert
+ */
+template <typename THash>
+static void BuildSlots(std::vector<UINT>& pSlots, const UINT nCount, THash nHashOf)
+{
+	size_t nSize = 16;
+	while (nSize < 2 * ((size_t)nCount + 1))
+		nSize *= 2;
+	pSlots.assign(nSize, NO_ENTRY);
+	for (UINT nEntry = 0; nEntry < nCount; nEntry++)
+		pSlots[FindSlot(pSlots, nHashOf(nEntry), [](const UINT) { return false; })] = nEntry;
+}
+
+/**
+ * @brief Inserts the last of nCount entries, growing the table when it would be more than half full
+ */
+template <typename THash>
+static void InsertSlot(std::vector<UINT>& pSlots, const UINT nCount, THash nHashOf)
+{
+	if (2 * (size_t)nCount > pSlots.size())
+		BuildSlots(pSlots, nCount, nHashOf);
+	else
+		pSlots[FindSlot(pSlots, nHashOf(nCount - 1), [](const UINT) { return false; })] = nCount - 1;
+}
+
+/**
+ * @brief Empties a slot and moves back the entries after it whose probe sequence passes through it,
+ *        so lookups never need tombstones
+ */
+template <typename THash>
+static void EraseSlot(std::vector<UINT>& pSlots, size_t nSlot, THash nHashOf)
+{
+	const size_t nMask = pSlots.size() - 1;
+	size_t nNext = nSlot;
+	pSlots[nSlot] = NO_ENTRY;
+	for (;;)
+	{
+		nNext = (nNext + 1) & nMask;
+		if (pSlots[nNext] == NO_ENTRY)
+			return;
+		// the entry may fill the hole only if the hole lies between its home slot and its slot
+		const size_t nHome = (size_t)nHashOf(pSlots[nNext]) & nMask;
+		if (((nNext - nHome) & nMask) >= ((nNext - nSlot) & nMask))
+		{
+			pSlots[nSlot] = pSlots[nNext];
+			pSlots[nNext] = NO_ENTRY;
+			nSlot = nNext;
+		}
+	}
+}
+
+/**
+ * @brief Mixes the bits of a hash so that the low bits used for the slot depend on all of them (splitmix64 finalizer)
+ */
+static ULONGLONG MixHash(ULONGLONG nValue)
+{
+	nValue = (nValue ^ (nValue >> 30)) * 0xBF58476D1CE4E5B9;
+	nValue = (nValue ^ (nValue >> 27)) * 0x94D049BB133111EB;
+	return nValue ^ (nValue >> 31);
+}
+
+const ULONGLONG FNV_OFFSET_BASIS = 0xCBF29CE484222325;
+const ULONGLONG FNV_PRIME = 0x100000001B3;
+
+/**
+ * @brief Continues a path hash without case (FNV-1a over the upper-case characters)
+ * @param nHash The hash state so far
+ * @param lpszText The characters
+ * @param nLength Number of characters
+ * @return The new hash state
+ */
+static ULONGLONG HashText(ULONGLONG nHash, const TCHAR* lpszText, const size_t nLength)
+{
+	for (size_t nIndex = 0; nIndex < nLength; nIndex++)
+	{
+		nHash ^= (ULONGLONG)towupper(lpszText[nIndex]);
+		nHash *= FNV_PRIME;
+	}
+	return nHash;
+}
+
+/**
+ * @brief Hashes a full path the way the snapshot does, so other indexes can share its hashes
+ * @param lpszPath The full path
+ * @param nLength Number of characters
+ * @return The path hash
+ */
+ULONGLONG CFileSnapshot::HashPath(LPCTSTR lpszPath, size_t nLength)
+{
+	return MixHash(HashText(FNV_OFFSET_BASIS, lpszPath, nLength));
+}
+
+void CFileSnapshot::Clear()
+{
+	m_pNamePool.clear();
+	m_nDirOffset.clear();
+	m_nDirLength.clear();
+	m_nDirHash.clear();
+	m_nDirectory.clear();
+	m_nNameOffset.clear();
+	m_nNameLength.clear();
+	m_nPathHash.clear();
+	m_nFileSize.clear();
+	m_nLastWriteTime.clear();
+	m_dwAttributes.clear();
+	m_nPathSlots.clear();
+	m_nDirSlots.clear();
+	m_nUnusedChars = 0;
+}
+
+/**
+ * @brief Sizes the columns for nCount entries, so that filling them does not reallocate
+ * @param nCount Expected number of entries (the size of the last snapshot of the same tree)
+ */
+void CFileSnapshot::Reserve(size_t nCount)
+{
+	m_pNamePool.reserve(nCount * 16);
+	m_nDirectory.reserve(nCount);
+	m_nNameOffset.reserve(nCount);
+	m_nNameLength.reserve(nCount);
+	m_nPathHash.reserve(nCount);
+	m_nFileSize.reserve(nCount);
+	m_nLastWriteTime.reserve(nCount);
+	m_dwAttributes.reserve(nCount);
+}
+
+/**
+ * @brief Stores the prefix shared by the entries of a directory
+ * @param dir The directory
+ * @return The directory number to pass to Add
+ */
+UINT CFileSnapshot::AddDirectory(const CString& dir)
+{
+	const int nLength = dir.GetLength();
+	m_nDirOffset.push_back((UINT)m_pNamePool.size());
+	m_pNamePool.insert(m_pNamePool.end(), (LPCTSTR)dir, (LPCTSTR)dir + nLength);
+	// same separator rule as CFileInformation::ConcPath
+	if ((nLength > 0) && (dir[nLength - 1] != L'\\'))
+		m_pNamePool.push_back(_T('\\'));
+	m_nDirLength.push_back((UINT)m_pNamePool.size() - m_nDirOffset.back());
+	m_nDirHash.push_back(HashText(FNV_OFFSET_BASIS, &m_pNamePool[m_nDirOffset.back()], m_nDirLength.back()));
+	if (!m_nDirSlots.empty())
+		InsertSlot(m_nDirSlots, (UINT)m_nDirOffset.size(), [this](const UINT nDirectory) { return MixHash(m_nDirHash[nDirectory]); });
+	return (UINT)m_nDirOffset.size() - 1;
+}
+
+/**
+ * @brief Appends a file or directory found by FindFirstFile/FindNextFile
+ * @param nDirectory The directory that holds it (from AddDirectory)
+ * @param fd Its find data
+ */
+void CFileSnapshot::Add(UINT nDirectory, const WIN32_FIND_DATA& fd)
+{
+	const size_t nLength = _tcslen(fd.cFileName);
+	m_nDirectory.push_back(nDirectory);
+	m_nNameOffset.push_back((UINT)m_pNamePool.size());
+	m_nNameLength.push_back((WORD)nLength);
+	m_pNamePool.insert(m_pNamePool.end(), fd.cFileName, fd.cFileName + nLength);
+	m_nPathHash.push_back(MixHash(HashText(m_nDirHash[nDirectory], fd.cFileName, nLength)));
+	m_nFileSize.push_back(((ULONGLONG)fd.nFileSizeHigh << 32) | fd.nFileSizeLow);
+	m_nLastWriteTime.push_back(((ULONGLONG)fd.ftLastWriteTime.dwHighDateTime << 32) | fd.ftLastWriteTime.dwLowDateTime);
+	m_dwAttributes.push_back(fd.dwFileAttributes);
+	if (!m_nPathSlots.empty())
+		InsertSlot(m_nPathSlots, GetCount(), [this](const UINT nEntry) { return m_nPathHash[nEntry]; });
+}
+
+/**
+ * @brief Appends the directories and entries of another snapshot (the parts built by parallel walkers)
+ * @param other The snapshot to append
+ */
+void CFileSnapshot::Append(const CFileSnapshot& other)
+{
+	const UINT nPoolBase = (UINT)m_pNamePool.size();
+	const UINT nDirBase = (UINT)m_nDirOffset.size();
+	m_pNamePool.insert(m_pNamePool.end(), other.m_pNamePool.begin(), other.m_pNamePool.end());
+	for (const UINT nOffset : other.m_nDirOffset)
+		m_nDirOffset.push_back(nPoolBase + nOffset);
+	m_nDirLength.insert(m_nDirLength.end(), other.m_nDirLength.begin(), other.m_nDirLength.end());
+	m_nDirHash.insert(m_nDirHash.end(), other.m_nDirHash.begin(), other.m_nDirHash.end());
+	for (const UINT nDirectory : other.m_nDirectory)
+		m_nDirectory.push_back(nDirBase + nDirectory);
+	for (const UINT nOffset : other.m_nNameOffset)
+		m_nNameOffset.push_back(nPoolBase + nOffset);
+	m_nNameLength.insert(m_nNameLength.end(), other.m_nNameLength.begin(), other.m_nNameLength.end());
+	m_nPathHash.insert(m_nPathHash.end(), other.m_nPathHash.begin(), other.m_nPathHash.end());
+	m_nFileSize.insert(m_nFileSize.end(), other.m_nFileSize.begin(), other.m_nFileSize.end());
+	m_nLastWriteTime.insert(m_nLastWriteTime.end(), other.m_nLastWriteTime.begin(), other.m_nLastWriteTime.end());
+	m_dwAttributes.insert(m_dwAttributes.end(), other.m_dwAttributes.begin(), other.m_dwAttributes.end());
+	m_nUnusedChars += other.m_nUnusedChars;
+	// rebuilt on the next lookup
+	m_nPathSlots.clear();
+	m_nDirSlots.clear();
+}
+
+void CFileSnapshot::IndexPaths()
+{
+	BuildSlots(m_nPathSlots, GetCount(), [this](const UINT nEntry) { return m_nPathHash[nEntry]; });
+}
+
+void CFileSnapshot::IndexDirectories()
+{
+	BuildSlots(m_nDirSlots, (UINT)m_nDirOffset.size(), [this](const UINT nDirectory) { return MixHash(m_nDirHash[nDirectory]); });
+}
+
+UINT CFileSnapshot::Find(const CString& path)
+{
+	if (m_nPathSlots.empty())
+		IndexPaths();
+	const ULONGLONG nHash = HashPath(path, path.GetLength());
+	return m_nPathSlots[FindSlot(m_nPathSlots, nHash, [&](const UINT nEntry)
+	{
+		return (m_nPathHash[nEntry] == nHash) && (GetFilePath(nEntry).CompareNoCase(path) == 0);
+	})];
+}
+
+/**
+ * @brief Finds the directory number of a prefix, adding the prefix if no entry used it yet
+ * @param dir The directory
+ * @return The directory number to pass to Add
+ */
+UINT CFileSnapshot::FindDirectory(const CString& dir)
+{
+	if (m_nDirSlots.empty())
+		IndexDirectories();
+	// same separator rule as AddDirectory
+	CString prefix(dir);
+	if (!prefix.IsEmpty() && (prefix[prefix.GetLength() - 1] != L'\\'))
+		prefix += _T("\\");
+	const UINT nLength = (UINT)prefix.GetLength();
+	const ULONGLONG nHash = HashText(FNV_OFFSET_BASIS, prefix, nLength);
+	const UINT nDirectory = m_nDirSlots[FindSlot(m_nDirSlots, MixHash(nHash), [&](const UINT nOther)
+	{
+		return (m_nDirHash[nOther] == nHash) && (m_nDirLength[nOther] == nLength) &&
+			(_tcsnicmp(&m_pNamePool[m_nDirOffset[nOther]], prefix, nLength) == 0);
+	})];
+	return (nDirectory != NO_ENTRY) ? nDirectory : AddDirectory(dir);
+}
+
+UINT CFileSnapshot::Set(const CString& path, const WIN32_FIND_DATA& fd)
+{
+	const UINT nEntry = Find(path);
+	if (nEntry == NO_ENTRY)
+	{
+		Add(FindDirectory(CFileInformation::GetFileDirectory(path)), fd);
+		return GetCount() - 1;
+	}
+	m_nFileSize[nEntry] = ((ULONGLONG)fd.nFileSizeHigh << 32) | fd.nFileSizeLow;
+	m_nLastWriteTime[nEntry] = ((ULONGLONG)fd.ftLastWriteTime.dwHighDateTime << 32) | fd.ftLastWriteTime.dwLowDateTime;
+	m_dwAttributes[nEntry] = fd.dwFileAttributes;
+	return nEntry;
+}
+
+void CFileSnapshot::Remove(UINT nEntry)
+{
+	const UINT nLast = GetCount() - 1;
+	if (!m_nPathSlots.empty())
+	{
+		auto nHashOf = [this](const UINT nOther) { return m_nPathHash[nOther]; };
+		EraseSlot(m_nPathSlots, FindSlot(m_nPathSlots, m_nPathHash[nEntry], [nEntry](const UINT nOther) { return nOther == nEntry; }), nHashOf);
+		if (nEntry != nLast)
+			m_nPathSlots[FindSlot(m_nPathSlots, m_nPathHash[nLast], [nLast](const UINT nOther) { return nOther == nLast; })] = nEntry;
+	}
+	m_nUnusedChars += m_nNameLength[nEntry];
+
+	m_nDirectory[nEntry] = m_nDirectory[nLast];
+	m_nNameOffset[nEntry] = m_nNameOffset[nLast];
+	m_nNameLength[nEntry] = m_nNameLength[nLast];
+	m_nPathHash[nEntry] = m_nPathHash[nLast];
+	m_nFileSize[nEntry] = m_nFileSize[nLast];
+	m_nLastWriteTime[nEntry] = m_nLastWriteTime[nLast];
+	m_dwAttributes[nEntry] = m_dwAttributes[nLast];
+	m_nDirectory.pop_back();
+	m_nNameOffset.pop_back();
+	m_nNameLength.pop_back();
+	m_nPathHash.pop_back();
+	m_nFileSize.pop_back();
+	m_nLastWriteTime.pop_back();
+	m_dwAttributes.pop_back();
+
+	if (m_nUnusedChars > m_pNamePool.size() / 2)
+		Compact();
+}
+
+/**
+ * @brief Copies the live names and the prefixes into a new pool, dropping the names of removed entries
+ */
+void CFileSnapshot::Compact()
+{
+	std::vector<TCHAR> pNamePool;
+	pNamePool.reserve(m_pNamePool.size() - m_nUnusedChars);
+	for (UINT nDirectory = 0; nDirectory < (UINT)m_nDirOffset.size(); nDirectory++)
+	{
+		const UINT nOffset = m_nDirOffset[nDirectory];
+		m_nDirOffset[nDirectory] = (UINT)pNamePool.size();
+		pNamePool.insert(pNamePool.end(), m_pNamePool.begin() + nOffset, m_pNamePool.begin() + nOffset + m_nDirLength[nDirectory]);
+	}
+	for (UINT nEntry = 0; nEntry < GetCount(); nEntry++)
+	{
+		const UINT nOffset = m_nNameOffset[nEntry];
+		m_nNameOffset[nEntry] = (UINT)pNamePool.size();
+		pNamePool.insert(pNamePool.end(), m_pNamePool.begin() + nOffset, m_pNamePool.begin() + nOffset + m_nNameLength[nEntry]);
+	}
+	m_pNamePool.swap(pNamePool);
+	m_nUnusedChars = 0;
+}
+
+void CFileSnapshot::FindTree(const CString& dir, std::vector<UINT>& entries) const
+{
+	CString prefix(dir);
+	if (!prefix.IsEmpty() && (prefix[prefix.GetLength() - 1] != L'\\'))
+		prefix += _T("\\");
+	const UINT nLength = (UINT)prefix.GetLength();
+	std::vector<bool> bBelow(m_nDirOffset.size(), false);
+	for (UINT nDirectory = 0; nDirectory < (UINT)m_nDirOffset.size(); nDirectory++)
+	{
+		bBelow[nDirectory] = (m_nDirLength[nDirectory] >= nLength) &&
+			(_tcsnicmp(&m_pNamePool[m_nDirOffset[nDirectory]], prefix, nLength) == 0);
+	}
+	entries.clear();
+	for (UINT nEntry = 0; nEntry < GetCount(); nEntry++)
+	{
+		if (bBelow[m_nDirectory[nEntry]])
+			entries.push_back(nEntry);
+	}
+}
+
+CString CFileSnapshot::GetFileName(UINT nEntry) const
+{
+	return CString(&m_pNamePool[m_nNameOffset[nEntry]], m_nNameLength[nEntry]);
+}
+
+CString CFileSnapshot::GetFilePath(UINT nEntry) const
+{
+	const UINT nDirectory = m_nDirectory[nEntry];
+	return CString(&m_pNamePool[m_nDirOffset[nDirectory]], m_nDirLength[nDirectory]) + GetFileName(nEntry);
+}
+
+/**
+ * @brief Rebuilds the find data of an entry
+ * @param nEntry The entry
+ * @return The find data (name, size, last write time and attributes)
+ */
+WIN32_FIND_DATA CFileSnapshot::GetFindData(UINT nEntry) const
+{
+	WIN32_FIND_DATA fd;
+	ZeroMemory(&fd, sizeof(fd));
+	_tcscpy_s(fd.cFileName, MAX_PATH, GetFileName(nEntry));
+	fd.nFileSizeHigh = (DWORD)(m_nFileSize[nEntry] >> 32);
+	fd.nFileSizeLow = (DWORD)m_nFileSize[nEntry];
+	fd.ftLastWriteTime.dwHighDateTime = (DWORD)(m_nLastWriteTime[nEntry] >> 32);
+	fd.ftLastWriteTime.dwLowDateTime = (DWORD)m_nLastWriteTime[nEntry];
+	fd.dwFileAttributes = m_dwAttributes[nEntry];
+	return fd;
+}
+
+/**
+ * @brief Builds the file information object that the notification callbacks take
+ * @param nEntry The entry
+ * @return The file information (path, size, last write time and attributes)
+ */
+CFileInformation CFileSnapshot::GetFileInformation(UINT nEntry) const
+{
+	const UINT nDirectory = m_nDirectory[nEntry];
+	UINT nDirLength = m_nDirLength[nDirectory];
+	if (nDirLength > 0)
+		nDirLength--; // without the separator
+	return CFileInformation(GetFindData(nEntry), CString(&m_pNamePool[m_nDirOffset[nDirectory]], nDirLength));
+}
+
+/**
+ * @brief Measures the memory held by the snapshot
+ * @return Bytes allocated for the pool and the columns
+ */
+size_t CFileSnapshot::GetMemorySize() const
+{
+	return m_pNamePool.capacity() * sizeof(TCHAR) +
+		(m_nDirOffset.capacity() + m_nDirLength.capacity()) * sizeof(UINT) +
+		m_nDirHash.capacity() * sizeof(ULONGLONG) +
+		(m_nDirectory.capacity() + m_nNameOffset.capacity()) * sizeof(UINT) +
+		m_nNameLength.capacity() * sizeof(WORD) +
+		(m_nPathHash.capacity() + m_nFileSize.capacity() + m_nLastWriteTime.capacity()) * sizeof(ULONGLONG) +
+		m_dwAttributes.capacity() * sizeof(DWORD) +
+		(m_nPathSlots.capacity() + m_nDirSlots.capacity()) * sizeof(UINT);
+}
+
+BOOL CFileSnapshot::IsSamePath(UINT nEntry, const CFileSnapshot& other, UINT nOtherEntry) const
+{
+	// the name is the last component, so the paths are the same when the prefixes and the names are
+	const UINT nDirectory = m_nDirectory[nEntry];
+	const UINT nOtherDirectory = other.m_nDirectory[nOtherEntry];
+	return (m_nPathHash[nEntry] == other.m_nPathHash[nOtherEntry]) &&
+		(m_nNameLength[nEntry] == other.m_nNameLength[nOtherEntry]) &&
+		(m_nDirLength[nDirectory] == other.m_nDirLength[nOtherDirectory]) &&
+		(_tcsnicmp(&m_pNamePool[m_nNameOffset[nEntry]], &other.m_pNamePool[other.m_nNameOffset[nOtherEntry]], m_nNameLength[nEntry]) == 0) &&
+		(_tcsnicmp(&m_pNamePool[m_nDirOffset[nDirectory]], &other.m_pNamePool[other.m_nDirOffset[nOtherDirectory]], m_nDirLength[nDirectory]) == 0);
+}
+
+BOOL CFileSnapshot::IsSameContent(UINT nEntry, const CFileSnapshot& other, UINT nOtherEntry) const
+{
+	return (m_nFileSize[nEntry] == other.m_nFileSize[nOtherEntry]) &&
+		(m_nLastWriteTime[nEntry] == other.m_nLastWriteTime[nOtherEntry]) &&
+		(m_dwAttributes[nEntry] == other.m_dwAttributes[nOtherEntry]);
+}
+
+/**
+ * @brief Hashes what a rename keeps: size, last write time and attributes
+ */
+static ULONGLONG HashContent(const ULONGLONG nFileSize, const ULONGLONG nLastWriteTime, const DWORD dwAttributes)
+{
+	return MixHash(nFileSize ^ MixHash(nLastWriteTime ^ MixHash(dwAttributes)));
+}
+
+void CFileSnapshot::Compare(const CFileSnapshot& oldSnapshot, const CFileSnapshot& newSnapshot, std::vector<FI_CHANGE>& changes)
+{
+	const UINT nOldCount = oldSnapshot.GetCount();
+	const UINT nNewCount = newSnapshot.GetCount();
+	std::vector<bool> bMatched(nOldCount, false);
+	std::vector<UINT> nCreated;
+	changes.clear();
+
+	// Match the entries that kept their path
+	CEntryIndex pPathIndex(nOldCount);
+	for (UINT nOld = 0; nOld < nOldCount; nOld++)
+		pPathIndex.Insert(oldSnapshot.m_nPathHash[nOld], nOld);
+	for (UINT nNew = 0; nNew < nNewCount; nNew++)
+	{
+		const UINT nOld = pPathIndex.Find(newSnapshot.m_nPathHash[nNew], [&](const UINT nEntry)
+		{
+			return !bMatched[nEntry] && oldSnapshot.IsSamePath(nEntry, newSnapshot, nNew);
+		});
+		if (nOld == NO_ENTRY)
+		{
+			nCreated.push_back(nNew);
+			continue;
+		}
+		bMatched[nOld] = true;
+		if (!oldSnapshot.IsSameContent(nOld, newSnapshot, nNew))
+			changes.push_back({ faChange, nOld, nNew });
+	}
+
+	// An entry that disappeared and one that appeared with the same size, time and attributes were renamed
+	CEntryIndex pContentIndex(nOldCount);
+	for (UINT nOld = 0; nOld < nOldCount; nOld++)
+	{
+		if (!bMatched[nOld])
+			pContentIndex.Insert(HashContent(oldSnapshot.m_nFileSize[nOld], oldSnapshot.m_nLastWriteTime[nOld], oldSnapshot.m_dwAttributes[nOld]), nOld);
+	}
+	for (const UINT nNew : nCreated)
+	{
+		const UINT nOld = pContentIndex.Find(HashContent(newSnapshot.m_nFileSize[nNew], newSnapshot.m_nLastWriteTime[nNew], newSnapshot.m_dwAttributes[nNew]), [&](const UINT nEntry)
+		{
+			return !bMatched[nEntry] && oldSnapshot.IsSameContent(nEntry, newSnapshot, nNew);
+		});
+		if (nOld == NO_ENTRY)
+		{
+			changes.push_back({ faCreate, NO_ENTRY, nNew });
+			continue;
+		}
+		bMatched[nOld] = true;
+		changes.push_back({ faRename, nOld, nNew });
+	}
+
+	for (UINT nOld = 0; nOld < nOldCount; nOld++)
+	{
+		if (!bMatched[nOld])
+			changes.push_back({ faDelete, nOld, NO_ENTRY });
+	}
+}
@@ -0,0 +1,133 @@
+/* Copyright (C) 2022-2026 Stefan-Mihai MOGA
+This file is part of IntelliDisk application developed by Stefan-Mihai MOGA.
+IntelliDisk is an alternative Windows version to the famous Microsoft OneDrive!
+
+IntelliDisk is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the Open
+Source Initiative, either version 3 of the License, or any later version.
+
+IntelliDisk is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+IntelliDisk. If not, see <http://www.opensource.org/licenses/gpl-3.0.html>*/
+
+#pragma once
+
+#ifndef __FILESNAPSHOT_H__
+#define __FILESNAPSHOT_H__
+
+#include <vector>
+#include "FileInformation.h"	// for file information class
+
+#define SNAPSHOT_NO_ENTRY ((UINT)-1)
+
+/**
+ * @brief One difference between two snapshots
+ */
+typedef struct {
+	EFileAction faAction;  // faCreate, faDelete, faChange or faRename
+	UINT nOldEntry;        // Entry in the old snapshot (faDelete, faChange, faRename)
+	UINT nNewEntry;        // Entry in the new snapshot (faCreate, faChange, faRename)
+} FI_CHANGE;
+
+/**
+ * @brief Flat snapshot of a directory tree, kept as one column per field.
+ *        Every directory prefix is stored once and every name is packed into a shared character pool,
+ *        so an entry costs its name plus a few dozen bytes instead of a heap-allocated CFileInformation
+ *        with a full WIN32_FIND_DATA, and filling it allocates only when a column grows.
+ *        Compare indexes the old snapshot by path hash and looks every new entry up once,
+ *        so the cost grows with the number of entries instead of its square,
+ *        and a file created while another is deleted is reported as both.
+ *        Find, Set and Remove keep a snapshot in step with the change records between two walks;
+ *        they index the entries by path hash on first use, and Remove moves the last entry into the hole.
+ */
+class CFileSnapshot
+{
+public:
+	void Clear();
+	void Reserve(size_t nCount);
+	UINT AddDirectory(const CString& dir);
+	void Add(UINT nDirectory, const WIN32_FIND_DATA& fd);
+	void Append(const CFileSnapshot& other);
+
+	/**
+	 * @brief Finds the entry of a path
+	 * @param path The full path, as the walk that filled the snapshot builds it
+	 * @return The entry, or SNAPSHOT_NO_ENTRY
+	 */
+	UINT Find(const CString& path);
+	/**
+	 * @brief Updates the entry of a path, or adds one (under its directory) if it has none
+	 * @param path The full path
+	 * @param fd Its find data
+	 * @return The entry
+	 */
+	UINT Set(const CString& path, const WIN32_FIND_DATA& fd);
+	/**
+	 * @brief Removes an entry; the last entry takes its number
+	 * @param nEntry The entry
+	 */
+	void Remove(UINT nEntry);
+	/**
+	 * @brief Lists the entries below a directory, at any depth
+	 * @param dir The directory
+	 * @param entries [out] The entries, in increasing order
+	 */
+	void FindTree(const CString& dir, std::vector<UINT>& entries) const;
+
+	UINT      GetCount() const { return (UINT)m_nPathHash.size(); }
+	ULONGLONG GetPathHash(UINT nEntry) const { return m_nPathHash[nEntry]; }
+	ULONGLONG GetFileSize(UINT nEntry) const { return m_nFileSize[nEntry]; }
+	ULONGLONG GetLastWriteTime(UINT nEntry) const { return m_nLastWriteTime[nEntry]; }
+	DWORD     GetFileAttribute(UINT nEntry) const { return m_dwAttributes[nEntry]; }
+	CString   GetFileName(UINT nEntry) const;
+	CString   GetFilePath(UINT nEntry) const;
+	WIN32_FIND_DATA GetFindData(UINT nEntry) const;
+	CFileInformation GetFileInformation(UINT nEntry) const;
+	size_t    GetMemorySize() const;
+
+	/**
+	 * @brief Finds the differences between two snapshots of the same tree.
+	 * @details Entries with the same path are matched through a hash table of the old snapshot; a match
+	 *          whose size, last write time or attributes differ is a change. A new entry without a match
+	 *          that has the size, last write time and attributes of an old entry without a match is a rename,
+	 *          the others are creates and deletes.
+	 * @param oldSnapshot The earlier snapshot.
+	 * @param newSnapshot The later snapshot.
+	 * @param changes [out] The differences: changes first, then creates and renames, deletes last.
+	 */
+	static void Compare(const CFileSnapshot& oldSnapshot, const CFileSnapshot& newSnapshot, std::vector<FI_CHANGE>& changes);
+	static ULONGLONG HashPath(LPCTSTR lpszPath, size_t nLength);
+
+protected:
+	BOOL IsSamePath(UINT nEntry, const CFileSnapshot& other, UINT nOtherEntry) const;
+	BOOL IsSameContent(UINT nEntry, const CFileSnapshot& other, UINT nOtherEntry) const;
+	UINT FindDirectory(const CString& dir);
+	void IndexPaths();
+	void IndexDirectories();
+	void Compact();
+
+protected:
+	// Character pool of the directory prefixes (with their trailing backslash) and the names
+	std::vector<TCHAR> m_pNamePool;
+	// One element per directory
+	std::vector<UINT> m_nDirOffset;
+	std::vector<UINT> m_nDirLength;
+	std::vector<ULONGLONG> m_nDirHash;       // Path hash state after the prefix
+	// One element per entry
+	std::vector<UINT> m_nDirectory;
+	std::vector<UINT> m_nNameOffset;
+	std::vector<WORD> m_nNameLength;
+	std::vector<ULONGLONG> m_nPathHash;      // Hash of the upper-case path (paths are compared without case)
+	std::vector<ULONGLONG> m_nFileSize;      // Size in bytes
+	std::vector<ULONGLONG> m_nLastWriteTime; // Last write time (FILETIME as one number)
+	std::vector<DWORD> m_dwAttributes;       // File attributes
+	// Open-addressing tables of the entries by path hash and of the directories by prefix hash, empty until first used
+	std::vector<UINT> m_nPathSlots;
+	std::vector<UINT> m_nDirSlots;
+	size_t m_nUnusedChars = 0;               // Characters of the pool left behind by removed entries
+};
+
+#endif // __FILESNAPSHOT_H__
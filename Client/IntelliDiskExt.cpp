@@ -159,6 +159,26 @@ const std::wstring GetSpecialFolder()
 	return _T("");
 }
 
+/**
+ * @brief Gets the path of the sync index file in the user's local application data
+ * @details The index must not live in the synced folder, or every write to it would be uploaded
+ * @return The path to "IntelliDisk\SyncIndex.dat", empty on failure
+ */
+const std::wstring GetSyncIndexFile()
+{
+	WCHAR* lpszSpecialFolderPath = nullptr;
+	if ((SHGetKnownFolderPath(FOLDERID_LocalAppData, 0, nullptr, &lpszSpecialFolderPath)) == S_OK)
+	{
+		std::wstring result(lpszSpecialFolderPath);
+		CoTaskMemFree(lpszSpecialFolderPath);
+		result += _T("\\IntelliDisk");
+		CreateDirectory(result.c_str(), nullptr);
+		result += _T("\\SyncIndex.dat");
+		return result;
+	}
+	return _T("");
+}
+
 /**
  * @brief Installs or removes IntelliDisk from Windows startup applications
  * @param bInstallStartupApps If true, adds to startup; if false, removes
@@ -213,6 +233,9 @@ UINT DirCallback(CFileInformation fiObject, EFileAction faAction, LPVOID lpData)
 	// Determine event type based on file action (delete vs create/modify)
 	const int nFileEvent = (IS_DELETE_FILE(faAction)) ? ID_FILE_DELETE : ID_FILE_UPLOAD;
 	const std::wstring strFilePath = fiObject.GetFilePath().GetBuffer();
+	// A file that still has the size and time it was synced with has nothing to send (e.g. the echo of a download)
+	if ((ID_FILE_UPLOAD == nFileEvent) && g_pSyncIndex.IsUnchanged(strFilePath.c_str()))
+		return 0;
 	// Queue the file event for processing by consumer thread
 	AddNewItem(nFileEvent, strFilePath, lpData);
 
@@ -220,10 +243,52 @@ UINT DirCallback(CFileInformation fiObject, EFileAction faAction, LPVOID lpData)
 }
 
 const int MAX_BUFFER = 0x10000; ///< Maximum buffer size for file and socket operations.
+const DWORD FRAME_TIMEOUT = 30000; ///< Time to wait (ms) for a windowed data frame or its acknowledgement.
 int g_nPingCount = 0;           ///< Ping counter for connection keep-alive.
 bool g_bClientRunning = true;   ///< Global flag to control client threads.
 bool g_bIsConnected = false;    ///< Global flag indicating connection status.
 
+const PROTOCOL_OPTIONS LEGACY_PROTOCOL = { 1, 0, 0, LEGACY_FRAME_SIZE }; ///< Options of servers that do not answer the handshake.
+PROTOCOL_OPTIONS g_pProtocolOptions = LEGACY_PROTOCOL;  ///< Options negotiated with the server.
+DATAPATH_COUNTERS g_pDataPathCounters;                  ///< Copy and allocation counters of the data path.
+CContentChunker g_pContentChunker;                      ///< Chunk sizes of deduplicated uploads (PROTOCOL_CDC).
+CSyncIndex g_pSyncIndex;                                ///< Files synced by this client, kept across runs.
+
+/**
+ * @brief Allocates the frame slots of a transfer according to the negotiated options
+ * @param pOptions Protocol options negotiated during the handshake
+ */
+CFrameWindow::CFrameWindow(const PROTOCOL_OPTIONS& pOptions)
+{
+	m_nFlags = pOptions.nFlags;
+	m_nWindowSize = ((pOptions.nFlags & PROTOCOL_WINDOW) != 0) ? pOptions.nWindowSize : 0;
+	m_nFrameSize = ((m_nWindowSize > 0) && ((pOptions.nFlags & PROTOCOL_LARGE_FRAME) != 0)) ? pOptions.nFrameSize : LEGACY_FRAME_SIZE;
+	m_nSlotCount = (m_nWindowSize > 0) ? m_nWindowSize : 1;
+	// Slots live on the heap; a legacy packet (STX, length, payload, ETX, LRC) fits in the slot as well
+	m_nSlotSize = sizeof(FRAME_HEADER) + max(m_nFrameSize, (unsigned int)MAX_BUFFER);
+	m_nBaseSequence = m_nNextSequence = 0;
+	m_pStorage.resize((size_t)(m_nSlotCount + 1) * m_nSlotSize);
+	m_nSlotLength.assign(m_nSlotCount, -1);
+	m_nRetryCount.assign(m_nSlotCount, 0);
+	g_pDataPathCounters.nAllocations++;
+}
+
+/**
+ * @brief Computes the checksum carried in a frame header
+ * @details With PROTOCOL_CRC32C the CRC covers the header fields before nChecksum and the payload,
+ *          so a damaged sequence number or length is detected as well; otherwise the LRC of the payload
+ * @param pHeader Frame header (nLength must be set)
+ * @param pPayload Frame payload
+ * @return The checksum to store in or compare with pHeader->nChecksum
+ */
+unsigned int CFrameWindow::GetChecksum(const FRAME_HEADER* pHeader, const unsigned char* pPayload) const
+{
+	if ((m_nFlags & PROTOCOL_CRC32C) == 0)
+		return calcLRC(pPayload, pHeader->nLength);
+	const uint32_t nCRC = calcCRC32C((const unsigned char*)pHeader, offsetof(FRAME_HEADER, nChecksum));
+	return calcCRC32C(pPayload, pHeader->nLength, nCRC);
+}
+
 const char HEX_MAP[] = { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F' };
 
 /**
@@ -305,16 +370,19 @@ bool ReadBuffer(CWSocket& pApplicationSocket, unsigned char* pBuffer, int& nLeng
 				return false;
 		}
 		// Step 2: Read data packet with retry on checksum failure
-		nLength = 0;
 		do {
+			nLength = 0;
 			while (pApplicationSocket.IsReadible(1000) &&
-				((nIndex = pApplicationSocket.Receive(pBuffer + nIndex, MAX_BUFFER - nLength)) > 0))
+				((nIndex = pApplicationSocket.Receive(pBuffer + nLength, MAX_BUFFER - nLength)) > 0))
 			{
 				nLength += nIndex;
 				TRACE(_T("Buffer Received %s\n"), dumpHEX(pBuffer, nLength).c_str());
 				// Verify LRC (Longitudinal Redundancy Check) checksum
 				// Note: calcLRC is defined in framework.h as inline function
 				nReturn = (pBuffer[nLength - 1] == calcLRC(&pBuffer[3], (nLength - 5))) ? ACK : NAK;
+				// Answer as soon as the whole packet is here instead of waiting for the line to go idle
+				if ((nLength >= 5) && (nLength >= 5 + (pBuffer[1] * 0x100) + pBuffer[2]))
+					break;
 			}
 			VERIFY(pApplicationSocket.Send(&nReturn, sizeof(nReturn)) == 1);
 			TRACE(_T("%s Sent\n"), ((ACK == nReturn) ? _T("ACK") : _T("NAK")));
@@ -324,7 +392,7 @@ bool ReadBuffer(CWSocket& pApplicationSocket, unsigned char* pBuffer, int& nLeng
 		{
 			unsigned char chEOT = ACK;
 			if (pApplicationSocket.IsReadible(1000) &&
-				((nLength = pApplicationSocket.Receive(&chEOT, sizeof(chEOT))) > 0) &&
+				((nIndex = pApplicationSocket.Receive(&chEOT, sizeof(chEOT))) > 0) &&
 				(EOT == chEOT))
 			{
 				TRACE(_T("EOT Received\n"));
@@ -357,26 +425,24 @@ bool ReadBuffer(CWSocket& pApplicationSocket, unsigned char* pBuffer, int& nLeng
  * @param SendEOT Whether to send an EOT handshake
  * @return true on successful write and protocol validation, false otherwise
  */
-#pragma warning(suppress: 6262)
 bool WriteBuffer(CWSocket& pApplicationSocket, const unsigned char* pBuffer, const int nLength, const bool SendENQ, const bool SendEOT)
 {
 	int nCount = 0;
 	unsigned char nReturn = ACK;
-	unsigned char pPacket[MAX_BUFFER] = { 0, };
 
 	try
 	{
-		ASSERT(nLength <= (sizeof(pPacket) - 5));
+		ASSERT(nLength <= LEGACY_FRAME_SIZE);
 		// Step 1: Send ENQ (enquiry) and wait for ACK if requested
 		if (SendENQ && pApplicationSocket.IsWritable(1000))
 		{
 			unsigned char chENQ = ENQ;
 			TRACE(_T("ENQ Sent\n"));
 			VERIFY(pApplicationSocket.Send(&chENQ, sizeof(chENQ)) == 1);
-			ZeroMemory(pPacket, sizeof(pPacket));
-			nCount = MAX_BUFFER;
-			if (((nCount = pApplicationSocket.Receive(pPacket, nCount)) > 0) &&
-				(ACK == pPacket[nCount - 1]))
+			unsigned char pReply[0x10] = { 0, };
+			nCount = sizeof(pReply);
+			if (((nCount = pApplicationSocket.Receive(pReply, nCount)) > 0) &&
+				(ACK == pReply[nCount - 1]))
 			{
 				TRACE(_T("ACK Received\n"));
 				nCount = 0;
@@ -384,19 +450,18 @@ bool WriteBuffer(CWSocket& pApplicationSocket, const unsigned char* pBuffer, con
 			else
 				return false;
 		}
-		// Step 2: Prepare packet with STX header, data, ETX trailer, and LRC checksum
-		ZeroMemory(pPacket, sizeof(pPacket));
-		CopyMemory(&pPacket[3], pBuffer, nLength);
-		pPacket[0] = STX;  // Start of text marker
-		pPacket[1] = (char)(nLength / 0x100);  // Length high byte
-		pPacket[2] = nLength % 0x100;  // Length low byte
-		pPacket[3 + nLength] = ETX;  // End of text marker
-		pPacket[4 + nLength] = calcLRC(pBuffer, nLength);  // Checksum
+		// Step 2: Send the STX header, data and ETX trailer with LRC straight from where they live
+		unsigned char pHeader[3] = { STX, (unsigned char)(nLength / 0x100), (unsigned char)(nLength % 0x100) };
+		unsigned char pTrailer[2] = { ETX, calcLRC(pBuffer, nLength) };
+		WSABUF pPacket[3] = {
+			{ sizeof(pHeader), (char*)pHeader },
+			{ (ULONG)nLength, (char*)pBuffer },
+			{ sizeof(pTrailer), (char*)pTrailer } };
 		// Step 3: Send packet and retry if NAK received
 		do {
-			if (pApplicationSocket.Send(pPacket, (5 + nLength)) == (5 + nLength))
+			if (pApplicationSocket.Send(pPacket, _countof(pPacket)) == (5 + nLength))
 			{
-				TRACE(_T("Buffer Sent %s\n"), dumpHEX(pPacket, (5 + nLength)).c_str());
+				TRACE(_T("Buffer Sent %s\n"), dumpHEX(pBuffer, nLength).c_str());
 				VERIFY(pApplicationSocket.Receive(&nReturn, sizeof(nReturn)) == 1);
 				TRACE(_T("%s Received\n"), ((ACK == nReturn) ? _T("ACK") : _T("NAK")));
 			}
@@ -424,57 +489,396 @@ bool WriteBuffer(CWSocket& pApplicationSocket, const unsigned char* pBuffer, con
 	return (ACK == nReturn);
 }
 
+/**
+ * @brief Receives exactly nLength bytes from the socket
+ * @param pApplicationSocket The socket to read from
+ * @param pBuffer Buffer to store received data
+ * @param nLength Number of bytes to receive
+ * @return true if all bytes arrived before FRAME_TIMEOUT, false otherwise
+ */
+bool ReceiveBuffer(CWSocket& pApplicationSocket, void* pBuffer, const int nLength)
+{
+	int nIndex = 0;
+	while (nIndex < nLength)
+	{
+		if (!pApplicationSocket.IsReadible(FRAME_TIMEOUT))
+			return false;
+		const int nCount = pApplicationSocket.Receive((unsigned char*)pBuffer + nIndex, nLength - nIndex);
+		if (nCount <= 0)
+			return false;
+		nIndex += nCount;
+	}
+	return true;
+}
+
+/**
+ * @brief Reads one acknowledgement of a windowed data frame and updates the window
+ * @details ACK slides the window up to the acknowledged frame (cumulative),
+ *          NAK resends only the damaged frame (selective)
+ * @param pApplicationSocket The socket to read from
+ * @param pFrameWindow Sliding window state of the current transfer
+ * @return true on success, false on timeout or too many retransmissions
+ */
+bool ReceiveFrameAck(CWSocket& pApplicationSocket, CFrameWindow& pFrameWindow)
+{
+	FRAME_ACK pFrameAck = { 0, };
+	if (!ReceiveBuffer(pApplicationSocket, &pFrameAck, sizeof(pFrameAck)))
+		return false;
+
+	// Ignore acknowledgements for frames that are no longer in flight
+	const unsigned int nOffset = pFrameAck.nSequence - pFrameWindow.m_nBaseSequence;
+	if (nOffset >= (pFrameWindow.m_nNextSequence - pFrameWindow.m_nBaseSequence))
+		return true;
+
+	if (ACK == pFrameAck.nReturn)
+	{
+		TRACE(_T("ACK %u Received\n"), pFrameAck.nSequence);
+		while (pFrameWindow.m_nBaseSequence != pFrameAck.nSequence + 1)
+			pFrameWindow.m_nSlotLength[pFrameWindow.m_nBaseSequence++ % pFrameWindow.m_nSlotCount] = -1;
+	}
+	else
+	{
+		TRACE(_T("NAK %u Received\n"), pFrameAck.nSequence);
+		const unsigned int nSlot = pFrameAck.nSequence % pFrameWindow.m_nSlotCount;
+		if (++pFrameWindow.m_nRetryCount[nSlot] > 3)  // Retry up to 3 times
+			return false;
+		const int nFrameLength = (int)sizeof(FRAME_HEADER) + pFrameWindow.m_nSlotLength[nSlot];
+		if (pApplicationSocket.Send(pFrameWindow.GetSlot(pFrameAck.nSequence), nFrameLength) != nFrameLength)
+			return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Waits for a free slot in the window and returns its payload area
+ * @details Data read straight into this area and passed to WriteFrame is sent without any copy.
+ *          Without PROTOCOL_WINDOW the single slot is returned and WriteFrame sends it through WriteBuffer
+ * @param pApplicationSocket The socket to read acknowledgements from
+ * @param pFrameWindow Sliding window state of the current transfer
+ * @return Payload area of the next frame, or nullptr on error
+ */
+unsigned char* ReserveFrame(CWSocket& pApplicationSocket, CFrameWindow& pFrameWindow)
+{
+	if (!pFrameWindow.IsEnabled())
+		return pFrameWindow.GetSlot(0) + sizeof(FRAME_HEADER);
+
+	try
+	{
+		while ((pFrameWindow.m_nNextSequence - pFrameWindow.m_nBaseSequence) >= pFrameWindow.m_nWindowSize)
+		{
+			if (!ReceiveFrameAck(pApplicationSocket, pFrameWindow))
+				return nullptr;
+		}
+	}
+	catch (CWSocketException* pException)
+	{
+		const int nErrorLength = 0x100;
+		TCHAR lpszErrorMessage[nErrorLength] = { 0, };
+		pException->GetErrorMessage(lpszErrorMessage, nErrorLength);
+		TRACE(_T("%s\n"), lpszErrorMessage);
+		pException->Delete();
+		pApplicationSocket.Close();
+		g_bIsConnected = false;
+		return nullptr;
+	}
+	return pFrameWindow.GetSlot(pFrameWindow.m_nNextSequence) + sizeof(FRAME_HEADER);
+}
+
+/**
+ * @brief Sends one data frame, keeping up to the window size of frames in flight
+ * @details Falls back to WriteBuffer when the server did not negotiate PROTOCOL_WINDOW
+ * @param pApplicationSocket The socket to write to
+ * @param pFrameWindow Sliding window state of the current transfer
+ * @param pBuffer Buffer containing data to send
+ * @param nLength Length of data to send
+ * @return true if the frame was sent, false otherwise
+ */
+bool WriteFrame(CWSocket& pApplicationSocket, CFrameWindow& pFrameWindow, const unsigned char* pBuffer, const int nLength)
+{
+	if (!pFrameWindow.IsEnabled())
+		return WriteBuffer(pApplicationSocket, pBuffer, nLength, false, false);
+
+	try
+	{
+		ASSERT(nLength <= pFrameWindow.GetFrameSize());
+		// Step 1: Block only while the window is full (no-op after ReserveFrame)
+		while ((pFrameWindow.m_nNextSequence - pFrameWindow.m_nBaseSequence) >= pFrameWindow.m_nWindowSize)
+		{
+			if (!ReceiveFrameAck(pApplicationSocket, pFrameWindow))
+				return false;
+		}
+		// Step 2: Build the frame in its slot, where it stays until acknowledged;
+		// the payload is already in place when the caller filled the slot returned by ReserveFrame
+		const unsigned int nSequence = pFrameWindow.m_nNextSequence++;
+		const unsigned int nSlot = nSequence % pFrameWindow.m_nSlotCount;
+		unsigned char* pFrame = pFrameWindow.GetSlot(nSequence);
+		FRAME_HEADER* pHeader = (FRAME_HEADER*)pFrame;
+		ZeroMemory(pHeader, sizeof(FRAME_HEADER));
+		pHeader->nStart = SOH;
+		pHeader->nSequence = nSequence;
+		pHeader->nLength = nLength;
+		if (pBuffer != pFrame + sizeof(FRAME_HEADER))
+		{
+			CopyMemory(pFrame + sizeof(FRAME_HEADER), pBuffer, nLength);
+			g_pDataPathCounters.nCopiedBytes += nLength;
+		}
+		pHeader->nChecksum = pFrameWindow.GetChecksum(pHeader, pFrame + sizeof(FRAME_HEADER));
+		pFrameWindow.m_nSlotLength[nSlot] = nLength;
+		pFrameWindow.m_nRetryCount[nSlot] = 0;
+		// Step 3: Send the frame without waiting for its acknowledgement
+		const int nFrameLength = (int)sizeof(FRAME_HEADER) + nLength;
+		if (pApplicationSocket.Send(pFrame, nFrameLength) != nFrameLength)
+			return false;
+		TRACE(_T("Frame %u Sent\n"), nSequence);
+		// Step 4: Consume acknowledgements that have already arrived
+		while ((pFrameWindow.m_nBaseSequence != pFrameWindow.m_nNextSequence) && pApplicationSocket.IsReadible(0))
+		{
+			if (!ReceiveFrameAck(pApplicationSocket, pFrameWindow))
+				return false;
+		}
+	}
+	catch (CWSocketException* pException)
+	{
+		const int nErrorLength = 0x100;
+		TCHAR lpszErrorMessage[nErrorLength] = { 0, };
+		pException->GetErrorMessage(lpszErrorMessage, nErrorLength);
+		TRACE(_T("%s\n"), lpszErrorMessage);
+		pException->Delete();
+		pApplicationSocket.Close();
+		g_bIsConnected = false;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Waits until every data frame sent through the window has been acknowledged
+ * @param pApplicationSocket The socket to read acknowledgements from
+ * @param pFrameWindow Sliding window state of the current transfer
+ * @return true if all frames were acknowledged, false otherwise
+ */
+bool FlushFrames(CWSocket& pApplicationSocket, CFrameWindow& pFrameWindow)
+{
+	try
+	{
+		while (pFrameWindow.m_nBaseSequence != pFrameWindow.m_nNextSequence)
+		{
+			if (!ReceiveFrameAck(pApplicationSocket, pFrameWindow))
+				return false;
+		}
+	}
+	catch (CWSocketException* pException)
+	{
+		const int nErrorLength = 0x100;
+		TCHAR lpszErrorMessage[nErrorLength] = { 0, };
+		pException->GetErrorMessage(lpszErrorMessage, nErrorLength);
+		TRACE(_T("%s\n"), lpszErrorMessage);
+		pException->Delete();
+		pApplicationSocket.Close();
+		g_bIsConnected = false;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Receives the next data frame in sequence order
+ * @details Every valid frame is acknowledged immediately (cumulative ACK), a damaged
+ *          frame is NAKed on its own while the frames behind it are kept in the window.
+ *          Falls back to ReadBuffer when the server did not negotiate PROTOCOL_WINDOW
+ * @param pApplicationSocket The socket to read from
+ * @param pFrameWindow Sliding window state of the current transfer
+ * @param pPayload [out] Points to the payload, valid until the next call
+ * @param nLength [out] Length of the payload
+ * @return true on success, false otherwise
+ */
+bool ReadFrame(CWSocket& pApplicationSocket, CFrameWindow& pFrameWindow, unsigned char*& pPayload, int& nLength)
+{
+	if (!pFrameWindow.IsEnabled())
+	{
+		unsigned char* pBuffer = pFrameWindow.GetSlot(0);
+		nLength = (int)pFrameWindow.m_nSlotSize;
+		if (!ReadBuffer(pApplicationSocket, pBuffer, nLength, false, false))
+			return false;
+		pPayload = &pBuffer[3];
+		nLength -= 5;
+		return true;
+	}
+
+	try
+	{
+		const unsigned int nMaxLength = pFrameWindow.m_nFrameSize;
+		const unsigned int nBaseSlot = pFrameWindow.m_nBaseSequence % pFrameWindow.m_nSlotCount;
+		while (pFrameWindow.m_nSlotLength[nBaseSlot] < 0)
+		{
+			FRAME_HEADER pHeader = { 0, };
+			if (!ReceiveBuffer(pApplicationSocket, &pHeader, sizeof(pHeader)) ||
+				(SOH != pHeader.nStart) || (pHeader.nLength > nMaxLength))
+			{
+				TRACE(_T("Invalid frame header!\n"));
+				return false;
+			}
+			// Duplicates of frames already delivered are read into the scratch slot and only acknowledged again
+			const unsigned int nSlot = pHeader.nSequence % pFrameWindow.m_nSlotCount;
+			const bool bInWindow = (pHeader.nSequence - pFrameWindow.m_nBaseSequence) < pFrameWindow.m_nWindowSize;
+			unsigned char* pFrame = bInWindow ? pFrameWindow.GetSlot(pHeader.nSequence) : pFrameWindow.GetScratch();
+			if (!ReceiveBuffer(pApplicationSocket, pFrame + sizeof(FRAME_HEADER), pHeader.nLength))
+				return false;
+			TRACE(_T("Frame %u Received\n"), pHeader.nSequence);
+
+			FRAME_ACK pFrameAck = { ACK, 0 };
+			if (pHeader.nChecksum == pFrameWindow.GetChecksum(&pHeader, pFrame + sizeof(FRAME_HEADER)))
+			{
+				if (bInWindow)
+					pFrameWindow.m_nSlotLength[nSlot] = pHeader.nLength;
+				// Acknowledge every frame received without a gap since the window base
+				unsigned int nSequence = pFrameWindow.m_nBaseSequence;
+				while (((nSequence - pFrameWindow.m_nBaseSequence) < pFrameWindow.m_nWindowSize) &&
+					(pFrameWindow.m_nSlotLength[nSequence % pFrameWindow.m_nSlotCount] >= 0))
+					nSequence++;
+				pFrameAck.nSequence = nSequence - 1;
+			}
+			else
+			{
+				if (bInWindow && (++pFrameWindow.m_nRetryCount[nSlot] > 3))  // Retry up to 3 times
+					return false;
+				pFrameAck.nReturn = NAK;
+				pFrameAck.nSequence = pHeader.nSequence;
+			}
+			VERIFY(pApplicationSocket.Send(&pFrameAck, sizeof(pFrameAck)) == sizeof(pFrameAck));
+			TRACE(_T("%s %u Sent\n"), ((ACK == pFrameAck.nReturn) ? _T("ACK") : _T("NAK")), pFrameAck.nSequence);
+		}
+		// Deliver the frame at the window base; its slot is reused only after the next call
+		pPayload = pFrameWindow.GetSlot(pFrameWindow.m_nBaseSequence) + sizeof(FRAME_HEADER);
+		nLength = pFrameWindow.m_nSlotLength[nBaseSlot];
+		pFrameWindow.m_nSlotLength[nBaseSlot] = -1;
+		pFrameWindow.m_nRetryCount[nBaseSlot] = 0;
+		pFrameWindow.m_nBaseSequence++;
+	}
+	catch (CWSocketException* pException)
+	{
+		const int nErrorLength = 0x100;
+		TCHAR lpszErrorMessage[nErrorLength] = { 0, };
+		pException->GetErrorMessage(lpszErrorMessage, nErrorLength);
+		TRACE(_T("%s\n"), lpszErrorMessage);
+		pException->Delete();
+		pApplicationSocket.Close();
+		g_bIsConnected = false;
+		return false;
+	}
+	return true;
+}
+
 std::wstring g_strCurrentDocument; ///< Currently processed document path (for upload/download).
 
+/// Upload session of an upload that broke off (PROTOCOL_RESUME), valid while the file keeps its length and time stamp.
+typedef struct {
+	ULONGLONG nToken;       ///< Token the server handed out
+	ULONGLONG nFileLength;  ///< Length of the file when the upload started
+	FILETIME ftLastWrite;   ///< Last write time of the file when the upload started
+} PENDING_UPLOAD;
+
+/// Uploads that broke off, by file path; only used while holding the socket mutex, like the uploads themselves.
+std::map<std::wstring, PENDING_UPLOAD> g_pUploadSessions;
+
+/// Downloads that broke off (PROTOCOL_RANGE): the bytes already written and the version they came from.
+/// Only used while holding the socket mutex, like the downloads themselves.
+std::map<std::wstring, RANGE_REQUEST> g_pPartialDownloads;
+
+RANGE_REQUEST GetResumeRange(const std::wstring& strFilePath)
+{
+	const auto pPartial = g_pPartialDownloads.find(strFilePath);
+	if (pPartial != g_pPartialDownloads.end())
+		return pPartial->second;
+	const RANGE_REQUEST pRequest = { 0, 0, 0 };
+	return pRequest;
+}
+
 /**
  * @brief Downloads a file from the server using the application socket
- * @details Verifies file integrity using SHA256 hash comparison
+ * @details Verifies file integrity using SHA256 hash comparison.
+ *          With PROTOCOL_RANGE the server may continue where an earlier download broke off; the bytes already
+ *          written came in checked frames, the SHA256 covers the bytes of this range. A download that breaks off
+ *          is recorded in g_pPartialDownloads, so the next one asks for the rest only.
  * @param pApplicationSocket The socket to use for communication
  * @param strFilePath The local file path to save to
+ * @param bRange Whether the server answers with a RANGE_REPLY instead of the bare file length
  * @return true on success, false otherwise
  */
 #pragma warning(suppress: 6262)
-bool DownloadFile(CWSocket& pApplicationSocket, const std::wstring& strFilePath)
+bool DownloadFile(CWSocket& pApplicationSocket, const std::wstring& strFilePath, const bool bRange)
 {
 	SHA256 pSHA256;
+	CFrameWindow pFrameWindow(g_pProtocolOptions);
+	const ULONGLONG nCopiedBytes = g_pDataPathCounters.nCopiedBytes;
 	unsigned char pFileBuffer[MAX_BUFFER] = { 0, };
 	try
 	{
+		const ULONGLONG nStartTime = GetTickCount64();
 		g_strCurrentDocument = strFilePath;
 		TRACE(_T("[DownloadFile] %s\n"), strFilePath.c_str());
-		CFile pBinaryFile(strFilePath.c_str(), CFile::modeWrite | CFile::modeCreate | CFile::typeBinary);
-		ULONGLONG nFileLength = 0;
-		int nLength = (int)(sizeof(nFileLength) + 5);
+		RANGE_REPLY pReply = { 0, 0, 0, 0 };
+		int nLength = bRange ? (int)(sizeof(pReply) + 5) : (int)(sizeof(pReply.nFileLength) + 5);
 		ZeroMemory(pFileBuffer, sizeof(pFileBuffer));
-		if (ReadBuffer(pApplicationSocket, pFileBuffer, nLength, false, false))
+		if (!ReadBuffer(pApplicationSocket, pFileBuffer, nLength, false, false) ||
+			(bRange && (nLength - 5 != (int)sizeof(pReply))))
+		{
+			TRACE(_T("Invalid nFileLength!\n"));
+			return false;
+		}
+		if (bRange)
+		{
+			CopyMemory(&pReply, &pFileBuffer[3], sizeof(pReply));
+		}
+		else
 		{
-			CopyMemory(&nFileLength, &pFileBuffer[3], sizeof(nFileLength));
-			TRACE(_T("nFileLength = %llu\n"), nFileLength);
+			CopyMemory(&pReply.nFileLength, &pFileBuffer[3], sizeof(pReply.nFileLength));
+			pReply.nLength = pReply.nFileLength;
+		}
+		if ((pReply.nOffset > pReply.nFileLength) || (pReply.nLength > pReply.nFileLength - pReply.nOffset))
+		{
+			TRACE(_T("Invalid range!\n"));
+			return false;
+		}
+		const ULONGLONG nFileLength = pReply.nFileLength;
+		TRACE(_T("nFileLength = %llu, range = %llu + %llu\n"), nFileLength, pReply.nOffset, pReply.nLength);
+		// A resumed download keeps the bytes before the range
+		CFile pBinaryFile(strFilePath.c_str(), CFile::modeWrite | CFile::modeCreate | CFile::typeBinary | (pReply.nOffset > 0 ? CFile::modeNoTruncate : 0));
+		if (pReply.nOffset > 0)
+			pBinaryFile.Seek((LONGLONG)pReply.nOffset, CFile::begin);
+		g_pPartialDownloads.erase(strFilePath);
 
-			// Read file data in chunks and write to local file
-			ULONGLONG nFileIndex = 0;
-			while (nFileIndex < nFileLength)
+		// Read file data in chunks and write to local file
+		ULONGLONG nFileIndex = 0;
+		while (nFileIndex < pReply.nLength)
+		{
+			unsigned char* pPayload = nullptr;
+			if (ReadFrame(pApplicationSocket, pFrameWindow, pPayload, nLength) &&
+				((ULONGLONG)nLength <= pReply.nLength - nFileIndex))
 			{
-				nLength = (int)sizeof(pFileBuffer);
-				ZeroMemory(pFileBuffer, sizeof(pFileBuffer));
-				if (ReadBuffer(pApplicationSocket, pFileBuffer, nLength, false, false))
-				{
-					nFileIndex += (nLength - 5);
-					// Update SHA256 hash for integrity verification
-					pSHA256.update(&pFileBuffer[3], nLength - 5);
+				// Update SHA256 hash for integrity verification
+				pSHA256.update(pPayload, nLength);
 
-					pBinaryFile.Write(&pFileBuffer[3], nLength - 5);
+				pBinaryFile.Write(pPayload, nLength);
+				nFileIndex += nLength;
+			}
+			else
+			{
+				// Remember how far the file got, so the next download of it continues from there
+				if (bRange && (pReply.nOffset + nFileIndex > 0))
+				{
+					const RANGE_REQUEST pRequest = { pReply.nOffset + nFileIndex, 0, pReply.nVersion };
+					g_pPartialDownloads[strFilePath] = pRequest;
 				}
+				pBinaryFile.Close();
+				return false;
 			}
 		}
-		else
-		{
-			TRACE(_T("Invalid nFileLength!\n"));
-			pBinaryFile.Close();
-			return false;
-		}
+		if (pReply.nOffset + pReply.nLength == nFileLength)
+			pBinaryFile.SetLength(nFileLength);
 		// Verify file integrity using SHA256 hash
-		const std::string strDigestSHA256 = pSHA256.toString(pSHA256.digest());
+		const SYNC_HASH pDigest = pSHA256.digest();
+		const std::string strDigestSHA256 = pSHA256.toString(pDigest);
 		nLength = (int)strDigestSHA256.length() + 5;
 		ZeroMemory(pFileBuffer, sizeof(pFileBuffer));
 		if (ReadBuffer(pApplicationSocket, pFileBuffer, nLength, false, true))
@@ -487,8 +891,27 @@ bool DownloadFile(CWSocket& pApplicationSocket, const std::wstring& strFilePath)
 				return false;
 			}
 		}
+		else
+		{
+			// The range was not verified, so the next download of the file fetches it again
+			TRACE(_T("No SHA256!\n"));
+			if (bRange && (pReply.nOffset > 0))
+			{
+				const RANGE_REQUEST pRequest = { pReply.nOffset, 0, pReply.nVersion };
+				g_pPartialDownloads[strFilePath] = pRequest;
+			}
+			pBinaryFile.Close();
+			return false;
+		}
 		pBinaryFile.Close();
 		g_strCurrentDocument.clear();
+		// Record the file as synced; the digest covers the whole file only when the range started at 0
+		ULONGLONG nFileSize = 0, nLastWriteTime = 0;
+		if (CSyncIndex::GetFileMetadata(strFilePath.c_str(), nFileSize, nLastWriteTime))
+			g_pSyncIndex.Update(strFilePath.c_str(), nFileSize, nLastWriteTime, (pReply.nOffset == 0) ? &pDigest : nullptr, pReply.nVersion);
+		const ULONGLONG nElapsedTime = GetTickCount64() - nStartTime;
+		TRACE(_T("Download Done! %.2f MB/s, %llu bytes copied\n"), (double)nFileLength / (1024.0 * 1024.0) / ((nElapsedTime > 0 ? nElapsedTime : 1) / 1000.0),
+			g_pDataPathCounters.nCopiedBytes - nCopiedBytes);
 	}
 	catch (CFileException* pException)
 	{
@@ -502,44 +925,345 @@ bool DownloadFile(CWSocket& pApplicationSocket, const std::wstring& strFilePath)
 	return true;
 }
 
+/**
+ * @brief Computes the SHA256 of every chunk of a file, and of the whole file
+ * @details Runs before the upload starts, so the server never waits on the disk during the have/need exchange.
+ *          Content-defined chunks are cut by g_pContentChunker, so an insertion only changes the chunks around it;
+ *          otherwise the chunks are DEDUP_CHUNK_SIZE bytes long.
+ * @param pBinaryFile The file, read from nStartOffset and rewound afterwards
+ * @param nStartOffset File offset the first chunk starts at (a resumed upload continues after its last checkpoint)
+ * @param nFileLength Length of the file
+ * @param bContentDefined Whether to cut content-defined chunks (PROTOCOL_CDC)
+ * @param pHashes [out] SHA256 of each chunk, in file order
+ * @param pLengths [out] Length of each chunk, in file order
+ * @param pSHA256 [in/out] SHA256 of the bytes from nStartOffset on
+ * @return true on success, false if the file shrank meanwhile
+ */
+bool HashFileChunks(CFile& pBinaryFile, const ULONGLONG nStartOffset, const ULONGLONG nFileLength, const bool bContentDefined, std::vector<CHUNK_HASH>& pHashes, std::vector<int>& pLengths, SHA256& pSHA256)
+{
+	const size_t nMaxSize = bContentDefined ? g_pContentChunker.GetMaxSize() : (size_t)DEDUP_CHUNK_SIZE;
+	std::vector<unsigned char> pBuffer(4 * DEDUP_CHUNK_SIZE);
+	pHashes.reserve((size_t)((nFileLength - nStartOffset) / (bContentDefined ? g_pContentChunker.GetAvgSize() : nMaxSize) + 1));
+	pLengths.reserve(pHashes.capacity());
+	size_t nStart = 0;
+	size_t nEnd = 0;
+	pBinaryFile.Seek((LONGLONG)nStartOffset, CFile::begin);
+	for (ULONGLONG nFileIndex = nStartOffset; (nFileIndex < nFileLength) || (nStart < nEnd); )
+	{
+		// Refill once less than the largest chunk is left in the buffer
+		if ((nEnd - nStart < nMaxSize) && (nFileIndex < nFileLength))
+		{
+			MoveMemory(pBuffer.data(), pBuffer.data() + nStart, nEnd - nStart);
+			nEnd -= nStart;
+			nStart = 0;
+			const UINT nCount = (UINT)min(nFileLength - nFileIndex, (ULONGLONG)(pBuffer.size() - nEnd));
+			if (pBinaryFile.Read(pBuffer.data() + nEnd, nCount) != nCount)
+				return false;
+			pSHA256.update(pBuffer.data() + nEnd, nCount);
+			nEnd += nCount;
+			nFileIndex += nCount;
+		}
+		const size_t nAvailable = nEnd - nStart;
+		const size_t nChunkLength = bContentDefined ? g_pContentChunker.FindBoundary(pBuffer.data() + nStart, nAvailable) : min(nAvailable, nMaxSize);
+		SHA256 pChunkSHA256;
+		pChunkSHA256.update(pBuffer.data() + nStart, nChunkLength);
+		pHashes.push_back(pChunkSHA256.digest());
+		pLengths.push_back((int)nChunkLength);
+		nStart += nChunkLength;
+	}
+	pBinaryFile.SeekToBegin();
+	return true;
+}
+
+/**
+ * @brief Sends the chunk hashes of an upload and collects the chunks the server asks for
+ * @details Each packet of up to DEDUP_HASHES_PER_PACKET hashes (DEDUP_ENTRIES_PER_PACKET hashes with their
+ *          lengths under PROTOCOL_CDC) is answered with one bit per hash (bit 0 of byte 0 first),
+ *          set when the server lacks the chunk
+ * @param pApplicationSocket The socket to use for communication
+ * @param bContentDefined Whether the chunks are content-defined and their lengths go along (PROTOCOL_CDC)
+ * @param pHashes SHA256 of each chunk, in file order
+ * @param pLengths Length of each chunk, in file order
+ * @param pNeeded [out] Indexes of the chunks to send, in file order
+ * @return true on success, false otherwise
+ */
+#pragma warning(suppress: 6262)
+bool ExchangeChunkHashes(CWSocket& pApplicationSocket, const bool bContentDefined, const std::vector<CHUNK_HASH>& pHashes, const std::vector<int>& pLengths, std::vector<ULONGLONG>& pNeeded)
+{
+	unsigned char pBuffer[MAX_BUFFER] = { 0, };
+	CHUNK_ENTRY pEntries[DEDUP_ENTRIES_PER_PACKET];
+	const size_t nPerPacket = bContentDefined ? DEDUP_ENTRIES_PER_PACKET : DEDUP_HASHES_PER_PACKET;
+	for (size_t nFirst = 0; nFirst < pHashes.size(); nFirst += nPerPacket)
+	{
+		const int nCount = (int)min(pHashes.size() - nFirst, nPerPacket);
+		if (bContentDefined)
+		{
+			for (int nIndex = 0; nIndex < nCount; nIndex++)
+			{
+				CopyMemory(pEntries[nIndex].pHash, pHashes[nFirst + nIndex].data(), sizeof(CHUNK_HASH));
+				pEntries[nIndex].nLength = (unsigned int)pLengths[nFirst + nIndex];
+			}
+			if (!WriteBuffer(pApplicationSocket, (unsigned char*)pEntries, nCount * (int)sizeof(CHUNK_ENTRY), false, false))
+				return false;
+		}
+		else if (!WriteBuffer(pApplicationSocket, pHashes[nFirst].data(), nCount * (int)sizeof(CHUNK_HASH), false, false))
+			return false;
+		int nLength = MAX_BUFFER;
+		if (!ReadBuffer(pApplicationSocket, pBuffer, nLength, false, false) ||
+			(nLength != (nCount + 7) / 8 + 5))
+		{
+			TRACE(_T("Invalid chunk bitmap!\n"));
+			return false;
+		}
+		for (int nIndex = 0; nIndex < nCount; nIndex++)
+		{
+			if ((pBuffer[3 + nIndex / 8] & (1 << (nIndex % 8))) != 0)
+				pNeeded.push_back(nFirst + nIndex);
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief Sends the chunks the server asked for, back to back in data frames
+ * @details The chunks are read straight into the frame slots; a chunk may continue in the next frame
+ * @param pApplicationSocket The socket to use for communication
+ * @param pFrameWindow Sliding window state of the upload
+ * @param pBinaryFile The file
+ * @param nStartOffset File offset of the first chunk
+ * @param pLengths Length of each chunk, in file order
+ * @param pNeeded Indexes of the chunks to send, in file order
+ * @return true on success, false otherwise
+ */
+bool SendChunks(CWSocket& pApplicationSocket, CFrameWindow& pFrameWindow, CFile& pBinaryFile, const ULONGLONG nStartOffset, const std::vector<int>& pLengths, const std::vector<ULONGLONG>& pNeeded)
+{
+	const int nFrameSize = pFrameWindow.GetFrameSize();
+	unsigned char* pPayload = nullptr;
+	int nFrameLength = 0;
+	size_t nNextChunk = 0;                // First chunk not summed into nNextIndex yet
+	ULONGLONG nNextIndex = nStartOffset;  // File offset of nNextChunk
+	for (const ULONGLONG nChunk : pNeeded)
+	{
+		for (; nNextChunk < (size_t)nChunk; nNextChunk++)
+			nNextIndex += pLengths[nNextChunk];
+		const ULONGLONG nChunkIndex = nNextIndex;
+		int nRemaining = pLengths[(size_t)nChunk];
+		if (pBinaryFile.GetPosition() != nChunkIndex)
+			pBinaryFile.Seek((LONGLONG)nChunkIndex, CFile::begin);
+		while (nRemaining > 0)
+		{
+			if ((pPayload == nullptr) &&
+				((pPayload = ReserveFrame(pApplicationSocket, pFrameWindow)) == nullptr))
+				return false;
+			const int nCount = min(nRemaining, nFrameSize - nFrameLength);
+			if (pBinaryFile.Read(pPayload + nFrameLength, nCount) != (UINT)nCount)  // File shrank meanwhile
+				return false;
+			nFrameLength += nCount;
+			nRemaining -= nCount;
+			if (nFrameLength == nFrameSize)
+			{
+				if (!WriteFrame(pApplicationSocket, pFrameWindow, pPayload, nFrameLength))
+					return false;
+				pPayload = nullptr;
+				nFrameLength = 0;
+			}
+		}
+	}
+	return (nFrameLength == 0) || WriteFrame(pApplicationSocket, pFrameWindow, pPayload, nFrameLength);
+}
+
+/**
+ * @brief Sends the token of a broken-off upload and prepares the file for the offset the server continues from (PROTOCOL_RESUME)
+ * @details With PROTOCOL_DEDUP the chunks before the offset are dropped; they are cut again from the offset if it is
+ *          no boundary of the current chunks. Otherwise the bytes before the offset only go into the SHA256 of the file,
+ *          which leaves the file positioned at the offset.
+ * @param pApplicationSocket The socket to use for communication
+ * @param pBinaryFile The file
+ * @param nFileLength Length of the file
+ * @param bDeduplicate Whether the upload sends chunk hashes (PROTOCOL_DEDUP)
+ * @param bContentDefined Whether the chunks are content-defined (PROTOCOL_CDC)
+ * @param pSession [in/out] Token of the broken-off upload (0 if none); the answer of the server
+ * @param pHashes [in/out] SHA256 of each chunk, in file order
+ * @param pLengths [in/out] Length of each chunk, in file order
+ * @param pSHA256 [in/out] SHA256 of the whole file
+ * @return true on success, false otherwise
+ */
+#pragma warning(suppress: 6262)
+bool ExchangeUploadSession(CWSocket& pApplicationSocket, CFile& pBinaryFile, const ULONGLONG nFileLength, const bool bDeduplicate, const bool bContentDefined, UPLOAD_SESSION& pSession, std::vector<CHUNK_HASH>& pHashes, std::vector<int>& pLengths, SHA256& pSHA256)
+{
+	unsigned char pBuffer[MAX_BUFFER] = { 0, };
+	pSession.nOffset = 0;
+	if (!WriteBuffer(pApplicationSocket, (unsigned char*)&pSession, sizeof(pSession), false, false))
+		return false;
+	int nLength = (int)(sizeof(pSession) + 5);
+	if (!ReadBuffer(pApplicationSocket, pBuffer, nLength, false, false) ||
+		(nLength - 5 != (int)sizeof(pSession)))
+	{
+		TRACE(_T("Invalid upload session!\n"));
+		return false;
+	}
+	CopyMemory(&pSession, &pBuffer[3], sizeof(pSession));
+	if (pSession.nOffset > nFileLength)
+	{
+		TRACE(_T("Invalid upload session!\n"));
+		return false;
+	}
+	if (pSession.nOffset == 0)
+		return true;
+	TRACE(_T("Resuming upload at offset %llu\n"), pSession.nOffset);
+
+	if (bDeduplicate)
+	{
+		size_t nChunks = 0;
+		ULONGLONG nOffset = 0;
+		while ((nChunks < pLengths.size()) && (nOffset < pSession.nOffset))
+			nOffset += pLengths[nChunks++];
+		if (nOffset == pSession.nOffset)
+		{
+			pHashes.erase(pHashes.begin(), pHashes.begin() + nChunks);
+			pLengths.erase(pLengths.begin(), pLengths.begin() + nChunks);
+			return true;
+		}
+		// The server only needs the chunk hashes, the SHA256 of the file is not checked
+		SHA256 pChunkedSHA256;
+		pHashes.clear();
+		pLengths.clear();
+		return HashFileChunks(pBinaryFile, pSession.nOffset, nFileLength, bContentDefined, pHashes, pLengths, pChunkedSHA256);
+	}
+
+	pBinaryFile.SeekToBegin();
+	for (ULONGLONG nFileIndex = 0; nFileIndex < pSession.nOffset; )
+	{
+		const UINT nCount = (UINT)min(pSession.nOffset - nFileIndex, (ULONGLONG)sizeof(pBuffer));
+		if (pBinaryFile.Read(pBuffer, nCount) != nCount)  // File shrank meanwhile
+			return false;
+		pSHA256.update(pBuffer, nCount);
+		nFileIndex += nCount;
+	}
+	return true;
+}
+
+/**
+ * @brief Reads whether the server verified and published an upload (PROTOCOL_RESULT)
+ * @param pApplicationSocket The socket to use for communication
+ * @param pResult [out] The answer of the server
+ * @return true if the server published the file, false otherwise
+ */
+#pragma warning(suppress: 6262)
+bool ReceiveUploadResult(CWSocket& pApplicationSocket, UPLOAD_RESULT& pResult)
+{
+	unsigned char pBuffer[MAX_BUFFER] = { 0, };
+	int nLength = (int)(sizeof(pResult) + 5);
+	if (!ReadBuffer(pApplicationSocket, pBuffer, nLength, false, true) ||
+		(nLength - 5 != (int)sizeof(pResult)))
+	{
+		TRACE(_T("Invalid upload result!\n"));
+		return false;
+	}
+	CopyMemory(&pResult, &pBuffer[3], sizeof(pResult));
+	if (pResult.nStatus != UPLOAD_PUBLISHED)
+	{
+		TRACE(_T("Upload not published!\n"));
+		return false;
+	}
+	return true;
+}
+
 /**
  * @brief Uploads a file to the server using the application socket
- * @details Sends file data and SHA256 digest for integrity verification
+ * @details Sends file data and SHA256 digest for integrity verification.
+ *          With PROTOCOL_DEDUP the chunk hashes go first and only the chunks the server lacks are sent.
+ *          With PROTOCOL_RESUME the server hands out a session token; an upload that breaks off is recorded
+ *          in g_pUploadSessions, so the next one continues from the offset the server committed
  * @param pApplicationSocket The socket to use for communication
  * @param strFilePath The local file path to upload
  * @return true on success, false otherwise
  */
-#pragma warning(suppress: 6262)
 bool UploadFile(CWSocket& pApplicationSocket, const std::wstring& strFilePath)
 {
 	SHA256 pSHA256;
-	unsigned char pFileBuffer[MAX_BUFFER] = { 0, };
+	CFrameWindow pFrameWindow(g_pProtocolOptions);
+	const bool bDeduplicate = ((g_pProtocolOptions.nFlags & PROTOCOL_DEDUP) != 0);
+	const bool bContentDefined = ((g_pProtocolOptions.nFlags & PROTOCOL_CDC) != 0);
+	const bool bResume = ((g_pProtocolOptions.nFlags & PROTOCOL_RESUME) != 0);
+	const bool bResult = ((g_pProtocolOptions.nFlags & PROTOCOL_RESULT) != 0);
+	const ULONGLONG nCopiedBytes = g_pDataPathCounters.nCopiedBytes;
 	try
 	{
+		const ULONGLONG nStartTime = GetTickCount64();
 		TRACE(_T("[UploadFile] %s\n"), strFilePath.c_str());
 		CFile pBinaryFile(strFilePath.c_str(), CFile::modeRead | CFile::typeBinary);
-		// Send file length first
 		ULONGLONG nFileLength = pBinaryFile.GetLength();
+		std::vector<CHUNK_HASH> pHashes;
+		std::vector<int> pLengths;
+		std::vector<ULONGLONG> pNeeded;
+		if (bDeduplicate && !HashFileChunks(pBinaryFile, 0, nFileLength, bContentDefined, pHashes, pLengths, pSHA256))
+		{
+			pBinaryFile.Close();
+			return false;
+		}
+		// A session is only resumed for the same contents
+		PENDING_UPLOAD pPending = { 0, nFileLength, { 0, 0 } };
+		VERIFY(GetFileTime(pBinaryFile.m_hFile, nullptr, nullptr, &pPending.ftLastWrite));
+		UPLOAD_SESSION pSession = { 0, 0 };
+		const auto pSessionIter = g_pUploadSessions.find(strFilePath);
+		if ((pSessionIter != g_pUploadSessions.end()) && (pSessionIter->second.nFileLength == nFileLength) &&
+			(CompareFileTime(&pSessionIter->second.ftLastWrite, &pPending.ftLastWrite) == 0))
+			pSession.nToken = pSessionIter->second.nToken;
+		g_pUploadSessions.erase(strFilePath);
+		// Send file length first
 		int nLength = sizeof(nFileLength);
 		if (WriteBuffer(pApplicationSocket, (unsigned char*)&nFileLength, nLength, false, false))
 		{
+			if (bResume && !ExchangeUploadSession(pApplicationSocket, pBinaryFile, nFileLength, bDeduplicate, bContentDefined, pSession, pHashes, pLengths, pSHA256))
+			{
+				pBinaryFile.Close();
+				return false;
+			}
+			// Remember the session until the upload is done, so a broken-off upload continues from its last checkpoint
+			if (pSession.nToken != 0)
+			{
+				pPending.nToken = pSession.nToken;
+				g_pUploadSessions[strFilePath] = pPending;
+			}
+			if (bDeduplicate)
+			{
+				// Send only the chunks the server does not store yet
+				if (!ExchangeChunkHashes(pApplicationSocket, bContentDefined, pHashes, pLengths, pNeeded) ||
+					!SendChunks(pApplicationSocket, pFrameWindow, pBinaryFile, pSession.nOffset, pLengths, pNeeded))
+				{
+					pBinaryFile.Close();
+					return false;
+				}
+				TRACE(_T("%d of %d chunks sent\n"), (int)pNeeded.size(), (int)pHashes.size());
+			}
 			// Send file data in chunks
-			ULONGLONG nFileIndex = 0;
+			ULONGLONG nFileIndex = bDeduplicate ? nFileLength : pSession.nOffset;
 			while (nFileIndex < nFileLength)
 			{
-				nLength = pBinaryFile.Read(pFileBuffer, MAX_BUFFER - 5);
-				nFileIndex += nLength;
-				if (WriteBuffer(pApplicationSocket, pFileBuffer, nLength, false, false))
+				// Read the file straight into the next frame slot, so the payload is sent without a copy
+				unsigned char* pPayload = ReserveFrame(pApplicationSocket, pFrameWindow);
+				if ((pPayload == nullptr) ||
+					((nLength = pBinaryFile.Read(pPayload, pFrameWindow.GetFrameSize())) == 0))  // File shrank meanwhile
 				{
-					// Update SHA256 hash as we send
-					pSHA256.update(pFileBuffer, nLength);
+					pBinaryFile.Close();
+					return false;
 				}
-				else
+				nFileIndex += nLength;
+				// Update SHA256 hash as we send
+				pSHA256.update(pPayload, nLength);
+				if (!WriteFrame(pApplicationSocket, pFrameWindow, pPayload, nLength))
 				{
 					pBinaryFile.Close();
 					return false;
 				}
 			}
+			// Wait for the frames still in flight before switching back to stop-and-wait
+			if (!FlushFrames(pApplicationSocket, pFrameWindow))
+			{
+				pBinaryFile.Close();
+				return false;
+			}
 		}
 		else
 		{
@@ -548,11 +1272,22 @@ bool UploadFile(CWSocket& pApplicationSocket, const std::wstring& strFilePath)
 			return false;
 		}
 		// Send SHA256 digest for server-side verification
-		const std::string strDigestSHA256 = pSHA256.toString(pSHA256.digest());
+		const SYNC_HASH pDigest = pSHA256.digest();
+		const std::string strDigestSHA256 = pSHA256.toString(pDigest);
 		nLength = (int)strDigestSHA256.length() + 1;
-		if (WriteBuffer(pApplicationSocket, (unsigned char*)strDigestSHA256.c_str(), nLength, false, true))
+		UPLOAD_RESULT pResult = { UPLOAD_FAILED, 0 };
+		if (WriteBuffer(pApplicationSocket, (unsigned char*)strDigestSHA256.c_str(), nLength, false, true) &&
+			(!bResult || ReceiveUploadResult(pApplicationSocket, pResult)))
 		{
-			TRACE(_T("Upload Done!\n"));
+			g_pUploadSessions.erase(strFilePath);
+			// Record the file as synced, with the time it had when the upload started; only a server
+			// that confirms the publication is trusted, the others get the file again on the next start
+			const ULONGLONG nLastWriteTime = ((ULONGLONG)pPending.ftLastWrite.dwHighDateTime << 32) | pPending.ftLastWrite.dwLowDateTime;
+			if (bResult)
+				g_pSyncIndex.Update(strFilePath.c_str(), nFileLength, nLastWriteTime, &pDigest, pResult.nVersion);
+			const ULONGLONG nElapsedTime = GetTickCount64() - nStartTime;
+			TRACE(_T("Upload Done! %.2f MB/s, %llu bytes copied\n"), (double)nFileLength / (1024.0 * 1024.0) / ((nElapsedTime > 0 ? nElapsedTime : 1) / 1000.0),
+				g_pDataPathCounters.nCopiedBytes - nCopiedBytes);
 		}
 		else
 		{
@@ -575,7 +1310,7 @@ bool UploadFile(CWSocket& pApplicationSocket, const std::wstring& strFilePath)
 
 /**
  * @brief Producer thread function
- * @details Handles connection establishment, login, and incoming server commands (Restart, NotifyDownload, NotifyDelete)
+ * @details Handles connection establishment, login, and incoming server commands (Restart, NotifyDownload, NotifyDelete, NotifyResync)
  * @param lpParam Pointer to CMainFrame instance
  * @return 0 on thread exit
  * 
@@ -592,7 +1327,7 @@ bool UploadFile(CWSocket& pApplicationSocket, const std::wstring& strFilePath)
  * 
  * CONNECTION STATE MACHINE:
  * -------------------------
- * State 1: Disconnected -> Attempt connection + send "IntelliDisk" + machine ID
+ * State 1: Disconnected -> Attempt connection + send "IntelliDisk" + machine ID + protocol options
  * State 2: Connected -> Listen for server commands OR send periodic ping
  * State 3: Error -> Close socket, set disconnected flag, retry after 1 second
  */
@@ -605,6 +1340,8 @@ DWORD WINAPI ProducerThread(LPVOID lpParam)
 	CMainFrame* pMainFrame = (CMainFrame*)lpParam;
 	CWSocket& pApplicationSocket = pMainFrame->m_pApplicationSocket;
 	HANDLE& hSocketMutex = pMainFrame->m_hSocketMutex;
+	std::vector<std::wstring> arrResyncFiles;  // Files to download after a "NotifyResync"
+	std::vector<std::wstring> arrResumeFiles;  // Files to upload again after their upload broke off
 
 	while (g_bClientRunning)
 	{
@@ -623,12 +1360,41 @@ DWORD WINAPI ProducerThread(LPVOID lpParam)
 				if (WriteBuffer(pApplicationSocket, (unsigned char*)strCommand.c_str(), nLength, true, false))
 				{
 					TRACE(_T("Client connected!\n"));
-					// Step 3: Send unique machine identifier for authentication
+					// Step 3: Send unique machine identifier for authentication,
+					// followed by the protocol options this client supports
 					const std::string strMachineID = GetMachineID();
-					int nComputerLength = (int)strMachineID.length() + 1;
-					if (WriteBuffer(pApplicationSocket, (unsigned char*)strMachineID.c_str(), nComputerLength, false, true))
+					const PROTOCOL_OPTIONS pClientOptions = { PROTOCOL_VERSION, PROTOCOL_WINDOW | PROTOCOL_CRC32C | PROTOCOL_LARGE_FRAME | PROTOCOL_RESYNC | PROTOCOL_DEDUP | PROTOCOL_CDC | PROTOCOL_RANGE | PROTOCOL_RESUME | PROTOCOL_RESULT, DEFAULT_WINDOW_SIZE, DEFAULT_FRAME_SIZE };
+					std::vector<unsigned char> pLogin(strMachineID.begin(), strMachineID.end());
+					pLogin.push_back(0);
+					pLogin.insert(pLogin.end(), (const unsigned char*)&pClientOptions, (const unsigned char*)&pClientOptions + sizeof(pClientOptions));
+					g_pProtocolOptions = LEGACY_PROTOCOL;
+					if (WriteBuffer(pApplicationSocket, pLogin.data(), (int)pLogin.size(), false, true))
 					{
 						TRACE(_T("Logged In!\n"));
+						// Step 4: Newer servers answer with the options they accept, old servers stay silent
+						nLength = sizeof(pBuffer);
+						ZeroMemory(pBuffer, sizeof(pBuffer));
+						if (ReadBuffer(pApplicationSocket, pBuffer, nLength, true, true) &&
+							(nLength - 5 == (int)(strCommand.length() + 1 + sizeof(PROTOCOL_OPTIONS))) &&
+							(strCommand.compare((char*)&pBuffer[3]) == 0))
+						{
+							CopyMemory(&g_pProtocolOptions, &pBuffer[3 + strCommand.length() + 1], sizeof(PROTOCOL_OPTIONS));
+							if (g_pProtocolOptions.nWindowSize > MAX_WINDOW_SIZE)
+								g_pProtocolOptions.nWindowSize = MAX_WINDOW_SIZE;
+							if ((g_pProtocolOptions.nFrameSize < LEGACY_FRAME_SIZE) || (g_pProtocolOptions.nFrameSize > MAX_FRAME_SIZE))
+								g_pProtocolOptions.nFlags &= ~PROTOCOL_LARGE_FRAME;
+						}
+						TRACE(_T("Protocol v%u, flags = 0x%08X, window = %u, frame = %u, CRC32C = %s\n"), g_pProtocolOptions.nVersion, g_pProtocolOptions.nFlags, g_pProtocolOptions.nWindowSize, g_pProtocolOptions.nFrameSize, IsCRC32CAccelerated() ? _T("hardware") : _T("slice-by-8"));
+						// Resume the downloads the lost connection broke off; older servers get the whole files again
+						for (const auto& pPartial : g_pPartialDownloads)
+							arrResyncFiles.push_back(pPartial.first);
+						if ((g_pProtocolOptions.nFlags & PROTOCOL_RANGE) == 0)
+							g_pPartialDownloads.clear();
+						// The same for the uploads; without PROTOCOL_RESUME they start over
+						for (const auto& pPending : g_pUploadSessions)
+							arrResumeFiles.push_back(pPending.first);
+						if ((g_pProtocolOptions.nFlags & PROTOCOL_RESUME) == 0)
+							g_pUploadSessions.clear();
 						g_bIsConnected = true;
 						MessageBeep(MB_OK);
 					}
@@ -675,7 +1441,7 @@ DWORD WINAPI ProducerThread(LPVOID lpParam)
 								strMessage.ReleaseBuffer();
 
 								TRACE(_T("Downloading %s...\n"), strUNICODE.c_str());
-								VERIFY(DownloadFile(pApplicationSocket, strUNICODE));
+								VERIFY(DownloadFile(pApplicationSocket, strUNICODE, (g_pProtocolOptions.nFlags & PROTOCOL_RANGE) != 0));
 							}
 						}
 						else if (strCommand.compare("NotifyDelete") == 0)
@@ -687,6 +1453,51 @@ DWORD WINAPI ProducerThread(LPVOID lpParam)
 							{
 								const std::wstring strUNICODE = decode_filepath(utf8_to_wstring((char*)&pBuffer[3]));
 								VERIFY(DeleteFile(strUNICODE.c_str()));
+								g_pSyncIndex.Remove(strUNICODE.c_str());
+							}
+						}
+						else if (strCommand.compare("NotifyResync") == 0)
+						{
+							// The server dropped our notifications - compare its file manifest with the local folder
+							ULONGLONG nFileCount = 0;
+							nLength = sizeof(pBuffer);
+							ZeroMemory(pBuffer, sizeof(pBuffer));
+							if (ReadBuffer(pApplicationSocket, pBuffer, nLength, false, false) &&
+								(nLength - 5 == sizeof(nFileCount)))
+							{
+								CopyMemory(&nFileCount, &pBuffer[3], sizeof(nFileCount));
+								TRACE(_T("Resync: %llu files\n"), nFileCount);
+								ULONGLONG nFileIndex = 0;
+								while (nFileIndex < nFileCount)
+								{
+									nLength = sizeof(pBuffer);
+									ZeroMemory(pBuffer, sizeof(pBuffer));
+									if (!ReadBuffer(pApplicationSocket, pBuffer, nLength, false, false))
+										break;
+									// Each packet holds "filepath\0" + 64-bit file size entries
+									int nOffset = 3;
+									const int nEnd = nLength - 2;
+									while (nOffset < nEnd)
+									{
+										const char* lpszFilePath = (const char*)&pBuffer[nOffset];
+										const int nPathLength = (int)strnlen(lpszFilePath, nEnd - nOffset);
+										ULONGLONG nFileSize = 0;
+										if (nOffset + nPathLength + 1 + (int)sizeof(nFileSize) > nEnd)
+											break;
+										CopyMemory(&nFileSize, &pBuffer[nOffset + nPathLength + 1], sizeof(nFileSize));
+										nOffset += nPathLength + 1 + (int)sizeof(nFileSize);
+										nFileIndex++;
+
+										// Download files that are missing or differ in size
+										const std::wstring strUNICODE = decode_filepath(utf8_to_wstring(lpszFilePath));
+										WIN32_FILE_ATTRIBUTE_DATA pFileData = { 0, };
+										if (!GetFileAttributesEx(strUNICODE.c_str(), GetFileExInfoStandard, &pFileData) ||
+											(((((ULONGLONG)pFileData.nFileSizeHigh) << 32) | pFileData.nFileSizeLow) != nFileSize))
+										{
+											arrResyncFiles.push_back(strUNICODE);
+										}
+									}
+								}
 							}
 						}
 					}
@@ -709,6 +1520,14 @@ DWORD WINAPI ProducerThread(LPVOID lpParam)
 			}
 
 			ReleaseSemaphore(hSocketMutex, 1, nullptr);
+
+			// Queue the resync downloads once the socket is free for the consumer thread
+			for (const std::wstring& strFilePath : arrResyncFiles)
+				AddNewItem(ID_FILE_DOWNLOAD, strFilePath, pMainFrame);
+			arrResyncFiles.clear();
+			for (const std::wstring& strFilePath : arrResumeFiles)
+				AddNewItem(ID_FILE_UPLOAD, strFilePath, pMainFrame);
+			arrResumeFiles.clear();
 		}
 		catch (CWSocketException* pException)
 		{
@@ -753,6 +1572,7 @@ DWORD WINAPI ProducerThread(LPVOID lpParam)
  * ----------------------------
  * - "Close": Graceful shutdown (ID_STOP_PROCESS)
  * - "Download": Request file from server (ID_FILE_DOWNLOAD)
+ * - "DownloadRange": Request file from server, resuming a broken-off download (ID_FILE_DOWNLOAD, PROTOCOL_RANGE)
  * - "Upload": Send file to server (ID_FILE_UPLOAD)
  * - "Delete": Remove file from server (ID_FILE_DELETE)
  */
@@ -841,16 +1661,20 @@ DWORD WINAPI ConsumerThread(LPVOID lpParam)
 				{
 					if (ID_FILE_DOWNLOAD == nFileEvent)
 					{
-						const std::string strCommand = "Download";
+						// With PROTOCOL_RANGE an interrupted download continues where it broke off
+						const bool bRange = ((g_pProtocolOptions.nFlags & PROTOCOL_RANGE) != 0);
+						const std::string strCommand = bRange ? "DownloadRange" : "Download";
 						nLength = (int)strCommand.length() + 1;
 						if (WriteBuffer(pApplicationSocket, (unsigned char*)strCommand.c_str(), nLength, true, false))
 						{
 							const std::string strASCII = wstring_to_utf8(encode_filepath(strFilePath));
 							const int nFileNameLength = (int)strASCII.length() + 1;
-							if (WriteBuffer(pApplicationSocket, (unsigned char*)strASCII.c_str(), nFileNameLength, false, false))
+							const RANGE_REQUEST pRequest = GetResumeRange(strFilePath);
+							if (WriteBuffer(pApplicationSocket, (unsigned char*)strASCII.c_str(), nFileNameLength, false, false) &&
+								(!bRange || WriteBuffer(pApplicationSocket, (unsigned char*)&pRequest, (int)sizeof(pRequest), false, false)))
 							{
-								TRACE(_T("Downloading %s...\n"), strFilePath.c_str());
-								VERIFY(DownloadFile(pApplicationSocket, strFilePath));
+								TRACE(_T("Downloading %s from %llu...\n"), strFilePath.c_str(), bRange ? pRequest.nOffset : 0);
+								VERIFY(DownloadFile(pApplicationSocket, strFilePath, bRange));
 							}
 						}
 					}
@@ -884,6 +1708,7 @@ DWORD WINAPI ConsumerThread(LPVOID lpParam)
 									if (WriteBuffer(pApplicationSocket, (unsigned char*)strASCII.c_str(), nFileNameLength, false, true))
 									{
 										TRACE(_T("Deleting %s...\n"), strFilePath.c_str());
+										g_pSyncIndex.Remove(strFilePath.c_str());
 									}
 								}
 							}
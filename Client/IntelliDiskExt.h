@@ -21,6 +21,12 @@ IntelliDisk. If not, see <http://www.opensource.org/licenses/gpl-3.0.html>*/
 #include "FileInformation.h"
 #include "NotifyDirCheck.h"
 #include "SocMFC.h"
+#include "CRC32C.h"
+#include "Chunker.h"
+#include "SyncIndex.h"
+#include <array>
+#include <atomic>
+#include <unordered_map>
 
 /**
  * @brief Calculates the Longitudinal Redundancy Check (LRC) for a buffer.
@@ -48,6 +54,166 @@ inline unsigned char calcLRC(const std::vector<unsigned char>& buffer)
 	return nLRC;
 }
 
+// Protocol features negotiated during the "IntelliDisk" handshake
+#define PROTOCOL_VERSION 11            // Version announced by this client
+#define PROTOCOL_WINDOW 0x00000001     // Sequence-numbered data frames with several frames in flight
+#define PROTOCOL_CRC32C 0x00000002     // Data frames carry a CRC32C instead of the LRC
+#define PROTOCOL_LARGE_FRAME 0x00000004 // Data frames carry up to nFrameSize bytes (requires PROTOCOL_WINDOW)
+#define PROTOCOL_RESYNC 0x00000008     // Server may send "NotifyResync" + file manifest instead of dropped notifications
+#define PROTOCOL_DEDUP 0x00000010      // Uploads announce their chunk hashes first and send only the chunks the server lacks
+// 0x00000020 was PROTOCOL_DELTA (rsync-style delta uploads), superseded by PROTOCOL_CDC; not to be reused
+#define PROTOCOL_CDC 0x00000040        // Deduplicated uploads use content-defined chunks and announce their lengths (requires PROTOCOL_DEDUP)
+#define PROTOCOL_RANGE 0x00000080      // Downloads go through "DownloadRange", which can start at an offset of a given file version
+#define PROTOCOL_RESUME 0x00000100     // Uploads open an upload session, so a broken-off upload continues from its last checkpoint
+#define PROTOCOL_RESULT 0x00000200     // Uploads end with an UPLOAD_RESULT once the server verified and published the file (or failed to)
+
+constexpr auto DEFAULT_WINDOW_SIZE = 16; // Data frames in flight proposed by this client
+constexpr auto MAX_WINDOW_SIZE = 64;     // Upper bound accepted from the server
+constexpr auto LEGACY_FRAME_SIZE = 0x10000 - 5;  // Payload of a legacy STX/ETX packet (16-bit length)
+constexpr auto DEFAULT_FRAME_SIZE = 0x100000;    // Payload per data frame proposed by this client (1 MiB)
+constexpr auto MAX_FRAME_SIZE = 0x400000;        // Upper bound accepted from the server (4 MiB)
+constexpr auto MAX_WINDOW_BYTES = 0x1000000;     // Upper bound for the payload bytes in flight (16 MiB)
+constexpr auto DEDUP_CHUNK_SIZE = LEGACY_FRAME_SIZE; // Largest stored chunk (fixed chunk size without PROTOCOL_CDC), keyed by its SHA256
+constexpr auto DEDUP_HASHES_PER_PACKET = LEGACY_FRAME_SIZE / 32; // Chunk hashes per packet of the have/need exchange
+static_assert(CHUNKER_MAX_SIZE <= DEDUP_CHUNK_SIZE, "A content-defined chunk must fit a chunk slot");
+
+typedef std::array<uint8_t, 32> CHUNK_HASH; // SHA256 of a chunk
+
+#pragma pack(push, 1)
+/**
+ * @brief Capability block exchanged during the "IntelliDisk" handshake.
+ *        The client appends it after the NUL terminator of the machine ID;
+ *        old servers stop at the terminator and never answer, so the client stays in legacy mode.
+ */
+typedef struct {
+	unsigned int nVersion;    // Protocol version
+	unsigned int nFlags;      // PROTOCOL_xxx feature bits
+	unsigned int nWindowSize; // Number of data frames allowed in flight
+	unsigned int nFrameSize;  // Maximum payload of one data frame (PROTOCOL_LARGE_FRAME)
+} PROTOCOL_OPTIONS;
+
+/**
+ * @brief Header of an extended (sequence-numbered) data frame, followed by the payload.
+ */
+typedef struct {
+	unsigned char nStart;       // SOH - marks an extended frame
+	unsigned char nReserved[3]; // Always zero
+	unsigned int nSequence;     // Frame sequence number within the transfer
+	unsigned int nLength;       // Payload length
+	unsigned int nChecksum;     // CRC32C of the header and payload (PROTOCOL_CRC32C), otherwise LRC of the payload
+} FRAME_HEADER;
+
+/**
+ * @brief Acknowledgement of an extended data frame.
+ *        ACK is cumulative (all frames up to nSequence arrived), NAK is selective (resend nSequence only).
+ */
+typedef struct {
+	unsigned char nReturn;  // ACK or NAK
+	unsigned int nSequence; // Acknowledged frame sequence number
+} FRAME_ACK;
+
+/**
+ * @brief Entry of the have/need exchange with PROTOCOL_CDC, where the chunks differ in length.
+ */
+typedef struct {
+	unsigned char pHash[32];  // SHA256 of the chunk
+	unsigned int nLength;     // Length of the chunk
+} CHUNK_ENTRY;
+
+/**
+ * @brief Request of a "DownloadRange", sent after the file path.
+ */
+typedef struct {
+	unsigned long long nOffset;  // First byte wanted
+	unsigned long long nLength;  // Bytes wanted, 0 for the rest of the file
+	long long nVersion;          // Version the bytes before nOffset came from, 0 for the current one
+} RANGE_REQUEST;
+
+/**
+ * @brief Answer to a "DownloadRange" (also sent by pushed downloads with PROTOCOL_RANGE), followed by the data frames
+ *        and the SHA256 of the bytes sent. The server starts at zero when it cannot serve the offset.
+ */
+typedef struct {
+	unsigned long long nFileLength;  // Length of the whole file
+	long long nVersion;              // Version the bytes come from
+	unsigned long long nOffset;      // First byte sent
+	unsigned long long nLength;      // Bytes sent
+} RANGE_REPLY;
+
+/**
+ * @brief Upload session of PROTOCOL_RESUME, exchanged after the file length of an upload.
+ *        The client sends the token of the upload that broke off (0 for a new one), the server answers
+ *        with the token of this upload and the offset the client continues from.
+ */
+typedef struct {
+	unsigned long long nToken;   // Session token, 0 if none
+	unsigned long long nOffset;  // Bytes the server already committed (server answer only)
+} UPLOAD_SESSION;
+
+#define UPLOAD_PUBLISHED 0  // The new version is stored and visible to other clients
+#define UPLOAD_FAILED 1     // Verification or the database failed; the previous version stays
+
+/**
+ * @brief Answer of PROTOCOL_RESULT to the SHA256 that ends an upload.
+ */
+typedef struct {
+	unsigned long long nStatus;   // UPLOAD_PUBLISHED or UPLOAD_FAILED
+	unsigned long long nVersion;  // Published version, 0 on failure
+} UPLOAD_RESULT;
+#pragma pack(pop)
+
+constexpr auto DEDUP_ENTRIES_PER_PACKET = LEGACY_FRAME_SIZE / (int)sizeof(CHUNK_ENTRY); // Chunk entries per packet with PROTOCOL_CDC
+
+/**
+ * @brief Sliding window state for one file transfer.
+ *        The sender keeps unacknowledged frames for selective retransmission;
+ *        the receiver keeps frames that arrived out of order until they can be delivered.
+ *        A window size of zero falls back to the legacy stop-and-wait ReadBuffer/WriteBuffer.
+ */
+class CFrameWindow
+{
+public:
+	CFrameWindow(const PROTOCOL_OPTIONS& pOptions);
+
+	bool IsEnabled() const { return m_nWindowSize > 0; }
+	int GetFrameSize() const { return (int)m_nFrameSize; }
+	unsigned int GetChecksum(const FRAME_HEADER* pHeader, const unsigned char* pPayload) const;
+	unsigned char* GetSlot(const unsigned int nSequence) { return &m_pStorage[(nSequence % m_nSlotCount) * m_nSlotSize]; }
+	unsigned char* GetScratch() { return &m_pStorage[m_nSlotCount * m_nSlotSize]; }
+
+public:
+	unsigned int m_nFlags;              // Negotiated PROTOCOL_xxx feature bits
+	unsigned int m_nWindowSize;         // Frames in flight (0 = stop-and-wait)
+	unsigned int m_nFrameSize;          // Maximum payload of one frame
+	unsigned int m_nSlotCount;          // Number of frame slots (at least one)
+	unsigned int m_nSlotSize;           // Bytes per slot (header + maximum payload)
+	unsigned int m_nBaseSequence;       // Oldest frame not yet acknowledged (sender) or delivered (receiver)
+	unsigned int m_nNextSequence;       // Next frame to be sent (sender)
+	std::vector<unsigned char> m_pStorage; // Slots followed by one scratch slot
+	std::vector<int> m_nSlotLength;     // Payload length stored in each slot (-1 = empty)
+	std::vector<int> m_nRetryCount;     // Retransmissions requested for each slot
+};
+
+/**
+ * @brief Data path counters, TRACEd after each transfer to show how often payloads are copied.
+ */
+typedef struct {
+	std::atomic<unsigned long long> nCopiedBytes; // Payload bytes copied into a frame slot before sending
+	std::atomic<unsigned long long> nAllocations; // Frame windows allocated (one per transfer)
+} DATAPATH_COUNTERS;
+
+extern DATAPATH_COUNTERS g_pDataPathCounters;
+
+/**
+ * @brief Cuts the content-defined chunks of deduplicated uploads; the sizes come from the registry.
+ */
+extern CContentChunker g_pContentChunker;
+
+/**
+ * @brief Files synced by this client, kept across runs so a restart only sends what changed.
+ */
+extern CSyncIndex g_pSyncIndex;
+
 /**
  * @brief Converts a UTF-8 encoded std::string to std::wstring.
  * @param str UTF-8 encoded string.
@@ -74,6 +240,12 @@ const std::string GetMachineID();
  */
 const std::wstring GetSpecialFolder();
 
+/**
+ * @brief Gets the path of the sync index file, outside the synced folder.
+ * @return Wide string with the index file path, empty on failure.
+ */
+const std::wstring GetSyncIndexFile();
+
 /**
  * @brief Installs or removes IntelliDisk from Windows startup applications.
  * @param bInstallStartupApps If true, adds to startup; if false, removes.
@@ -103,14 +275,59 @@ bool ReadBuffer(CWSocket& pApplicationSocket, unsigned char* pBuffer, int& nLeng
  */
 bool WriteBuffer(CWSocket& pApplicationSocket, const unsigned char* pBuffer, const int nLength, const bool SendENQ, const bool SendEOT);
 
+/**
+ * @brief Waits for a free slot in the window and returns its payload area.
+ *        Filling it in place and passing it to WriteFrame sends the frame without copying the payload.
+ * @param pApplicationSocket The socket to read acknowledgements from.
+ * @param pFrameWindow Sliding window state of the current transfer.
+ * @return Payload area of the next frame (GetFrameSize() bytes), or nullptr on error.
+ */
+unsigned char* ReserveFrame(CWSocket& pApplicationSocket, CFrameWindow& pFrameWindow);
+
+/**
+ * @brief Sends one data frame, keeping up to the window size of frames in flight.
+ * @param pApplicationSocket The socket to write to.
+ * @param pFrameWindow Sliding window state of the current transfer.
+ * @param pBuffer Buffer containing data to send.
+ * @param nLength Length of data to send.
+ * @return true if the frame was sent, false otherwise.
+ */
+bool WriteFrame(CWSocket& pApplicationSocket, CFrameWindow& pFrameWindow, const unsigned char* pBuffer, const int nLength);
+
+/**
+ * @brief Waits until every data frame sent through the window has been acknowledged.
+ * @param pApplicationSocket The socket to read acknowledgements from.
+ * @param pFrameWindow Sliding window state of the current transfer.
+ * @return true if all frames were acknowledged, false otherwise.
+ */
+bool FlushFrames(CWSocket& pApplicationSocket, CFrameWindow& pFrameWindow);
+
+/**
+ * @brief Receives the next data frame in sequence order.
+ * @param pApplicationSocket The socket to read from.
+ * @param pFrameWindow Sliding window state of the current transfer.
+ * @param pPayload [out] Points to the payload, valid until the next call.
+ * @param nLength [out] Length of the payload.
+ * @return true on success, false otherwise.
+ */
+bool ReadFrame(CWSocket& pApplicationSocket, CFrameWindow& pFrameWindow, unsigned char*& pPayload, int& nLength);
+
 /**
  * @brief Downloads a file from the server using the application socket.
  *        Verifies file integrity using SHA256.
  * @param pApplicationSocket The socket to use.
  * @param strFilePath The local file path to save to.
+ * @param bRange Whether the server answers with a RANGE_REPLY (PROTOCOL_RANGE).
  * @return true on success, false otherwise.
  */
-bool DownloadFile(CWSocket& pApplicationSocket, const std::wstring& strFilePath);
+bool DownloadFile(CWSocket& pApplicationSocket, const std::wstring& strFilePath, const bool bRange = false);
+
+/**
+ * @brief Returns the "DownloadRange" request for a file: the rest of an interrupted download, or the whole file.
+ * @param strFilePath The local file path.
+ * @return The range to ask the server for.
+ */
+RANGE_REQUEST GetResumeRange(const std::wstring& strFilePath);
 
 /**
  * @brief Uploads a file to the server using the application socket.
@@ -197,12 +197,22 @@ int CMainFrame::OnCreate(LPCREATESTRUCT lpCreateStruct)
 	m_pNotifyDirCheck.SetData(this);  // Pass this pointer to callback
 	// Set callback to work with each new file system event
 	m_pNotifyDirCheck.SetActionCallback(DirCallback);
+	// Threads that walk the folder on a full scan (0 = one per processor)
+	m_pNotifyDirCheck.SetScanThreads(theApp.GetInt(_T("ScanThreads"), 0));
+	// Files synced by earlier runs, so the first scan reports only what changed since
+	BOOL bNewSyncIndex = FALSE;
+	if (g_pSyncIndex.Open(GetSyncIndexFile().c_str(), bNewSyncIndex))
+		m_pNotifyDirCheck.SetSyncIndex(&g_pSyncIndex);
+	TRACE(_T("Sync index: %s, %u files\n"), bNewSyncIndex ? _T("new") : _T("existing"), g_pSyncIndex.GetCount());
 	m_pNotifyDirCheck.Run();  // Start monitoring thread
 
 	// === PHASE 8: LOAD SERVER CONNECTION SETTINGS ===
 	// Load server IP and port from registry (or use defaults)
 	m_strServerIP = theApp.GetString(_T("ServerIP"), IntelliDiskIP);
 	m_nServerPort = theApp.GetInt(_T("ServerPort"), IntelliDiskPort);
+	// Chunk sizes of deduplicated uploads; out-of-range values are clamped by the chunker
+	g_pContentChunker = CContentChunker(theApp.GetInt(_T("ChunkMinSize"), CHUNKER_MIN_SIZE),
+		theApp.GetInt(_T("ChunkAvgSize"), CHUNKER_AVG_SIZE), theApp.GetInt(_T("ChunkMaxSize"), CHUNKER_MAX_SIZE));
 
 	// === PHASE 9: START WORKER THREADS ===
 	// Producer thread: Handles server connection and incoming commands
@@ -244,6 +254,7 @@ void CMainFrame::OnDestroy()
 	hThreadArray[0] = m_hProducerThread;
 	hThreadArray[1] = m_hConsumerThread;
 	WaitForMultipleObjects(2, hThreadArray, TRUE, INFINITE);  // Wait for all threads
+	g_pSyncIndex.Close();  // Write the index back after the last transfer
 
 	// === STEP 4: CLEAN UP THREAD HANDLES ===
 	if (m_hProducerThread != nullptr)
@@ -4,6 +4,8 @@
 
 #include "pch.h"
 #include "NotifyDirCheck.h"
+#include "FileSnapshot.h"
+#include "SyncIndex.h"
 
 #ifdef _DEBUG
 #undef THIS_FILE
@@ -70,6 +72,337 @@ static void ErrorMessage(CString failedSource)
 	LocalFree(lpMsgBuf);
 }
 
+//////////////////////////////////////////////////////////////////////
+// Change Records
+//////////////////////////////////////////////////////////////////////
+
+// Builds the file information of a path that is gone; it only carries the path
+static CFileInformation PathFileInformation(const CString& csPath)
+{
+	WIN32_FIND_DATA fd;
+	CFileInformation fi;
+
+	ZeroMemory(&fd, sizeof(fd));
+	_tcscpy_s(fd.cFileName, MAX_PATH, CFileInformation::GetFileName(csPath));
+	fi.SetFileData(fd);
+	fi.SetFileDir(CFileInformation::GetFileDirectory(csPath));
+
+	return fi;
+}
+
+// Reads the find data of a path, FALSE when it is gone already
+static BOOL LoadFindData(const CString& csPath, WIN32_FIND_DATA& fd)
+{
+	HANDLE hFind = FindFirstFile(csPath, &fd);
+
+	if (hFind == INVALID_HANDLE_VALUE)
+		return FALSE;
+
+	FindClose(hFind);
+	return TRUE;
+}
+
+// Calls the user's callback (or virtual function), returns TRUE to stop the thread
+static BOOL NotifyAction(CNotifyDirCheck *pNDC, CFileInformation fi, EFileAction faAction)
+{
+	NOTIFICATION_CALLBACK_PTR ncpAction = pNDC->GetActionCallback();
+
+	if (ncpAction) //call user's callback
+		return (ncpAction(fi, faAction, pNDC->GetData()) > 0);
+
+	//call user's virtual function
+	return (pNDC->Action(fi, faAction) > 0);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Quiet Period
+//////////////////////////////////////////////////////////////////////
+
+// A file is reported once it stops changing, so a save that writes it in several steps is sent once
+typedef struct {
+	EFileAction faAction;  // faCreate, faChange or faDelete
+	ULONGLONG nFirstTick;  // When the first record named the file
+	ULONGLONG nDueTick;    // When the file will have been quiet for NOTIFICATION_QUIET_PERIOD
+	CFileInformation fi;   // The file as it was before a delete
+} PENDING_CHANGE;
+
+// Records and walks may spell a path in different cases
+struct PathLess
+{
+	bool operator()(const CString& csLeft, const CString& csRight) const { return csLeft.CompareNoCase(csRight) < 0; }
+};
+
+typedef std::map<CString, PENDING_CHANGE, PathLess> PENDING_CHANGES;
+
+// Records an action on a file, merged with the one still waiting for it
+static void DelayAction(PENDING_CHANGES& pending, const CString& csPath, EFileAction faAction, const CFileInformation& fi)
+{
+	const ULONGLONG nNow = GetTickCount64();
+	PENDING_CHANGES::iterator it = pending.find(csPath);
+
+	if (it == pending.end())
+	{
+		pending[csPath] = { faAction, nNow, nNow + NOTIFICATION_QUIET_PERIOD, fi };
+		return;
+	}
+
+	PENDING_CHANGE& change = it->second;
+	if (IS_DELETE_FILE(faAction))
+	{
+		// created and deleted while quiet: nobody heard of it
+		if (IS_CREATE_FILE(change.faAction))
+		{
+			pending.erase(it);
+			return;
+		}
+		change.faAction = faDelete;
+		change.fi = fi;
+	}
+	else if (IS_DELETE_FILE(change.faAction))
+		change.faAction = faChange; // deleted and written again, e.g. a save through a temporary file
+	// a change after a create is still a create
+
+	change.nDueTick = nNow + NOTIFICATION_QUIET_PERIOD;
+}
+
+// Reports the files that have been quiet long enough, returns TRUE to stop the thread
+static BOOL FlushActions(CNotifyDirCheck *pNDC, CFileSnapshot& snapshot, PENDING_CHANGES& pending)
+{
+	const ULONGLONG nNow = GetTickCount64();
+	BOOL bStop = FALSE;
+
+	for (PENDING_CHANGES::iterator it = pending.begin(); (it != pending.end()) && !bStop;)
+	{
+		const PENDING_CHANGE& change = it->second;
+
+		if ((nNow < change.nDueTick) && (nNow - change.nFirstTick < NOTIFICATION_MAX_DELAY))
+		{
+			++it;
+			continue;
+		}
+
+		if (IS_DELETE_FILE(change.faAction))
+			bStop = NotifyAction(pNDC, change.fi, faDelete);
+		else
+		{
+			// report the file as it is now; if it is gone, its delete is waiting too
+			const UINT nEntry = snapshot.Find(it->first);
+			if (nEntry != SNAPSHOT_NO_ENTRY)
+				bStop = NotifyAction(pNDC, snapshot.GetFileInformation(nEntry), change.faAction);
+		}
+
+		it = pending.erase(it);
+	}
+
+	return bStop;
+}
+
+// How long the thread may wait for the next records before a file is due
+static DWORD GetWaitTime(const PENDING_CHANGES& pending)
+{
+	const ULONGLONG nNow = GetTickCount64();
+	ULONGLONG nWait = NOTIFICATION_TIMEOUT;
+
+	for (const auto& it : pending)
+	{
+		const ULONGLONG nDueTick = min(it.second.nDueTick, it.second.nFirstTick + NOTIFICATION_MAX_DELAY);
+		nWait = min(nWait, (nDueTick > nNow) ? (nDueTick - nNow) : 0);
+	}
+
+	return (DWORD)nWait;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Change Records
+//////////////////////////////////////////////////////////////////////
+
+// A directory that was moved or copied into the tree reports only itself: its files are reported as created
+static void AddTree(CFileSnapshot& snapshot, PENDING_CHANGES& pending, const CString& csPath)
+{
+	CFileSnapshot tree;
+
+	CFileInformation::EnumFiles(csPath, &tree);
+	for (UINT nEntry = 0; nEntry < tree.GetCount(); nEntry++)
+	{
+		const CString csFilePath = tree.GetFilePath(nEntry);
+		snapshot.Set(csFilePath, tree.GetFindData(nEntry));
+		if ((tree.GetFileAttribute(nEntry) & FILE_ATTRIBUTE_DIRECTORY) == 0)
+			DelayAction(pending, csFilePath, faCreate, CFileInformation());
+	}
+}
+
+// A directory that was moved out of the tree or deleted reports only itself: its files are reported as deleted
+static void RemovePath(CFileSnapshot& snapshot, PENDING_CHANGES& pending, const CString& csPath)
+{
+	std::vector<UINT> entries;
+	const UINT nEntry = snapshot.Find(csPath);
+
+	if (nEntry == SNAPSHOT_NO_ENTRY)
+	{
+		DelayAction(pending, csPath, faDelete, PathFileInformation(csPath));
+		return;
+	}
+
+	if ((snapshot.GetFileAttribute(nEntry) & FILE_ATTRIBUTE_DIRECTORY) != 0)
+		snapshot.FindTree(csPath, entries);
+	entries.push_back(nEntry);
+
+	for (const UINT nRemoved : entries)
+	{
+		if ((snapshot.GetFileAttribute(nRemoved) & FILE_ATTRIBUTE_DIRECTORY) == 0)
+			DelayAction(pending, snapshot.GetFilePath(nRemoved), faDelete, snapshot.GetFileInformation(nRemoved));
+	}
+
+	// from the highest entry down, so the last entry that fills each hole is never one still to remove
+	std::sort(entries.begin(), entries.end());
+	for (std::vector<UINT>::reverse_iterator it = entries.rbegin(); it != entries.rend(); ++it)
+		snapshot.Remove(*it);
+}
+
+// Keeps the snapshot in step with a change record and delays what it reports; directories are never reported
+static void ApplyRecord(CFileSnapshot& snapshot, PENDING_CHANGES& pending, DWORD dwAction, const CString& csPath)
+{
+	WIN32_FIND_DATA fd;
+
+	switch (dwAction)
+	{
+	case FILE_ACTION_REMOVED:
+	case FILE_ACTION_RENAMED_OLD_NAME:
+		RemovePath(snapshot, pending, csPath);
+		break;
+	case FILE_ACTION_ADDED:
+	case FILE_ACTION_RENAMED_NEW_NAME:
+	case FILE_ACTION_MODIFIED:
+		if (!LoadFindData(csPath, fd))
+			break; // gone again, its own record follows
+		snapshot.Set(csPath, fd);
+		if ((fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0)
+		{
+			// a modified directory only means that its entries changed, and they have their own records
+			if (dwAction != FILE_ACTION_MODIFIED)
+				AddTree(snapshot, pending, csPath);
+		}
+		else
+			DelayAction(pending, csPath, (dwAction == FILE_ACTION_MODIFIED) ? faChange : faCreate, CFileInformation());
+		break;
+	default:
+		break;
+	}
+}
+
+// Compares a new walk of the tree with the snapshot kept by the change records; only needed when the records overflowed
+static void RescanDirectory(CNotifyDirCheck *pNDC, CFileSnapshot& oldSnapshot, PENDING_CHANGES& pending)
+{
+	CFileSnapshot newSnapshot;
+	std::vector<FI_CHANGE> changes;
+
+	newSnapshot.Reserve(oldSnapshot.GetCount());
+	CFileInformation::EnumFiles(pNDC->GetDirectory(), &newSnapshot, pNDC->GetScanThreads());
+
+	CFileSnapshot::Compare(oldSnapshot, newSnapshot, changes);
+
+	for (const FI_CHANGE& change : changes)
+	{
+		// the files of a directory that changed show up as changes of their own
+		const UINT nEntry = IS_DELETE_FILE(change.faAction) ? change.nOldEntry : change.nNewEntry;
+		const DWORD dwAttributes = IS_DELETE_FILE(change.faAction) ?
+			oldSnapshot.GetFileAttribute(nEntry) : newSnapshot.GetFileAttribute(nEntry);
+		if ((dwAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0)
+			continue;
+
+		if (IS_RENAME_FILE(change.faAction)) //reported as delete of the old name and create of the new one
+		{
+			DelayAction(pending, oldSnapshot.GetFilePath(change.nOldEntry), faDelete, oldSnapshot.GetFileInformation(change.nOldEntry));
+			DelayAction(pending, newSnapshot.GetFilePath(change.nNewEntry), faCreate, CFileInformation());
+		}
+		else if (IS_DELETE_FILE(change.faAction))
+			DelayAction(pending, oldSnapshot.GetFilePath(change.nOldEntry), faDelete, oldSnapshot.GetFileInformation(change.nOldEntry));
+		else
+			DelayAction(pending, newSnapshot.GetFilePath(change.nNewEntry), change.faAction, CFileInformation());
+	}
+
+	std::swap(oldSnapshot, newSnapshot);
+}
+
+// Reports what changed since the files were last synced: the first walk of the tree is compared with the index,
+// so only files whose size or last write time moved are read, and only those whose contents moved are reported
+static BOOL ReconcileIndex(CNotifyDirCheck *pNDC, const CFileSnapshot& snapshot)
+{
+	CSyncIndex *pSyncIndex = pNDC->GetSyncIndex();
+	SYNC_INDEX_ENTRY entry;
+	SYNC_HASH pContentHash;
+	UINT nFound = 0, nChanged = 0;
+	BOOL bStop = FALSE;
+
+	if ((pSyncIndex == nullptr) || !pSyncIndex->IsOpen())
+		return FALSE;
+
+	// without an index nothing is known to have changed: record the tree as it is
+	const BOOL bSeed = (pSyncIndex->GetCount() == 0);
+
+	for (UINT nEntry = 0; (nEntry < snapshot.GetCount()) && !bStop; nEntry++)
+	{
+		if ((snapshot.GetFileAttribute(nEntry) & FILE_ATTRIBUTE_DIRECTORY) != 0)
+			continue;
+
+		const CString csPath = snapshot.GetFilePath(nEntry);
+		const ULONGLONG nFileSize = snapshot.GetFileSize(nEntry);
+		const ULONGLONG nLastWriteTime = snapshot.GetLastWriteTime(nEntry);
+
+		if (bSeed)
+		{
+			pSyncIndex->Update(csPath, nFileSize, nLastWriteTime, nullptr, 0);
+			continue;
+		}
+
+		if (pSyncIndex->Find(csPath, snapshot.GetPathHash(nEntry), entry))
+		{
+			nFound++;
+			if ((entry.nFileSize == nFileSize) && (entry.nLastWriteTime == nLastWriteTime))
+				continue;
+
+			// touched but not modified: keep the entry, with the new metadata
+			if (((entry.dwFlags & SYNC_ENTRY_HASHED) != 0) && CSyncIndex::HashFile(csPath, pContentHash) &&
+				(pContentHash == entry.pContentHash))
+			{
+				pSyncIndex->Update(csPath, nFileSize, nLastWriteTime, &entry.pContentHash, entry.nVersion);
+				continue;
+			}
+		}
+
+		nChanged++;
+		bStop = NotifyAction(pNDC, snapshot.GetFileInformation(nEntry), faChange);
+	}
+
+	// files synced before that are gone now
+	if (!bSeed && !bStop && (nFound < pSyncIndex->GetCount()))
+	{
+		for (const CString& csPath : pSyncIndex->GetFilePaths())
+		{
+			if (GetFileAttributes(csPath) != INVALID_FILE_ATTRIBUTES)
+				continue;
+
+			WIN32_FIND_DATA fd;
+			CFileInformation fi;
+			ZeroMemory(&fd, sizeof(fd));
+			_tcscpy_s(fd.cFileName, MAX_PATH, CFileInformation::GetFileName(csPath));
+			fi.SetFileData(fd);
+			fi.SetFileDir(CFileInformation::GetFileDirectory(csPath));
+
+			nChanged++;
+			pSyncIndex->Remove(csPath);
+			if ((bStop = NotifyAction(pNDC, fi, faDelete)) != FALSE)
+				break;//to end
+		}
+	}
+
+	pSyncIndex->Flush();
+	TRACE(_T("[NotifyDirThread] %s sync index, %u files, %u changed since the last run\n"),
+		bSeed ? _T("new") : _T("existing"), pSyncIndex->GetCount(), nChanged);
+
+	return bStop;
+}
+
 //////////////////////////////////////////////////////////////////////
 // Work Thread 
 //////////////////////////////////////////////////////////////////////
@@ -82,44 +415,81 @@ UINT NotifyDirThread(LPVOID pParam)
 
 	CNotifyDirCheck *pNDC = (CNotifyDirCheck *)pParam;
 
-	FI_List newFIL,
-		oldFIL;
+	CFileSnapshot oldSnapshot;
 
-	FI_List fileList;
+	PENDING_CHANGES pending;
 
-	EFileAction faAction;
+	BOOL bSnapshot = FALSE;
 
-	CFileInformation fi;
+	OVERLAPPED ovRead;
 
+	DWORD dwBytes = 0;
 
-	if (pNDC == nullptr)
-		return(0);
+	// change records are DWORD aligned; 64 KB is the limit for directories on network shares
+	std::vector<DWORD> pBuffer(NOTIFICATION_BUFFER_SIZE / sizeof(DWORD));
 
-	hDir = FindFirstChangeNotification(pNDC->GetDirectory(),
-		TRUE,
-		FILE_NOTIFY_CHANGE_FILE_NAME |
+	const DWORD dwFilter = FILE_NOTIFY_CHANGE_FILE_NAME |
 		FILE_NOTIFY_CHANGE_DIR_NAME |
 		FILE_NOTIFY_CHANGE_SIZE |
 		FILE_NOTIFY_CHANGE_LAST_WRITE |
-		FILE_NOTIFY_CHANGE_ATTRIBUTES
-	);
+		FILE_NOTIFY_CHANGE_ATTRIBUTES;
+
+
+	if (pNDC == nullptr)
+		return(0);
+
+	hDir = CreateFile(pNDC->GetDirectory(),
+		FILE_LIST_DIRECTORY,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		nullptr,
+		OPEN_EXISTING,
+		FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED,
+		nullptr);
 
 	if (hDir == INVALID_HANDLE_VALUE)
 	{
-		ErrorMessage(_T("FindFirstChangeNotification"));
+		ErrorMessage(_T("CreateFile"));
+		return(0);
+	}
+
+	ZeroMemory(&ovRead, sizeof(ovRead));
+	ovRead.hEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+
+	if (ovRead.hEvent == nullptr)
+	{
+		ErrorMessage(_T("CreateEvent"));
+		CloseHandle(hDir);
 		return(0);
 	}
 
 	while (pNDC->IsRun())
 	{
-		CFileInformation::RemoveFiles(&oldFIL);
-		CFileInformation::EnumFiles(pNDC->GetDirectory(), &oldFIL);
+		if (!ReadDirectoryChangesW(hDir, pBuffer.data(), NOTIFICATION_BUFFER_SIZE, TRUE, dwFilter, nullptr, &ovRead, nullptr))
+		{
+			ErrorMessage(_T("ReadDirectoryChangesW"));
+			break;
+		}
 
-		bStop = FALSE;
+		// the first request is queued before the tree is walked, so no change falls between the two
+		if (!bSnapshot)
+		{
+			CFileInformation::EnumFiles(pNDC->GetDirectory(), &oldSnapshot, pNDC->GetScanThreads());
+			bSnapshot = TRUE;
+			TRACE(_T("[NotifyDirThread] snapshot of %u entries, %zu bytes per entry\n"), oldSnapshot.GetCount(),
+				oldSnapshot.GetMemorySize() / max(oldSnapshot.GetCount(), 1u));
+			bStop = ReconcileIndex(pNDC, oldSnapshot);
+			pNDC->SetReady(TRUE);
+			if (bStop)
+			{
+				CancelIo(hDir);
+				GetOverlappedResult(hDir, &ovRead, &dwBytes, TRUE);
+				break;//to end
+			}
+		}
 
-		while (WaitForSingleObject(hDir, WAIT_TIMEOUT) != WAIT_OBJECT_0)
+		while (WaitForSingleObject(ovRead.hEvent, GetWaitTime(pending)) != WAIT_OBJECT_0)
 		{
-			if (!pNDC->IsRun())
+			if (!pNDC->IsRun() || FlushActions(pNDC, oldSnapshot, pending))
 			{
 				bStop = TRUE;//to end
 				break;
@@ -127,55 +497,63 @@ UINT NotifyDirThread(LPVOID pParam)
 		}
 
 		if (bStop)
+		{
+			CancelIo(hDir);
+			GetOverlappedResult(hDir, &ovRead, &dwBytes, TRUE);
 			break;//to end
+		}
 
-		Sleep(WAIT_TIMEOUT);
-
-		CFileInformation::RemoveFiles(&newFIL);
-		CFileInformation::EnumFiles(pNDC->GetDirectory(), &newFIL);
-
-		// Sleep( WAIT_TIMEOUT);
+		if (!GetOverlappedResult(hDir, &ovRead, &dwBytes, FALSE))
+		{
+			if (GetLastError() != ERROR_NOTIFY_ENUM_DIR)
+			{
+				ErrorMessage(_T("ReadDirectoryChangesW"));
+				break;
+			}
+			dwBytes = 0;
+		}
 
-		// faAction = CFileInformation::CompareFiles( &oldFIL, &newFIL, fi);
-		faAction = CFileInformation::CompareFiles(&oldFIL, &newFIL, &fileList);
+		ResetEvent(ovRead.hEvent);
 
-		if (!IS_NOTACT_FILE(faAction))
+		// no records means the buffer overflowed: fall back to walking the tree
+		if (dwBytes == 0)
 		{
-			NOTIFICATION_CALLBACK_PTR ncpAction = pNDC->GetActionCallback();
+			TRACE(_T("[NotifyDirThread] change records overflowed, rescanning\n"));
+			RescanDirectory(pNDC, oldSnapshot, pending);
+			continue;
+		}
 
-			POSITION fileListPos = nullptr;
+		PFILE_NOTIFY_INFORMATION pRecord = (PFILE_NOTIFY_INFORMATION)pBuffer.data();
+		DWORD dwLastAction = 0;
+		CString csLastName;
 
-			fileListPos = fileList.GetHeadPosition();
+		for (;;)
+		{
+			CString csName(pRecord->FileName, pRecord->FileNameLength / sizeof(WCHAR));
 
-			while (fileListPos)
+			// a save usually reports the same file several times in a row
+			if ((pRecord->Action != dwLastAction) || (csName.Compare(csLastName) != 0))
 			{
-				fi = fileList.GetAt(fileListPos);
+				ApplyRecord(oldSnapshot, pending, pRecord->Action, CFileInformation::ConcPath(pNDC->GetDirectory(), csName));
 
-				if (ncpAction) //call user's callback
-					bStop = (ncpAction(fi, faAction, pNDC->GetData()) > 0);
-
-				else //call user's virtual function
-					bStop = (pNDC->Action(fi, faAction) > 0);
+				dwLastAction = pRecord->Action;
+				csLastName = csName;
+			}
 
-				if (bStop)
-					break;//to end
+			if (pRecord->NextEntryOffset == 0)
+				break;
 
-				fileList.GetNext(fileListPos);
-			}
+			pRecord = (PFILE_NOTIFY_INFORMATION)((LPBYTE)pRecord + pRecord->NextEntryOffset);
 		}
 
-		if (FindNextChangeNotification(hDir) == 0)
-		{
-			ErrorMessage(_T("FindNextChangeNotification"));
-			return(0);
-		}
+		if (FlushActions(pNDC, oldSnapshot, pending))
+			break;//to end
 	}
 
 	//end point of notification thread
-	CFileInformation::RemoveFiles(&newFIL);
-	CFileInformation::RemoveFiles(&oldFIL);
+	CloseHandle(ovRead.hEvent);
 
-	return FindCloseChangeNotification(hDir);
+	return CloseHandle(hDir);
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -187,7 +565,10 @@ CNotifyDirCheck::CNotifyDirCheck()
 	SetDirectory(_T(""));
 	SetActionCallback(nullptr);
 	SetData(nullptr);
+	SetScanThreads(0);
+	SetSyncIndex(nullptr);
 	SetStop();
+	SetReady(FALSE);
 	m_pThread = nullptr;
 }
 
@@ -196,7 +577,10 @@ CNotifyDirCheck::CNotifyDirCheck(CString csDir, NOTIFICATION_CALLBACK_PTR ncpAct
 	SetDirectory(csDir);
 	SetActionCallback(ncpAction);
 	SetData(lpData);
+	SetScanThreads(0);
+	SetSyncIndex(nullptr);
 	SetStop();
+	SetReady(FALSE);
 	m_pThread = nullptr;
 }
 
@@ -211,6 +595,7 @@ BOOL CNotifyDirCheck::Run()
 		return FALSE;
 
 	SetRun();
+	SetReady(FALSE);
 	m_pThread = AfxBeginThread(NotifyDirThread, this);
 
 	if (m_pThread == nullptr)
@@ -15,12 +15,17 @@
 
 #include "FileInformation.h"	// for file information class
 
+class CSyncIndex;
+
 typedef UINT NOTIFICATION_CALLBACK(CFileInformation fiObject, EFileAction faAction, LPVOID lpData);
 typedef NOTIFICATION_CALLBACK* NOTIFICATION_CALLBACK_PTR;
 
 UINT NotifyDirThread(LPVOID pParam);
 
 #define NOTIFICATION_TIMEOUT 1000
+#define NOTIFICATION_BUFFER_SIZE 0x10000
+#define NOTIFICATION_QUIET_PERIOD 500  // A file is reported once no record named it for this long (ms)
+#define NOTIFICATION_MAX_DELAY 10000    // ...or once it has waited this long, for files that are written all the time (ms)
 
 class CNotifyDirCheck : public CObject
 {
@@ -35,7 +40,13 @@ public:
 	void                            SetDirectory(CString csDir) { m_csDir = csDir; }
 	LPVOID                          GetData() const { return m_lpData; }
 	void                            SetData(LPVOID lpData) { m_lpData = lpData; }
+	int                             GetScanThreads() const { return m_nScanThreads; }
+	void                            SetScanThreads(int nScanThreads) { m_nScanThreads = nScanThreads; }
+	CSyncIndex*                     GetSyncIndex() const { return m_pSyncIndex; }
+	void                            SetSyncIndex(CSyncIndex* pSyncIndex) { m_pSyncIndex = pSyncIndex; }
 	BOOL                            IsRun() const { return m_isRun; }
+	BOOL                            IsReady() const { return m_isReady; }
+	void                            SetReady(BOOL isReady) { m_isReady = isReady; }
 	BOOL                            Run();
 	void                            Stop();
 
@@ -51,7 +62,10 @@ protected:
 	CWinThread*               m_pThread;
 	CString                   m_csDir;
 	BOOL                      m_isRun;
+	BOOL                      m_isReady;      // The first walk is done and compared with the sync index
 	LPVOID					  m_lpData;
+	int                       m_nScanThreads; // Threads that walk the tree, 0 for one per processor
+	CSyncIndex*               m_pSyncIndex;   // Files synced before this run, nullptr to report nothing at start
 };
 
 #endif // !defined(AFX_NOTIFYDIRCHECK_H__44DFE393_51AF_42C2_BA07_A1628BDA25FC__INCLUDED_)
@@ -0,0 +1,449 @@
+/* Copyright (C) 2022-2026 Stefan-Mihai MOGA
+This file is part of IntelliDisk application developed by Stefan-Mihai MOGA.
+IntelliDisk is an alternative Windows version to the famous Microsoft OneDrive!
+
+IntelliDisk is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the Open
+Source Initiative, either version 3 of the License, or any later version.
+
+IntelliDisk is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+IntelliDisk. If not, see <http://www.opensource.org/licenses/gpl-3.0.html>*/
+
+#include "pch.h"
+#include "SyncIndex.h"
+#include "FileSnapshot.h"
+#include "SHA256.h"
+
+#ifdef _DEBUG
+#undef THIS_FILE
+static char THIS_FILE[] = __FILE__;
+#define new DEBUG_NEW
+#endif
+
+/**
+ * @brief Bytes of an index file with the given table and pool
+ */
+static ULONGLONG GetIndexSize(const DWORD nCapacity, const DWORD nPoolSize)
+{
+	return sizeof(SYNC_INDEX_HEADER) + (ULONGLONG)nCapacity * sizeof(SYNC_INDEX_ENTRY) + (ULONGLONG)nPoolSize * sizeof(TCHAR);
+}
+
+CSyncIndex::CSyncIndex()
+{
+	InitializeSRWLock(&m_pLock);
+	m_hFile = INVALID_HANDLE_VALUE;
+	m_hMapping = nullptr;
+	m_pHeader = nullptr;
+}
+
+CSyncIndex::~CSyncIndex()
+{
+	Close();
+}
+
+/**
+ * @brief Opens the index file, or starts a new one when it is missing or not valid
+ * @param lpszFileName The index file
+ * @param bCreated [out] TRUE if the index starts empty
+ * @return TRUE on success, FALSE otherwise
+ */
+BOOL CSyncIndex::Open(LPCTSTR lpszFileName, BOOL& bCreated)
+{
+	AcquireSRWLockExclusive(&m_pLock);
+	Unmap();
+	bCreated = FALSE;
+	m_hFile = CreateFile(lpszFileName, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (m_hFile == INVALID_HANDLE_VALUE)
+	{
+		TRACE(_T("[CSyncIndex] CreateFile failed with %lu\n"), GetLastError());
+		ReleaseSRWLockExclusive(&m_pLock);
+		return FALSE;
+	}
+	LARGE_INTEGER nFileSize = { 0 };
+	BOOL bResult = GetFileSizeEx(m_hFile, &nFileSize) && ((ULONGLONG)nFileSize.QuadPart >= sizeof(SYNC_INDEX_HEADER)) &&
+		Map(0, 0, FALSE);
+	// the header must describe a file that fits
+	if (bResult && ((m_pHeader->dwSignature != SYNC_INDEX_SIGNATURE) || (m_pHeader->dwVersion != SYNC_INDEX_VERSION) ||
+		(m_pHeader->nCapacity == 0) || ((m_pHeader->nCapacity & (m_pHeader->nCapacity - 1)) != 0) ||
+		(m_pHeader->nPoolUsed > m_pHeader->nPoolSize) || (m_pHeader->nUsed >= m_pHeader->nCapacity) ||
+		(GetIndexSize(m_pHeader->nCapacity, m_pHeader->nPoolSize) > (ULONGLONG)nFileSize.QuadPart)))
+	{
+		TRACE(_T("[CSyncIndex] %s is not valid, starting a new index\n"), lpszFileName);
+		bResult = FALSE;
+	}
+	if (!bResult)
+	{
+		bCreated = TRUE;
+		bResult = Map(SYNC_INDEX_MIN_CAPACITY, SYNC_INDEX_MIN_POOL, TRUE);
+	}
+	if (!bResult)
+	{
+		Unmap();
+		if (m_hFile != INVALID_HANDLE_VALUE)
+		{
+			VERIFY(CloseHandle(m_hFile));
+			m_hFile = INVALID_HANDLE_VALUE;
+		}
+	}
+	ReleaseSRWLockExclusive(&m_pLock);
+	return bResult;
+}
+
+void CSyncIndex::Close()
+{
+	AcquireSRWLockExclusive(&m_pLock);
+	if (m_pHeader != nullptr)
+		VERIFY(FlushViewOfFile(m_pHeader, 0));
+	Unmap();
+	if (m_hFile != INVALID_HANDLE_VALUE)
+	{
+		VERIFY(CloseHandle(m_hFile));
+		m_hFile = INVALID_HANDLE_VALUE;
+	}
+	ReleaseSRWLockExclusive(&m_pLock);
+}
+
+/**
+ * @brief Writes the changed pages to disk, so a crash loses nothing before this point
+ */
+void CSyncIndex::Flush()
+{
+	AcquireSRWLockShared(&m_pLock);
+	if (m_pHeader != nullptr)
+		VERIFY(FlushViewOfFile(m_pHeader, 0));
+	ReleaseSRWLockShared(&m_pLock);
+}
+
+/**
+ * @brief Maps the index file into memory
+ * @param nCapacity Slots of a new table (bInitialize)
+ * @param nPoolSize Path characters of a new pool (bInitialize)
+ * @param bInitialize TRUE to size the file for an empty table, FALSE to map the file as it is
+ * @return TRUE on success, FALSE otherwise
+ */
+BOOL CSyncIndex::Map(DWORD nCapacity, DWORD nPoolSize, BOOL bInitialize)
+{
+	const ULONGLONG nSize = bInitialize ? GetIndexSize(nCapacity, nPoolSize) : 0;
+	// a mapping larger than the file extends it
+	m_hMapping = CreateFileMapping(m_hFile, nullptr, PAGE_READWRITE, (DWORD)(nSize >> 32), (DWORD)nSize, nullptr);
+	if (m_hMapping == nullptr)
+	{
+		TRACE(_T("[CSyncIndex] CreateFileMapping failed with %lu\n"), GetLastError());
+		return FALSE;
+	}
+	m_pHeader = (SYNC_INDEX_HEADER*)MapViewOfFile(m_hMapping, FILE_MAP_ALL_ACCESS, 0, 0, (SIZE_T)nSize);
+	if (m_pHeader == nullptr)
+	{
+		TRACE(_T("[CSyncIndex] MapViewOfFile failed with %lu\n"), GetLastError());
+		VERIFY(CloseHandle(m_hMapping));
+		m_hMapping = nullptr;
+		return FALSE;
+	}
+	if (bInitialize)
+	{
+		ZeroMemory(m_pHeader, (SIZE_T)nSize);
+		m_pHeader->dwSignature = SYNC_INDEX_SIGNATURE;
+		m_pHeader->dwVersion = SYNC_INDEX_VERSION;
+		m_pHeader->nCapacity = nCapacity;
+		m_pHeader->nPoolSize = nPoolSize;
+	}
+	return TRUE;
+}
+
+void CSyncIndex::Unmap()
+{
+	if (m_pHeader != nullptr)
+	{
+		VERIFY(UnmapViewOfFile(m_pHeader));
+		m_pHeader = nullptr;
+	}
+	if (m_hMapping != nullptr)
+	{
+		VERIFY(CloseHandle(m_hMapping));
+		m_hMapping = nullptr;
+	}
+}
+
+/**
+ * @brief Rebuilds the table in a larger file, dropping the removed slots and their paths
+ * @param nPathLength Characters of the path about to be added
+ * @return TRUE on success, FALSE otherwise
+ */
+BOOL CSyncIndex::Grow(DWORD nPathLength)
+{
+	std::vector<SYNC_INDEX_ENTRY> pEntries;
+	std::vector<CString> pPaths;
+	pEntries.reserve(m_pHeader->nCount);
+	pPaths.reserve(m_pHeader->nCount);
+	ULONGLONG nPoolNeeded = nPathLength;
+	for (DWORD nSlot = 0; nSlot < m_pHeader->nCapacity; nSlot++)
+	{
+		const SYNC_INDEX_ENTRY& pEntry = GetTable()[nSlot];
+		if ((pEntry.dwFlags & SYNC_ENTRY_USED) == 0)
+			continue;
+		pEntries.push_back(pEntry);
+		pPaths.push_back(CString(GetPool() + pEntry.nPathOffset, (int)pEntry.nPathLength));
+		nPoolNeeded += pEntry.nPathLength;
+	}
+	DWORD nCapacity = max(m_pHeader->nCapacity, (DWORD)SYNC_INDEX_MIN_CAPACITY);
+	while ((ULONGLONG)(pEntries.size() + 1) * 2 > nCapacity)
+		nCapacity *= 2;
+	DWORD nPoolSize = max(m_pHeader->nPoolSize, (DWORD)SYNC_INDEX_MIN_POOL);
+	while (nPoolNeeded > nPoolSize)
+		nPoolSize *= 2;
+	TRACE(_T("[CSyncIndex] %u files, %u slots, %u path characters\n"), (DWORD)pEntries.size(), nCapacity, nPoolSize);
+
+	Unmap();
+	if (!Map(nCapacity, nPoolSize, TRUE))
+		return FALSE;
+	for (size_t nIndex = 0; nIndex < pEntries.size(); nIndex++)
+	{
+		SYNC_INDEX_ENTRY* pFree = nullptr;
+		Lookup(pPaths[nIndex], pEntries[nIndex].nPathLength, pEntries[nIndex].nPathHash, &pFree);
+		*pFree = pEntries[nIndex];
+		pFree->nPathOffset = m_pHeader->nPoolUsed;
+		CopyMemory(GetPool() + m_pHeader->nPoolUsed, (LPCTSTR)pPaths[nIndex], pEntries[nIndex].nPathLength * sizeof(TCHAR));
+		m_pHeader->nPoolUsed += pEntries[nIndex].nPathLength;
+		m_pHeader->nCount++;
+		m_pHeader->nUsed++;
+	}
+	return TRUE;
+}
+
+/**
+ * @brief Finds the slot of a path
+ * @param lpszPath The path
+ * @param nPathLength Characters of the path
+ * @param nPathHash Hash of the path
+ * @param pFree [out] Slot to store the path in when it is missing (optional)
+ * @return The slot, or nullptr when the path is missing
+ */
+SYNC_INDEX_ENTRY* CSyncIndex::Lookup(LPCTSTR lpszPath, DWORD nPathLength, ULONGLONG nPathHash, SYNC_INDEX_ENTRY** pFree)
+{
+	const DWORD nMask = m_pHeader->nCapacity - 1;
+	SYNC_INDEX_ENTRY* pTable = GetTable();
+	if (pFree != nullptr)
+		*pFree = nullptr;
+	// less than half of the slots are taken, so the probe ends on an empty one
+	for (DWORD nSlot = (DWORD)nPathHash & nMask, nStep = 0; nStep < m_pHeader->nCapacity; nSlot = (nSlot + 1) & nMask, nStep++)
+	{
+		SYNC_INDEX_ENTRY* pEntry = &pTable[nSlot];
+		if (pEntry->dwFlags == 0)
+		{
+			if ((pFree != nullptr) && (*pFree == nullptr))
+				*pFree = pEntry;
+			return nullptr;
+		}
+		if ((pEntry->dwFlags & SYNC_ENTRY_REMOVED) != 0)
+		{
+			if ((pFree != nullptr) && (*pFree == nullptr))
+				*pFree = pEntry;
+			continue;
+		}
+		if ((pEntry->nPathHash == nPathHash) && (pEntry->nPathLength == nPathLength) &&
+			((ULONGLONG)pEntry->nPathOffset + pEntry->nPathLength <= m_pHeader->nPoolUsed) &&
+			(_tcsnicmp(GetPool() + pEntry->nPathOffset, lpszPath, nPathLength) == 0))
+			return pEntry;
+	}
+	return nullptr;
+}
+
+/**
+ * @brief Reads what was last synced for a file
+ * @param path The full path
+ * @param nPathHash Hash of the path (CFileSnapshot::HashPath)
+ * @param pEntry [out] Copy of the slot
+ * @return TRUE if the file is in the index, FALSE otherwise
+ */
+BOOL CSyncIndex::Find(const CString& path, ULONGLONG nPathHash, SYNC_INDEX_ENTRY& pEntry)
+{
+	BOOL bResult = FALSE;
+	AcquireSRWLockShared(&m_pLock);
+	if (m_pHeader != nullptr)
+	{
+		const SYNC_INDEX_ENTRY* pFound = Lookup(path, path.GetLength(), nPathHash, nullptr);
+		if (pFound != nullptr)
+		{
+			pEntry = *pFound;
+			bResult = TRUE;
+		}
+	}
+	ReleaseSRWLockShared(&m_pLock);
+	return bResult;
+}
+
+BOOL CSyncIndex::Find(const CString& path, SYNC_INDEX_ENTRY& pEntry)
+{
+	return Find(path, CFileSnapshot::HashPath(path, path.GetLength()), pEntry);
+}
+
+/**
+ * @brief Records that a file was synced
+ * @param path The full path
+ * @param nFileSize Its size
+ * @param nLastWriteTime Its last write time after the transfer
+ * @param pContentHash SHA256 of the whole file, nullptr when unknown
+ * @param nVersion Version on the server, 0 when unknown
+ * @return TRUE on success, FALSE otherwise
+ */
+BOOL CSyncIndex::Update(const CString& path, ULONGLONG nFileSize, ULONGLONG nLastWriteTime, const SYNC_HASH* pContentHash, ULONGLONG nVersion)
+{
+	const DWORD nPathLength = (DWORD)path.GetLength();
+	const ULONGLONG nPathHash = CFileSnapshot::HashPath(path, nPathLength);
+	AcquireSRWLockExclusive(&m_pLock);
+	if (m_pHeader == nullptr)
+	{
+		ReleaseSRWLockExclusive(&m_pLock);
+		return FALSE;
+	}
+	SYNC_INDEX_ENTRY* pFree = nullptr;
+	SYNC_INDEX_ENTRY* pEntry = Lookup(path, nPathLength, nPathHash, &pFree);
+	if (pEntry == nullptr)
+	{
+		if ((((ULONGLONG)m_pHeader->nUsed + 1) * 2 > m_pHeader->nCapacity) ||
+			((ULONGLONG)m_pHeader->nPoolUsed + nPathLength > m_pHeader->nPoolSize))
+		{
+			if (!Grow(nPathLength))
+			{
+				ReleaseSRWLockExclusive(&m_pLock);
+				return FALSE;
+			}
+			Lookup(path, nPathLength, nPathHash, &pFree);
+		}
+		pEntry = pFree;
+		if (pEntry->dwFlags == 0)
+			m_pHeader->nUsed++;
+		m_pHeader->nCount++;
+		ZeroMemory(pEntry, sizeof(SYNC_INDEX_ENTRY));
+		pEntry->nPathHash = nPathHash;
+		pEntry->nPathOffset = m_pHeader->nPoolUsed;
+		pEntry->nPathLength = nPathLength;
+		CopyMemory(GetPool() + m_pHeader->nPoolUsed, (LPCTSTR)path, nPathLength * sizeof(TCHAR));
+		m_pHeader->nPoolUsed += nPathLength;
+	}
+	pEntry->nFileSize = nFileSize;
+	pEntry->nLastWriteTime = nLastWriteTime;
+	pEntry->nVersion = nVersion;
+	pEntry->dwFlags = SYNC_ENTRY_USED;
+	if (pContentHash != nullptr)
+	{
+		pEntry->pContentHash = *pContentHash;
+		pEntry->dwFlags |= SYNC_ENTRY_HASHED;
+	}
+	ReleaseSRWLockExclusive(&m_pLock);
+	return TRUE;
+}
+
+/**
+ * @brief Forgets a file that was deleted
+ * @param path The full path
+ * @return TRUE if the file was in the index, FALSE otherwise
+ */
+BOOL CSyncIndex::Remove(const CString& path)
+{
+	const DWORD nPathLength = (DWORD)path.GetLength();
+	const ULONGLONG nPathHash = CFileSnapshot::HashPath(path, nPathLength);
+	BOOL bResult = FALSE;
+	AcquireSRWLockExclusive(&m_pLock);
+	if (m_pHeader != nullptr)
+	{
+		SYNC_INDEX_ENTRY* pEntry = Lookup(path, nPathLength, nPathHash, nullptr);
+		if (pEntry != nullptr)
+		{
+			// the slot stays taken, so the probe sequences through it still reach the paths after it
+			pEntry->dwFlags = SYNC_ENTRY_REMOVED;
+			m_pHeader->nCount--;
+			bResult = TRUE;
+		}
+	}
+	ReleaseSRWLockExclusive(&m_pLock);
+	return bResult;
+}
+
+/**
+ * @brief Tells whether a file still has the size and last write time it was synced with
+ * @param path The full path
+ * @return TRUE if the file is in the index and its metadata did not change, FALSE otherwise
+ */
+BOOL CSyncIndex::IsUnchanged(const CString& path)
+{
+	ULONGLONG nFileSize = 0, nLastWriteTime = 0;
+	SYNC_INDEX_ENTRY pEntry;
+	return GetFileMetadata(path, nFileSize, nLastWriteTime) && Find(path, pEntry) &&
+		(pEntry.nFileSize == nFileSize) && (pEntry.nLastWriteTime == nLastWriteTime);
+}
+
+/**
+ * @brief Lists the files in the index
+ * @return Their full paths
+ */
+std::vector<CString> CSyncIndex::GetFilePaths()
+{
+	std::vector<CString> pPaths;
+	AcquireSRWLockShared(&m_pLock);
+	if (m_pHeader != nullptr)
+	{
+		pPaths.reserve(m_pHeader->nCount);
+		for (DWORD nSlot = 0; nSlot < m_pHeader->nCapacity; nSlot++)
+		{
+			const SYNC_INDEX_ENTRY& pEntry = GetTable()[nSlot];
+			if (((pEntry.dwFlags & SYNC_ENTRY_USED) != 0) &&
+				((ULONGLONG)pEntry.nPathOffset + pEntry.nPathLength <= m_pHeader->nPoolUsed))
+				pPaths.push_back(CString(GetPool() + pEntry.nPathOffset, (int)pEntry.nPathLength));
+		}
+	}
+	ReleaseSRWLockShared(&m_pLock);
+	return pPaths;
+}
+
+/**
+ * @brief Computes the SHA256 of a whole file
+ * @param path The full path
+ * @param pContentHash [out] The hash
+ * @return TRUE on success, FALSE if the file could not be read
+ */
+BOOL CSyncIndex::HashFile(const CString& path, SYNC_HASH& pContentHash)
+{
+	SHA256 pSHA256;
+	std::vector<uint8_t> pBuffer(0x10000);
+	try
+	{
+		CFile pBinaryFile(path, CFile::modeRead | CFile::shareDenyWrite | CFile::typeBinary);
+		UINT nCount = 0;
+		while ((nCount = pBinaryFile.Read(pBuffer.data(), (UINT)pBuffer.size())) > 0)
+			pSHA256.update(pBuffer.data(), nCount);
+		pBinaryFile.Close();
+	}
+	catch (CFileException* pException)
+	{
+		const int nErrorLength = 0x100;
+		TCHAR lpszErrorMessage[nErrorLength] = { 0, };
+		pException->GetErrorMessage(lpszErrorMessage, nErrorLength);
+		TRACE(_T("%s\n"), lpszErrorMessage);
+		pException->Delete();
+		return FALSE;
+	}
+	pContentHash = pSHA256.digest();
+	return TRUE;
+}
+
+/**
+ * @brief Reads the size and last write time of a file, in the form the index keeps them
+ * @param path The full path
+ * @param nFileSize [out] Size in bytes
+ * @param nLastWriteTime [out] Last write time (FILETIME as one number)
+ * @return TRUE on success, FALSE if the file is missing
+ */
+BOOL CSyncIndex::GetFileMetadata(const CString& path, ULONGLONG& nFileSize, ULONGLONG& nLastWriteTime)
+{
+	WIN32_FILE_ATTRIBUTE_DATA pFileData = { 0, };
+	if (!GetFileAttributesEx(path, GetFileExInfoStandard, &pFileData))
+		return FALSE;
+	nFileSize = ((ULONGLONG)pFileData.nFileSizeHigh << 32) | pFileData.nFileSizeLow;
+	nLastWriteTime = ((ULONGLONG)pFileData.ftLastWriteTime.dwHighDateTime << 32) | pFileData.ftLastWriteTime.dwLowDateTime;
+	return TRUE;
+}
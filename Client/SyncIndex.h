@@ -0,0 +1,109 @@
+/* Copyright (C) 2022-2026 Stefan-Mihai MOGA
+This file is part of IntelliDisk application developed by Stefan-Mihai MOGA.
+IntelliDisk is an alternative Windows version to the famous Microsoft OneDrive!
+
+IntelliDisk is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the Open
+Source Initiative, either version 3 of the License, or any later version.
+
+IntelliDisk is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+IntelliDisk. If not, see <http://www.opensource.org/licenses/gpl-3.0.html>*/
+
+#pragma once
+
+#ifndef __SYNCINDEX_H__
+#define __SYNCINDEX_H__
+
+#include <array>
+#include <vector>
+
+#define SYNC_INDEX_SIGNATURE 0x58444953 // "SIDX"
+#define SYNC_INDEX_VERSION 1
+#define SYNC_INDEX_MIN_CAPACITY 0x400   // Slots of a new index
+#define SYNC_INDEX_MIN_POOL 0x10000     // Path characters of a new index
+
+#define SYNC_ENTRY_USED 0x01     // The slot holds a file
+#define SYNC_ENTRY_REMOVED 0x02  // The file was removed, the slot keeps the probe sequence going
+#define SYNC_ENTRY_HASHED 0x04   // pContentHash is the SHA256 of the whole file
+
+typedef std::array<uint8_t, 32> SYNC_HASH; // SHA256 of a file
+
+/**
+ * @brief Start of the index file
+ */
+typedef struct {
+	DWORD dwSignature;  // SYNC_INDEX_SIGNATURE
+	DWORD dwVersion;    // SYNC_INDEX_VERSION
+	DWORD nCapacity;    // Slots in the table (power of two)
+	DWORD nCount;       // Files in the table
+	DWORD nUsed;        // Files and removed slots in the table
+	DWORD nPoolSize;    // Characters in the path pool
+	DWORD nPoolUsed;    // Characters taken from the path pool
+	DWORD dwReserved;
+} SYNC_INDEX_HEADER;
+
+/**
+ * @brief One slot of the index table: what the client last synced for a file
+ */
+typedef struct {
+	ULONGLONG nPathHash;       // Hash of the upper-case path, the same as CFileSnapshot's
+	ULONGLONG nFileSize;       // Size in bytes
+	ULONGLONG nLastWriteTime;  // Last write time (FILETIME as one number)
+	ULONGLONG nVersion;        // Version on the server, 0 when unknown
+	DWORD nPathOffset;         // First character of the path in the pool
+	DWORD nPathLength;         // Characters of the path
+	DWORD dwFlags;             // SYNC_ENTRY_USED, SYNC_ENTRY_REMOVED, SYNC_ENTRY_HASHED
+	DWORD dwReserved;
+	SYNC_HASH pContentHash;    // SHA256 of the file (SYNC_ENTRY_HASHED)
+} SYNC_INDEX_ENTRY;
+
+/**
+ * @brief Persistent record of the files the client synced, one per synced root.
+ *        The file is mapped into memory: a header, an open-addressing table of SYNC_INDEX_ENTRY slots keyed
+ *        by path hash and a pool of path characters. Lookups and updates touch only the slots they need,
+ *        so a start with nothing changed compares the folder against the index without reading any file
+ *        and without sending anything to the server. The table is rebuilt in a larger file when it gets half full.
+ *        All members may be called from any thread.
+ */
+class CSyncIndex
+{
+public:
+	CSyncIndex();
+	virtual ~CSyncIndex();
+
+	BOOL Open(LPCTSTR lpszFileName, BOOL& bCreated);
+	void Close();
+	void Flush();
+	BOOL IsOpen() const { return m_pHeader != nullptr; }
+	DWORD GetCount() const { return (m_pHeader != nullptr) ? m_pHeader->nCount : 0; }
+
+	BOOL Find(const CString& path, ULONGLONG nPathHash, SYNC_INDEX_ENTRY& pEntry);
+	BOOL Find(const CString& path, SYNC_INDEX_ENTRY& pEntry);
+	BOOL Update(const CString& path, ULONGLONG nFileSize, ULONGLONG nLastWriteTime, const SYNC_HASH* pContentHash, ULONGLONG nVersion);
+	BOOL Remove(const CString& path);
+	BOOL IsUnchanged(const CString& path);
+	std::vector<CString> GetFilePaths();
+
+	static BOOL HashFile(const CString& path, SYNC_HASH& pContentHash);
+	static BOOL GetFileMetadata(const CString& path, ULONGLONG& nFileSize, ULONGLONG& nLastWriteTime);
+
+protected:
+	BOOL Map(DWORD nCapacity, DWORD nPoolSize, BOOL bInitialize);
+	void Unmap();
+	BOOL Grow(DWORD nPathLength);
+	SYNC_INDEX_ENTRY* Lookup(LPCTSTR lpszPath, DWORD nPathLength, ULONGLONG nPathHash, SYNC_INDEX_ENTRY** pFree);
+	SYNC_INDEX_ENTRY* GetTable() const { return (SYNC_INDEX_ENTRY*)(m_pHeader + 1); }
+	TCHAR* GetPool() const { return (TCHAR*)(GetTable() + m_pHeader->nCapacity); }
+
+protected:
+	SRWLOCK            m_pLock;
+	HANDLE             m_hFile;
+	HANDLE             m_hMapping;
+	SYNC_INDEX_HEADER* m_pHeader;
+};
+
+#endif // __SYNCINDEX_H__
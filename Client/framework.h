@@ -102,6 +102,7 @@ IntelliDisk. If not, see <http://www.opensource.org/licenses/gpl-3.0.html>*/
 #define CWSOCKET_MFC_EXTENSIONS
 
 // Protocol control characters for communication handshake
+#define SOH 0x01  // Start of Header - marks the beginning of an extended data frame
 #define STX 0x02  // Start of Text - marks the beginning of a data packet
 #define ETX 0x03  // End of Text - marks the end of a data packet
 #define EOT 0x04  // End of Transmission - signals end of communication
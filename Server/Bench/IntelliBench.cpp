@@ -0,0 +1,3682 @@
+/* Copyright (C) 2022-2026 Stefan-Mihai MOGA
+This file is part of IntelliDisk application developed by Stefan-Mihai MOGA.
+IntelliDisk is an alternative Windows version to the famous Microsoft OneDrive!
+
+IntelliDisk is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the Open
+Source Initiative, either version 3 of the License, or any later version.
+
+IntelliDisk is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+IntelliDisk. If not, see <http://www.opensource.org/licenses/gpl-3.0.html>*/
+
+/**
+ * @file IntelliBench.cpp
+ * @brief Console load test and benchmarks for the IntelliDisk server
+ * @details Logs in many clients with the legacy handshake, then times "Ping" while
+ *          slow downloads keep the transfer pool busy, and broadcasts to subscribers while
+ *          one of them stalls; measures transfers through a
+ *          delay relay and into the store; holds an upload open during a schema
+ *          migration; replays edit bursts through the server's notification queue;
+ *          checks and times the data-path algorithms shared with the
+ *          server, the client's snapshot code, tree walk, watcher and sync index (see README.md)
+ */
+
+#include "pch.h"
+#include "../../Client/FileSnapshot.h"
+#include "../../Client/NotifyDirCheck.h"
+#include "../../Client/SyncIndex.h"
+#include "../CRC32C.h"
+#include "../Chunker.h"
+#include "../IntelliDiskINI.h"
+#include "../IntelliDiskProtocol.h"
+#include "../NotifyQueue.h"
+#include "../SHA256.h"
+
+#pragma comment(lib, "Ws2_32.lib")
+#pragma comment(lib, "Psapi.lib")
+
+// Protocol control characters (same as the server)
+#define SOH 0x01  // Start of Header - marks the beginning of an extended data frame
+#define STX 0x02  // Start of Text - marks the beginning of a data packet
+#define ETX 0x03  // End of Text - marks the end of a data packet
+#define EOT 0x04  // End of Transmission - signals end of communication
+#define ENQ 0x05  // Enquiry - requests acknowledgment from receiver
+#define ACK 0x06  // Acknowledgment - confirms successful receipt
+#define NAK 0x15  // Negative Acknowledgment - indicates transmission error
+
+// === LOAD TEST CONFIGURATION ===
+constexpr auto LOGIN_THREADS = 32;               // Threads opening and logging in the connections
+constexpr auto CONNECTIONS_PER_ADDRESS = 15000;  // Loopback connections per source address (127.0.0.x)
+constexpr auto PING_SAMPLES = 2000;              // Pings timed in each phase
+constexpr auto MAX_SLOW_DOWNLOADS = 64;          // Upper bound for the slow downloads
+constexpr auto SLOW_FILE_SIZE = 0x40000;         // Size of the file the slow downloads fetch
+constexpr auto SLOW_PACKET_SIZE = 0x1000;        // Payload per packet of the upload that creates it
+constexpr auto SLOW_ACK_DELAY = 50;              // Milliseconds a slow download waits before each ACK
+constexpr auto SOCKET_TIMEOUT = 30000;           // Receive timeout of every client socket, in milliseconds
+const char* SLOW_FILE_NAME = "IntelliBench.bin"; // Uploaded first, then downloaded by the slow clients
+constexpr auto LOAD_SETTLE_TIME = 5000;          // Milliseconds the server gets to free the closed sessions before its memory is read
+constexpr auto MAX_SUBSCRIBERS = 64;             // Upper bound for the subscribers of the broadcast test
+constexpr auto NOTIFY_DEFAULT_FILES = 5000;      // Files uploaded per broadcast round unless given (more than NotifyQueueLimit)
+constexpr auto NOTIFY_FILE_SIZE = 0x1000;        // Size of each file the broadcast test uploads
+constexpr auto NOTIFY_IDLE_TIMEOUT = 5000;       // Milliseconds a subscriber waits for the next notification
+const char* NOTIFY_FILE_NAME = "IntelliBench-notify-%d-%05d.bin"; // Round and index of each uploaded file
+constexpr auto CHURN_DEFAULT_CYCLES = 1000000;   // Connect/disconnect cycles of the churn test unless given
+constexpr auto CHURN_PHASES = 10;                // Phases the churn test reports separately
+constexpr auto CHURN_MEMORY_GROWTH = 0x1000000;  // Growth of the server's working set after the first phase that fails the check (16 MiB)
+constexpr auto CHURN_UPLOADS = 100;              // Files uploaded, and broadcast, after each phase
+constexpr auto CHURN_UPLOAD_GROWTH = 3;          // Growth of the median upload time after the first phase that fails the check
+const char* CHURN_FILE_NAME = "IntelliBench-churn-%03d.bin"; // Index of each uploaded file, the same in every phase
+
+// === THROUGHPUT CONFIGURATION ===
+constexpr auto THROUGHPUT_DEFAULT_SIZE = 16;     // MiB per transfer unless given
+constexpr auto THROUGHPUT_WINDOW_SIZE = 16;      // Frames in flight, as proposed by the client (DEFAULT_WINDOW_SIZE)
+const wchar_t* THROUGHPUT_ROUND_TRIPS = L"0,1,10,50"; // Round-trip times (ms) unless given
+const wchar_t* THROUGHPUT_FRAME_SIZES = L"64,256,1024,4096"; // Large frame sizes (KiB) unless given
+const char* THROUGHPUT_FILE_NAME = "IntelliBench-throughput.bin"; // Uploaded and downloaded by each measurement
+
+// === PIPELINE BENCHMARK CONFIGURATION ===
+constexpr auto PIPELINE_DEFAULT_SIZE = 64;       // MiB downloaded unless given
+constexpr auto PIPELINE_DEFAULT_DELAY = 20;      // Milliseconds per MiB of the server's FetchDelay and of the slow client unless given
+constexpr auto PIPELINE_HIDDEN_SHARE = 0.25;     // Share of the shorter of fetch and client time that a download must hide
+const char* PIPELINE_FILE_NAME = "IntelliBench-pipeline.bin"; // Uploaded once, then downloaded by each measurement
+
+// === SMALL FILE BENCHMARK CONFIGURATION ===
+constexpr auto SMALL_DEFAULT_FILES = 1000;       // Files uploaded, downloaded and deleted unless given
+constexpr auto SMALL_FILE_SIZE = 0x1000;         // Size of each file (4 KiB)
+const char* SMALL_FILE_NAME = "IntelliBench-small/%05d.bin"; // Index of each file
+
+// === STORE BENCHMARK CONFIGURATION ===
+constexpr auto STORE_DEFAULT_SIZE = 256;         // MiB per transfer unless given
+const char* STORE_FILE_NAME = "IntelliBench-store.bin"; // Uploaded and downloaded by each run
+
+// === BATCH BENCHMARK CONFIGURATION ===
+constexpr auto BATCH_DEFAULT_SIZE = 1024;        // MiB uploaded per batch size unless given (1 GiB)
+const wchar_t* BATCH_DEFAULT_SIZES = L"1,16,64,256"; // UploadBatchSize values unless given
+const char* BATCH_FILE_NAME = "IntelliBench-batch.bin"; // Uploaded, downloaded and deleted for each batch size
+
+// === MIGRATION TEST CONFIGURATION ===
+constexpr auto MIGRATION_DEFAULT_HOLD = 30;      // Seconds the upload keeps its transaction open unless given
+constexpr auto MIGRATION_FAST_PACKETS = 128;     // Packets sent at full speed before and after the hold
+constexpr auto MIGRATION_PROBE_SIZE = 0x100000;  // File the probe connection downloads again and again (1 MiB)
+constexpr auto MIGRATION_V1_ROWS = 1024;         // Rows of the Base64 file that IntelliDiskV1.sql creates
+const char* MIGRATION_FILE_NAME = "IntelliBench-migration.bin"; // Uploaded while the migration runs
+const char* MIGRATION_PROBE_NAME = "IntelliBench-probe.bin"; // Downloaded by the probe connection
+const char* MIGRATION_V1_NAME = "IntelliBench-v1.bin"; // Created in Base64 by IntelliDiskV1.sql
+
+// === RESUME TEST CONFIGURATION ===
+constexpr auto RESUME_DEFAULT_SIZE = 256;        // MiB uploaded unless given (more than UPLOAD_CHECKPOINT_SIZE)
+constexpr auto RESUME_DEFAULT_KILLS = 8;         // Connections killed per upload unless given
+constexpr auto RESUME_SEED = 0x5EED;             // Seed of the files and of the kill positions
+const char* RESUME_FILE_NAME = "IntelliBench-resume.bin"; // Uploaded again and again, then downloaded
+
+// === DEDUP CORPUS CONFIGURATION ===
+constexpr auto CORPUS_DEFAULT_SIZE = 256;        // MiB of files per upload of the corpus unless given
+constexpr auto CORPUS_DEFAULT_COPIES = 4;        // Copies of the directory in the corpus unless given
+constexpr auto CORPUS_MIN_FILE_SIZE = 0x1000;    // Smallest file of the directory (4 KiB)
+constexpr auto CORPUS_MAX_FILE_SIZE = 0x100000;  // Largest file of the directory (1 MiB)
+constexpr auto CORPUS_EDITED_FILES = 10;         // One file in this many is edited in every copy but the first
+constexpr auto CORPUS_EDIT_SIZE = 100;           // Bytes overwritten by an edit
+constexpr auto CORPUS_SEED = 0xC0DE;             // Seed of the directory of the first mode
+constexpr auto CORPUS_DEFAULT_BANDWIDTH = 100;   // Mbit/s of the link to the server unless given (0: no relay)
+constexpr auto CORPUS_ROUND_TRIP = 10;           // Round-trip time of that link, in milliseconds
+const char* CORPUS_FILE_NAME = "IntelliBench-dedup/%s/%s/copy%d/file%04d.bin"; // Mode, upload, copy and index of each file
+
+// === BENCHMARK CONFIGURATION ===
+constexpr auto BENCH_BUFFER_SIZE = 0x100000;  // Buffer processed again and again (1 MiB)
+constexpr auto BENCH_DEFAULT_SIZE = 1024;     // MiB processed per run unless given
+constexpr auto BENCH_RUNS = 3;                // Runs per measurement; the fastest one is reported
+constexpr auto CHUNKER_FILE_SIZE = 0x800000;  // File cut twice by the chunker check (8 MiB)
+constexpr auto CHUNKER_EDIT_OFFSET = 0x100000; // Where the chunker check inserts bytes
+constexpr auto CHUNKER_EDIT_SIZE = 100;       // How many bytes it inserts
+constexpr auto EDITS_DEFAULT_SIZE = 64;       // Largest file (MiB) of the edit benchmark unless given
+constexpr auto EDITS_APPEND_SIZE = 0x10000;   // Bytes appended by the edit benchmark (64 KiB)
+constexpr auto UPLOAD_FRAME_SIZE = 0x100000;  // Payload per data frame, as proposed by the client (DEFAULT_FRAME_SIZE)
+const char* EDITS_FILE_NAME = "IntelliBench.bin"; // Path the modelled uploads send
+constexpr auto DIFF_MIN_ENTRIES = 10000;      // Smallest snapshot of the diff benchmark
+constexpr auto DIFF_DEFAULT_ENTRIES = 1000000; // Largest snapshot of the diff benchmark unless given
+constexpr auto DIFF_FILES_PER_DIRECTORY = 100; // Files per synthetic directory; one of each is edited
+constexpr auto DIFF_LAST_WRITE_TIME = 0x01DC000000000000ULL; // Last write time of the first synthetic file
+const TCHAR* DIFF_ROOT_FOLDER = _T("C:\\IntelliBench"); // Root of the synthetic snapshots
+constexpr auto WATCH_MIN_FILES = 1000;        // Smallest tree of the watcher benchmark
+constexpr auto WATCH_DEFAULT_FILES = 100000;  // Largest tree of the watcher benchmark unless given
+constexpr auto WATCH_DEFAULT_EVENTS = 100;    // Timed writes per tree unless given
+constexpr auto WATCH_EVENT_TIMEOUT = NOTIFICATION_MAX_DELAY + 5000; // A write the watcher did not report by then is lost (ms)
+const TCHAR* WATCH_ROOT_FOLDER = _T("IntelliBench-watch"); // Synthetic tree, in the temporary folder
+constexpr auto SCAN_DEFAULT_FILES = 100000;   // Files per tree of the scan benchmark unless given
+constexpr auto SCAN_DEFAULT_THREADS = L"1,0"; // Walker threads unless given: serial, then one per processor
+constexpr auto SCAN_DEEP_LEVELS = 20;         // Nested directories per chain of the deep tree
+constexpr auto SCAN_DEEP_FILES = 10;          // Files per directory of the deep tree
+constexpr auto SYSTEM_MEMORY_LIST_INFORMATION = 80; // SYSTEM_INFORMATION_CLASS that purges the file cache
+const TCHAR* SCAN_ROOT_FOLDER = _T("IntelliBench-scan"); // Synthetic trees, in the temporary folder
+enum { SCAN_WIDE, SCAN_DEEP, SCAN_TINY };     // Shapes of the synthetic trees
+constexpr auto RESTART_DEFAULT_FILES = 1000000; // Unchanged files of the restart benchmark unless given
+constexpr auto RESTART_EDITED_FILES = 10;     // Files rewritten before the last start
+constexpr auto RESTART_TIMEOUT = 600000;      // A start that has not reconciled the tree by then failed (ms)
+const TCHAR* RESTART_ROOT_FOLDER = _T("IntelliBench-restart"); // Synthetic tree, in the temporary folder
+const TCHAR* RESTART_INDEX_NAME = _T("IntelliBench-restart.idx"); // Its sync index, in the temporary folder
+
+constexpr auto REPLAY_DEFAULT_TRACE = L"EditBursts.txt"; // Trace replayed unless given
+constexpr auto REPLAY_SUBSCRIBERS = 3;        // Simulated subscribers, one per bandwidth below
+const int REPLAY_BANDWIDTHS[REPLAY_SUBSCRIBERS] = { 1, 10, 100 }; // MiB/s each subscriber downloads at
+
+sockaddr_in g_pServerAddress;          // Server under test
+bool g_bLoopback = false;              // Server on 127.x.x.x: the connections use several source addresses
+std::vector<SOCKET> g_pSockets;        // One per connection, INVALID_SOCKET if it could not log in
+std::vector<double> g_pLoginTimes;     // Connect + handshake of each connection, in milliseconds
+std::atomic<int> g_nNextConnection(0); // Next connection a login thread opens
+std::atomic<int> g_nLoginFailures(0);  // Connections that could not log in
+int g_nChurnStart = 0;                 // First cycle of the current churn phase
+int g_nChurnEnd = 0;                   // Cycle after the last one of the current churn phase
+volatile bool g_bSlowDownloads = false;   // The slow downloads start again while true
+std::atomic<int> g_nSlowDownloads(0);     // Slow downloads completed
+std::atomic<int> g_nSlowFailures(0);      // Slow downloads that failed
+std::chrono::steady_clock::time_point g_nNotifyStart; // First upload of the current broadcast round
+volatile unsigned int g_nBenchResult = 0; // Results of the measured functions, so they are not optimized away
+
+/**
+ * @brief Milliseconds elapsed since a time point
+ * @param nStart The time point
+ * @return Elapsed milliseconds
+ */
+double ElapsedMilliseconds(const std::chrono::steady_clock::time_point& nStart)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - nStart).count();
+}
+
+/**
+ * @brief Sends a whole buffer
+ * @param hSocket The socket
+ * @param pBuffer The data
+ * @param nLength Number of bytes
+ * @return true on success
+ */
+bool SendAll(SOCKET hSocket, const void* pBuffer, const int nLength)
+{
+	const char* pData = (const char*)pBuffer;
+	for (int nIndex = 0, nCount = 0; nIndex < nLength; nIndex += nCount)
+	{
+		if ((nCount = send(hSocket, pData + nIndex, nLength - nIndex, 0)) <= 0)
+			return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Receives exactly nLength bytes (or fails after SOCKET_TIMEOUT)
+ * @param hSocket The socket
+ * @param pBuffer [out] The data
+ * @param nLength Number of bytes
+ * @return true on success
+ */
+bool ReceiveAll(SOCKET hSocket, void* pBuffer, const int nLength)
+{
+	char* pData = (char*)pBuffer;
+	for (int nIndex = 0, nCount = 0; nIndex < nLength; nIndex += nCount)
+	{
+		if ((nCount = recv(hSocket, pData + nIndex, nLength - nIndex, 0)) <= 0)
+			return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Sends one control character
+ */
+bool SendByte(SOCKET hSocket, const unsigned char nByte)
+{
+	return SendAll(hSocket, &nByte, sizeof(nByte));
+}
+
+/**
+ * @brief Receives one control character
+ * @return true if it is nExpected
+ */
+bool ReceiveByte(SOCKET hSocket, const unsigned char nExpected)
+{
+	unsigned char nByte = 0;
+	return ReceiveAll(hSocket, &nByte, sizeof(nByte)) && (nExpected == nByte);
+}
+
+/**
+ * @brief Sends one STX/ETX packet and waits for its ACK
+ * @param hSocket The socket
+ * @param pPayload The payload
+ * @param nLength Payload size (at most 0xFFFF - 5 bytes)
+ * @return true if the server acknowledged it
+ */
+bool SendPacket(SOCKET hSocket, const void* pPayload, const int nLength)
+{
+	std::vector<unsigned char> pPacket;
+	pPacket.reserve(nLength + 5);
+	pPacket.push_back(STX);
+	pPacket.push_back((unsigned char)(nLength / 0x100));
+	pPacket.push_back((unsigned char)(nLength % 0x100));
+	pPacket.insert(pPacket.end(), (const unsigned char*)pPayload, (const unsigned char*)pPayload + nLength);
+	pPacket.push_back(ETX);
+	pPacket.push_back(calcLRC((const unsigned char*)pPayload, nLength));
+	return SendAll(hSocket, pPacket.data(), (int)pPacket.size()) && ReceiveByte(hSocket, ACK);
+}
+
+/**
+ * @brief Receives one STX/ETX packet and acknowledges it
+ * @param hSocket The socket
+ * @param pPayload [out] The payload
+ * @param nAckDelay Milliseconds to wait before the ACK
+ * @param nOffset Bytes of the transfer received before this packet; the wait is then only made by a packet that
+ *        completes a MiB of the transfer (ULLONG_MAX: before every ACK)
+ * @return true if the packet was valid
+ */
+bool ReceivePacket(SOCKET hSocket, std::vector<unsigned char>& pPayload, const DWORD nAckDelay, const unsigned long long nOffset = ULLONG_MAX)
+{
+	unsigned char pHeader[3] = { 0, };
+	unsigned char pTrailer[2] = { 0, };
+	if (!ReceiveAll(hSocket, pHeader, sizeof(pHeader)) || (STX != pHeader[0]))
+		return false;
+	pPayload.resize(pHeader[1] * 0x100 + pHeader[2]);
+	if (!ReceiveAll(hSocket, pPayload.data(), (int)pPayload.size()) ||
+		!ReceiveAll(hSocket, pTrailer, sizeof(pTrailer)) ||
+		(ETX != pTrailer[0]) || (calcLRC(pPayload.data(), (int)pPayload.size()) != pTrailer[1]))
+		return false;
+	if ((nAckDelay > 0) && ((ULLONG_MAX == nOffset) || ((nOffset + pPayload.size()) / 0x100000 != nOffset / 0x100000)))
+		Sleep(nAckDelay);
+	return SendByte(hSocket, ACK);
+}
+
+/**
+ * @brief Sends a command: ENQ, ACK, then the command packet
+ */
+bool SendCommand(SOCKET hSocket, const char* lpszCommand)
+{
+	return SendByte(hSocket, ENQ) && ReceiveByte(hSocket, ACK) &&
+		SendPacket(hSocket, lpszCommand, (int)strlen(lpszCommand) + 1);
+}
+
+/**
+ * @brief Opens one connection to the server
+ * @param nIndex Index of the connection (picks its source address on loopback)
+ * @return The socket, or INVALID_SOCKET
+ * @details A source address has about 16k ephemeral ports, so loopback connections are
+ *          spread over 127.0.0.1, 127.0.0.2, ... (CONNECTIONS_PER_ADDRESS each)
+ */
+SOCKET OpenConnection(const int nIndex)
+{
+	SOCKET hSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (INVALID_SOCKET == hSocket)
+		return INVALID_SOCKET;
+	const DWORD nTimeout = SOCKET_TIMEOUT;
+	const BOOL bNoDelay = TRUE;
+	setsockopt(hSocket, SOL_SOCKET, SO_RCVTIMEO, (const char*)&nTimeout, sizeof(nTimeout));
+	// The protocol answers every small write, so Nagle would only add delayed-ACK stalls to the timings
+	setsockopt(hSocket, IPPROTO_TCP, TCP_NODELAY, (const char*)&bNoDelay, sizeof(bNoDelay));
+	if (g_bLoopback)
+	{
+		// Without SO_REUSE_UNICASTPORT bind() would take a port of the shared range for every address
+		const DWORD nReuse = 1;
+		setsockopt(hSocket, SOL_SOCKET, SO_REUSE_UNICASTPORT, (const char*)&nReuse, sizeof(nReuse));
+		sockaddr_in pSourceAddress = { 0, };
+		pSourceAddress.sin_family = AF_INET;
+		pSourceAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK + nIndex / CONNECTIONS_PER_ADDRESS);
+		if (bind(hSocket, (const sockaddr*)&pSourceAddress, sizeof(pSourceAddress)) == SOCKET_ERROR)
+		{
+			closesocket(hSocket);
+			return INVALID_SOCKET;
+		}
+	}
+	if (connect(hSocket, (const sockaddr*)&g_pServerAddress, sizeof(g_pServerAddress)) == SOCKET_ERROR)
+	{
+		closesocket(hSocket);
+		return INVALID_SOCKET;
+	}
+	return hSocket;
+}
+
+/**
+ * @brief Logs in with the legacy handshake ("IntelliDisk", machine ID, EOT; the server does not answer)
+ * @param hSocket The socket
+ * @param strMachineID Unique machine ID of the connection
+ * @return true on success
+ */
+bool Login(SOCKET hSocket, const std::string& strMachineID)
+{
+	return SendCommand(hSocket, "IntelliDisk") &&
+		SendPacket(hSocket, strMachineID.c_str(), (int)strMachineID.length() + 1) &&
+		SendByte(hSocket, EOT);
+}
+
+/**
+ * @brief Sends a "Ping"
+ * @return true once the server acknowledged it
+ */
+bool Ping(SOCKET hSocket)
+{
+	return SendCommand(hSocket, "Ping") && SendByte(hSocket, EOT);
+}
+
+/**
+ * @brief Uploads SLOW_FILE_NAME, the file the slow downloads fetch
+ * @return true once the server has stored it
+ * @details Runs before the other connections log in, so no test client is told to download it
+ */
+bool UploadSlowFile()
+{
+	SOCKET hSocket = OpenConnection(0);
+	if (INVALID_SOCKET == hSocket)
+		return false;
+	std::vector<unsigned char> pFileData(SLOW_FILE_SIZE);
+	for (size_t nIndex = 0; nIndex < pFileData.size(); nIndex++)
+		pFileData[nIndex] = (unsigned char)(nIndex * 7 + nIndex / 0x1000);
+	SHA256 pSHA256;
+	pSHA256.update(pFileData.data(), pFileData.size());
+	const std::string strDigestSHA256 = SHA256::toString(pSHA256.digest());
+	const ULONGLONG nFileLength = SLOW_FILE_SIZE;
+
+	bool bResult = Login(hSocket, "IntelliBench") &&
+		SendCommand(hSocket, "Upload") &&
+		SendPacket(hSocket, SLOW_FILE_NAME, (int)strlen(SLOW_FILE_NAME) + 1) &&
+		SendPacket(hSocket, &nFileLength, sizeof(nFileLength));
+	for (int nIndex = 0; bResult && (nIndex < SLOW_FILE_SIZE); nIndex += SLOW_PACKET_SIZE)
+		bResult = SendPacket(hSocket, &pFileData[nIndex], SLOW_PACKET_SIZE);
+	// The server handles one command at a time, so the ping returns after the upload was published
+	bResult = bResult &&
+		SendPacket(hSocket, strDigestSHA256.c_str(), (int)strDigestSHA256.length() + 1) &&
+		SendByte(hSocket, EOT) &&
+		Ping(hSocket);
+	closesocket(hSocket);
+	return bResult;
+}
+
+/**
+ * @brief Downloads SLOW_FILE_NAME, waiting SLOW_ACK_DELAY before each ACK
+ * @return true if the whole file arrived
+ */
+bool DownloadSlowly(SOCKET hSocket)
+{
+	std::vector<unsigned char> pPayload;
+	ULONGLONG nFileLength = 0;
+	if (!SendCommand(hSocket, "Download") ||
+		!SendPacket(hSocket, SLOW_FILE_NAME, (int)strlen(SLOW_FILE_NAME) + 1) ||
+		!ReceivePacket(hSocket, pPayload, 0) || (pPayload.size() != sizeof(nFileLength)))
+		return false;
+	memcpy(&nFileLength, pPayload.data(), sizeof(nFileLength));
+	for (ULONGLONG nFileIndex = 0; nFileIndex < nFileLength; nFileIndex += pPayload.size())
+	{
+		if (!ReceivePacket(hSocket, pPayload, SLOW_ACK_DELAY) || pPayload.empty())
+			return false;
+	}
+	// SHA256 of the file, then EOT
+	return ReceivePacket(hSocket, pPayload, 0) && ReceiveByte(hSocket, EOT);
+}
+
+/**
+ * @brief Login thread: opens and logs in connections until every one was tried
+ * @param lpParam Unused parameter
+ * @return 0 on thread exit
+ */
+DWORD WINAPI LoginThread(LPVOID lpParam)
+{
+	UNREFERENCED_PARAMETER(lpParam);
+	for (int nIndex = g_nNextConnection++; nIndex < (int)g_pSockets.size(); nIndex = g_nNextConnection++)
+	{
+		const auto nStart = std::chrono::steady_clock::now();
+		char lpszMachineID[0x20] = { 0, };
+		sprintf_s(lpszMachineID, "IntelliBench-%05d", nIndex);
+		SOCKET hSocket = OpenConnection(nIndex);
+		if ((INVALID_SOCKET != hSocket) && !Login(hSocket, lpszMachineID))
+		{
+			closesocket(hSocket);
+			hSocket = INVALID_SOCKET;
+		}
+		if (INVALID_SOCKET == hSocket)
+			g_nLoginFailures++;
+		g_pSockets[nIndex] = hSocket;
+		g_pLoginTimes[nIndex] = ElapsedMilliseconds(nStart);
+	}
+	return 0;
+}
+
+/**
+ * @brief Slow download thread: downloads SLOW_FILE_NAME again and again on one connection
+ * @param lpParam Index of the connection
+ * @return 0 on thread exit
+ */
+DWORD WINAPI SlowDownloadThread(LPVOID lpParam)
+{
+	const SOCKET hSocket = g_pSockets[(size_t)lpParam];
+	while (g_bSlowDownloads)
+	{
+		if (!DownloadSlowly(hSocket))
+		{
+			g_nSlowFailures++;
+			break;
+		}
+		g_nSlowDownloads++;
+	}
+	return 0;
+}
+
+/**
+ * @brief Reads the memory use of the server process (or of IntelliBench itself)
+ * @param dwProcessID Process ID of the server (0 = not measured)
+ * @param nWorkingSet [out] Working set, in bytes
+ * @param nPrivateBytes [out] Private bytes, in bytes
+ * @return true if it could be read
+ */
+bool GetServerMemory(const DWORD dwProcessID, SIZE_T& nWorkingSet, SIZE_T& nPrivateBytes)
+{
+	nWorkingSet = nPrivateBytes = 0;
+	if (0 == dwProcessID)
+		return false;
+	HANDLE hProcess = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, dwProcessID);
+	if (nullptr == hProcess)
+		return false;
+	PROCESS_MEMORY_COUNTERS_EX pCounters = { 0, };
+	const bool bResult = GetProcessMemoryInfo(hProcess, (PROCESS_MEMORY_COUNTERS*)&pCounters, sizeof(pCounters)) != FALSE;
+	CloseHandle(hProcess);
+	nWorkingSet = pCounters.WorkingSetSize;
+	nPrivateBytes = pCounters.PrivateUsage;
+	return bResult;
+}
+
+/**
+ * @brief Prints the memory of the server at one phase of the load test, against its memory before the logins
+ * @param lpszPhase Name of the phase
+ * @param dwProcessID Process ID of the server (0 = not measured)
+ * @param nBaseWorkingSet Working set before the logins, in bytes
+ * @param nBasePrivateBytes Private bytes before the logins, in bytes
+ * @param nConnections Connections the growth is divided by (0: the growth is printed in MiB)
+ */
+void PrintServerMemory(const wchar_t* lpszPhase, const DWORD dwProcessID, const SIZE_T nBaseWorkingSet, const SIZE_T nBasePrivateBytes, const int nConnections)
+{
+	SIZE_T nWorkingSet = 0, nPrivateBytes = 0;
+	if (!GetServerMemory(dwProcessID, nWorkingSet, nPrivateBytes))
+		return;
+	const double nWorkingSetGrowth = (double)nWorkingSet - nBaseWorkingSet;
+	const double nPrivateGrowth = (double)nPrivateBytes - nBasePrivateBytes;
+	if (nConnections > 0)
+	{
+		wprintf(L"Server memory (%s): working set %.1f MiB (%+.0f bytes per connection), private bytes %.1f MiB (%+.0f bytes per connection)\n",
+			lpszPhase, nWorkingSet / 1048576.0, nWorkingSetGrowth / nConnections, nPrivateBytes / 1048576.0, nPrivateGrowth / nConnections);
+	}
+	else
+	{
+		wprintf(L"Server memory (%s): working set %.1f MiB (%+.1f MiB), private bytes %.1f MiB (%+.1f MiB)\n",
+			lpszPhase, nWorkingSet / 1048576.0, nWorkingSetGrowth / 1048576.0, nPrivateBytes / 1048576.0, nPrivateGrowth / 1048576.0);
+	}
+}
+
+/**
+ * @brief Prints the median, 99th percentile and maximum of a set of timings
+ * @param lpszName Name of the timings
+ * @param pTimes The timings, in milliseconds (sorted in place)
+ */
+void PrintPercentiles(const wchar_t* lpszName, std::vector<double>& pTimes)
+{
+	if (pTimes.empty())
+	{
+		wprintf(L"%s: no samples\n", lpszName);
+		return;
+	}
+	std::sort(pTimes.begin(), pTimes.end());
+	wprintf(L"%s: %u samples, p50 %.3f ms, p99 %.3f ms, max %.3f ms\n", lpszName, (unsigned int)pTimes.size(),
+		pTimes[pTimes.size() / 2], pTimes[pTimes.size() * 99 / 100], pTimes.back());
+}
+
+/**
+ * @brief Times PING_SAMPLES pings on connections picked at random
+ * @param lpszName Name printed with the timings
+ * @param nFirst First connection that may be picked (the slow downloads use the ones before it)
+ */
+void TimePings(const wchar_t* lpszName, const int nFirst)
+{
+	std::vector<double> pTimes;
+	int nFailures = 0;
+	unsigned int nRandom = 0x12345678;
+	const int nCount = (int)g_pSockets.size() - nFirst;
+	for (int nSample = 0; (nCount > 0) && (nSample < PING_SAMPLES); nSample++)
+	{
+		nRandom = nRandom * 1103515245 + 12345;
+		const int nIndex = nFirst + (int)((nRandom >> 8) % (unsigned int)nCount);
+		if (INVALID_SOCKET == g_pSockets[nIndex])
+			continue;
+		const auto nStart = std::chrono::steady_clock::now();
+		if (Ping(g_pSockets[nIndex]))
+			pTimes.push_back(ElapsedMilliseconds(nStart));
+		else
+		{
+			// The protocol state of the connection is unknown now
+			nFailures++;
+			closesocket(g_pSockets[nIndex]);
+			g_pSockets[nIndex] = INVALID_SOCKET;
+		}
+	}
+	PrintPercentiles(lpszName, pTimes);
+	if (nFailures > 0)
+		wprintf(L"%s: %d failed\n", lpszName, nFailures);
+}
+
+bool BroadcastTest(const int nSubscribers, const int nFiles);
+
+/**
+ * @brief Runs the load test
+ * @param lpszServer IPv4 address of the server
+ * @param nPort Service port of the server
+ * @param nConnections Number of client connections
+ * @param nSlowDownloads Number of connections downloading slowly during the second ping phase
+ * @param dwProcessID Process ID of the server, to report its memory use (0 = not reported)
+ * @param nSubscribers Number of healthy subscribers of the broadcast test (0 = no broadcast test)
+ * @param nFiles Number of files uploaded per broadcast round
+ * @return 0 if every connection logged in, every ping was answered and the broadcast test passed
+ *
+ * LOAD TEST STEPS:
+ * ================
+ * 1. Upload SLOW_FILE_NAME (only with slow downloads)
+ * 2. Open and log in nConnections connections on LOGIN_THREADS threads
+ * 3. Time pings while the server has nothing else to do
+ * 4. Time pings while nSlowDownloads connections download, holding a transfer thread each
+ * 5. Close every connection
+ * 6. Broadcast test (BroadcastTest), on connections of its own
+ */
+int LoadTest(const wchar_t* lpszServer, const int nPort, const int nConnections, const int nSlowDownloads, const DWORD dwProcessID,
+	const int nSubscribers, const int nFiles)
+{
+	WSADATA pWSAData = { 0, };
+	if (WSAStartup(MAKEWORD(2, 2), &pWSAData) != 0)
+		return 1;
+	ZeroMemory(&g_pServerAddress, sizeof(g_pServerAddress));
+	g_pServerAddress.sin_family = AF_INET;
+	g_pServerAddress.sin_port = htons((u_short)nPort);
+	if ((nConnections <= 0) || (InetPtonW(AF_INET, lpszServer, &g_pServerAddress.sin_addr) != 1))
+	{
+		wprintf(L"Invalid parameters\n");
+		WSACleanup();
+		return 1;
+	}
+	g_bLoopback = ((ntohl(g_pServerAddress.sin_addr.s_addr) >> 24) == 127);
+	int nSlowCount = min(min(max(nSlowDownloads, 0), MAX_SLOW_DOWNLOADS), nConnections);
+	SIZE_T nBaseWorkingSet = 0, nBasePrivateBytes = 0;
+	if (GetServerMemory(dwProcessID, nBaseWorkingSet, nBasePrivateBytes))
+		PrintServerMemory(L"before the logins", dwProcessID, nBaseWorkingSet, nBasePrivateBytes, 0);
+
+	// Step 1: The file of the slow downloads, before any test client can be told about it
+	if ((nSlowCount > 0) && !UploadSlowFile())
+	{
+		wprintf(L"Upload of %hs failed, no slow downloads\n", SLOW_FILE_NAME);
+		nSlowCount = 0;
+	}
+
+	// Step 2: Log in every connection
+	g_pSockets.assign(nConnections, INVALID_SOCKET);
+	g_pLoginTimes.assign(nConnections, 0);
+	const auto nStart = std::chrono::steady_clock::now();
+	HANDLE hLoginThreads[LOGIN_THREADS] = { nullptr, };
+	for (int nIndex = 0; nIndex < LOGIN_THREADS; nIndex++)
+		hLoginThreads[nIndex] = CreateThread(nullptr, 0, LoginThread, nullptr, 0, nullptr);
+	WaitForMultipleObjects(LOGIN_THREADS, hLoginThreads, TRUE, INFINITE);
+	for (int nIndex = 0; nIndex < LOGIN_THREADS; nIndex++)
+		CloseHandle(hLoginThreads[nIndex]);
+	const double nLoginTime = ElapsedMilliseconds(nStart);
+	const int nLoggedIn = nConnections - g_nLoginFailures;
+	wprintf(L"%d connections logged in, %d failed, in %.1f s (%.0f logins/s)\n",
+		nLoggedIn, g_nLoginFailures.load(), nLoginTime / 1000, nLoggedIn * 1000 / nLoginTime);
+	PrintPercentiles(L"Login", g_pLoginTimes);
+	PrintServerMemory(L"logged in", dwProcessID, nBaseWorkingSet, nBasePrivateBytes, nLoggedIn);
+
+	// Step 3: Pings with the transfer pool idle
+	TimePings(L"Ping", nSlowCount);
+	PrintServerMemory(L"after the pings", dwProcessID, nBaseWorkingSet, nBasePrivateBytes, nLoggedIn);
+
+	// Step 4: Pings while the slow downloads hold transfer threads
+	if (nSlowCount > 0)
+	{
+		HANDLE hSlowThreads[MAX_SLOW_DOWNLOADS] = { nullptr, };
+		int nSlowThreads = 0;
+		g_bSlowDownloads = true;
+		for (int nIndex = 0; nIndex < nSlowCount; nIndex++)
+		{
+			if (INVALID_SOCKET != g_pSockets[nIndex])
+				hSlowThreads[nSlowThreads++] = CreateThread(nullptr, 0, SlowDownloadThread, (LPVOID)(size_t)nIndex, 0, nullptr);
+		}
+		// Every slow download has asked for the file and is being served by now
+		Sleep(1000);
+		wchar_t lpszName[0x40] = { 0, };
+		swprintf_s(lpszName, L"Ping (%d slow downloads)", nSlowThreads);
+		TimePings(lpszName, nSlowCount);
+		PrintServerMemory(L"during the slow downloads", dwProcessID, nBaseWorkingSet, nBasePrivateBytes, nLoggedIn);
+		g_bSlowDownloads = false;
+		WaitForMultipleObjects(nSlowThreads, hSlowThreads, TRUE, INFINITE);
+		for (int nIndex = 0; nIndex < nSlowThreads; nIndex++)
+			CloseHandle(hSlowThreads[nIndex]);
+		wprintf(L"Slow downloads: %d completed, %d failed\n", g_nSlowDownloads.load(), g_nSlowFailures.load());
+	}
+
+	// Step 5: Close every connection
+	int nClosed = 0;
+	for (SOCKET& hSocket : g_pSockets)
+	{
+		if (INVALID_SOCKET != hSocket)
+		{
+			closesocket(hSocket);
+			hSocket = INVALID_SOCKET;
+			nClosed++;
+		}
+	}
+	// The server sees the connections close and frees the sessions on its workers
+	if (0 != dwProcessID)
+	{
+		Sleep(LOAD_SETTLE_TIME);
+		PrintServerMemory(L"connections closed", dwProcessID, nBaseWorkingSet, nBasePrivateBytes, 0);
+	}
+
+	// Step 6: Subscribers and an uploader of their own, so the connections above do not receive the broadcasts
+	bool bBroadcast = true;
+	if (nSubscribers > 0)
+	{
+		bBroadcast = BroadcastTest(min(nSubscribers, MAX_SUBSCRIBERS), nFiles);
+		PrintServerMemory(L"after the broadcasts", dwProcessID, nBaseWorkingSet, nBasePrivateBytes, 0);
+	}
+	WSACleanup();
+	return ((nClosed == nConnections) && (0 == g_nSlowFailures) && bBroadcast) ? 0 : 1;
+}
+
+/**
+ * @brief Fills a buffer with pseudo-random bytes (xorshift64, the same bytes for the same seed)
+ * @param pBuffer The buffer
+ * @param nSeed Seed of the generator (not 0)
+ */
+void FillRandom(std::vector<unsigned char>& pBuffer, unsigned long long nSeed)
+{
+	for (unsigned char& nByte : pBuffer)
+	{
+		nSeed ^= nSeed << 13;
+		nSeed ^= nSeed >> 7;
+		nSeed ^= nSeed << 17;
+		nByte = (unsigned char)(nSeed >> 56);
+	}
+}
+
+/**
+ * @brief Runs a function over the same buffer until nTotalSize bytes were processed, BENCH_RUNS times
+ * @param pBuffer The buffer
+ * @param nTotalSize Bytes processed per run
+ * @param pFunction Called with (buffer, length)
+ * @return Throughput of the fastest run, in MiB/s
+ */
+template <typename FUNCTION>
+double MeasureThroughput(const std::vector<unsigned char>& pBuffer, const size_t nTotalSize, FUNCTION pFunction)
+{
+	double nBest = 0;
+	for (int nRun = 0; nRun < BENCH_RUNS; nRun++)
+	{
+		const auto nStart = std::chrono::steady_clock::now();
+		for (size_t nDone = 0; nDone < nTotalSize; nDone += pBuffer.size())
+			pFunction(pBuffer.data(), pBuffer.size());
+		nBest = max(nBest, (nTotalSize / 1048576.0) / (ElapsedMilliseconds(nStart) / 1000));
+	}
+	return nBest;
+}
+
+/**
+ * @brief Checks calcCRC32C and compares its speed with the LRC it replaced in windowed frames
+ * @param nMegabytes MiB processed per run
+ * @return 0 if the checks passed
+ */
+int BenchCRC32C(const int nMegabytes)
+{
+	std::vector<unsigned char> pBuffer(BENCH_BUFFER_SIZE);
+	FillRandom(pBuffer, 1);
+	// Check value of CRC-32C (RFC 3720, B.4), then a running checksum split at an odd offset
+	const bool bCheckValue = (calcCRC32C((const unsigned char*)"123456789", 9) == 0xE3069283);
+	const bool bRunning = (calcCRC32C(pBuffer.data() + 1001, pBuffer.size() - 1001, calcCRC32C(pBuffer.data(), 1001)) ==
+		calcCRC32C(pBuffer.data(), pBuffer.size()));
+	wprintf(L"CRC32C (%s): check value %s, running checksum %s\n", IsCRC32CAccelerated() ? L"hardware" : L"slice-by-8",
+		bCheckValue ? L"passed" : L"FAILED", bRunning ? L"passed" : L"FAILED");
+
+	const size_t nTotalSize = (size_t)nMegabytes * 1048576;
+	wprintf(L"CRC32C: %.0f MiB/s\n", MeasureThroughput(pBuffer, nTotalSize,
+		[](const unsigned char* pData, const size_t nLength) { g_nBenchResult = g_nBenchResult ^ calcCRC32C(pData, nLength); }));
+	wprintf(L"LRC: %.0f MiB/s\n", MeasureThroughput(pBuffer, nTotalSize,
+		[](const unsigned char* pData, const size_t nLength) { g_nBenchResult = g_nBenchResult ^ calcLRC(pData, (int)nLength); }));
+	return (bCheckValue && bRunning) ? 0 : 1;
+}
+
+/**
+ * @brief Cuts a whole buffer into content-defined chunks
+ * @param pChunker The chunker
+ * @param pData The data
+ * @param nLength Number of bytes
+ * @return The length of each chunk
+ */
+std::vector<size_t> CutChunks(const CContentChunker& pChunker, const unsigned char* pData, const size_t nLength)
+{
+	std::vector<size_t> pLengths;
+	for (size_t nOffset = 0; nOffset < nLength; nOffset += pLengths.back())
+		pLengths.push_back(pChunker.FindBoundary(pData + nOffset, nLength - nOffset));
+	return pLengths;
+}
+
+/**
+ * @brief Checks that an insert only changes the chunks around it, and times the chunker
+ * @param nMegabytes MiB processed per run
+ * @return 0 if the checks passed
+ * @details Cuts a random file, then the same file with CHUNKER_EDIT_SIZE bytes inserted, and counts the
+ *          chunks of the second cut that the first one has too (same CRC32C and length)
+ */
+int BenchChunker(const int nMegabytes)
+{
+	const CContentChunker pChunker;
+	std::vector<unsigned char> pFile(CHUNKER_FILE_SIZE);
+	FillRandom(pFile, 2);
+	std::vector<unsigned char> pEdited(pFile);
+	std::vector<unsigned char> pInsert(CHUNKER_EDIT_SIZE);
+	FillRandom(pInsert, 3);
+	pEdited.insert(pEdited.begin() + CHUNKER_EDIT_OFFSET, pInsert.begin(), pInsert.end());
+
+	const std::vector<size_t> pLengths = CutChunks(pChunker, pFile.data(), pFile.size());
+	const std::vector<size_t> pEditedLengths = CutChunks(pChunker, pEdited.data(), pEdited.size());
+	std::vector<unsigned long long> pKeys;
+	bool bSizes = true;
+	size_t nOffset = 0;
+	for (size_t nIndex = 0; nIndex < pLengths.size(); nOffset += pLengths[nIndex++])
+	{
+		bSizes = bSizes && (pLengths[nIndex] <= pChunker.GetMaxSize()) &&
+			((pLengths[nIndex] >= pChunker.GetMinSize()) || (nIndex + 1 == pLengths.size()));
+		pKeys.push_back(((unsigned long long)pLengths[nIndex] << 32) | calcCRC32C(&pFile[nOffset], pLengths[nIndex]));
+	}
+	std::sort(pKeys.begin(), pKeys.end());
+	size_t nShared = 0;
+	nOffset = 0;
+	for (const size_t nLength : pEditedLengths)
+	{
+		const unsigned long long nKey = ((unsigned long long)nLength << 32) | calcCRC32C(&pEdited[nOffset], nLength);
+		nShared += std::binary_search(pKeys.begin(), pKeys.end(), nKey) ? 1 : 0;
+		nOffset += nLength;
+	}
+	// Only the chunk with the insert and, at most, the next two may change
+	const bool bStable = (nShared + 3 >= pEditedLengths.size());
+	wprintf(L"Chunker (%u/%u/%u): %u chunks, average %u bytes, sizes %s\n", pChunker.GetMinSize(), pChunker.GetAvgSize(), pChunker.GetMaxSize(),
+		(unsigned int)pLengths.size(), (unsigned int)(pFile.size() / pLengths.size()), bSizes ? L"passed" : L"FAILED");
+	wprintf(L"Chunker: %u of %u chunks unchanged after inserting %d bytes, %s\n",
+		(unsigned int)nShared, (unsigned int)pEditedLengths.size(), CHUNKER_EDIT_SIZE, bStable ? L"passed" : L"FAILED");
+
+	std::vector<unsigned char> pBuffer(BENCH_BUFFER_SIZE);
+	FillRandom(pBuffer, 4);
+	wprintf(L"Chunker: %.0f MiB/s\n", MeasureThroughput(pBuffer, (size_t)nMegabytes * 1048576,
+		[&pChunker](const unsigned char* pData, const size_t nLength) { g_nBenchResult = g_nBenchResult ^ (unsigned int)CutChunks(pChunker, pData, nLength).size(); }));
+	return (bSizes && bStable) ? 0 : 1;
+}
+
+/**
+ * @brief Checks SHA256 against the FIPS 180-2 test vectors and times it on whole buffers and per chunk
+ * @param nMegabytes MiB processed per run
+ * @return 0 if the checks passed
+ */
+int BenchSHA256(const int nMegabytes)
+{
+	SHA256 pEmpty;
+	SHA256 pABC;
+	pABC.update(std::string("abc"));
+	const bool bVectors =
+		(SHA256::toString(pEmpty.digest()) == "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855") &&
+		(SHA256::toString(pABC.digest()) == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+	// Updates of any size give the digest of the whole buffer
+	std::vector<unsigned char> pBuffer(BENCH_BUFFER_SIZE);
+	FillRandom(pBuffer, 5);
+	SHA256 pWhole;
+	SHA256 pPieces;
+	pWhole.update(pBuffer.data(), pBuffer.size());
+	for (size_t nOffset = 0, nLength = 1; nOffset < pBuffer.size(); nOffset += nLength, nLength = nLength * 3 + 1)
+		pPieces.update(pBuffer.data() + nOffset, min(nLength, pBuffer.size() - nOffset));
+	const bool bUpdates = (pWhole.digest() == pPieces.digest());
+	wprintf(L"SHA256: test vectors %s, split updates %s\n", bVectors ? L"passed" : L"FAILED", bUpdates ? L"passed" : L"FAILED");
+
+	const size_t nTotalSize = (size_t)nMegabytes * 1048576;
+	wprintf(L"SHA256: %.0f MiB/s\n", MeasureThroughput(pBuffer, nTotalSize,
+		[](const unsigned char* pData, const size_t nLength)
+		{
+			SHA256 pSHA256;
+			pSHA256.update(pData, nLength);
+			g_nBenchResult = g_nBenchResult ^ pSHA256.digest()[0];
+		}));
+	// The dedup path hashes every chunk on its own
+	wprintf(L"SHA256 per %u-byte chunk: %.0f MiB/s\n", (unsigned int)CHUNKER_AVG_SIZE, MeasureThroughput(pBuffer, nTotalSize,
+		[](const unsigned char* pData, const size_t nLength)
+		{
+			for (size_t nOffset = 0; nOffset < nLength; nOffset += CHUNKER_AVG_SIZE)
+			{
+				SHA256 pSHA256;
+				pSHA256.update(pData + nOffset, min((size_t)CHUNKER_AVG_SIZE, nLength - nOffset));
+				g_nBenchResult = g_nBenchResult ^ pSHA256.digest()[0];
+			}
+		}));
+	return (bVectors && bUpdates) ? 0 : 1;
+}
+
+/**
+ * @brief Bytes one upload puts on the wire, counted the way UploadFile sends them
+ */
+typedef struct {
+	unsigned long long nSent;     // Client to server
+	unsigned long long nReceived; // Server to client
+	unsigned int nChunks;         // Chunks of the file
+	unsigned int nNeeded;         // Chunks the server asked for
+	unsigned long long nNeededBytes; // Bytes of those chunks
+} UPLOAD_BYTES;
+
+/**
+ * @brief Counts the bytes of an upload with PROTOCOL_WINDOW | PROTOCOL_LARGE_FRAME | PROTOCOL_DEDUP | PROTOCOL_CDC |
+ *        PROTOCOL_RESUME | PROTOCOL_RESULT, and stores its chunks on the modelled server
+ * @param pFile Contents of the file
+ * @param pStored [in/out] SHA256 of the chunks the server stores
+ * @return The bytes in each direction
+ * @details Every STX/ETX packet costs 5 bytes more than its payload and is answered by one ACK; every data frame
+ *          costs a FRAME_HEADER and is answered by a FRAME_ACK. The server asks once for each chunk it lacks, even
+ *          when the file repeats it (ExchangeChunkHashes on the server).
+ */
+UPLOAD_BYTES CountUploadBytes(const std::vector<unsigned char>& pFile, std::set<std::array<uint8_t, 32>>& pStored)
+{
+	UPLOAD_BYTES pBytes = { 0, 0, 0, 0, 0 };
+	const CContentChunker pChunker;
+	std::vector<std::array<uint8_t, 32>> pHashes;
+	std::vector<size_t> pLengths = CutChunks(pChunker, pFile.data(), pFile.size());
+	size_t nOffset = 0;
+	for (const size_t nLength : pLengths)
+	{
+		SHA256 pSHA256;
+		pSHA256.update(&pFile[nOffset], nLength);
+		pHashes.push_back(pSHA256.digest());
+		nOffset += nLength;
+	}
+	pBytes.nChunks = (unsigned int)pHashes.size();
+	std::set<std::array<uint8_t, 32>> pRequested;
+	for (size_t nIndex = 0; nIndex < pHashes.size(); nIndex++)
+	{
+		if ((pStored.find(pHashes[nIndex]) == pStored.end()) && pRequested.insert(pHashes[nIndex]).second)
+		{
+			pBytes.nNeeded++;
+			pBytes.nNeededBytes += pLengths[nIndex];
+		}
+	}
+	pStored.insert(pHashes.begin(), pHashes.end());
+
+	// ENQ, "Upload", file name, file length, upload session
+	const unsigned long long pPackets[] = { strlen("Upload") + 1, strlen(EDITS_FILE_NAME) + 1, sizeof(unsigned long long), sizeof(UPLOAD_SESSION) };
+	pBytes.nSent += 1;
+	pBytes.nReceived += 1;
+	for (const unsigned long long nPayload : pPackets)
+	{
+		pBytes.nSent += nPayload + 5;
+		pBytes.nReceived += 1;
+	}
+	pBytes.nReceived += sizeof(UPLOAD_SESSION) + 5;
+	pBytes.nSent += 1;
+	// Have/need exchange: the chunk entries, then a bitmap for each packet
+	for (size_t nFirst = 0; nFirst < pHashes.size(); nFirst += DEDUP_ENTRIES_PER_PACKET)
+	{
+		const size_t nCount = min(pHashes.size() - nFirst, (size_t)DEDUP_ENTRIES_PER_PACKET);
+		pBytes.nSent += nCount * sizeof(CHUNK_ENTRY) + 5;
+		pBytes.nReceived += 1;
+		pBytes.nReceived += (nCount + 7) / 8 + 5;
+		pBytes.nSent += 1;
+	}
+	// The chunks the server lacks, back to back in data frames
+	const unsigned long long nFrames = (pBytes.nNeededBytes + UPLOAD_FRAME_SIZE - 1) / UPLOAD_FRAME_SIZE;
+	pBytes.nSent += pBytes.nNeededBytes + nFrames * sizeof(FRAME_HEADER);
+	pBytes.nReceived += nFrames * sizeof(FRAME_ACK);
+	// SHA256 of the file and EOT, then the UPLOAD_RESULT and EOT
+	pBytes.nSent += 64 + 1 + 5 + 1;
+	pBytes.nReceived += 1;
+	pBytes.nReceived += sizeof(UPLOAD_RESULT) + 5 + 1;
+	pBytes.nSent += 1;
+	return pBytes;
+}
+
+/**
+ * @brief Reports the bytes a deduplicated upload sends after a small edit, an append and an insert
+ * @param nMegabytes Size of the largest file, in MiB
+ * @return 0 if every edit only sent the chunks around it
+ * @details The files are 1 MiB, 8 MiB, 64 MiB, ... up to nMegabytes. Each one is uploaded once, then each edit is
+ *          uploaded against the chunks of the first upload: CHUNKER_EDIT_SIZE bytes overwritten in the middle,
+ *          EDITS_APPEND_SIZE bytes appended, and CHUNKER_EDIT_SIZE bytes inserted in the middle.
+ */
+int BenchEdits(const int nMegabytes)
+{
+	bool bResult = true;
+	const CContentChunker pChunker;
+	std::vector<unsigned char> pInsert(max(CHUNKER_EDIT_SIZE, EDITS_APPEND_SIZE));
+	FillRandom(pInsert, 7);
+	wprintf(L"%10s  %-9s %15s %14s %14s %9s %12s\n", L"File", L"Edit", L"Chunks sent", L"Chunk bytes", L"Bytes sent", L"% of file", L"Bytes back");
+	for (size_t nSize = 1; nSize <= (size_t)nMegabytes; nSize *= 8)
+	{
+		std::vector<unsigned char> pFile(nSize * 1048576);
+		FillRandom(pFile, 6 + nSize);
+		std::set<std::array<uint8_t, 32>> pStored;
+		const UPLOAD_BYTES pFirst = CountUploadBytes(pFile, pStored);
+		for (int nEdit = 0; nEdit < 4; nEdit++)
+		{
+			const wchar_t* lpszEdit = L"first";
+			std::vector<unsigned char> pEdited(pFile);
+			size_t nMaxNeeded = pFirst.nChunks;
+			const size_t nMiddle = pFile.size() / 2;
+			switch (nEdit)
+			{
+			case 1:
+				lpszEdit = L"overwrite";
+				std::copy(pInsert.begin(), pInsert.begin() + CHUNKER_EDIT_SIZE, pEdited.begin() + nMiddle);
+				nMaxNeeded = 3;
+				break;
+			case 2:
+				lpszEdit = L"append";
+				pEdited.insert(pEdited.end(), pInsert.begin(), pInsert.begin() + EDITS_APPEND_SIZE);
+				// The last chunk of the file, then the new bytes in chunks of at least the minimum size
+				nMaxNeeded = 1 + EDITS_APPEND_SIZE / pChunker.GetMinSize() + 1;
+				break;
+			case 3:
+				lpszEdit = L"insert";
+				pEdited.insert(pEdited.begin() + nMiddle, pInsert.begin(), pInsert.begin() + CHUNKER_EDIT_SIZE);
+				nMaxNeeded = 3;
+				break;
+			}
+			std::set<std::array<uint8_t, 32>> pServer(pStored);
+			const UPLOAD_BYTES pBytes = (nEdit == 0) ? pFirst : CountUploadBytes(pEdited, pServer);
+			const bool bBounded = (pBytes.nNeeded <= nMaxNeeded);
+			bResult = bResult && bBounded;
+			wchar_t lpszFile[0x20] = { 0, };
+			wchar_t lpszChunks[0x20] = { 0, };
+			swprintf_s(lpszFile, L"%u MiB", (unsigned int)nSize);
+			swprintf_s(lpszChunks, L"%u/%u", pBytes.nNeeded, pBytes.nChunks);
+			wprintf(L"%10s  %-9s %15s %14llu %14llu %8.3f%% %12llu%s\n", lpszFile, lpszEdit, lpszChunks,
+				pBytes.nNeededBytes, pBytes.nSent, pBytes.nSent * 100.0 / pEdited.size(), pBytes.nReceived, bBounded ? L"" : L"  FAILED");
+		}
+	}
+	return bResult ? 0 : 1;
+}
+
+/**
+ * @brief One direction of a delay relay: bytes received from hFrom are sent to hTo nDelay microseconds later,
+ *        after the bytes before them, at nBytesPerSecond
+ */
+typedef struct {
+	SOCKET hFrom;                 // Socket the bytes come from
+	SOCKET hTo;                   // Socket they go to
+	DWORD nDelay;                 // One-way delay, in microseconds
+	unsigned long long nBytesPerSecond; // Bandwidth of the link, 0 for none
+	std::chrono::steady_clock::time_point nLinkFree; // When the link has passed on the bytes queued so far
+	SRWLOCK pLock;                // Protects pPending and bClosed
+	CONDITION_VARIABLE pReady;    // Signalled when bytes arrive or hFrom closes
+	std::deque<std::pair<std::chrono::steady_clock::time_point, std::vector<char>>> pPending; // Bytes and when to send them
+	bool bClosed;                 // hFrom was closed; the sender stops once pPending is empty
+} RELAY_PIPE;
+
+/**
+ * @brief Relay between a client socket and the server, adding half the round-trip time in each direction
+ */
+typedef struct {
+	SOCKET hClient;          // End handed to the benchmark
+	SOCKET hAccepted;        // Relay end of hClient
+	SOCKET hServer;          // Relay end of the server connection
+	RELAY_PIPE pUpstream;    // hAccepted -> hServer
+	RELAY_PIPE pDownstream;  // hServer -> hAccepted
+	HANDLE hThreads[4];      // Receive and send thread of each pipe
+} DELAY_RELAY;
+
+/**
+ * @brief Relay receive thread: queues what arrives with the time it is due
+ * @param lpParam The RELAY_PIPE
+ * @return 0 on thread exit
+ */
+DWORD WINAPI RelayReceiveThread(LPVOID lpParam)
+{
+	RELAY_PIPE* pPipe = (RELAY_PIPE*)lpParam;
+	std::vector<char> pBuffer(0x10000);
+	int nCount = 0;
+	while ((nCount = recv(pPipe->hFrom, pBuffer.data(), (int)pBuffer.size(), 0)) > 0)
+	{
+		auto nDue = std::chrono::steady_clock::now();
+		if (pPipe->nBytesPerSecond > 0)
+		{
+			// The bytes leave the link once it has passed on those before them
+			pPipe->nLinkFree = max(pPipe->nLinkFree, nDue) + std::chrono::microseconds(nCount * 1000000ULL / pPipe->nBytesPerSecond);
+			nDue = pPipe->nLinkFree;
+		}
+		nDue += std::chrono::microseconds(pPipe->nDelay);
+		AcquireSRWLockExclusive(&pPipe->pLock);
+		pPipe->pPending.emplace_back(nDue, std::vector<char>(pBuffer.begin(), pBuffer.begin() + nCount));
+		ReleaseSRWLockExclusive(&pPipe->pLock);
+		WakeConditionVariable(&pPipe->pReady);
+	}
+	AcquireSRWLockExclusive(&pPipe->pLock);
+	pPipe->bClosed = true;
+	ReleaseSRWLockExclusive(&pPipe->pLock);
+	WakeConditionVariable(&pPipe->pReady);
+	return 0;
+}
+
+/**
+ * @brief Relay send thread: sends the queued bytes once they are due
+ * @param lpParam The RELAY_PIPE
+ * @return 0 on thread exit
+ */
+DWORD WINAPI RelaySendThread(LPVOID lpParam)
+{
+	RELAY_PIPE* pPipe = (RELAY_PIPE*)lpParam;
+	bool bSending = true;
+	for (;;)
+	{
+		AcquireSRWLockExclusive(&pPipe->pLock);
+		while (pPipe->pPending.empty() && !pPipe->bClosed)
+			SleepConditionVariableSRW(&pPipe->pReady, &pPipe->pLock, INFINITE, 0);
+		if (pPipe->pPending.empty())
+		{
+			ReleaseSRWLockExclusive(&pPipe->pLock);
+			break;
+		}
+		auto pNext = std::move(pPipe->pPending.front());
+		pPipe->pPending.pop_front();
+		ReleaseSRWLockExclusive(&pPipe->pLock);
+		std::this_thread::sleep_until(pNext.first);
+		// Once the receiver is gone, the rest is only drained
+		bSending = bSending && SendAll(pPipe->hTo, pNext.second.data(), (int)pNext.second.size());
+	}
+	shutdown(pPipe->hTo, SD_SEND);
+	return 0;
+}
+
+/**
+ * @brief Opens a connection to the server through a delay relay
+ * @param pRelay [out] The relay; pRelay.hClient is the connection
+ * @param nRoundTrip Round-trip time added by the relay, in milliseconds
+ * @param nMegabits Bandwidth of the link in each direction, in Mbit/s (0: no limit)
+ * @return true on success
+ * @details The relay reads as fast as the bytes arrive; without nMegabits it only adds latency
+ */
+bool OpenRelay(DELAY_RELAY& pRelay, const DWORD nRoundTrip, const int nMegabits = 0)
+{
+	pRelay.hClient = pRelay.hAccepted = pRelay.hServer = INVALID_SOCKET;
+	SOCKET hListener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	sockaddr_in pAddress = { 0, };
+	pAddress.sin_family = AF_INET;
+	pAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	int nAddressLength = sizeof(pAddress);
+	const BOOL bNoDelay = TRUE;
+	if ((INVALID_SOCKET == hListener) ||
+		(bind(hListener, (const sockaddr*)&pAddress, sizeof(pAddress)) == SOCKET_ERROR) ||
+		(getsockname(hListener, (sockaddr*)&pAddress, &nAddressLength) == SOCKET_ERROR) ||
+		(listen(hListener, 1) == SOCKET_ERROR) ||
+		((pRelay.hClient = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) == INVALID_SOCKET) ||
+		(connect(pRelay.hClient, (const sockaddr*)&pAddress, sizeof(pAddress)) == SOCKET_ERROR) ||
+		((pRelay.hAccepted = accept(hListener, nullptr, nullptr)) == INVALID_SOCKET) ||
+		((pRelay.hServer = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) == INVALID_SOCKET) ||
+		(connect(pRelay.hServer, (const sockaddr*)&g_pServerAddress, sizeof(g_pServerAddress)) == SOCKET_ERROR))
+	{
+		for (SOCKET hSocket : { hListener, pRelay.hClient, pRelay.hAccepted, pRelay.hServer })
+		{
+			if (INVALID_SOCKET != hSocket)
+				closesocket(hSocket);
+		}
+		return false;
+	}
+	closesocket(hListener);
+	const DWORD nTimeout = SOCKET_TIMEOUT;
+	setsockopt(pRelay.hClient, SOL_SOCKET, SO_RCVTIMEO, (const char*)&nTimeout, sizeof(nTimeout));
+	for (SOCKET hSocket : { pRelay.hClient, pRelay.hAccepted, pRelay.hServer })
+		setsockopt(hSocket, IPPROTO_TCP, TCP_NODELAY, (const char*)&bNoDelay, sizeof(bNoDelay));
+
+	RELAY_PIPE* pPipes[2] = { &pRelay.pUpstream, &pRelay.pDownstream };
+	pRelay.pUpstream.hFrom = pRelay.pDownstream.hTo = pRelay.hAccepted;
+	pRelay.pUpstream.hTo = pRelay.pDownstream.hFrom = pRelay.hServer;
+	for (int nIndex = 0; nIndex < 2; nIndex++)
+	{
+		pPipes[nIndex]->nDelay = nRoundTrip * 500;
+		pPipes[nIndex]->nBytesPerSecond = (unsigned long long)nMegabits * 1000000 / 8;
+		pPipes[nIndex]->nLinkFree = std::chrono::steady_clock::now();
+		InitializeSRWLock(&pPipes[nIndex]->pLock);
+		InitializeConditionVariable(&pPipes[nIndex]->pReady);
+		pPipes[nIndex]->bClosed = false;
+		pRelay.hThreads[2 * nIndex] = CreateThread(nullptr, 0, RelayReceiveThread, pPipes[nIndex], 0, nullptr);
+		pRelay.hThreads[2 * nIndex + 1] = CreateThread(nullptr, 0, RelaySendThread, pPipes[nIndex], 0, nullptr);
+	}
+	return true;
+}
+
+/**
+ * @brief Closes the connection and stops the relay
+ * @param pRelay The relay
+ */
+void CloseRelay(DELAY_RELAY& pRelay)
+{
+	closesocket(pRelay.hClient);
+	// The upstream pipe passes the close on to the server; the server side is then cut off as well
+	WaitForMultipleObjects(2, &pRelay.hThreads[0], TRUE, INFINITE);
+	shutdown(pRelay.hServer, SD_BOTH);
+	shutdown(pRelay.hAccepted, SD_BOTH);
+	WaitForMultipleObjects(2, &pRelay.hThreads[2], TRUE, INFINITE);
+	for (int nIndex = 0; nIndex < 4; nIndex++)
+		CloseHandle(pRelay.hThreads[nIndex]);
+	closesocket(pRelay.hAccepted);
+	closesocket(pRelay.hServer);
+}
+
+/**
+ * @brief Logs in and proposes protocol options ("IntelliDisk", machine ID + PROTOCOL_OPTIONS, EOT)
+ * @param hSocket The socket
+ * @param strMachineID Unique machine ID of the connection
+ * @param pOptions [in/out] Proposed options; the options the server accepted (nFlags = 0: none)
+ * @return true on success
+ */
+bool LoginWithOptions(SOCKET hSocket, const std::string& strMachineID, PROTOCOL_OPTIONS& pOptions)
+{
+	if (0 == pOptions.nFlags)
+		return Login(hSocket, strMachineID);
+	std::vector<unsigned char> pPayload(strMachineID.begin(), strMachineID.end());
+	pPayload.push_back(0);
+	pPayload.insert(pPayload.end(), (const unsigned char*)&pOptions, (const unsigned char*)&pOptions + sizeof(pOptions));
+	std::vector<unsigned char> pReply;
+	const size_t nCommandLength = strlen("IntelliDisk") + 1;
+	// The server answers with ENQ, "IntelliDisk" + the accepted options, EOT
+	if (!SendCommand(hSocket, "IntelliDisk") ||
+		!SendPacket(hSocket, pPayload.data(), (int)pPayload.size()) ||
+		!SendByte(hSocket, EOT) ||
+		!ReceiveByte(hSocket, ENQ) || !SendByte(hSocket, ACK) ||
+		!ReceivePacket(hSocket, pReply, 0) || !ReceiveByte(hSocket, EOT) ||
+		(pReply.size() != nCommandLength + sizeof(pOptions)))
+		return false;
+	memcpy(&pOptions, &pReply[nCommandLength], sizeof(pOptions));
+	if ((pOptions.nFlags & PROTOCOL_WINDOW) == 0)
+		pOptions.nWindowSize = 0;
+	if ((pOptions.nFlags & PROTOCOL_LARGE_FRAME) == 0)
+		pOptions.nFrameSize = LEGACY_FRAME_SIZE;
+	return true;
+}
+
+/**
+ * @brief Checksum of a data frame (same as CFrameWindow::GetChecksum)
+ */
+unsigned int GetFrameChecksum(const PROTOCOL_OPTIONS& pOptions, const FRAME_HEADER* pHeader, const unsigned char* pPayload)
+{
+	if ((pOptions.nFlags & PROTOCOL_CRC32C) == 0)
+		return calcLRC(pPayload, pHeader->nLength);
+	return calcCRC32C(pPayload, pHeader->nLength, calcCRC32C((const unsigned char*)pHeader, offsetof(FRAME_HEADER, nChecksum)));
+}
+
+/**
+ * @brief Sends file data: stop-and-wait packets, or data frames with the negotiated window
+ * @param hSocket The socket
+ * @param pOptions Negotiated options
+ * @param pData The data
+ * @param nLength Number of bytes
+ * @param pAcknowledged [out] If given, returns once the last frame is sent, without waiting for the acknowledgements
+ *        still missing, and stores the bytes acknowledged so far
+ * @return true once every packet or frame was acknowledged (or sent)
+ */
+bool SendFileData(SOCKET hSocket, const PROTOCOL_OPTIONS& pOptions, const unsigned char* pData, const size_t nLength, size_t* pAcknowledged = nullptr)
+{
+	if (0 == pOptions.nWindowSize)
+	{
+		for (size_t nOffset = 0; nOffset < nLength; nOffset += LEGACY_FRAME_SIZE)
+		{
+			if (!SendPacket(hSocket, pData + nOffset, (int)min(nLength - nOffset, (size_t)LEGACY_FRAME_SIZE)))
+				return false;
+		}
+		if (nullptr != pAcknowledged)
+			*pAcknowledged = nLength;
+		return true;
+	}
+	std::vector<unsigned char> pFrame(sizeof(FRAME_HEADER) + pOptions.nFrameSize);
+	FRAME_HEADER* pHeader = (FRAME_HEADER*)pFrame.data();
+	unsigned int nBaseSequence = 0;
+	unsigned int nNextSequence = 0;
+	for (size_t nOffset = 0; (nOffset < nLength) || (nBaseSequence != nNextSequence); )
+	{
+		if ((nOffset == nLength) && (nullptr != pAcknowledged))
+		{
+			*pAcknowledged = min((size_t)nBaseSequence * pOptions.nFrameSize, nLength);
+			return true;
+		}
+		if ((nOffset < nLength) && (nNextSequence - nBaseSequence < pOptions.nWindowSize))
+		{
+			ZeroMemory(pHeader, sizeof(FRAME_HEADER));
+			pHeader->nStart = SOH;
+			pHeader->nSequence = nNextSequence++;
+			pHeader->nLength = (unsigned int)min(nLength - nOffset, (size_t)pOptions.nFrameSize);
+			memcpy(&pFrame[sizeof(FRAME_HEADER)], pData + nOffset, pHeader->nLength);
+			pHeader->nChecksum = GetFrameChecksum(pOptions, pHeader, &pFrame[sizeof(FRAME_HEADER)]);
+			if (!SendAll(hSocket, pFrame.data(), (int)(sizeof(FRAME_HEADER) + pHeader->nLength)))
+				return false;
+			nOffset += pHeader->nLength;
+			continue;
+		}
+		// The acknowledgement is cumulative; TCP delivers in order, so there is nothing to resend
+		FRAME_ACK pFrameAck = { 0, 0 };
+		if (!ReceiveAll(hSocket, &pFrameAck, sizeof(pFrameAck)) || (ACK != pFrameAck.nReturn))
+			return false;
+		nBaseSequence = pFrameAck.nSequence + 1;
+	}
+	return true;
+}
+
+/**
+ * @brief Receives file data: stop-and-wait packets, or data frames acknowledged one by one
+ * @param hSocket The socket
+ * @param pOptions Negotiated options
+ * @param nLength Number of bytes
+ * @param pSHA256 [in/out] Updated with the data
+ * @param nAckDelay Milliseconds to wait per MiB received, before the acknowledgement that completes it (a slow client)
+ * @return true if every packet or frame was valid
+ */
+bool ReceiveFileData(SOCKET hSocket, const PROTOCOL_OPTIONS& pOptions, const unsigned long long nLength, SHA256& pSHA256, const DWORD nAckDelay = 0)
+{
+	std::vector<unsigned char> pPayload;
+	unsigned int nSequence = 0;
+	for (unsigned long long nOffset = 0; nOffset < nLength; nOffset += pPayload.size())
+	{
+		if (0 == pOptions.nWindowSize)
+		{
+			if (!ReceivePacket(hSocket, pPayload, nAckDelay, nOffset) || pPayload.empty())
+				return false;
+		}
+		else
+		{
+			FRAME_HEADER pHeader = { 0, };
+			if (!ReceiveAll(hSocket, &pHeader, sizeof(pHeader)) || (SOH != pHeader.nStart) ||
+				(pHeader.nSequence != nSequence) || (pHeader.nLength == 0) || (pHeader.nLength > pOptions.nFrameSize))
+				return false;
+			pPayload.resize(pHeader.nLength);
+			const FRAME_ACK pFrameAck = { ACK, nSequence++ };
+			if (!ReceiveAll(hSocket, pPayload.data(), (int)pPayload.size()) ||
+				(GetFrameChecksum(pOptions, &pHeader, pPayload.data()) != pHeader.nChecksum))
+				return false;
+			if ((nAckDelay > 0) && ((nOffset + pPayload.size()) / 0x100000 != nOffset / 0x100000))
+				Sleep(nAckDelay);
+			if (!SendAll(hSocket, &pFrameAck, sizeof(pFrameAck)))
+				return false;
+		}
+		pSHA256.update(pPayload.data(), pPayload.size());
+	}
+	return true;
+}
+
+/**
+ * @brief Uploads a file without deduplication, then pings so the server has stored it on return
+ * @return true on success
+ */
+bool UploadData(SOCKET hSocket, const PROTOCOL_OPTIONS& pOptions, const char* lpszFileName, const std::vector<unsigned char>& pData)
+{
+	SHA256 pSHA256;
+	pSHA256.update(pData.data(), pData.size());
+	const std::string strDigestSHA256 = SHA256::toString(pSHA256.digest());
+	const unsigned long long nFileLength = pData.size();
+	return SendCommand(hSocket, "Upload") &&
+		SendPacket(hSocket, lpszFileName, (int)strlen(lpszFileName) + 1) &&
+		SendPacket(hSocket, &nFileLength, sizeof(nFileLength)) &&
+		SendFileData(hSocket, pOptions, pData.data(), pData.size()) &&
+		SendPacket(hSocket, strDigestSHA256.c_str(), (int)strDigestSHA256.length() + 1) &&
+		SendByte(hSocket, EOT) &&
+		Ping(hSocket);
+}
+
+/**
+ * @brief Downloads a file and checks it against the SHA256 the server sends
+ * @param nExpected Expected length of the file
+ * @param nAckDelay Milliseconds to wait per MiB received (see ReceiveFileData)
+ * @return true if the file arrived whole
+ */
+bool DownloadData(SOCKET hSocket, const PROTOCOL_OPTIONS& pOptions, const char* lpszFileName, const unsigned long long nExpected, const std::string& strDigestSHA256, const DWORD nAckDelay = 0)
+{
+	SHA256 pSHA256;
+	std::vector<unsigned char> pPayload;
+	unsigned long long nFileLength = 0;
+	if (!SendCommand(hSocket, "Download") ||
+		!SendPacket(hSocket, lpszFileName, (int)strlen(lpszFileName) + 1) ||
+		!ReceivePacket(hSocket, pPayload, 0) || (pPayload.size() != sizeof(nFileLength)))
+		return false;
+	memcpy(&nFileLength, pPayload.data(), sizeof(nFileLength));
+	if ((nFileLength != nExpected) ||
+		!ReceiveFileData(hSocket, pOptions, nFileLength, pSHA256, nAckDelay) ||
+		!ReceivePacket(hSocket, pPayload, 0) || !ReceiveByte(hSocket, EOT))
+		return false;
+	pPayload.push_back(0);
+	const std::string strReceived = SHA256::toString(pSHA256.digest());
+	return (strReceived == (const char*)pPayload.data()) && (strReceived == strDigestSHA256);
+}
+
+/**
+ * @brief Deletes a file, then pings so the deletion is known to be done
+ * @param hSocket The socket (logged in)
+ * @param lpszFileName Path of the file on the server
+ * @return true once the server answered the ping
+ */
+bool DeleteData(SOCKET hSocket, const char* lpszFileName)
+{
+	return SendCommand(hSocket, "Delete") &&
+		SendPacket(hSocket, lpszFileName, (int)strlen(lpszFileName) + 1) &&
+		SendByte(hSocket, EOT) &&
+		Ping(hSocket);
+}
+
+// A subscriber of the broadcast test
+typedef struct {
+	SOCKET hSocket;            // Logged in with PROTOCOL_RESYNC
+	PROTOCOL_OPTIONS pOptions; // Options the server accepted
+	int nDownloads;            // "NotifyDownload" received, with the whole file
+	int nResyncs;              // "NotifyResync" received
+	unsigned long long nManifestFiles; // Files listed by the last manifest
+	double nLastTime;          // Milliseconds from the first upload of the round to the last notification
+	bool bFailed;              // A notification was not understood, or the server sent "Restart"
+} NOTIFY_SUBSCRIBER;
+
+/**
+ * @brief Receives the notifications the server pushes, until none arrives for NOTIFY_IDLE_TIMEOUT
+ * @param pSubscriber The subscriber (its socket times out after NOTIFY_IDLE_TIMEOUT)
+ * @details Answers "NotifyDownload" with the download that follows it, "NotifyDelete" with its path,
+ *          and "NotifyResync" with the manifest: "filepath\0" + 64-bit size entries
+ */
+void ReceiveNotifications(NOTIFY_SUBSCRIBER& pSubscriber)
+{
+	const SOCKET hSocket = pSubscriber.hSocket;
+	std::vector<unsigned char> pPayload;
+	while (!pSubscriber.bFailed && ReceiveByte(hSocket, ENQ))
+	{
+		pSubscriber.bFailed = true;
+		if (!SendByte(hSocket, ACK) || !ReceivePacket(hSocket, pPayload, 0))
+			break;
+		pPayload.push_back(0);
+		const std::string strCommand = (const char*)pPayload.data();
+		if (strCommand.compare("NotifyDownload") == 0)
+		{
+			SHA256 pSHA256;
+			unsigned long long nFileLength = 0;
+			if (!ReceivePacket(hSocket, pPayload, 0) ||
+				!ReceivePacket(hSocket, pPayload, 0) || (pPayload.size() != sizeof(nFileLength)))
+				break;
+			memcpy(&nFileLength, pPayload.data(), sizeof(nFileLength));
+			if (!ReceiveFileData(hSocket, pSubscriber.pOptions, nFileLength, pSHA256) ||
+				!ReceivePacket(hSocket, pPayload, 0) || !ReceiveByte(hSocket, EOT))
+				break;
+			pPayload.push_back(0);
+			if (SHA256::toString(pSHA256.digest()) != (const char*)pPayload.data())
+				break;
+			pSubscriber.nDownloads++;
+		}
+		else if (strCommand.compare("NotifyDelete") == 0)
+		{
+			if (!ReceivePacket(hSocket, pPayload, 0))
+				break;
+		}
+		else if (strCommand.compare("NotifyResync") == 0)
+		{
+			unsigned long long nFileCount = 0;
+			if (!ReceivePacket(hSocket, pPayload, 0) || (pPayload.size() != sizeof(nFileCount)))
+				break;
+			memcpy(&nFileCount, pPayload.data(), sizeof(nFileCount));
+			unsigned long long nFileIndex = 0;
+			while ((nFileIndex < nFileCount) && ReceivePacket(hSocket, pPayload, 0))
+			{
+				for (size_t nOffset = 0; nOffset < pPayload.size(); nFileIndex++)
+				{
+					const size_t nPathLength = strnlen((const char*)&pPayload[nOffset], pPayload.size() - nOffset);
+					nOffset += nPathLength + 1 + sizeof(unsigned long long);
+				}
+			}
+			if (nFileIndex != nFileCount)
+				break;
+			pSubscriber.nResyncs++;
+			pSubscriber.nManifestFiles = nFileCount;
+		}
+		else
+		{
+			// "Restart": the server gave up on the subscriber
+			break;
+		}
+		pSubscriber.bFailed = false;
+		pSubscriber.nLastTime = ElapsedMilliseconds(g_nNotifyStart);
+	}
+}
+
+/**
+ * @brief Subscriber thread of the broadcast test
+ * @param lpParam The subscriber (NOTIFY_SUBSCRIBER)
+ * @return 0 on thread exit
+ */
+DWORD WINAPI SubscriberThread(LPVOID lpParam)
+{
+	ReceiveNotifications(*(NOTIFY_SUBSCRIBER*)lpParam);
+	return 0;
+}
+
+/**
+ * @brief Runs one round of the broadcast test
+ * @param nRound Round number, part of the file names
+ * @param nSubscribers Number of subscribers that read their notifications
+ * @param nFiles Number of files uploaded
+ * @param bStalled true to add a subscriber that reads nothing until the uploads are done
+ * @return true if every healthy subscriber received every file, and the stalled one a resync
+ * @details The healthy subscribers are timed from the first upload to their last notification,
+ *          so a stalled subscriber that slows them down shows up as a lower rate
+ */
+bool BroadcastRound(const int nRound, const int nSubscribers, const int nFiles, const bool bStalled)
+{
+	const int nCount = nSubscribers + (bStalled ? 1 : 0);
+	std::vector<NOTIFY_SUBSCRIBER> pSubscribers(nCount);
+	bool bResult = true;
+	for (int nIndex = 0; nIndex < nCount; nIndex++)
+	{
+		NOTIFY_SUBSCRIBER& pSubscriber = pSubscribers[nIndex];
+		ZeroMemory(&pSubscriber, sizeof(pSubscriber));
+		pSubscriber.pOptions = { PROTOCOL_VERSION, PROTOCOL_WINDOW | PROTOCOL_CRC32C | PROTOCOL_RESYNC, THROUGHPUT_WINDOW_SIZE, LEGACY_FRAME_SIZE };
+		char lpszMachineID[0x20] = { 0, };
+		sprintf_s(lpszMachineID, "IntelliBench-notify-%02d", nIndex);
+		pSubscriber.hSocket = OpenConnection(nIndex);
+		if ((INVALID_SOCKET == pSubscriber.hSocket) || !LoginWithOptions(pSubscriber.hSocket, lpszMachineID, pSubscriber.pOptions) ||
+			((pSubscriber.pOptions.nFlags & PROTOCOL_RESYNC) == 0))
+		{
+			wprintf(L"Subscriber %d could not log in with PROTOCOL_RESYNC\n", nIndex);
+			bResult = false;
+		}
+		const DWORD nTimeout = NOTIFY_IDLE_TIMEOUT;
+		setsockopt(pSubscriber.hSocket, SOL_SOCKET, SO_RCVTIMEO, (const char*)&nTimeout, sizeof(nTimeout));
+	}
+	SOCKET hUploadSocket = OpenConnection(nCount);
+	if ((INVALID_SOCKET == hUploadSocket) || !Login(hUploadSocket, "IntelliBench-upload"))
+		bResult = false;
+	if (!bResult)
+	{
+		for (NOTIFY_SUBSCRIBER& pSubscriber : pSubscribers)
+			closesocket(pSubscriber.hSocket);
+		closesocket(hUploadSocket);
+		return false;
+	}
+
+	// The stalled subscriber is the last one; it gets no thread until the uploads are done
+	std::vector<HANDLE> hThreads(nSubscribers);
+	g_nNotifyStart = std::chrono::steady_clock::now();
+	for (int nIndex = 0; nIndex < nSubscribers; nIndex++)
+		hThreads[nIndex] = CreateThread(nullptr, 0, SubscriberThread, &pSubscribers[nIndex], 0, nullptr);
+	const PROTOCOL_OPTIONS pLegacy = { 1, 0, 0, LEGACY_FRAME_SIZE };
+	std::vector<unsigned char> pFileData(NOTIFY_FILE_SIZE);
+	int nUploaded = 0;
+	for (; nUploaded < nFiles; nUploaded++)
+	{
+		char lpszFileName[0x40] = { 0, };
+		sprintf_s(lpszFileName, NOTIFY_FILE_NAME, nRound, nUploaded);
+		FillRandom(pFileData, ((unsigned long long)nRound << 32) + nUploaded + 1);
+		if (!UploadData(hUploadSocket, pLegacy, lpszFileName, pFileData))
+			break;
+	}
+	const double nUploadTime = ElapsedMilliseconds(g_nNotifyStart);
+	WaitForMultipleObjects(nSubscribers, hThreads.data(), TRUE, INFINITE);
+	for (HANDLE hThread : hThreads)
+		CloseHandle(hThread);
+	if (bStalled)
+		ReceiveNotifications(pSubscribers.back());
+	closesocket(hUploadSocket);
+	for (NOTIFY_SUBSCRIBER& pSubscriber : pSubscribers)
+		closesocket(pSubscriber.hSocket);
+
+	// Healthy subscribers: every file, no resync; the rate is that of the slowest one
+	int nComplete = 0;
+	double nSlowestTime = 0;
+	for (int nIndex = 0; nIndex < nSubscribers; nIndex++)
+	{
+		const NOTIFY_SUBSCRIBER& pSubscriber = pSubscribers[nIndex];
+		if (!pSubscriber.bFailed && (pSubscriber.nDownloads == nUploaded) && (0 == pSubscriber.nResyncs))
+			nComplete++;
+		nSlowestTime = max(nSlowestTime, pSubscriber.nLastTime);
+	}
+	bResult = (nUploaded == nFiles) && (nComplete == nSubscribers);
+	wprintf(L"%-22s %6d uploaded in %6.1f s (%6.0f files/s), %2d/%d subscribers got every file at %6.0f files/s: %s\n",
+		bStalled ? L"1 stalled subscriber:" : L"No stalled subscriber:", nUploaded, nUploadTime / 1000, nUploaded * 1000 / nUploadTime,
+		nComplete, nSubscribers, (nSlowestTime > 0) ? nUploaded * 1000 / nSlowestTime : 0.0, bResult ? L"ok" : L"FAILED");
+	if (bStalled)
+	{
+		// Its queue overflowed, so the server must have replaced the events with one manifest of every file
+		const NOTIFY_SUBSCRIBER& pSubscriber = pSubscribers.back();
+		const bool bResync = !pSubscriber.bFailed && (pSubscriber.nResyncs > 0) && (pSubscriber.nManifestFiles >= (unsigned long long)nUploaded);
+		wprintf(L"%-22s %d downloads, %d resyncs, manifest of %llu files: %s\n", L"Stalled subscriber:",
+			pSubscriber.nDownloads, pSubscriber.nResyncs, pSubscriber.nManifestFiles, bResync ? L"ok" : L"FAILED");
+		bResult = bResult && bResync;
+	}
+	return bResult;
+}
+
+/**
+ * @brief Runs the broadcast test: a round with healthy subscribers only, then one with a stalled subscriber
+ * @param nSubscribers Number of healthy subscribers
+ * @param nFiles Files uploaded per round; more than the server's NotifyQueueLimit, or the stalled queue never overflows
+ * @return true if both rounds passed
+ */
+bool BroadcastTest(const int nSubscribers, const int nFiles)
+{
+	wprintf(L"Broadcast: %d subscribers, %d files of %d bytes per round\n", nSubscribers, nFiles, NOTIFY_FILE_SIZE);
+	const bool bHealthy = BroadcastRound(1, nSubscribers, nFiles, false);
+	const bool bStalled = BroadcastRound(2, nSubscribers, nFiles, true);
+	return bHealthy && bStalled;
+}
+
+/**
+ * @brief Churn thread: connects, logs in, pings and resets connections until the phase is done
+ * @param lpParam Unused parameter
+ * @return 0 on thread exit
+ */
+DWORD WINAPI ChurnThread(LPVOID lpParam)
+{
+	UNREFERENCED_PARAMETER(lpParam);
+	for (int nCycle = g_nNextConnection++; nCycle < g_nChurnEnd; nCycle = g_nNextConnection++)
+	{
+		const auto nStart = std::chrono::steady_clock::now();
+		char lpszMachineID[0x20] = { 0, };
+		sprintf_s(lpszMachineID, "IntelliBench-churn-%07d", nCycle);
+		SOCKET hSocket = OpenConnection(0);
+		const bool bResult = (INVALID_SOCKET != hSocket) && Login(hSocket, lpszMachineID) && Ping(hSocket);
+		if (INVALID_SOCKET != hSocket)
+		{
+			// Reset instead of a graceful close: a million closes would leave as many ports in TIME_WAIT
+			const linger pLinger = { 1, 0 };
+			setsockopt(hSocket, SOL_SOCKET, SO_LINGER, (const char*)&pLinger, sizeof(pLinger));
+			closesocket(hSocket);
+		}
+		if (!bResult)
+			g_nLoginFailures++;
+		g_pLoginTimes[nCycle - g_nChurnStart] = ElapsedMilliseconds(nStart);
+	}
+	return 0;
+}
+
+/**
+ * @brief Runs the churn test: nCycles connections, each one logged in, pinged and reset
+ * @param lpszServer IPv4 address of the server
+ * @param nPort Service port of the server
+ * @param nCycles Number of connect/disconnect cycles
+ * @param dwProcessID Process ID of the server, to report its memory use (0 = not reported)
+ * @return 0 if every cycle got its ping answered, every upload succeeded, the median upload took at most
+ *         CHURN_UPLOAD_GROWTH times that of the first phase and, given the process ID, the server's
+ *         working set grew by at most CHURN_MEMORY_GROWTH after the first phase
+ * @details The cycles run on LOGIN_THREADS threads in CHURN_PHASES phases. After each phase, one more
+ *          connection uploads CHURN_UPLOADS files of NOTIFY_FILE_SIZE; the server broadcasts each one to
+ *          the live sessions, so the upload times show the cost of a broadcast. For each phase it prints
+ *          the cycle rate, the connect + login + ping and upload percentiles and the server's memory.
+ *          Past 65,536 cycles, every connection needs a slot released by an earlier one
+ */
+int ChurnTest(const wchar_t* lpszServer, const int nPort, const int nCycles, const DWORD dwProcessID)
+{
+	WSADATA pWSAData = { 0, };
+	if (WSAStartup(MAKEWORD(2, 2), &pWSAData) != 0)
+		return 1;
+	ZeroMemory(&g_pServerAddress, sizeof(g_pServerAddress));
+	g_pServerAddress.sin_family = AF_INET;
+	g_pServerAddress.sin_port = htons((u_short)nPort);
+	if ((nCycles <= 0) || (InetPtonW(AF_INET, lpszServer, &g_pServerAddress.sin_addr) != 1))
+	{
+		wprintf(L"Invalid parameters\n");
+		WSACleanup();
+		return 1;
+	}
+	g_bLoopback = ((ntohl(g_pServerAddress.sin_addr.s_addr) >> 24) == 127);
+	SIZE_T nWorkingSet = 0, nPrivateBytes = 0;
+	const bool bMemory = GetServerMemory(dwProcessID, nWorkingSet, nPrivateBytes);
+	if (bMemory)
+		wprintf(L"Server: working set %.1f MiB, private bytes %.1f MiB\n", nWorkingSet / 1048576.0, nPrivateBytes / 1048576.0);
+
+	PROTOCOL_OPTIONS pOptions = { PROTOCOL_VERSION, PROTOCOL_WINDOW | PROTOCOL_CRC32C, THROUGHPUT_WINDOW_SIZE, LEGACY_FRAME_SIZE };
+	SOCKET hUploader = OpenConnection(0);
+	if ((INVALID_SOCKET == hUploader) || !LoginWithOptions(hUploader, "IntelliBench-churn-uploader", pOptions))
+	{
+		wprintf(L"The uploader could not log in\n");
+		if (INVALID_SOCKET != hUploader)
+			closesocket(hUploader);
+		WSACleanup();
+		return 1;
+	}
+	std::vector<unsigned char> pData(NOTIFY_FILE_SIZE);
+	FillRandom(pData, 11);
+
+	SIZE_T nFirstWorkingSet = 0;
+	double nFirstUploadTime = 0, nUploadTime = 0;
+	int nUploadFailures = 0;
+	bool bResult = true;
+	g_nNextConnection = 0;
+	g_nLoginFailures = 0;
+	for (int nPhase = 0; nPhase < CHURN_PHASES; nPhase++)
+	{
+		g_nChurnStart = (int)((long long)nCycles * nPhase / CHURN_PHASES);
+		g_nChurnEnd = (int)((long long)nCycles * (nPhase + 1) / CHURN_PHASES);
+		if (g_nChurnEnd == g_nChurnStart)
+			continue;
+		const int nFailures = g_nLoginFailures;
+		g_pLoginTimes.assign(g_nChurnEnd - g_nChurnStart, 0);
+		const auto nStart = std::chrono::steady_clock::now();
+		HANDLE hChurnThreads[LOGIN_THREADS] = { nullptr, };
+		for (int nIndex = 0; nIndex < LOGIN_THREADS; nIndex++)
+			hChurnThreads[nIndex] = CreateThread(nullptr, 0, ChurnThread, nullptr, 0, nullptr);
+		WaitForMultipleObjects(LOGIN_THREADS, hChurnThreads, TRUE, INFINITE);
+		for (int nIndex = 0; nIndex < LOGIN_THREADS; nIndex++)
+			CloseHandle(hChurnThreads[nIndex]);
+		const double nElapsed = ElapsedMilliseconds(nStart);
+		wprintf(L"Cycles %d-%d: %.0f cycles/s, %d failed\n", g_nChurnStart + 1, g_nChurnEnd,
+			(g_nChurnEnd - g_nChurnStart) * 1000 / nElapsed, g_nLoginFailures - nFailures);
+		PrintPercentiles(L"Connect + login + ping", g_pLoginTimes);
+		std::vector<double> pUploadTimes;
+		for (int nUpload = 0; nUpload < CHURN_UPLOADS; nUpload++)
+		{
+			char lpszFileName[0x40] = { 0, };
+			sprintf_s(lpszFileName, CHURN_FILE_NAME, nUpload);
+			const auto nUploadStart = std::chrono::steady_clock::now();
+			if (UploadData(hUploader, pOptions, lpszFileName, pData))
+				pUploadTimes.push_back(ElapsedMilliseconds(nUploadStart));
+			else
+				nUploadFailures++;
+		}
+		PrintPercentiles(L"Upload + broadcast", pUploadTimes);
+		if (!pUploadTimes.empty())
+		{
+			nUploadTime = pUploadTimes[pUploadTimes.size() / 2];
+			if (0 == nFirstUploadTime)
+				nFirstUploadTime = nUploadTime;
+		}
+		if (bMemory && GetServerMemory(dwProcessID, nWorkingSet, nPrivateBytes))
+		{
+			if (0 == nFirstWorkingSet)
+				nFirstWorkingSet = nWorkingSet;
+			wprintf(L"Server: working set %.1f MiB (%+.1f MiB since the first phase), private bytes %.1f MiB\n",
+				nWorkingSet / 1048576.0, ((double)nWorkingSet - nFirstWorkingSet) / 1048576.0, nPrivateBytes / 1048576.0);
+		}
+	}
+	closesocket(hUploader);
+	if (g_nLoginFailures > 0)
+	{
+		wprintf(L"%d of %d cycles failed\n", g_nLoginFailures.load(), nCycles);
+		bResult = false;
+	}
+	if ((nUploadFailures > 0) || (nUploadTime > CHURN_UPLOAD_GROWTH * nFirstUploadTime))
+	{
+		wprintf(L"%d uploads failed, median upload %.3f ms after the first phase, %.3f ms after the last\n",
+			nUploadFailures, nFirstUploadTime, nUploadTime);
+		bResult = false;
+	}
+	if (bMemory && (nWorkingSet > nFirstWorkingSet + CHURN_MEMORY_GROWTH))
+	{
+		wprintf(L"The server's working set grew by %.1f MiB after the first phase\n", (nWorkingSet - nFirstWorkingSet) / 1048576.0);
+		bResult = false;
+	}
+	wprintf(L"Churn: %s\n", bResult ? L"ok" : L"FAILED");
+	WSACleanup();
+	return bResult ? 0 : 1;
+}
+
+/**
+ * @brief Parses a comma-separated list of integers
+ * @param lpszList The list, for example "0,1,10,50"
+ * @return The integers, in the order of the list
+ */
+std::vector<int> ParseIntegers(const wchar_t* lpszList)
+{
+	std::vector<int> pIntegers;
+	for (const wchar_t* lpszNext = lpszList; *lpszNext != 0; )
+	{
+		wchar_t* lpszEnd = nullptr;
+		pIntegers.push_back((int)wcstol(lpszNext, &lpszEnd, 10));
+		lpszNext = (*lpszEnd == L',') ? lpszEnd + 1 : lpszEnd + wcslen(lpszEnd);
+	}
+	return pIntegers;
+}
+
+/**
+ * @brief Measures upload and download throughput through a delay relay, for each round-trip time and frame mode
+ * @param lpszServer IPv4 address of the server
+ * @param nPort Service port of the server
+ * @param nMegabytes Size of the file transferred, in MiB
+ * @param lpszRoundTrips Comma-separated round-trip times, in milliseconds
+ * @param lpszFrameSizes Comma-separated sizes of the PROTOCOL_LARGE_FRAME modes, in KiB
+ * @return 0 if every transfer succeeded
+ * @details Each measurement opens a new connection through the relay, logs in with the mode's options,
+ *          uploads the file, downloads it again and checks its SHA256. The `large` modes propose
+ *          THROUGHPUT_WINDOW_SIZE frames; the server shrinks the window of large frames, so the Window
+ *          column shows what it accepted
+ */
+int BenchThroughput(const wchar_t* lpszServer, const int nPort, const int nMegabytes, const wchar_t* lpszRoundTrips, const wchar_t* lpszFrameSizes)
+{
+	WSADATA pWSAData = { 0, };
+	if (WSAStartup(MAKEWORD(2, 2), &pWSAData) != 0)
+		return 1;
+	ZeroMemory(&g_pServerAddress, sizeof(g_pServerAddress));
+	g_pServerAddress.sin_family = AF_INET;
+	g_pServerAddress.sin_port = htons((u_short)nPort);
+	const std::vector<int> pFrameSizes = ParseIntegers(lpszFrameSizes);
+	if ((InetPtonW(AF_INET, lpszServer, &g_pServerAddress.sin_addr) != 1) ||
+		std::any_of(pFrameSizes.begin(), pFrameSizes.end(), [](const int nFrameSize) { return (nFrameSize <= 0) || (nFrameSize * 1024 > MAX_FRAME_SIZE); }))
+	{
+		wprintf(L"Invalid parameters\n");
+		WSACleanup();
+		return 1;
+	}
+	const std::vector<int> pRoundTrips = ParseIntegers(lpszRoundTrips);
+	std::vector<unsigned char> pData((size_t)nMegabytes * 1048576);
+	FillRandom(pData, 8);
+	SHA256 pSHA256;
+	pSHA256.update(pData.data(), pData.size());
+	const std::string strDigestSHA256 = SHA256::toString(pSHA256.digest());
+
+	typedef struct {
+		const wchar_t* lpszName;
+		PROTOCOL_OPTIONS pOptions;
+	} FRAME_MODE;
+	std::vector<FRAME_MODE> pModes = {
+		{ L"legacy", { 1, 0, 0, LEGACY_FRAME_SIZE } },
+		{ L"window", { PROTOCOL_VERSION, PROTOCOL_WINDOW | PROTOCOL_CRC32C, THROUGHPUT_WINDOW_SIZE, LEGACY_FRAME_SIZE } },
+	};
+	for (const int nFrameSize : pFrameSizes)
+		pModes.push_back({ L"large", { PROTOCOL_VERSION, PROTOCOL_WINDOW | PROTOCOL_CRC32C | PROTOCOL_LARGE_FRAME, THROUGHPUT_WINDOW_SIZE, (unsigned int)nFrameSize * 1024 } });
+	int nFailures = 0;
+	wprintf(L"%6s  %-14s %6s %9s %14s %14s\n", L"RTT", L"Mode", L"Window", L"Frame", L"Upload MiB/s", L"Download MiB/s");
+	for (const int nRoundTrip : pRoundTrips)
+	{
+		for (const FRAME_MODE& pMode : pModes)
+		{
+			DELAY_RELAY pRelay;
+			PROTOCOL_OPTIONS pOptions = pMode.pOptions;
+			if (!OpenRelay(pRelay, (DWORD)max(nRoundTrip, 0)))
+			{
+				wprintf(L"%3d ms  %-14s %6s %9u connection failed\n", nRoundTrip, pMode.lpszName, L"-", pMode.pOptions.nFrameSize);
+				nFailures++;
+				continue;
+			}
+			double nUpload = 0, nDownload = 0;
+			bool bResult = LoginWithOptions(pRelay.hClient, "IntelliBench-throughput", pOptions);
+			auto nStart = std::chrono::steady_clock::now();
+			bResult = bResult && UploadData(pRelay.hClient, pOptions, THROUGHPUT_FILE_NAME, pData);
+			nUpload = nMegabytes / (ElapsedMilliseconds(nStart) / 1000);
+			nStart = std::chrono::steady_clock::now();
+			bResult = bResult && DownloadData(pRelay.hClient, pOptions, THROUGHPUT_FILE_NAME, pData.size(), strDigestSHA256);
+			nDownload = nMegabytes / (ElapsedMilliseconds(nStart) / 1000);
+			CloseRelay(pRelay);
+			if (bResult)
+				wprintf(L"%3d ms  %-14s %6u %9u %14.1f %14.1f\n", nRoundTrip, pMode.lpszName, pOptions.nWindowSize, pOptions.nFrameSize, nUpload, nDownload);
+			else
+			{
+				wprintf(L"%3d ms  %-14s %6s %9u FAILED\n", nRoundTrip, pMode.lpszName, L"-", pMode.pOptions.nFrameSize);
+				nFailures++;
+			}
+		}
+	}
+	WSACleanup();
+	return (0 == nFailures) ? 0 : 1;
+}
+
+/**
+ * @brief Times downloads while the server's fetch stage and the client's acknowledgements are both slowed down
+ * @param lpszServer IPv4 address of the server
+ * @param nPort Service port of the server
+ * @param nMegabytes Size of the file downloaded, in MiB
+ * @param nFetchDelay The server's FetchDelay (IntelliDisk.xml), in milliseconds per MiB
+ * @param nAckDelay Milliseconds the client waits per MiB before the acknowledgement that completes it
+ * @return 0 if every check passed
+ * @details A fetch stage that waits nFetchDelay per MiB takes F = nMegabytes * nFetchDelay, a client that waits nAckDelay
+ *          per MiB takes S = nMegabytes * nAckDelay. Each mode is downloaded first by a fast client, in T0, which must be at
+ *          least 90% of F, or the server does not run with that FetchDelay. A server that fetches between sends needs
+ *          T0 + S for the slow client; the read-ahead pipeline fetches while the client waits, so the download must hide
+ *          at least PIPELINE_HIDDEN_SHARE of the shorter of F and S
+ */
+int BenchPipeline(const wchar_t* lpszServer, const int nPort, const int nMegabytes, const int nFetchDelay, const int nAckDelay)
+{
+	WSADATA pWSAData = { 0, };
+	if (WSAStartup(MAKEWORD(2, 2), &pWSAData) != 0)
+		return 1;
+	ZeroMemory(&g_pServerAddress, sizeof(g_pServerAddress));
+	g_pServerAddress.sin_family = AF_INET;
+	g_pServerAddress.sin_port = htons((u_short)nPort);
+	if ((nFetchDelay < 0) || (nAckDelay < 0) || (InetPtonW(AF_INET, lpszServer, &g_pServerAddress.sin_addr) != 1))
+	{
+		wprintf(L"Invalid parameters\n");
+		WSACleanup();
+		return 1;
+	}
+	std::vector<unsigned char> pData((size_t)nMegabytes * 1048576);
+	FillRandom(pData, 9);
+	SHA256 pSHA256;
+	pSHA256.update(pData.data(), pData.size());
+	const std::string strDigestSHA256 = SHA256::toString(pSHA256.digest());
+	PROTOCOL_OPTIONS pUploadOptions = { PROTOCOL_VERSION, PROTOCOL_WINDOW | PROTOCOL_CRC32C | PROTOCOL_LARGE_FRAME, THROUGHPUT_WINDOW_SIZE, UPLOAD_FRAME_SIZE };
+	SOCKET hSocket = OpenConnection(0);
+	const bool bUploaded = (INVALID_SOCKET != hSocket) && LoginWithOptions(hSocket, "IntelliBench-pipeline", pUploadOptions) &&
+		UploadData(hSocket, pUploadOptions, PIPELINE_FILE_NAME, pData);
+	if (INVALID_SOCKET != hSocket)
+		closesocket(hSocket);
+	if (!bUploaded)
+	{
+		wprintf(L"Upload of %hs failed\n", PIPELINE_FILE_NAME);
+		WSACleanup();
+		return 1;
+	}
+
+	typedef struct {
+		const wchar_t* lpszName;
+		PROTOCOL_OPTIONS pOptions;
+	} FRAME_MODE;
+	const FRAME_MODE pModes[] = {
+		{ L"legacy", { 1, 0, 0, LEGACY_FRAME_SIZE } },
+		{ L"window", { PROTOCOL_VERSION, PROTOCOL_WINDOW | PROTOCOL_CRC32C | PROTOCOL_LARGE_FRAME, THROUGHPUT_WINDOW_SIZE, UPLOAD_FRAME_SIZE } },
+	};
+	const double nFetchTime = nMegabytes * nFetchDelay / 1000.0;
+	int nFailures = 0;
+	wprintf(L"%d MiB, fetch %d ms/MiB, client %d ms/MiB\n", nMegabytes, nFetchDelay, nAckDelay);
+	wprintf(L"%-8s %10s %10s %10s %10s %10s %8s %8s\n", L"Mode", L"Client", L"Fetch s", L"Client s", L"Serial s", L"Measured s", L"Hidden", L"Check");
+	for (const FRAME_MODE& pMode : pModes)
+	{
+		double nBaseline = 0;
+		const int pAckDelays[] = { 0, nAckDelay };
+		for (const int nDelay : pAckDelays)
+		{
+			PROTOCOL_OPTIONS pOptions = pMode.pOptions;
+			hSocket = OpenConnection(0);
+			const auto nStart = std::chrono::steady_clock::now();
+			bool bResult = (INVALID_SOCKET != hSocket) && LoginWithOptions(hSocket, "IntelliBench-pipeline", pOptions) &&
+				DownloadData(hSocket, pOptions, PIPELINE_FILE_NAME, pData.size(), strDigestSHA256, nDelay);
+			const double nElapsed = ElapsedMilliseconds(nStart) / 1000;
+			if (INVALID_SOCKET != hSocket)
+				closesocket(hSocket);
+			const double nClientTime = nMegabytes * nDelay / 1000.0;
+			const double nShorter = min(nFetchTime, nClientTime);
+			wchar_t lpszHidden[32] = L"-";
+			if (0 == nDelay)
+			{
+				nBaseline = nElapsed;
+				bResult = bResult && (nElapsed >= 0.9 * nFetchTime);
+			}
+			else if (nShorter > 0)
+			{
+				const double nHidden = (nBaseline + nClientTime - nElapsed) / nShorter;
+				swprintf_s(lpszHidden, L"%.0f%%", 100 * nHidden);
+				bResult = bResult && (nHidden >= PIPELINE_HIDDEN_SHARE);
+			}
+			if (!bResult)
+				nFailures++;
+			wprintf(L"%-8s %7d ms %10.2f %10.2f %10.2f %10.2f %8s %8s\n", pMode.lpszName, nDelay, nFetchTime, nClientTime,
+				nBaseline + nClientTime, nElapsed, lpszHidden, bResult ? L"ok" : L"FAILED");
+		}
+	}
+	WSACleanup();
+	return (0 == nFailures) ? 0 : 1;
+}
+
+/**
+ * @brief Times uploads, downloads and deletions of small files, one after the other on one connection
+ * @param lpszServer IPv4 address of the server
+ * @param nPort Service port of the server
+ * @param nFiles Number of files
+ * @return 0 if every operation succeeded and every download matched its SHA256
+ * @details Each operation of a small file is a few database statements, so the time the server
+ *          needs to get a database connection dominates. Run it once with DatabasePool set to 1 and
+ *          once with 0 in IntelliDisk.xml, restarting the server in between, to compare
+ */
+int BenchSmallFiles(const wchar_t* lpszServer, const int nPort, const int nFiles)
+{
+	WSADATA pWSAData = { 0, };
+	if (WSAStartup(MAKEWORD(2, 2), &pWSAData) != 0)
+		return 1;
+	ZeroMemory(&g_pServerAddress, sizeof(g_pServerAddress));
+	g_pServerAddress.sin_family = AF_INET;
+	g_pServerAddress.sin_port = htons((u_short)nPort);
+	if ((nFiles <= 0) || (InetPtonW(AF_INET, lpszServer, &g_pServerAddress.sin_addr) != 1))
+	{
+		wprintf(L"Invalid parameters\n");
+		WSACleanup();
+		return 1;
+	}
+	std::vector<unsigned char> pData(SMALL_FILE_SIZE);
+	FillRandom(pData, 13);
+	SHA256 pSHA256;
+	pSHA256.update(pData.data(), pData.size());
+	const std::string strDigestSHA256 = SHA256::toString(pSHA256.digest());
+	PROTOCOL_OPTIONS pOptions = { PROTOCOL_VERSION, PROTOCOL_WINDOW | PROTOCOL_CRC32C, THROUGHPUT_WINDOW_SIZE, LEGACY_FRAME_SIZE };
+	SOCKET hSocket = OpenConnection(0);
+	if ((INVALID_SOCKET == hSocket) || !LoginWithOptions(hSocket, "IntelliBench-small", pOptions))
+	{
+		wprintf(L"Login failed\n");
+		if (INVALID_SOCKET != hSocket)
+			closesocket(hSocket);
+		WSACleanup();
+		return 1;
+	}
+
+	const wchar_t* pOperations[] = { L"Upload", L"Download", L"Delete" };
+	int nFailures = 0;
+	double nTotalTime = 0;
+	wprintf(L"%d files of %d bytes\n", nFiles, SMALL_FILE_SIZE);
+	wprintf(L"%-10s %10s %10s %10s %10s %8s\n", L"Operation", L"ops/s", L"p50 ms", L"p99 ms", L"max ms", L"Failed");
+	for (int nOperation = 0; nOperation < (int)_countof(pOperations); nOperation++)
+	{
+		std::vector<double> pTimes;
+		int nFailed = 0;
+		const auto nStart = std::chrono::steady_clock::now();
+		for (int nFile = 0; nFile < nFiles; nFile++)
+		{
+			char lpszFileName[0x40] = { 0, };
+			sprintf_s(lpszFileName, SMALL_FILE_NAME, nFile);
+			const auto nOperationStart = std::chrono::steady_clock::now();
+			bool bResult = false;
+			if (0 == nOperation)
+				bResult = UploadData(hSocket, pOptions, lpszFileName, pData);
+			else if (1 == nOperation)
+				bResult = DownloadData(hSocket, pOptions, lpszFileName, pData.size(), strDigestSHA256);
+			else
+				bResult = DeleteData(hSocket, lpszFileName);
+			if (bResult)
+				pTimes.push_back(ElapsedMilliseconds(nOperationStart));
+			else
+				nFailed++;
+		}
+		const double nElapsed = ElapsedMilliseconds(nStart);
+		nTotalTime += nElapsed;
+		nFailures += nFailed;
+		std::sort(pTimes.begin(), pTimes.end());
+		if (pTimes.empty())
+			pTimes.push_back(0);
+		wprintf(L"%-10s %10.0f %10.3f %10.3f %10.3f %8d\n", pOperations[nOperation], nFiles * 1000 / nElapsed,
+			pTimes[pTimes.size() / 2], pTimes[pTimes.size() * 99 / 100], pTimes.back(), nFailed);
+	}
+	closesocket(hSocket);
+	wprintf(L"All: %.0f ops/s, %s\n", 3 * nFiles * 1000 / nTotalTime, (0 == nFailures) ? L"ok" : L"FAILED");
+	WSACleanup();
+	return (0 == nFailures) ? 0 : 1;
+}
+
+/**
+ * @brief Measures the rate of large files into and out of the store
+ * @param lpszServer IPv4 address of the server
+ * @param nPort Service port of the server
+ * @param nMegabytes Size of the file, in MiB
+ * @return 0 if every transfer succeeded
+ * @details Each run opens a new direct connection, uploads the file, downloads it again and checks its SHA256.
+ *          On a loopback connection the network costs little, so the rates are those of the server and its
+ *          database: the chunk INSERTs of an upload, the SELECT of a download. The fastest of BENCH_RUNS runs
+ *          is reported for each frame mode
+ */
+int BenchStore(const wchar_t* lpszServer, const int nPort, const int nMegabytes)
+{
+	WSADATA pWSAData = { 0, };
+	if (WSAStartup(MAKEWORD(2, 2), &pWSAData) != 0)
+		return 1;
+	ZeroMemory(&g_pServerAddress, sizeof(g_pServerAddress));
+	g_pServerAddress.sin_family = AF_INET;
+	g_pServerAddress.sin_port = htons((u_short)nPort);
+	if (InetPtonW(AF_INET, lpszServer, &g_pServerAddress.sin_addr) != 1)
+	{
+		wprintf(L"Invalid parameters\n");
+		WSACleanup();
+		return 1;
+	}
+	std::vector<unsigned char> pData((size_t)nMegabytes * 1048576);
+	FillRandom(pData, 14);
+	SHA256 pSHA256;
+	pSHA256.update(pData.data(), pData.size());
+	const std::string strDigestSHA256 = SHA256::toString(pSHA256.digest());
+
+	typedef struct {
+		const wchar_t* lpszName;
+		PROTOCOL_OPTIONS pOptions;
+	} FRAME_MODE;
+	const FRAME_MODE pModes[] = {
+		{ L"legacy", { 1, 0, 0, LEGACY_FRAME_SIZE } },
+		{ L"window", { PROTOCOL_VERSION, PROTOCOL_WINDOW | PROTOCOL_CRC32C | PROTOCOL_LARGE_FRAME, THROUGHPUT_WINDOW_SIZE, UPLOAD_FRAME_SIZE } },
+	};
+	int nFailures = 0;
+	wprintf(L"%d MiB, fastest of %d runs\n", nMegabytes, BENCH_RUNS);
+	wprintf(L"%-8s %6s %9s %14s %14s\n", L"Mode", L"Window", L"Frame", L"Upload MiB/s", L"Download MiB/s");
+	for (const FRAME_MODE& pMode : pModes)
+	{
+		PROTOCOL_OPTIONS pOptions = pMode.pOptions;
+		double nUpload = 0, nDownload = 0;
+		bool bResult = true;
+		for (int nRun = 0; bResult && (nRun < BENCH_RUNS); nRun++)
+		{
+			pOptions = pMode.pOptions;
+			SOCKET hSocket = OpenConnection(0);
+			bResult = (INVALID_SOCKET != hSocket) && LoginWithOptions(hSocket, "IntelliBench-store", pOptions);
+			auto nStart = std::chrono::steady_clock::now();
+			bResult = bResult && UploadData(hSocket, pOptions, STORE_FILE_NAME, pData);
+			if (bResult)
+				nUpload = max(nUpload, nMegabytes / (ElapsedMilliseconds(nStart) / 1000));
+			nStart = std::chrono::steady_clock::now();
+			bResult = bResult && DownloadData(hSocket, pOptions, STORE_FILE_NAME, pData.size(), strDigestSHA256);
+			if (bResult)
+				nDownload = max(nDownload, nMegabytes / (ElapsedMilliseconds(nStart) / 1000));
+			if (INVALID_SOCKET != hSocket)
+				closesocket(hSocket);
+		}
+		if (bResult)
+			wprintf(L"%-8s %6u %9u %14.1f %14.1f\n", pMode.lpszName, pOptions.nWindowSize, pOptions.nFrameSize, nUpload, nDownload);
+		else
+		{
+			wprintf(L"%-8s FAILED\n", pMode.lpszName);
+			nFailures++;
+		}
+	}
+	WSACleanup();
+	return (0 == nFailures) ? 0 : 1;
+}
+
+/**
+ * @brief Times a large upload once for each UploadBatchSize of the server
+ * @param lpszServer IPv4 address of the server
+ * @param nPort Service port of the server
+ * @param nMegabytes Size of the file, in MiB
+ * @param lpszBatchSizes Comma-separated batch sizes, in chunks per INSERT
+ * @return 0 if every transfer succeeded
+ * @details The server reads UploadBatchSize from IntelliDisk.xml when it starts. Before each batch size,
+ *          IntelliBench asks for it to be set and the server restarted, then waits for Enter or for the end of
+ *          its input, so a script that restarts the server can drive it. Each upload runs on a new connection
+ *          with 1 MiB frames. It is checked by a download, then deleted so the database does not grow
+ */
+int BenchBatch(const wchar_t* lpszServer, const int nPort, const int nMegabytes, const wchar_t* lpszBatchSizes)
+{
+	WSADATA pWSAData = { 0, };
+	if (WSAStartup(MAKEWORD(2, 2), &pWSAData) != 0)
+		return 1;
+	ZeroMemory(&g_pServerAddress, sizeof(g_pServerAddress));
+	g_pServerAddress.sin_family = AF_INET;
+	g_pServerAddress.sin_port = htons((u_short)nPort);
+	const std::vector<int> pBatchSizes = ParseIntegers(lpszBatchSizes);
+	if ((InetPtonW(AF_INET, lpszServer, &g_pServerAddress.sin_addr) != 1) ||
+		std::any_of(pBatchSizes.begin(), pBatchSizes.end(), [](const int nBatchSize) { return nBatchSize <= 0; }))
+	{
+		wprintf(L"Invalid parameters\n");
+		WSACleanup();
+		return 1;
+	}
+	std::vector<unsigned char> pData((size_t)nMegabytes * 1048576);
+	FillRandom(pData, 17);
+	SHA256 pSHA256;
+	pSHA256.update(pData.data(), pData.size());
+	const std::string strDigestSHA256 = SHA256::toString(pSHA256.digest());
+
+	typedef struct {
+		int nBatchSize;
+		bool bResult;
+		double nUploadTime;
+		double nDownloadTime;
+	} BATCH_RESULT;
+	std::vector<BATCH_RESULT> pResults;
+	for (const int nBatchSize : pBatchSizes)
+	{
+		wprintf(L"Set UploadBatchSize to %d in IntelliDisk.xml, restart the server and press Enter\n", nBatchSize);
+		fflush(stdout);
+		for (wint_t nChar = getwchar(); (nChar != L'\n') && (nChar != WEOF); nChar = getwchar());
+		BATCH_RESULT pResult = { nBatchSize, false, 0, 0 };
+		PROTOCOL_OPTIONS pOptions = { PROTOCOL_VERSION, PROTOCOL_WINDOW | PROTOCOL_CRC32C | PROTOCOL_LARGE_FRAME, THROUGHPUT_WINDOW_SIZE, UPLOAD_FRAME_SIZE };
+		SOCKET hSocket = OpenConnection(0);
+		pResult.bResult = (INVALID_SOCKET != hSocket) && LoginWithOptions(hSocket, "IntelliBench-batch", pOptions);
+		auto nStart = std::chrono::steady_clock::now();
+		pResult.bResult = pResult.bResult && UploadData(hSocket, pOptions, BATCH_FILE_NAME, pData);
+		pResult.nUploadTime = ElapsedMilliseconds(nStart) / 1000;
+		nStart = std::chrono::steady_clock::now();
+		pResult.bResult = pResult.bResult && DownloadData(hSocket, pOptions, BATCH_FILE_NAME, pData.size(), strDigestSHA256);
+		pResult.nDownloadTime = ElapsedMilliseconds(nStart) / 1000;
+		pResult.bResult = pResult.bResult && DeleteData(hSocket, BATCH_FILE_NAME);
+		if (INVALID_SOCKET != hSocket)
+			closesocket(hSocket);
+		pResults.push_back(pResult);
+	}
+
+	int nFailures = 0;
+	wprintf(L"%d MiB\n", nMegabytes);
+	wprintf(L"%6s %10s %14s %14s %8s\n", L"Batch", L"Upload s", L"Upload MiB/s", L"Download MiB/s", L"Check");
+	for (const BATCH_RESULT& pResult : pResults)
+	{
+		if (pResult.bResult)
+			wprintf(L"%6d %10.2f %14.1f %14.1f %8s\n", pResult.nBatchSize, pResult.nUploadTime,
+				nMegabytes / pResult.nUploadTime, nMegabytes / pResult.nDownloadTime, L"ok");
+		else
+		{
+			wprintf(L"%6d FAILED\n", pResult.nBatchSize);
+			nFailures++;
+		}
+	}
+	WSACleanup();
+	return (0 == nFailures) ? 0 : 1;
+}
+
+// The probe connection of the migration test
+typedef struct {
+	SOCKET hSocket;             // Logged in with the legacy handshake
+	std::string strDigest;      // SHA256 of MIGRATION_PROBE_NAME
+	std::atomic<bool> bStop;    // Set once the held upload is done
+	std::vector<double> pTimes; // Milliseconds of each download + ping
+	int nFailures;              // Rounds that failed
+} MIGRATION_PROBE;
+
+/**
+ * @brief Probe thread: downloads MIGRATION_PROBE_NAME and pings until told to stop
+ * @param lpParam The MIGRATION_PROBE
+ * @return 0 on thread exit
+ */
+DWORD WINAPI MigrationProbeThread(LPVOID lpParam)
+{
+	MIGRATION_PROBE* pProbe = (MIGRATION_PROBE*)lpParam;
+	const PROTOCOL_OPTIONS pOptions = { 0, 0, 0, LEGACY_FRAME_SIZE };
+	while (!pProbe->bStop && (0 == pProbe->nFailures))
+	{
+		const auto nStart = std::chrono::steady_clock::now();
+		if (DownloadData(pProbe->hSocket, pOptions, MIGRATION_PROBE_NAME, MIGRATION_PROBE_SIZE, pProbe->strDigest) && Ping(pProbe->hSocket))
+			pProbe->pTimes.push_back(ElapsedMilliseconds(nStart));
+		else
+			pProbe->nFailures++;
+	}
+	return 0;
+}
+
+/**
+ * @brief Keeps an upload transaction open while the server migrates a version 1 database
+ * @param lpszServer IPv4 address of the server
+ * @param nPort Service port of the server
+ * @param nHold Seconds the upload sends one packet per second
+ * @return 0 if every check passed
+ * @details Load IntelliDiskV1.sql into a test database, start the server on it and run this right away.
+ *          The upload sends MIGRATION_FAST_PACKETS legacy packets, then one packet per second for nHold
+ *          seconds, then MIGRATION_FAST_PACKETS more. Its transaction holds the metadata lock of `filedata`
+ *          all along, so the column rename of the migration times out and is tried again; the server TRACEs
+ *          each attempt. Meanwhile a probe connection downloads a file and pings, and each round is timed.
+ *          Then the upload must be published, and the file of IntelliDiskV1.sql must download with the bytes
+ *          the script created
+ */
+int BenchMigration(const wchar_t* lpszServer, const int nPort, const int nHold)
+{
+	WSADATA pWSAData = { 0, };
+	if (WSAStartup(MAKEWORD(2, 2), &pWSAData) != 0)
+		return 1;
+	ZeroMemory(&g_pServerAddress, sizeof(g_pServerAddress));
+	g_pServerAddress.sin_family = AF_INET;
+	g_pServerAddress.sin_port = htons((u_short)nPort);
+	if ((nHold < 0) || (InetPtonW(AF_INET, lpszServer, &g_pServerAddress.sin_addr) != 1))
+	{
+		wprintf(L"Invalid parameters\n");
+		WSACleanup();
+		return 1;
+	}
+	// Row n of IntelliDiskV1.sql repeats the SHA256 of the decimal n over LEGACY_FRAME_SIZE bytes
+	SHA256 pV1SHA256;
+	std::vector<unsigned char> pRow(LEGACY_FRAME_SIZE);
+	for (int nRow = 1; nRow <= MIGRATION_V1_ROWS; nRow++)
+	{
+		SHA256 pRowSHA256;
+		pRowSHA256.update(std::to_string(nRow));
+		const std::array<uint8_t, 32> pDigest = pRowSHA256.digest();
+		for (size_t nIndex = 0; nIndex < pRow.size(); nIndex++)
+			pRow[nIndex] = pDigest[nIndex % pDigest.size()];
+		pV1SHA256.update(pRow.data(), pRow.size());
+	}
+	const std::string strV1Digest = SHA256::toString(pV1SHA256.digest());
+	std::vector<unsigned char> pProbeData(MIGRATION_PROBE_SIZE);
+	FillRandom(pProbeData, 15);
+	std::vector<unsigned char> pData((size_t)(2 * MIGRATION_FAST_PACKETS + nHold) * LEGACY_FRAME_SIZE);
+	FillRandom(pData, 16);
+	SHA256 pSHA256;
+	pSHA256.update(pData.data(), pData.size());
+	const std::string strDigestSHA256 = SHA256::toString(pSHA256.digest());
+	SHA256 pProbeSHA256;
+	pProbeSHA256.update(pProbeData.data(), pProbeData.size());
+
+	// The probe file is stored before the upload connection logs in, so nobody is told to download it
+	const PROTOCOL_OPTIONS pOptions = { 0, 0, 0, LEGACY_FRAME_SIZE };
+	MIGRATION_PROBE pProbe;
+	pProbe.strDigest = SHA256::toString(pProbeSHA256.digest());
+	pProbe.bStop = false;
+	pProbe.nFailures = 0;
+	pProbe.hSocket = OpenConnection(0);
+	SOCKET hSocket = INVALID_SOCKET;
+	bool bResult = (INVALID_SOCKET != pProbe.hSocket) && Login(pProbe.hSocket, "IntelliBench-probe") &&
+		UploadData(pProbe.hSocket, pOptions, MIGRATION_PROBE_NAME, pProbeData);
+	if (bResult)
+	{
+		hSocket = OpenConnection(0);
+		bResult = (INVALID_SOCKET != hSocket) && Login(hSocket, "IntelliBench-migration");
+	}
+	if (!bResult)
+	{
+		wprintf(L"Login failed\n");
+		if (INVALID_SOCKET != pProbe.hSocket)
+			closesocket(pProbe.hSocket);
+		if (INVALID_SOCKET != hSocket)
+			closesocket(hSocket);
+		WSACleanup();
+		return 1;
+	}
+
+	const unsigned long long nFileLength = pData.size();
+	const size_t nFastLength = (size_t)MIGRATION_FAST_PACKETS * LEGACY_FRAME_SIZE;
+	const auto nStart = std::chrono::steady_clock::now();
+	HANDLE hThread = CreateThread(nullptr, 0, MigrationProbeThread, &pProbe, 0, nullptr);
+	bResult = (nullptr != hThread) &&
+		SendCommand(hSocket, "Upload") &&
+		SendPacket(hSocket, MIGRATION_FILE_NAME, (int)strlen(MIGRATION_FILE_NAME) + 1) &&
+		SendPacket(hSocket, &nFileLength, sizeof(nFileLength)) &&
+		SendFileData(hSocket, pOptions, pData.data(), nFastLength);
+	double nHoldTime = 0;
+	if (bResult)
+	{
+		wprintf(L"Upload of %hs open, holding it for %d s\n", MIGRATION_FILE_NAME, nHold);
+		const auto nHoldStart = std::chrono::steady_clock::now();
+		for (int nPacket = 0; bResult && (nPacket < nHold); nPacket++)
+		{
+			Sleep(1000);
+			bResult = SendFileData(hSocket, pOptions, pData.data() + nFastLength + (size_t)nPacket * LEGACY_FRAME_SIZE, LEGACY_FRAME_SIZE);
+		}
+		nHoldTime = ElapsedMilliseconds(nHoldStart) / 1000;
+	}
+	// The probe stops before the upload is published, or it would be told to download it
+	pProbe.bStop = true;
+	if (nullptr != hThread)
+	{
+		WaitForMultipleObjects(1, &hThread, TRUE, INFINITE);
+		CloseHandle(hThread);
+	}
+	closesocket(pProbe.hSocket);
+	const size_t nHeldLength = nFastLength + (size_t)nHold * LEGACY_FRAME_SIZE;
+	bResult = bResult &&
+		SendFileData(hSocket, pOptions, pData.data() + nHeldLength, pData.size() - nHeldLength) &&
+		SendPacket(hSocket, strDigestSHA256.c_str(), (int)strDigestSHA256.length() + 1) &&
+		SendByte(hSocket, EOT) &&
+		Ping(hSocket);
+	const double nUploadTime = ElapsedMilliseconds(nStart) / 1000;
+	const bool bPublished = bResult && DownloadData(hSocket, pOptions, MIGRATION_FILE_NAME, pData.size(), strDigestSHA256);
+	const bool bConverted = bResult && DownloadData(hSocket, pOptions, MIGRATION_V1_NAME, (unsigned long long)MIGRATION_V1_ROWS * LEGACY_FRAME_SIZE, strV1Digest);
+	closesocket(hSocket);
+
+	wprintf(L"Held upload: %.1f s held, %.1f s in all, %s\n", nHoldTime, nUploadTime, bPublished ? L"published" : L"FAILED");
+	PrintPercentiles(L"Probe download + ping", pProbe.pTimes);
+	wprintf(L"Probe failures: %d\n", pProbe.nFailures);
+	wprintf(L"%hs: %s\n", MIGRATION_V1_NAME, bConverted ? L"same bytes as IntelliDiskV1.sql" : L"FAILED");
+	const bool bPassed = bPublished && bConverted && (0 == pProbe.nFailures);
+	wprintf(L"Migration test %s\n", bPassed ? L"passed" : L"FAILED");
+	WSACleanup();
+	return bPassed ? 0 : 1;
+}
+
+/**
+ * @brief One attempt of a resumable upload (PROTOCOL_RESUME)
+ */
+typedef struct {
+	unsigned long long nToken;        // [in] Session to resume, 0 for none; [out] the session the server answered with
+	unsigned long long nOffset;       // [out] File offset the server continued from
+	unsigned long long nSent;         // [out] File position up to which data was sent
+	unsigned long long nAcknowledged; // [out] File position up to which data was acknowledged
+	unsigned long long nBytes;        // [out] Payload bytes sent (with PROTOCOL_DEDUP only the chunks the server asked for)
+} RESUME_ATTEMPT;
+
+/**
+ * @brief Maps payload bytes sent to the file position they reach
+ * @param pPieces File offset and length of each piece sent, in order
+ * @param nBytes Payload bytes
+ * @return The file position after the last of those bytes
+ */
+unsigned long long GetFilePosition(const std::vector<std::pair<unsigned long long, unsigned long long>>& pPieces, unsigned long long nBytes)
+{
+	unsigned long long nPosition = pPieces.empty() ? 0 : pPieces.front().first;
+	for (const auto& pPiece : pPieces)
+	{
+		if (nBytes == 0)
+			break;
+		const unsigned long long nCount = min(nBytes, pPiece.second);
+		nPosition = pPiece.first + nCount;
+		nBytes -= nCount;
+	}
+	return nPosition;
+}
+
+/**
+ * @brief Uploads a file, with PROTOCOL_RESUME continuing a session, and can stop partway
+ * @param hSocket The socket, logged in with PROTOCOL_RESULT and a window
+ * @param pOptions Negotiated options
+ * @param lpszFileName Name of the file on the server
+ * @param pData The file
+ * @param nKillFraction Part of the bytes after the offset to send before stopping; the caller then kills the connection
+ *        (1: no stop)
+ * @param pAttempt [in/out] The session (PROTOCOL_RESUME only) and what was sent
+ * @param bPublished [out] The server published the file (only when it was sent to the end)
+ * @return true on success
+ * @details With PROTOCOL_DEDUP the chunks after the offset are announced in CHUNK_ENTRY packets and only
+ *          those the server asks for are sent
+ */
+bool UploadResumable(SOCKET hSocket, const PROTOCOL_OPTIONS& pOptions, const char* lpszFileName, const std::vector<unsigned char>& pData, const double nKillFraction, RESUME_ATTEMPT& pAttempt, bool& bPublished)
+{
+	const unsigned long long nFileLength = pData.size();
+	UPLOAD_SESSION pSession = { pAttempt.nToken, 0 };
+	std::vector<unsigned char> pReply;
+	bPublished = false;
+	if (!SendCommand(hSocket, "Upload") ||
+		!SendPacket(hSocket, lpszFileName, (int)strlen(lpszFileName) + 1) ||
+		!SendPacket(hSocket, &nFileLength, sizeof(nFileLength)))
+		return false;
+	if ((pOptions.nFlags & PROTOCOL_RESUME) != 0)
+	{
+		if (!SendPacket(hSocket, &pSession, sizeof(pSession)) ||
+			!ReceivePacket(hSocket, pReply, 0) || (pReply.size() != sizeof(pSession)))
+			return false;
+		memcpy(&pSession, pReply.data(), sizeof(pSession));
+	}
+	pAttempt.nToken = pSession.nToken;
+	pAttempt.nOffset = pSession.nOffset;
+	if (pSession.nOffset > nFileLength)
+		return false;
+
+	// The pieces of the file to send, from the offset on
+	std::vector<std::pair<unsigned long long, unsigned long long>> pPieces;
+	if ((pOptions.nFlags & PROTOCOL_DEDUP) == 0)
+		pPieces.emplace_back(pSession.nOffset, nFileLength - pSession.nOffset);
+	else
+	{
+		const CContentChunker pChunker;
+		const std::vector<size_t> pLengths = CutChunks(pChunker, pData.data() + pSession.nOffset, (size_t)(nFileLength - pSession.nOffset));
+		unsigned long long nOffset = pSession.nOffset;
+		for (size_t nFirst = 0; nFirst < pLengths.size(); nFirst += DEDUP_ENTRIES_PER_PACKET)
+		{
+			const size_t nCount = min(pLengths.size() - nFirst, (size_t)DEDUP_ENTRIES_PER_PACKET);
+			std::vector<CHUNK_ENTRY> pEntries(nCount);
+			std::vector<unsigned long long> pOffsets(nCount);
+			for (size_t nIndex = 0; nIndex < nCount; nIndex++)
+			{
+				SHA256 pSHA256;
+				pSHA256.update(pData.data() + nOffset, pLengths[nFirst + nIndex]);
+				const std::array<uint8_t, 32> pHash = pSHA256.digest();
+				memcpy(pEntries[nIndex].pHash, pHash.data(), pHash.size());
+				pEntries[nIndex].nLength = (unsigned int)pLengths[nFirst + nIndex];
+				pOffsets[nIndex] = nOffset;
+				nOffset += pLengths[nFirst + nIndex];
+			}
+			// One bit per entry, set for the chunks to send
+			if (!SendPacket(hSocket, pEntries.data(), (int)(nCount * sizeof(CHUNK_ENTRY))) ||
+				!ReceivePacket(hSocket, pReply, 0) || (pReply.size() != (nCount + 7) / 8))
+				return false;
+			for (size_t nIndex = 0; nIndex < nCount; nIndex++)
+			{
+				if ((pReply[nIndex / 8] & (1 << (nIndex % 8))) != 0)
+					pPieces.emplace_back(pOffsets[nIndex], pEntries[nIndex].nLength);
+			}
+		}
+	}
+
+	// Send the pieces up to nKillAt
+	const bool bKill = (nKillFraction < 1) && (nFileLength - pSession.nOffset > 1);
+	const unsigned long long nKillAt = bKill ? pSession.nOffset + max((unsigned long long)((nFileLength - pSession.nOffset) * nKillFraction), 1ULL) : nFileLength;
+	std::vector<unsigned char> pPayload;
+	for (const auto& pPiece : pPieces)
+	{
+		if (pPiece.first >= nKillAt)
+			break;
+		const unsigned long long nCount = min(pPiece.second, nKillAt - pPiece.first);
+		pPayload.insert(pPayload.end(), pData.begin() + (size_t)pPiece.first, pData.begin() + (size_t)(pPiece.first + nCount));
+	}
+	size_t nAcknowledged = pPayload.size();
+	if (!SendFileData(hSocket, pOptions, pPayload.data(), pPayload.size(), bKill ? &nAcknowledged : nullptr))
+		return false;
+	pAttempt.nBytes = pPayload.size();
+	pAttempt.nSent = bKill ? nKillAt : nFileLength;
+	pAttempt.nAcknowledged = bKill ? GetFilePosition(pPieces, nAcknowledged) : nFileLength;
+	if (bKill)
+		return true;
+
+	SHA256 pSHA256;
+	pSHA256.update(pData.data(), pData.size());
+	const std::string strDigestSHA256 = SHA256::toString(pSHA256.digest());
+	UPLOAD_RESULT pResult = { UPLOAD_FAILED, 0 };
+	if (!SendPacket(hSocket, strDigestSHA256.c_str(), (int)strDigestSHA256.length() + 1) ||
+		!SendByte(hSocket, EOT) ||
+		!ReceivePacket(hSocket, pReply, 0) || (pReply.size() != sizeof(pResult)) ||
+		!ReceiveByte(hSocket, EOT))
+		return false;
+	memcpy(&pResult, pReply.data(), sizeof(pResult));
+	bPublished = (UPLOAD_PUBLISHED == pResult.nStatus);
+	return true;
+}
+
+/**
+ * @brief Closes a connection with a reset, as a crash or a pulled cable would leave it
+ * @param hSocket The socket
+ */
+void KillConnection(SOCKET hSocket)
+{
+	const linger pLinger = { 1, 0 };
+	setsockopt(hSocket, SOL_SOCKET, SO_LINGER, (const char*)&pLinger, sizeof(pLinger));
+	closesocket(hSocket);
+}
+
+/**
+ * @brief Kills resumable uploads at random offsets and checks how much each resume sends again
+ * @param lpszServer IPv4 address of the server
+ * @param nPort Service port of the server
+ * @param nMegabytes Size of the file uploaded, in MiB (more than UPLOAD_CHECKPOINT_SIZE, or no session is opened)
+ * @param nKills Connections killed per upload
+ * @return 0 if every check passed
+ * @details Runs once in stream mode (the server cuts the chunks, UploadFile checkpoints after the assembler)
+ *          and once with PROTOCOL_DEDUP | PROTOCOL_CDC (checkpoints between the chunks the client sends).
+ *          Each kill resets the connection at a random file position after the last offset; the next
+ *          connection resumes the session. The offset the server answers must not lie beyond the data sent,
+ *          and the data sent again must stay within UPLOAD_CHECKPOINT_SIZE plus the bytes the server could
+ *          hold unprocessed (the window and one chunk) plus the bytes that were not acknowledged.
+ *          Finally the file must be published and download with the same SHA256
+ */
+int BenchResume(const wchar_t* lpszServer, const int nPort, const int nMegabytes, const int nKills)
+{
+	WSADATA pWSAData = { 0, };
+	if (WSAStartup(MAKEWORD(2, 2), &pWSAData) != 0)
+		return 1;
+	ZeroMemory(&g_pServerAddress, sizeof(g_pServerAddress));
+	g_pServerAddress.sin_family = AF_INET;
+	g_pServerAddress.sin_port = htons((u_short)nPort);
+	if ((nKills < 0) || ((unsigned long long)nMegabytes * 1048576 <= UPLOAD_CHECKPOINT_SIZE) ||
+		(InetPtonW(AF_INET, lpszServer, &g_pServerAddress.sin_addr) != 1))
+	{
+		wprintf(L"Invalid parameters\n");
+		WSACleanup();
+		return 1;
+	}
+
+	typedef struct {
+		const wchar_t* lpszName;
+		PROTOCOL_OPTIONS pOptions;
+	} RESUME_MODE;
+	const unsigned int nFlags = PROTOCOL_WINDOW | PROTOCOL_CRC32C | PROTOCOL_LARGE_FRAME | PROTOCOL_RESUME | PROTOCOL_RESULT;
+	const RESUME_MODE pModes[] = {
+		{ L"stream", { PROTOCOL_VERSION, nFlags, THROUGHPUT_WINDOW_SIZE, UPLOAD_FRAME_SIZE } },
+		{ L"dedup", { PROTOCOL_VERSION, nFlags | PROTOCOL_DEDUP | PROTOCOL_CDC, THROUGHPUT_WINDOW_SIZE, UPLOAD_FRAME_SIZE } },
+	};
+	int nFailures = 0;
+	unsigned long long nSeed = RESUME_SEED;
+	for (const RESUME_MODE& pMode : pModes)
+	{
+		// A file of its own per mode, so the dedup run finds none of its chunks stored
+		std::vector<unsigned char> pData((size_t)nMegabytes * 1048576);
+		FillRandom(pData, nSeed++);
+		SHA256 pSHA256;
+		pSHA256.update(pData.data(), pData.size());
+		const std::string strDigestSHA256 = SHA256::toString(pSHA256.digest());
+		std::vector<unsigned char> pKillPoints(nKills + 1);
+		FillRandom(pKillPoints, nSeed++);
+
+		wprintf(L"%s: %d MiB, %d kills\n", pMode.lpszName, nMegabytes, nKills);
+		wprintf(L"%7s %12s %12s %12s %12s %8s\n", L"Attempt", L"Resumed at", L"Killed at", L"Acked", L"Sent again", L"Check");
+		RESUME_ATTEMPT pPrevious = { 0, };
+		unsigned long long nTotalBytes = 0;
+		unsigned long long nMaxSentAgain = 0;
+		bool bResult = true;
+		bool bPublished = false;
+		PROTOCOL_OPTIONS pOptions = pMode.pOptions;
+		const unsigned int nRequired = pMode.pOptions.nFlags & ~(PROTOCOL_CRC32C | PROTOCOL_LARGE_FRAME);
+		for (int nAttempt = 0; bResult && (nAttempt <= nKills); nAttempt++)
+		{
+			pOptions = pMode.pOptions;
+			SOCKET hSocket = OpenConnection(0);
+			if ((INVALID_SOCKET == hSocket) || !LoginWithOptions(hSocket, "IntelliBench-resume", pOptions) ||
+				((pOptions.nFlags & nRequired) != nRequired))
+			{
+				wprintf(L"%7d login failed, or the server does not accept %s uploads with PROTOCOL_RESUME\n", nAttempt, pMode.lpszName);
+				if (INVALID_SOCKET != hSocket)
+					closesocket(hSocket);
+				bResult = false;
+				break;
+			}
+			// The last attempt sends the file to the end, the others a random part of what is left
+			RESUME_ATTEMPT pAttempt = { pPrevious.nToken, 0, };
+			const double nKillFraction = (nAttempt < nKills) ? (pKillPoints[nAttempt] + 1) / 257.0 : 1;
+			if (!UploadResumable(hSocket, pOptions, RESUME_FILE_NAME, pData, nKillFraction, pAttempt, bPublished))
+			{
+				wprintf(L"%7d upload failed\n", nAttempt);
+				closesocket(hSocket);
+				bResult = false;
+				break;
+			}
+			if (nAttempt < nKills)
+				KillConnection(hSocket);
+			else
+				closesocket(hSocket);
+			nTotalBytes += pAttempt.nBytes;
+
+			// The server cannot have stored more than was sent; what it lost is bounded by the data it may hold
+			// without a checkpoint (a checkpoint's worth, the frames in flight and a chunk) and the bytes not acknowledged
+			bool bCheck = (0 == pAttempt.nOffset);
+			unsigned long long nSentAgain = 0;
+			if (nAttempt > 0)
+			{
+				const unsigned long long nBound = UPLOAD_CHECKPOINT_SIZE + (unsigned long long)pOptions.nWindowSize * pOptions.nFrameSize +
+					DEDUP_CHUNK_SIZE + (pPrevious.nSent - pPrevious.nAcknowledged);
+				nSentAgain = pPrevious.nSent - min(pAttempt.nOffset, pPrevious.nSent);
+				bCheck = (pAttempt.nOffset <= pPrevious.nSent) && (nSentAgain <= nBound);
+				nMaxSentAgain = max(nMaxSentAgain, nSentAgain);
+			}
+			bResult = bResult && bCheck;
+			wchar_t lpszKilledAt[32] = L"end";
+			wchar_t lpszAcknowledged[32] = L"-";
+			if (nAttempt < nKills)
+			{
+				swprintf_s(lpszKilledAt, L"%.1f MiB", pAttempt.nSent / 1048576.0);
+				swprintf_s(lpszAcknowledged, L"%.1f MiB", pAttempt.nAcknowledged / 1048576.0);
+			}
+			wprintf(L"%7d %8.1f MiB %12s %12s %8.1f MiB %8s\n", nAttempt, pAttempt.nOffset / 1048576.0, lpszKilledAt, lpszAcknowledged,
+				nSentAgain / 1048576.0, bCheck ? L"ok" : L"FAILED");
+			pPrevious = pAttempt;
+		}
+
+		// The file the server published must be the one sent
+		bool bDownload = false;
+		if (bResult && bPublished)
+		{
+			SOCKET hSocket = OpenConnection(0);
+			pOptions = pMode.pOptions;
+			bDownload = (INVALID_SOCKET != hSocket) && LoginWithOptions(hSocket, "IntelliBench-resume", pOptions) &&
+				DownloadData(hSocket, pOptions, RESUME_FILE_NAME, pData.size(), strDigestSHA256);
+			if (INVALID_SOCKET != hSocket)
+				closesocket(hSocket);
+		}
+		wprintf(L"%s: published %s, download %s; sent %.1f MiB for %d MiB (%.0f%%), at most %.1f MiB again after a kill\n\n",
+			pMode.lpszName, bPublished ? L"yes" : L"NO", bDownload ? L"ok" : L"FAILED", nTotalBytes / 1048576.0, nMegabytes,
+			100.0 * nTotalBytes / pData.size(), nMaxSentAgain / 1048576.0);
+		if (!bResult || !bPublished || !bDownload)
+			nFailures++;
+	}
+	WSACleanup();
+	return (0 == nFailures) ? 0 : 1;
+}
+
+/**
+ * @brief Makes the files of one copy of the corpus directory
+ * @param pDirectory The files of the directory
+ * @param nCopy The copy: 0 is the directory itself, the others edit one file in CORPUS_EDITED_FILES
+ * @param nFile Index of the file
+ * @param pData [out] The file
+ * @return true if the file was edited
+ */
+bool MakeCorpusFile(const std::vector<std::vector<unsigned char>>& pDirectory, const int nCopy, const size_t nFile, std::vector<unsigned char>& pData)
+{
+	pData = pDirectory[nFile];
+	if ((0 == nCopy) || ((nFile + nCopy) % CORPUS_EDITED_FILES != 0))
+		return false;
+	// The same file is edited at a different place in each copy
+	const size_t nOffset = (nFile * 7919 + (size_t)nCopy * 104729) % (pData.size() - CORPUS_EDIT_SIZE);
+	for (size_t nIndex = nOffset; nIndex < nOffset + CORPUS_EDIT_SIZE; nIndex++)
+		pData[nIndex] ^= (unsigned char)(nCopy + 1);
+	return true;
+}
+
+/**
+ * @brief Uploads a corpus of duplicated directories twice, with and without deduplication
+ * @param lpszServer IPv4 address of the server
+ * @param nPort Service port of the server
+ * @param nMegabytes Size of the corpus, in MiB
+ * @param nCopies Copies of the directory in the corpus
+ * @param nMegabits Bandwidth of the link to the server, in Mbit/s; the uploads go through a relay with that bandwidth
+ *        and CORPUS_ROUND_TRIP (0: no relay)
+ * @return 0 if every check passed
+ * @details The directory holds files of 4 KiB to 1 MiB; each copy but the first edits 100 bytes in one file
+ *          of every CORPUS_EDITED_FILES. Each mode uploads the corpus under a first name, then again under a
+ *          second name, on one connection. It reports the bytes of the files and the bytes the client had to
+ *          send, as g_pChunkStoreCounters counts them on the server, and the wall time. With PROTOCOL_DEDUP the
+ *          first upload must send little more than one copy plus the edited chunks, and the second nothing.
+ *          Each mode has a directory of its own, so the dedup mode finds none of its chunks stored
+ */
+int BenchDedup(const wchar_t* lpszServer, const int nPort, const int nMegabytes, const int nCopies, const int nMegabits)
+{
+	WSADATA pWSAData = { 0, };
+	if (WSAStartup(MAKEWORD(2, 2), &pWSAData) != 0)
+		return 1;
+	ZeroMemory(&g_pServerAddress, sizeof(g_pServerAddress));
+	g_pServerAddress.sin_family = AF_INET;
+	g_pServerAddress.sin_port = htons((u_short)nPort);
+	if ((nCopies < 1) || (nMegabits < 0) || (InetPtonW(AF_INET, lpszServer, &g_pServerAddress.sin_addr) != 1))
+	{
+		wprintf(L"Invalid parameters\n");
+		WSACleanup();
+		return 1;
+	}
+
+	typedef struct {
+		const char* lpszName;
+		PROTOCOL_OPTIONS pOptions;
+	} CORPUS_MODE;
+	const unsigned int nFlags = PROTOCOL_WINDOW | PROTOCOL_CRC32C | PROTOCOL_LARGE_FRAME | PROTOCOL_RESULT;
+	const CORPUS_MODE pModes[] = {
+		{ "stream", { PROTOCOL_VERSION, nFlags, THROUGHPUT_WINDOW_SIZE, UPLOAD_FRAME_SIZE } },
+		{ "dedup", { PROTOCOL_VERSION, nFlags | PROTOCOL_DEDUP | PROTOCOL_CDC, THROUGHPUT_WINDOW_SIZE, UPLOAD_FRAME_SIZE } },
+	};
+	const char* pUploads[] = { "first", "again" };
+	double pTimes[_countof(pModes)][_countof(pUploads)] = { { 0, }, };
+	int nFailures = 0;
+	if (nMegabits > 0)
+		wprintf(L"Link: %d Mbit/s, %d ms round trip\n", nMegabits, CORPUS_ROUND_TRIP);
+	wprintf(L"%7s %7s %7s %14s %14s %7s %9s %8s %8s\n", L"Mode", L"Upload", L"Files", L"Uploaded MiB", L"Received MiB", L"Ratio", L"Seconds", L"MiB/s", L"Check");
+	for (size_t nMode = 0; nMode < _countof(pModes); nMode++)
+	{
+		const CORPUS_MODE& pMode = pModes[nMode];
+		// The directory: files of random sizes, nMegabytes / nCopies in all
+		std::vector<std::vector<unsigned char>> pDirectory;
+		unsigned long long nSeed = CORPUS_SEED + nMode * 0x10000;
+		const size_t nTargetSize = (size_t)nMegabytes * 1048576 / nCopies;
+		std::vector<unsigned char> pSizes((nTargetSize / CORPUS_MIN_FILE_SIZE + 1) * sizeof(unsigned int));
+		FillRandom(pSizes, nSeed++);
+		size_t nDirectorySize = 0;
+		while (nDirectorySize < nTargetSize)
+		{
+			const unsigned int nRandom = ((const unsigned int*)pSizes.data())[pDirectory.size()];
+			const size_t nSize = CORPUS_MIN_FILE_SIZE + nRandom % (CORPUS_MAX_FILE_SIZE - CORPUS_MIN_FILE_SIZE);
+			pDirectory.emplace_back(nSize);
+			FillRandom(pDirectory.back(), nSeed++);
+			nDirectorySize += nSize;
+		}
+
+		for (size_t nUpload = 0; nUpload < _countof(pUploads); nUpload++)
+		{
+			PROTOCOL_OPTIONS pOptions = pMode.pOptions;
+			const unsigned int nRequired = pMode.pOptions.nFlags & ~(PROTOCOL_CRC32C | PROTOCOL_LARGE_FRAME);
+			DELAY_RELAY pRelay;
+			pRelay.hClient = INVALID_SOCKET;
+			if ((nMegabits > 0) ? !OpenRelay(pRelay, CORPUS_ROUND_TRIP, nMegabits) : ((pRelay.hClient = OpenConnection(0)) == INVALID_SOCKET))
+			{
+				wprintf(L"%7hs %7hs cannot connect\n", pMode.lpszName, pUploads[nUpload]);
+				nFailures++;
+				continue;
+			}
+			const SOCKET hSocket = pRelay.hClient;
+			if (!LoginWithOptions(hSocket, "IntelliBench-dedup", pOptions) || ((pOptions.nFlags & nRequired) != nRequired))
+			{
+				wprintf(L"%7hs %7hs login failed, or the server does not accept these uploads\n", pMode.lpszName, pUploads[nUpload]);
+				if (nMegabits > 0)
+					CloseRelay(pRelay);
+				else
+					closesocket(hSocket);
+				nFailures++;
+				continue;
+			}
+			unsigned long long nUploadedBytes = 0, nReceivedBytes = 0, nEditedFiles = 0;
+			int nFiles = 0;
+			bool bResult = true;
+			char lpszFileName[0x100] = { 0, };
+			std::vector<unsigned char> pData;
+			const auto nStart = std::chrono::steady_clock::now();
+			for (int nCopy = 0; bResult && (nCopy < nCopies); nCopy++)
+			{
+				for (size_t nFile = 0; bResult && (nFile < pDirectory.size()); nFile++)
+				{
+					nEditedFiles += MakeCorpusFile(pDirectory, nCopy, nFile, pData) ? 1 : 0;
+					sprintf_s(lpszFileName, CORPUS_FILE_NAME, pMode.lpszName, pUploads[nUpload], nCopy, (int)nFile);
+					RESUME_ATTEMPT pAttempt = { 0, };
+					bool bPublished = false;
+					bResult = UploadResumable(hSocket, pOptions, lpszFileName, pData, 1, pAttempt, bPublished) && bPublished;
+					nUploadedBytes += pData.size();
+					nReceivedBytes += pAttempt.nBytes;
+					nFiles++;
+				}
+			}
+			const double nElapsed = ElapsedMilliseconds(nStart) / 1000;
+			pTimes[nMode][nUpload] = nElapsed;
+			// The last file stored must be the one sent
+			if (bResult)
+			{
+				SHA256 pSHA256;
+				pSHA256.update(pData.data(), pData.size());
+				bResult = DownloadData(hSocket, pOptions, lpszFileName, pData.size(), SHA256::toString(pSHA256.digest()));
+			}
+			if (nMegabits > 0)
+				CloseRelay(pRelay);
+			else
+				closesocket(hSocket);
+			// Dedup sends one copy, the chunks of the edits (an overwrite changes at most 3), then nothing
+			if ((pOptions.nFlags & PROTOCOL_DEDUP) != 0)
+				bResult = bResult && (nReceivedBytes <= ((0 == nUpload) ? nDirectorySize + nEditedFiles * 3 * CHUNKER_MAX_SIZE : 0));
+			if (!bResult)
+				nFailures++;
+			wchar_t lpszRatio[32] = L"-";
+			if (nReceivedBytes > 0)
+				swprintf_s(lpszRatio, L"%.2f", (double)nUploadedBytes / nReceivedBytes);
+			wprintf(L"%7hs %7hs %7d %14.1f %14.1f %7s %9.2f %8.1f %8s\n", pMode.lpszName, pUploads[nUpload], nFiles,
+				nUploadedBytes / 1048576.0, nReceivedBytes / 1048576.0, lpszRatio, nElapsed, nUploadedBytes / 1048576.0 / nElapsed, bResult ? L"ok" : L"FAILED");
+		}
+	}
+	for (size_t nUpload = 0; nUpload < _countof(pUploads); nUpload++)
+	{
+		const double nSaved = pTimes[0][nUpload] - pTimes[1][nUpload];
+		wprintf(L"Dedup saved %.2f s of %.2f s (%.0f%%) on the %hs upload\n", nSaved, pTimes[0][nUpload],
+			(pTimes[0][nUpload] > 0) ? 100 * nSaved / pTimes[0][nUpload] : 0.0, pUploads[nUpload]);
+	}
+	WSACleanup();
+	return (0 == nFailures) ? 0 : 1;
+}
+
+/**
+ * @brief Fills a synthetic snapshot of nEntries files, DIFF_FILES_PER_DIRECTORY per directory
+ * @param pSnapshot [out] The snapshot
+ * @param nEntries Number of files before the edits (a multiple of DIFF_FILES_PER_DIRECTORY)
+ * @param bEdited false: the files as they were; true: after the edits
+ * @details File i is named f<i>; its size and last write time are unique, so a rename can only pair with itself.
+ *          With bEdited, i modulo DIFF_FILES_PER_DIRECTORY picks its edit: faDelete drops it, faCreate adds n<i>
+ *          next to it, faChange grows it by one byte and faRename calls it r<i>
+ */
+void FillSnapshot(CFileSnapshot& pSnapshot, const UINT nEntries, const bool bEdited)
+{
+	WIN32_FIND_DATA fd;
+	ZeroMemory(&fd, sizeof(fd));
+	fd.dwFileAttributes = FILE_ATTRIBUTE_ARCHIVE;
+	pSnapshot.Clear();
+	pSnapshot.Reserve(nEntries + nEntries / DIFF_FILES_PER_DIRECTORY);
+	for (UINT nFirst = 0; nFirst < nEntries; nFirst += DIFF_FILES_PER_DIRECTORY)
+	{
+		CString strDirectory;
+		strDirectory.Format(_T("%s\\%05u"), DIFF_ROOT_FOLDER, nFirst / DIFF_FILES_PER_DIRECTORY);
+		const UINT nDirectory = pSnapshot.AddDirectory(strDirectory);
+		for (UINT nFile = nFirst; nFile < nFirst + DIFF_FILES_PER_DIRECTORY; nFile++)
+		{
+			const int nEdit = bEdited ? (int)(nFile % DIFF_FILES_PER_DIRECTORY) : faNone;
+			const ULONGLONG nLastWriteTime = DIFF_LAST_WRITE_TIME + nFile;
+			if (faDelete == nEdit)
+				continue;
+			swprintf_s(fd.cFileName, L"%c%07u.dat", (faRename == nEdit) ? L'r' : L'f', nFile);
+			fd.nFileSizeHigh = 0;
+			fd.nFileSizeLow = nFile + ((faChange == nEdit) ? 1 : 0);
+			fd.ftLastWriteTime.dwHighDateTime = (DWORD)(nLastWriteTime >> 32);
+			fd.ftLastWriteTime.dwLowDateTime = (DWORD)nLastWriteTime;
+			pSnapshot.Add(nDirectory, fd);
+			if (faCreate == nEdit)
+			{
+				// Later than every file of the first snapshot, so it cannot pass for a rename
+				const ULONGLONG nCreateTime = DIFF_LAST_WRITE_TIME + nEntries + nFile;
+				swprintf_s(fd.cFileName, L"n%07u.dat", nFile);
+				fd.ftLastWriteTime.dwHighDateTime = (DWORD)(nCreateTime >> 32);
+				fd.ftLastWriteTime.dwLowDateTime = (DWORD)nCreateTime;
+				pSnapshot.Add(nDirectory, fd);
+			}
+		}
+	}
+}
+
+/**
+ * @brief Checks the differences reported between the snapshots of FillSnapshot
+ * @param pOldSnapshot The files as they were
+ * @param pNewSnapshot The files after the edits
+ * @param pChanges The differences reported by CFileSnapshot::Compare
+ * @param nEntries Number of files before the edits
+ * @return true if every edit was reported once, with the right action and entries, and nothing else was
+ */
+bool CheckDiff(const CFileSnapshot& pOldSnapshot, const CFileSnapshot& pNewSnapshot, const std::vector<FI_CHANGE>& pChanges, const UINT nEntries)
+{
+	std::vector<bool> bReported(nEntries, false);
+	for (const FI_CHANGE& pChange : pChanges)
+	{
+		const CString strOldName = (SNAPSHOT_NO_ENTRY != pChange.nOldEntry) ? pOldSnapshot.GetFileName(pChange.nOldEntry) : CString();
+		const CString strNewName = (SNAPSHOT_NO_ENTRY != pChange.nNewEntry) ? pNewSnapshot.GetFileName(pChange.nNewEntry) : CString();
+		const CString& strName = strOldName.IsEmpty() ? strNewName : strOldName;
+		const UINT nFile = (UINT)wcstoul((LPCTSTR)strName + 1, nullptr, 10);
+		if ((nFile >= nEntries) || bReported[nFile] || ((int)(nFile % DIFF_FILES_PER_DIRECTORY) != pChange.faAction))
+			return false;
+		bReported[nFile] = true;
+		bool bExpected = false;
+		switch (pChange.faAction)
+		{
+			case faChange:
+				bExpected = (strOldName[0] == L'f') && (strOldName == strNewName);
+				break;
+			case faDelete:
+				bExpected = (strOldName[0] == L'f') && strNewName.IsEmpty();
+				break;
+			case faRename:
+				bExpected = (strOldName[0] == L'f') && (strNewName[0] == L'r') && (strOldName.Mid(1) == strNewName.Mid(1));
+				break;
+			case faCreate:
+				bExpected = strOldName.IsEmpty() && (strNewName[0] == L'n');
+				break;
+			default:
+				break;
+		}
+		if (!bExpected)
+			return false;
+	}
+	// Four edits per directory, each reported once
+	return pChanges.size() == 4 * (size_t)(nEntries / DIFF_FILES_PER_DIRECTORY);
+}
+
+/**
+ * @brief Checks and times CFileSnapshot::Compare on synthetic snapshots of 10k, 100k, ... files
+ * @param nMaxEntries Largest number of files
+ * @return 0 if every check passed
+ * @details Also reports the memory of the first snapshot per entry: as counted by CFileSnapshot::GetMemorySize
+ *          (what the watcher traces) and as the private bytes this process gained while it was filled
+ */
+int BenchDiff(const int nMaxEntries)
+{
+	int nFailures = 0;
+	wprintf(L"%9s %9s %9s %9s %9s %9s %11s %13s %11s %13s\n", L"Entries", L"Changed", L"Created", L"Deleted", L"Renamed", L"Result",
+		L"Compare ms", L"M entries/s", L"B/entry", L"Private B/e");
+	for (UINT nEntries = DIFF_MIN_ENTRIES; nEntries <= (UINT)nMaxEntries; nEntries *= 10)
+	{
+		CFileSnapshot pOldSnapshot, pNewSnapshot;
+		SIZE_T nWorkingSet = 0, nPrivateBefore = 0, nPrivateAfter = 0;
+		const bool bMemory = GetServerMemory(GetCurrentProcessId(), nWorkingSet, nPrivateBefore);
+		FillSnapshot(pOldSnapshot, nEntries, false);
+		GetServerMemory(GetCurrentProcessId(), nWorkingSet, nPrivateAfter);
+		FillSnapshot(pNewSnapshot, nEntries, true);
+		std::vector<FI_CHANGE> pChanges;
+		double nBest = 0;
+		for (int nRun = 0; nRun < BENCH_RUNS; nRun++)
+		{
+			const auto nStart = std::chrono::steady_clock::now();
+			CFileSnapshot::Compare(pOldSnapshot, pNewSnapshot, pChanges);
+			const double nElapsed = ElapsedMilliseconds(nStart);
+			nBest = (0 == nRun) ? nElapsed : min(nBest, nElapsed);
+		}
+		int nCount[faRename + 1] = { 0, };
+		for (const FI_CHANGE& pChange : pChanges)
+			nCount[pChange.faAction]++;
+		const bool bResult = CheckDiff(pOldSnapshot, pNewSnapshot, pChanges, nEntries);
+		if (!bResult)
+			nFailures++;
+		wprintf(L"%9u %9d %9d %9d %9d %9s %11.1f %13.1f %11.1f %13.1f\n", nEntries, nCount[faChange], nCount[faCreate], nCount[faDelete], nCount[faRename],
+			bResult ? L"ok" : L"FAILED", nBest, (pOldSnapshot.GetCount() + pNewSnapshot.GetCount()) / (nBest * 1000),
+			(double)pOldSnapshot.GetMemorySize() / pOldSnapshot.GetCount(),
+			bMemory ? ((double)nPrivateAfter - (double)nPrivateBefore) / pOldSnapshot.GetCount() : 0.0);
+	}
+	return (0 == nFailures) ? 0 : 1;
+}
+
+/**
+ * @brief The file the watcher benchmark waits for, shared with the watcher's callback
+ */
+typedef struct {
+	SRWLOCK pLock;                // Protects the fields below
+	CONDITION_VARIABLE pReported; // Signalled when the callback names strExpected
+	CString strExpected;          // Path of the file written last
+	bool bReported;               // The callback named strExpected
+	std::chrono::steady_clock::time_point nReportedTime; // When it did
+} WATCH_STATE;
+
+/**
+ * @brief Callback of the watcher: records when the file written last is reported
+ * @param fiObject The file
+ * @param faAction What happened to it
+ * @param lpData The WATCH_STATE
+ * @return 0, so the watcher keeps running
+ */
+UINT WatchCallback(CFileInformation fiObject, EFileAction faAction, LPVOID lpData)
+{
+	UNREFERENCED_PARAMETER(faAction);
+	WATCH_STATE* pState = (WATCH_STATE*)lpData;
+	const auto nNow = std::chrono::steady_clock::now();
+	AcquireSRWLockExclusive(&pState->pLock);
+	if (!pState->bReported && (fiObject.GetFilePath().CompareNoCase(pState->strExpected) == 0))
+	{
+		pState->bReported = true;
+		pState->nReportedTime = nNow;
+		WakeConditionVariable(&pState->pReported);
+	}
+	ReleaseSRWLockExclusive(&pState->pLock);
+	return 0;
+}
+
+/**
+ * @brief Path of a file of the synthetic tree, DIFF_FILES_PER_DIRECTORY per directory
+ * @param strRoot Root of the tree
+ * @param nFile Index of the file
+ * @return The path
+ */
+CString WatchFilePath(const CString& strRoot, const UINT nFile)
+{
+	CString strPath;
+	strPath.Format(_T("%s\\%05u\\f%07u.dat"), (LPCTSTR)strRoot, nFile / DIFF_FILES_PER_DIRECTORY, nFile);
+	return strPath;
+}
+
+/**
+ * @brief Writes a small file of the synthetic tree, replacing what it held
+ * @param strPath The file
+ * @param nContent Written as the content, so every write changes the file
+ * @return true on success
+ */
+bool WriteWatchFile(const CString& strPath, const UINT nContent)
+{
+	HANDLE hFile = CreateFile(strPath, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (INVALID_HANDLE_VALUE == hFile)
+		return false;
+	DWORD nWritten = 0;
+	const bool bResult = WriteFile(hFile, &nContent, sizeof(nContent), &nWritten, nullptr) && (sizeof(nContent) == nWritten);
+	CloseHandle(hFile);
+	return bResult;
+}
+
+/**
+ * @brief Creates a synthetic tree of nFiles small files, DIFF_FILES_PER_DIRECTORY per directory
+ * @param strRoot Root of the tree (removed first)
+ * @param nFiles Number of files
+ * @return true on success
+ */
+bool CreateWatchTree(const CString& strRoot, const UINT nFiles)
+{
+	CFileInformation::RemoveDir(strRoot);
+	if (!CreateDirectory(strRoot, nullptr))
+		return false;
+	for (UINT nFile = 0; nFile < nFiles; nFile++)
+	{
+		if (0 == nFile % DIFF_FILES_PER_DIRECTORY)
+		{
+			CString strDirectory;
+			strDirectory.Format(_T("%s\\%05u"), (LPCTSTR)strRoot, nFile / DIFF_FILES_PER_DIRECTORY);
+			if (!CreateDirectory(strDirectory, nullptr))
+				return false;
+		}
+		if (!WriteWatchFile(WatchFilePath(strRoot, nFile), nFile))
+			return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Times how long the client's watcher takes to report a write, on trees of 1k, 10k, ... files
+ * @param nMaxFiles Largest tree
+ * @param nEvents Timed writes per tree
+ * @return 0 if every write was reported
+ * @details For each tree, times one walk of CFileInformation::EnumFiles (the old watcher walked the tree
+ *          twice per change), starts a CNotifyDirCheck on it without a sync index, then writes a file picked
+ *          at random and waits for the callback to name it, nEvents times. The latency runs from the write
+ *          to the callback, so it includes the NOTIFICATION_QUIET_PERIOD the watcher waits for the file to
+ *          settle; the first write also waits for the watcher's own walk and is not timed.
+ */
+int BenchWatch(const int nMaxFiles, const int nEvents)
+{
+	TCHAR lpszTempPath[MAX_PATH] = { 0, };
+	if (0 == GetTempPath(MAX_PATH, lpszTempPath))
+	{
+		wprintf(L"GetTempPath failed: %u\n", GetLastError());
+		return 1;
+	}
+	const CString strRoot = CFileInformation::ConcPath(lpszTempPath, WATCH_ROOT_FOLDER);
+	int nFailures = 0;
+	wprintf(L"%9s %9s %9s %9s %9s %9s %9s %13s\n", L"Files", L"Walk ms", L"Reported", L"Lost", L"p50 ms", L"p99 ms", L"max ms", L"p50-quiet ms");
+	for (UINT nFiles = WATCH_MIN_FILES; nFiles <= (UINT)nMaxFiles; nFiles *= 10)
+	{
+		if (!CreateWatchTree(strRoot, nFiles))
+		{
+			wprintf(L"%9u cannot create the tree in %s: %u\n", nFiles, (LPCTSTR)strRoot, GetLastError());
+			CFileInformation::RemoveDir(strRoot);
+			return 1;
+		}
+		CFileSnapshot pSnapshot;
+		const auto nWalkStart = std::chrono::steady_clock::now();
+		CFileInformation::EnumFiles(strRoot, &pSnapshot);
+		const double nWalk = ElapsedMilliseconds(nWalkStart);
+
+		WATCH_STATE pState;
+		InitializeSRWLock(&pState.pLock);
+		InitializeConditionVariable(&pState.pReported);
+		pState.bReported = false;
+		std::vector<double> pTimes;
+		int nLost = 0;
+		{
+			CNotifyDirCheck pWatcher(strRoot, WatchCallback, &pState);
+			if (!pWatcher.Run())
+			{
+				wprintf(L"%9u cannot start the watcher\n", nFiles);
+				CFileInformation::RemoveDir(strRoot);
+				return 1;
+			}
+			unsigned int nRandom = 0x2468ACE1;
+			for (int nEvent = -1; nEvent < nEvents; nEvent++)
+			{
+				nRandom = nRandom * 1103515245 + 12345;
+				const CString strPath = WatchFilePath(strRoot, (nRandom >> 8) % nFiles);
+				AcquireSRWLockExclusive(&pState.pLock);
+				pState.strExpected = strPath;
+				pState.bReported = false;
+				ReleaseSRWLockExclusive(&pState.pLock);
+
+				const auto nStart = std::chrono::steady_clock::now();
+				if (!WriteWatchFile(strPath, nFiles + nEvent))
+				{
+					nLost++;
+					continue;
+				}
+				// The first write is reported once the watcher has walked the tree as well
+				const double nTimeout = WATCH_EVENT_TIMEOUT + ((nEvent < 0) ? 10 * nWalk : 0);
+				AcquireSRWLockExclusive(&pState.pLock);
+				while (!pState.bReported && (ElapsedMilliseconds(nStart) < nTimeout))
+					SleepConditionVariableSRW(&pState.pReported, &pState.pLock, (DWORD)(nTimeout - ElapsedMilliseconds(nStart)) + 1, 0);
+				const bool bReported = pState.bReported;
+				const double nLatency = std::chrono::duration<double, std::milli>(pState.nReportedTime - nStart).count();
+				ReleaseSRWLockExclusive(&pState.pLock);
+				if (!bReported)
+					nLost++;
+				else if (nEvent >= 0)
+					pTimes.push_back(nLatency);
+			}
+			pWatcher.Stop();
+		}
+		CFileInformation::RemoveDir(strRoot);
+
+		if (nLost > 0)
+			nFailures++;
+		if (pTimes.empty())
+		{
+			wprintf(L"%9u %9.1f %9d %9d\n", nFiles, nWalk, 0, nLost);
+			continue;
+		}
+		std::sort(pTimes.begin(), pTimes.end());
+		const double nMedian = pTimes[pTimes.size() / 2];
+		wprintf(L"%9u %9.1f %9u %9d %9.1f %9.1f %9.1f %13.1f\n", nFiles, nWalk, (unsigned int)pTimes.size(), nLost,
+			nMedian, pTimes[pTimes.size() * 99 / 100], pTimes.back(), nMedian - NOTIFICATION_QUIET_PERIOD);
+	}
+	return (0 == nFailures) ? 0 : 1;
+}
+
+/**
+ * @brief Path of a file of a synthetic tree of BenchScan
+ * @param strRoot Root of the tree
+ * @param nShape SCAN_WIDE, SCAN_DEEP or SCAN_TINY
+ * @param nFile Index of the file
+ * @return The path
+ * @details SCAN_WIDE puts every file in the root. SCAN_DEEP nests chains of SCAN_DEEP_LEVELS directories with
+ *          SCAN_DEEP_FILES files in each. SCAN_TINY gives each file a directory of its own, DIFF_FILES_PER_DIRECTORY
+ *          of them per parent.
+ */
+CString ScanFilePath(const CString& strRoot, const int nShape, const UINT nFile)
+{
+	CString strPath = strRoot;
+	if (SCAN_DEEP == nShape)
+	{
+		strPath.AppendFormat(_T("\\c%05u"), nFile / (SCAN_DEEP_LEVELS * SCAN_DEEP_FILES));
+		for (UINT nLevel = 1; nLevel <= nFile / SCAN_DEEP_FILES % SCAN_DEEP_LEVELS; nLevel++)
+			strPath.AppendFormat(_T("\\d%02u"), nLevel);
+	}
+	else if (SCAN_TINY == nShape)
+		strPath.AppendFormat(_T("\\%05u\\%07u"), nFile / DIFF_FILES_PER_DIRECTORY, nFile);
+	strPath.AppendFormat(_T("\\f%07u.dat"), nFile);
+	return strPath;
+}
+
+/**
+ * @brief Creates a synthetic tree of BenchScan
+ * @param strRoot Root of the tree (removed first)
+ * @param nShape SCAN_WIDE, SCAN_DEEP or SCAN_TINY
+ * @param nFiles Number of files
+ * @return true on success
+ */
+bool CreateScanTree(const CString& strRoot, const int nShape, const UINT nFiles)
+{
+	CFileInformation::RemoveDir(strRoot);
+	CString strLastDirectory;
+	for (UINT nFile = 0; nFile < nFiles; nFile++)
+	{
+		const CString strPath = ScanFilePath(strRoot, nShape, nFile);
+		const CString strDirectory = strPath.Left(strPath.ReverseFind(_T('\\')));
+		if (strDirectory != strLastDirectory)
+		{
+			CFileInformation::CreateDir(strDirectory);
+			strLastDirectory = strDirectory;
+		}
+		if (!WriteWatchFile(strPath, nFile))
+			return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Drops the file data and metadata that Windows caches, so the next walk reads the disk
+ * @return true on success; it needs an administrator (SeProfileSingleProcessPrivilege)
+ * @details Empties the working sets (the system cache among them), writes the modified pages and purges
+ *          the standby list, as RAMMap does. A reboot is colder still.
+ */
+bool PurgeFileCache()
+{
+	HANDLE hToken = nullptr;
+	if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &hToken))
+		return false;
+	TOKEN_PRIVILEGES pPrivileges = { 1, };
+	pPrivileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+	const bool bPrivilege = LookupPrivilegeValue(nullptr, SE_PROF_SINGLE_PROCESS_NAME, &pPrivileges.Privileges[0].Luid) &&
+		AdjustTokenPrivileges(hToken, FALSE, &pPrivileges, 0, nullptr, nullptr) && (ERROR_SUCCESS == GetLastError());
+	CloseHandle(hToken);
+	if (!bPrivilege)
+		return false;
+	typedef LONG(WINAPI* NT_SET_SYSTEM_INFORMATION)(INT, PVOID, ULONG);
+	const NT_SET_SYSTEM_INFORMATION pNtSetSystemInformation =
+		(NT_SET_SYSTEM_INFORMATION)GetProcAddress(GetModuleHandle(_T("ntdll.dll")), "NtSetSystemInformation");
+	if (nullptr == pNtSetSystemInformation)
+		return false;
+	// SystemMemoryListInformation: MemoryEmptyWorkingSets, MemoryFlushModifiedList, MemoryPurgeStandbyList
+	for (INT nCommand : { 2, 3, 4 })
+	{
+		if (pNtSetSystemInformation(SYSTEM_MEMORY_LIST_INFORMATION, &nCommand, sizeof(nCommand)) < 0)
+			return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Times cold and warm walks of CFileInformation::EnumFiles on wide, deep and many-tiny-directory trees
+ * @param nFiles Files per tree (rounded down to a multiple of SCAN_DEEP_LEVELS * SCAN_DEEP_FILES)
+ * @param lpszThreads Comma-separated walker thread counts (0: one per processor, 1: the serial walk)
+ * @return 0 if every walk found the whole tree
+ * @details Each tree is created in the temporary folder and removed afterwards. For each thread count the
+ *          cold walk follows PurgeFileCache, and the warm walk is the fastest of BENCH_RUNS that follow it.
+ *          The check fails unless every walk returns each file and directory of the tree once.
+ */
+int BenchScan(const int nFiles, const wchar_t* lpszThreads)
+{
+	const UINT nTreeFiles = (UINT)nFiles / (SCAN_DEEP_LEVELS * SCAN_DEEP_FILES) * (SCAN_DEEP_LEVELS * SCAN_DEEP_FILES);
+	const std::vector<int> pThreads = ParseIntegers(lpszThreads);
+	TCHAR lpszTempPath[MAX_PATH] = { 0, };
+	if ((0 == nTreeFiles) || pThreads.empty() || (0 == GetTempPath(MAX_PATH, lpszTempPath)))
+	{
+		wprintf(L"Invalid parameters\n");
+		return 1;
+	}
+	const CString strRoot = CFileInformation::ConcPath(lpszTempPath, SCAN_ROOT_FOLDER);
+	const wchar_t* pShapes[] = { L"wide", L"deep", L"tiny" };
+	// Every entry of the snapshot: the files, then the directories below the root
+	const UINT pEntries[] = { nTreeFiles, nTreeFiles + nTreeFiles / SCAN_DEEP_FILES,
+		nTreeFiles + nTreeFiles + nTreeFiles / DIFF_FILES_PER_DIRECTORY };
+	int nFailures = 0;
+	wprintf(L"%6s %8s %9s %9s %11s %11s %9s\n", L"Tree", L"Threads", L"Entries", L"Found", L"Cold ms", L"Warm ms", L"Check");
+	for (int nShape = SCAN_WIDE; nShape <= SCAN_TINY; nShape++)
+	{
+		if (!CreateScanTree(strRoot, nShape, nTreeFiles))
+		{
+			wprintf(L"%6s cannot create the tree in %s: %u\n", pShapes[nShape], (LPCTSTR)strRoot, GetLastError());
+			CFileInformation::RemoveDir(strRoot);
+			return 1;
+		}
+		for (const int nThreads : pThreads)
+		{
+			bool bResult = true;
+			UINT nFound = 0;
+			double nCold = -1, nWarm = 0;
+			for (int nRun = -1; nRun < BENCH_RUNS; nRun++)
+			{
+				if ((nRun < 0) && !PurgeFileCache())
+					continue;
+				CFileSnapshot pSnapshot;
+				const auto nStart = std::chrono::steady_clock::now();
+				CFileInformation::EnumFiles(strRoot, &pSnapshot, nThreads);
+				const double nElapsed = ElapsedMilliseconds(nStart);
+				if (nRun < 0)
+					nCold = nElapsed;
+				else
+					nWarm = (0 == nRun) ? nElapsed : min(nWarm, nElapsed);
+				// Same paths once each, with the serial walk or any other
+				std::set<ULONGLONG> pPaths;
+				for (UINT nEntry = 0; nEntry < pSnapshot.GetCount(); nEntry++)
+					pPaths.insert(pSnapshot.GetPathHash(nEntry));
+				nFound = pSnapshot.GetCount();
+				bResult = bResult && (pEntries[nShape] == nFound) && (pPaths.size() == nFound);
+			}
+			if (!bResult)
+				nFailures++;
+			CString strCold;
+			if (nCold >= 0)
+				strCold.Format(_T("%.1f"), nCold);
+			else
+				strCold = _T("n/a");
+			wprintf(L"%6s %8d %9u %9u %11s %11.1f %9s\n", pShapes[nShape], nThreads, pEntries[nShape], nFound,
+				(LPCTSTR)strCold, nWarm, bResult ? L"ok" : L"FAILED");
+		}
+		CFileInformation::RemoveDir(strRoot);
+	}
+	return (0 == nFailures) ? 0 : 1;
+}
+
+/**
+ * @brief What the watcher reported during a timed start of the client
+ */
+typedef struct {
+	CSyncIndex* pSyncIndex;  // Index of the start
+	volatile LONG nReports;  // Calls of the callback
+	volatile LONG nQueued;   // Reports that DirCallback would have queued for the server
+} RESTART_STATE;
+
+/**
+ * @brief Callback of the watcher: counts the reports, and those the client would send to the server
+ * @param fiObject The file
+ * @param faAction What happened to it
+ * @param lpData The RESTART_STATE
+ * @return 0, so the watcher keeps running
+ */
+UINT RestartCallback(CFileInformation fiObject, EFileAction faAction, LPVOID lpData)
+{
+	RESTART_STATE* pState = (RESTART_STATE*)lpData;
+	InterlockedIncrement(&pState->nReports);
+	// The test of DirCallback: a file that still has the size and time it was synced with is not sent
+	if (IS_DELETE_FILE(faAction) || !pState->pSyncIndex->IsUnchanged(fiObject.GetFilePath()))
+		InterlockedIncrement(&pState->nQueued);
+	return 0;
+}
+
+/**
+ * @brief Times one start of the client's watcher with its sync index, until the first walk is reconciled
+ * @param strRoot The synced folder
+ * @param strIndex The index file
+ * @param pState [out] What the watcher reported
+ * @param nElapsed [out] Milliseconds from opening the index to the end of the reconciliation
+ * @param nIndexFiles [out] Files in the index afterwards
+ * @param bCreated [out] TRUE if the index started empty
+ * @return true if the watcher got ready within RESTART_TIMEOUT
+ */
+bool TimeRestart(const CString& strRoot, const CString& strIndex, RESTART_STATE& pState, double& nElapsed, DWORD& nIndexFiles, BOOL& bCreated)
+{
+	CSyncIndex pSyncIndex;
+	pState.pSyncIndex = &pSyncIndex;
+	pState.nReports = pState.nQueued = 0;
+	nElapsed = 0;
+	nIndexFiles = 0;
+	const auto nStart = std::chrono::steady_clock::now();
+	if (!pSyncIndex.Open(strIndex, bCreated))
+		return false;
+	CNotifyDirCheck pWatcher(strRoot, RestartCallback, &pState);
+	pWatcher.SetSyncIndex(&pSyncIndex);
+	if (!pWatcher.Run())
+		return false;
+	while (!pWatcher.IsReady() && (ElapsedMilliseconds(nStart) < RESTART_TIMEOUT))
+		Sleep(1);
+	nElapsed = ElapsedMilliseconds(nStart);
+	const bool bReady = (pWatcher.IsReady() != FALSE);
+	pWatcher.Stop();
+	nIndexFiles = pSyncIndex.GetCount();
+	pSyncIndex.Close();
+	return bReady;
+}
+
+/**
+ * @brief Times starts of the client on a tree of unchanged files, and checks that they would send nothing
+ * @param nFiles Files of the tree
+ * @return 0 if every check passed
+ * @details Creates the tree in the temporary folder, DIFF_FILES_PER_DIRECTORY files per directory, then starts
+ *          the watcher with a sync index, as CMainFrame does, four times: without an index file (seed), after
+ *          PurgeFileCache (cold), again (warm), and after RESTART_EDITED_FILES files were rewritten (edited).
+ *          Each start is timed from opening the index to the end of the reconciliation. A file reaches the
+ *          server only through the callback, so the cold and warm starts pass only if the callback was not
+ *          called at all; the edited start shows that the edits are still seen.
+ */
+int BenchRestart(const int nFiles)
+{
+	TCHAR lpszTempPath[MAX_PATH] = { 0, };
+	if (0 == GetTempPath(MAX_PATH, lpszTempPath))
+	{
+		wprintf(L"GetTempPath failed: %u\n", GetLastError());
+		return 1;
+	}
+	const CString strRoot = CFileInformation::ConcPath(lpszTempPath, RESTART_ROOT_FOLDER);
+	const CString strIndex = CFileInformation::ConcPath(lpszTempPath, RESTART_INDEX_NAME);
+	const auto nCreateStart = std::chrono::steady_clock::now();
+	if (!CreateWatchTree(strRoot, (UINT)nFiles))
+	{
+		wprintf(L"Cannot create the tree in %s: %u\n", (LPCTSTR)strRoot, GetLastError());
+		CFileInformation::RemoveDir(strRoot);
+		return 1;
+	}
+	wprintf(L"Created %d files in %.1f s\n", nFiles, ElapsedMilliseconds(nCreateStart) / 1000);
+	DeleteFile(strIndex);
+
+	int nFailures = 0;
+	const wchar_t* pPhases[] = { L"seed", L"cold", L"warm", L"edited" };
+	wprintf(L"%8s %11s %9s %9s %9s %9s\n", L"Start", L"ms", L"Index", L"Reports", L"Queued", L"Check");
+	for (int nPhase = 0; nPhase < (int)_countof(pPhases); nPhase++)
+	{
+		if ((1 == nPhase) && !PurgeFileCache())
+		{
+			wprintf(L"%8s %11s\n", pPhases[nPhase], L"n/a");
+			continue;
+		}
+		if (3 == nPhase)
+		{
+			for (UINT nEdit = 0; nEdit < RESTART_EDITED_FILES; nEdit++)
+				WriteWatchFile(WatchFilePath(strRoot, nEdit * (nFiles / RESTART_EDITED_FILES)), nFiles + nEdit);
+		}
+		RESTART_STATE pState;
+		double nElapsed = 0;
+		DWORD nIndexFiles = 0;
+		BOOL bCreated = FALSE;
+		bool bResult = TimeRestart(strRoot, strIndex, pState, nElapsed, nIndexFiles, bCreated) &&
+			((0 == nPhase) == (bCreated != FALSE)) && ((DWORD)nFiles == nIndexFiles);
+		// The seed records the tree and reports nothing; so does a start with nothing changed
+		const LONG nExpected = (3 == nPhase) ? RESTART_EDITED_FILES : 0;
+		bResult = bResult && (nExpected == pState.nReports) && (nExpected == pState.nQueued);
+		if (!bResult)
+			nFailures++;
+		wprintf(L"%8s %11.1f %9u %9ld %9ld %9s\n", pPhases[nPhase], nElapsed, nIndexFiles, pState.nReports, pState.nQueued,
+			bResult ? L"ok" : L"FAILED");
+	}
+	CFileInformation::RemoveDir(strRoot);
+	DeleteFile(strIndex);
+	return (0 == nFailures) ? 0 : 1;
+}
+
+/**
+ * @brief One event of a replayed trace
+ */
+typedef struct {
+	ULONGLONG nTime;          // Milliseconds since the start of the trace
+	int nFileEvent;           // ID_FILE_DOWNLOAD (the file was uploaded) or ID_FILE_DELETE
+	unsigned long long nSize; // Size of the file after the event
+	unsigned int nPathID;     // Index of the path in the trace
+	int nBurst;               // Burst of the path the event belongs to
+} REPLAY_EVENT;
+
+/**
+ * @brief Subscriber simulated by the replay
+ */
+typedef struct {
+	CNotifyQueue pQueue;          // Its notification queue, as the server keeps it
+	ULONGLONG nBusyUntil;         // End of the download in progress
+	std::vector<int> pSent;       // Notifications sent for each burst
+	std::vector<double> pDelays;  // Milliseconds from the end of each burst to its last notification
+} REPLAY_SUBSCRIBER;
+
+/**
+ * @brief Loads a trace of file events
+ * @param lpszFileName Text file with one "<milliseconds> <upload|delete> <bytes> <path>" per line; # starts a comment
+ * @param pEvents [out] The events, in the order of their times
+ * @param nPaths [out] Number of distinct paths
+ * @return false if the file cannot be read or a line is not understood
+ */
+bool LoadTrace(const wchar_t* lpszFileName, std::vector<REPLAY_EVENT>& pEvents, unsigned int& nPaths)
+{
+	FILE* pFile = nullptr;
+	if ((0 != _wfopen_s(&pFile, lpszFileName, L"r")) || (nullptr == pFile))
+	{
+		wprintf(L"Cannot open %s\n", lpszFileName);
+		return false;
+	}
+	std::map<std::string, unsigned int> pPathIDs;
+	char lpszLine[0x400] = { 0, };
+	bool bResult = true;
+	pEvents.clear();
+	while (bResult && (nullptr != fgets(lpszLine, sizeof(lpszLine), pFile)))
+	{
+		std::string strLine(lpszLine);
+		strLine.erase(strLine.find_last_not_of(" \t\r\n") + 1);
+		if (strLine.empty() || ('#' == strLine[0]))
+			continue;
+		unsigned long long nTime = 0, nSize = 0;
+		char lpszEvent[0x10] = { 0, };
+		int nPathOffset = 0;
+		bResult = (3 == sscanf_s(strLine.c_str(), "%llu %15s %llu %n", &nTime, lpszEvent, (unsigned)sizeof(lpszEvent), &nSize, &nPathOffset)) &&
+			(nPathOffset < (int)strLine.size()) && (pEvents.empty() || (pEvents.back().nTime <= nTime));
+		const int nFileEvent = (strcmp(lpszEvent, "upload") == 0) ? ID_FILE_DOWNLOAD : ((strcmp(lpszEvent, "delete") == 0) ? ID_FILE_DELETE : 0);
+		if (!bResult || (0 == nFileEvent))
+		{
+			wprintf(L"Bad trace line: %hs\n", strLine.c_str());
+			bResult = false;
+			break;
+		}
+		const auto pPathID = pPathIDs.emplace(strLine.substr(nPathOffset), (unsigned int)pPathIDs.size()).first;
+		pEvents.push_back({ nTime, nFileEvent, nSize, pPathID->second, 0 });
+	}
+	fclose(pFile);
+	nPaths = (unsigned int)pPathIDs.size();
+	return bResult && !pEvents.empty();
+}
+
+/**
+ * @brief Replays a trace through one CNotifyQueue per subscriber, on a virtual clock
+ * @param pEvents The events of the trace, with their bursts
+ * @param nPaths Number of distinct paths
+ * @param nBursts Number of bursts
+ * @param pBurstEnds Time of the last event of each burst
+ * @param nSettleTime Settle time passed to CNotifyQueue::Push
+ * @param pSubscribers [out] What each subscriber was sent
+ * @param pCounters [out] The counters of the server, for every subscriber
+ * @details Each event is pushed to every subscriber at its time. A subscriber takes its next event as soon as
+ *          the queue lets it and its previous download is done; a download lasts the size of the file over
+ *          the bandwidth of the subscriber. A notification counts for the burst of the latest event of its path.
+ */
+void ReplayTrace(const std::vector<REPLAY_EVENT>& pEvents, const unsigned int nPaths, const int nBursts, const std::vector<ULONGLONG>& pBurstEnds,
+	const ULONGLONG nSettleTime, REPLAY_SUBSCRIBER* pSubscribers, NOTIFY_COUNTERS& pCounters)
+{
+	std::vector<size_t> pLatest(nPaths, 0); // Latest event pushed for each path
+	for (int nSubscriber = 0; nSubscriber < REPLAY_SUBSCRIBERS; nSubscriber++)
+	{
+		pSubscribers[nSubscriber].pQueue.Clear();
+		pSubscribers[nSubscriber].nBusyUntil = 0;
+		pSubscribers[nSubscriber].pSent.assign(nBursts, 0);
+		pSubscribers[nSubscriber].pDelays.assign(nBursts, 0);
+	}
+	size_t nNext = 0;
+	for (;;)
+	{
+		// Earliest time a subscriber can take an event
+		int nReady = -1;
+		ULONGLONG nReadyTime = ULLONG_MAX;
+		for (int nSubscriber = 0; nSubscriber < REPLAY_SUBSCRIBERS; nSubscriber++)
+		{
+			REPLAY_SUBSCRIBER& pSubscriber = pSubscribers[nSubscriber];
+			if (pSubscriber.pQueue.GetCount() > 0)
+			{
+				const ULONGLONG nTime = max(pSubscriber.pQueue.GetReadyTime(), pSubscriber.nBusyUntil);
+				if (nTime < nReadyTime)
+				{
+					nReady = nSubscriber;
+					nReadyTime = nTime;
+				}
+			}
+		}
+		if ((nNext < pEvents.size()) && (pEvents[nNext].nTime <= nReadyTime))
+		{
+			const REPLAY_EVENT& pEvent = pEvents[nNext];
+			pLatest[pEvent.nPathID] = nNext++;
+			for (int nSubscriber = 0; nSubscriber < REPLAY_SUBSCRIBERS; nSubscriber++)
+			{
+				int nPreviousEvent = 0, nDiscarded = 0;
+				const int nResult = pSubscribers[nSubscriber].pQueue.Push(pEvent.nPathID, pEvent.nFileEvent, IntelliDiskNotifyQueueLimit,
+					pEvent.nTime, nSettleTime, nPreviousEvent, nDiscarded);
+				CountNotification(pCounters, nResult, pEvent.nFileEvent, nPreviousEvent, nDiscarded);
+			}
+			continue;
+		}
+		if (nReady < 0)
+			break;
+		REPLAY_SUBSCRIBER& pSubscriber = pSubscribers[nReady];
+		NOTIFY_FILE_NODE pNode = { 0, 0, 0, 0 };
+		VERIFY(pSubscriber.pQueue.Pop(pNode, nReadyTime));
+		pCounters.nSent++;
+		const REPLAY_EVENT& pLatestEvent = pEvents[pLatest[pNode.nPathID]];
+		pSubscriber.pSent[pLatestEvent.nBurst]++;
+		pSubscriber.pDelays[pLatestEvent.nBurst] = (double)nReadyTime - (double)pBurstEnds[pLatestEvent.nBurst];
+		pSubscriber.nBusyUntil = nReadyTime;
+		if (ID_FILE_DOWNLOAD == pNode.nFileEvent)
+		{
+			const unsigned long long nBytesPerSecond = (unsigned long long)REPLAY_BANDWIDTHS[nReady] << 20;
+			pSubscriber.nBusyUntil += (pLatestEvent.nSize * 1000 + nBytesPerSecond - 1) / nBytesPerSecond;
+		}
+	}
+}
+
+/**
+ * @brief Replays edit bursts through the notification queue of the server and checks how often each burst is sent
+ * @param lpszFileName The trace (see LoadTrace)
+ * @param nSettleTime Settle time of the server, in milliseconds
+ * @return 0 if every check passed
+ * @details The events of a path that follow each other by less than the settle time form a burst. With the
+ *          settle time, a subscriber must be sent each burst at most once, plus once per NOTIFY_SETTLE_LIMIT
+ *          settle times that the burst lasts. The same trace is also replayed without a settle time, for comparison.
+ */
+int BenchReplay(const wchar_t* lpszFileName, const int nSettleTime)
+{
+	std::vector<REPLAY_EVENT> pEvents;
+	unsigned int nPaths = 0;
+	if (!LoadTrace(lpszFileName, pEvents, nPaths))
+		return 1;
+	// Bursts are cut with the settle time of the server, whatever the replay uses
+	std::vector<ULONGLONG> pBurstStarts, pBurstEnds;
+	std::vector<int> pPathBursts(nPaths, -1);
+	for (REPLAY_EVENT& pEvent : pEvents)
+	{
+		int& nBurst = pPathBursts[pEvent.nPathID];
+		if ((nBurst < 0) || (pEvent.nTime - pBurstEnds[nBurst] >= (ULONGLONG)max(nSettleTime, 1)))
+		{
+			nBurst = (int)pBurstStarts.size();
+			pBurstStarts.push_back(pEvent.nTime);
+			pBurstEnds.push_back(pEvent.nTime);
+		}
+		pBurstEnds[nBurst] = pEvent.nTime;
+		pEvent.nBurst = nBurst;
+	}
+	const int nBursts = (int)pBurstStarts.size();
+	wprintf(L"%d events, %u paths, %d bursts (%d ms settle time)\n", (int)pEvents.size(), nPaths, nBursts, nSettleTime);
+	wprintf(L"%10s %7s %7s %10s %13s %13s %9s\n", L"Settle ms", L"MiB/s", L"Sent", L"Max/burst", L"Avg delay ms", L"Max delay ms", L"Result");
+	int nFailures = 0;
+	REPLAY_SUBSCRIBER pSubscribers[REPLAY_SUBSCRIBERS];
+	const int pSettleTimes[] = { 0, nSettleTime };
+	for (const int nReplaySettleTime : pSettleTimes)
+	{
+		NOTIFY_COUNTERS pCounters{};
+		ReplayTrace(pEvents, nPaths, nBursts, pBurstEnds, nReplaySettleTime, pSubscribers, pCounters);
+		for (int nSubscriber = 0; nSubscriber < REPLAY_SUBSCRIBERS; nSubscriber++)
+		{
+			const REPLAY_SUBSCRIBER& pSubscriber = pSubscribers[nSubscriber];
+			int nSent = 0, nMaxSent = 0, nNotified = 0;
+			double nTotalDelay = 0, nMaxDelay = 0;
+			bool bResult = true;
+			for (int nBurst = 0; nBurst < nBursts; nBurst++)
+			{
+				const int nBurstSent = pSubscriber.pSent[nBurst];
+				nSent += nBurstSent;
+				nMaxSent = max(nMaxSent, nBurstSent);
+				if (nBurstSent > 0)
+				{
+					nNotified++;
+					nTotalDelay += pSubscriber.pDelays[nBurst];
+					nMaxDelay = max(nMaxDelay, pSubscriber.pDelays[nBurst]);
+				}
+				// Once, plus once per NOTIFY_SETTLE_LIMIT settle times of a burst that goes on
+				if ((nReplaySettleTime > 0) && (nBurstSent > 1 + (int)((pBurstEnds[nBurst] - pBurstStarts[nBurst]) / ((ULONGLONG)NOTIFY_SETTLE_LIMIT * nReplaySettleTime))))
+					bResult = false;
+			}
+			if (!bResult)
+				nFailures++;
+			wprintf(L"%10d %7d %7d %10d %13.0f %13.0f %9s\n", nReplaySettleTime, REPLAY_BANDWIDTHS[nSubscriber], nSent, nMaxSent,
+				(nNotified > 0) ? nTotalDelay / nNotified : 0.0, nMaxDelay, (nReplaySettleTime > 0) ? (bResult ? L"ok" : L"FAILED") : L"-");
+		}
+		wprintf(L"%10s pushed %llu, coalesced %llu, cancelled %llu, sent %llu\n", L"", pCounters.nPushed.load(), pCounters.nCoalesced.load(),
+			pCounters.nCancelled.load(), pCounters.nSent.load());
+	}
+	return (0 == nFailures) ? 0 : 1;
+}
+
+/**
+ * @brief Main entry point of IntelliBench
+ * @param argc Number of command-line arguments
+ * @param argv Array of command-line argument strings
+ * @return 0 on success
+ *
+ * COMMAND-LINE USAGE:
+ * ===================
+ * IntelliBench.exe -load <server> <port> <connections> [slow downloads] [server process id] [subscribers] [files]
+ * IntelliBench.exe -churn <server> <port> [cycles] [server process id]
+ * IntelliBench.exe -throughput <server> <port> [MiB per transfer] [RTT ms,...] [frame KiB,...]
+ * IntelliBench.exe -pipeline <server> <port> [MiB file size] [fetch ms per MiB] [client ms per MiB]
+ * IntelliBench.exe -smallfiles <server> <port> [files]
+ * IntelliBench.exe -store <server> <port> [MiB per transfer]
+ * IntelliBench.exe -batch <server> <port> [MiB file size] [batch size,...]
+ * IntelliBench.exe -migration <server> <port> [hold seconds]
+ * IntelliBench.exe -resume <server> <port> [MiB file size] [kills]
+ * IntelliBench.exe -dedup <server> <port> [MiB corpus] [copies] [Mbit/s]
+ * IntelliBench.exe -crc32c [MiB per run]
+ * IntelliBench.exe -chunker [MiB per run]
+ * IntelliBench.exe -sha256 [MiB per run]
+ * IntelliBench.exe -edits [MiB file size]
+ * IntelliBench.exe -diff [entries]
+ * IntelliBench.exe -watch [files] [writes]
+ * IntelliBench.exe -scan [files] [threads,...]
+ * IntelliBench.exe -restart [files]
+ * IntelliBench.exe -replay [trace file] [settle ms]
+ */
+int wmain(int argc, wchar_t* argv[])
+{
+	// MFC serves only the client sources; a console application initializes it without a CWinApp
+	if (!AfxWinInit(::GetModuleHandle(nullptr), nullptr, ::GetCommandLine(), 0))
+		return 1;
+	if ((argc > 1) && ((*argv[1] == L'-') || (*argv[1] == L'/')))
+	{
+		const wchar_t* lpszMode = argv[1] + 1;
+		const int nMegabytes = ((argc > 2) && (_wtoi(argv[2]) > 0)) ? _wtoi(argv[2]) : BENCH_DEFAULT_SIZE;
+		if ((argc >= 5) && (_wcsicmp(L"load", lpszMode) == 0))
+		{
+			return LoadTest(argv[2], _wtoi(argv[3]), _wtoi(argv[4]),
+				(argc > 5) ? _wtoi(argv[5]) : 0, (argc > 6) ? wcstoul(argv[6], nullptr, 10) : 0,
+				(argc > 7) ? _wtoi(argv[7]) : 0, ((argc > 8) && (_wtoi(argv[8]) > 0)) ? _wtoi(argv[8]) : NOTIFY_DEFAULT_FILES);
+		}
+		if ((argc >= 4) && (_wcsicmp(L"churn", lpszMode) == 0))
+		{
+			return ChurnTest(argv[2], _wtoi(argv[3]), ((argc > 4) && (_wtoi(argv[4]) > 0)) ? _wtoi(argv[4]) : CHURN_DEFAULT_CYCLES,
+				(argc > 5) ? wcstoul(argv[5], nullptr, 10) : 0);
+		}
+		if ((argc >= 4) && (_wcsicmp(L"throughput", lpszMode) == 0))
+		{
+			return BenchThroughput(argv[2], _wtoi(argv[3]), ((argc > 4) && (_wtoi(argv[4]) > 0)) ? _wtoi(argv[4]) : THROUGHPUT_DEFAULT_SIZE,
+				(argc > 5) ? argv[5] : THROUGHPUT_ROUND_TRIPS, (argc > 6) ? argv[6] : THROUGHPUT_FRAME_SIZES);
+		}
+		if ((argc >= 4) && (_wcsicmp(L"pipeline", lpszMode) == 0))
+		{
+			return BenchPipeline(argv[2], _wtoi(argv[3]), ((argc > 4) && (_wtoi(argv[4]) > 0)) ? _wtoi(argv[4]) : PIPELINE_DEFAULT_SIZE,
+				(argc > 5) ? _wtoi(argv[5]) : PIPELINE_DEFAULT_DELAY, (argc > 6) ? _wtoi(argv[6]) : PIPELINE_DEFAULT_DELAY);
+		}
+		if ((argc >= 4) && (_wcsicmp(L"smallfiles", lpszMode) == 0))
+			return BenchSmallFiles(argv[2], _wtoi(argv[3]), ((argc > 4) && (_wtoi(argv[4]) > 0)) ? _wtoi(argv[4]) : SMALL_DEFAULT_FILES);
+		if ((argc >= 4) && (_wcsicmp(L"store", lpszMode) == 0))
+			return BenchStore(argv[2], _wtoi(argv[3]), ((argc > 4) && (_wtoi(argv[4]) > 0)) ? _wtoi(argv[4]) : STORE_DEFAULT_SIZE);
+		if ((argc >= 4) && (_wcsicmp(L"batch", lpszMode) == 0))
+		{
+			return BenchBatch(argv[2], _wtoi(argv[3]), ((argc > 4) && (_wtoi(argv[4]) > 0)) ? _wtoi(argv[4]) : BATCH_DEFAULT_SIZE,
+				(argc > 5) ? argv[5] : BATCH_DEFAULT_SIZES);
+		}
+		if ((argc >= 4) && (_wcsicmp(L"migration", lpszMode) == 0))
+			return BenchMigration(argv[2], _wtoi(argv[3]), (argc > 4) ? _wtoi(argv[4]) : MIGRATION_DEFAULT_HOLD);
+		if ((argc >= 4) && (_wcsicmp(L"resume", lpszMode) == 0))
+		{
+			return BenchResume(argv[2], _wtoi(argv[3]), ((argc > 4) && (_wtoi(argv[4]) > 0)) ? _wtoi(argv[4]) : RESUME_DEFAULT_SIZE,
+				(argc > 5) ? _wtoi(argv[5]) : RESUME_DEFAULT_KILLS);
+		}
+		if ((argc >= 4) && (_wcsicmp(L"dedup", lpszMode) == 0))
+		{
+			return BenchDedup(argv[2], _wtoi(argv[3]), ((argc > 4) && (_wtoi(argv[4]) > 0)) ? _wtoi(argv[4]) : CORPUS_DEFAULT_SIZE,
+				((argc > 5) && (_wtoi(argv[5]) > 0)) ? _wtoi(argv[5]) : CORPUS_DEFAULT_COPIES,
+				(argc > 6) ? _wtoi(argv[6]) : CORPUS_DEFAULT_BANDWIDTH);
+		}
+		if (_wcsicmp(L"crc32c", lpszMode) == 0)
+			return BenchCRC32C(nMegabytes);
+		if (_wcsicmp(L"chunker", lpszMode) == 0)
+			return BenchChunker(nMegabytes);
+		if (_wcsicmp(L"sha256", lpszMode) == 0)
+			return BenchSHA256(nMegabytes);
+		if (_wcsicmp(L"edits", lpszMode) == 0)
+			return BenchEdits((argc > 2) ? nMegabytes : EDITS_DEFAULT_SIZE);
+		if (_wcsicmp(L"diff", lpszMode) == 0)
+			return BenchDiff(((argc > 2) && (_wtoi(argv[2]) > 0)) ? _wtoi(argv[2]) : DIFF_DEFAULT_ENTRIES);
+		if (_wcsicmp(L"watch", lpszMode) == 0)
+		{
+			return BenchWatch(((argc > 2) && (_wtoi(argv[2]) > 0)) ? _wtoi(argv[2]) : WATCH_DEFAULT_FILES,
+				((argc > 3) && (_wtoi(argv[3]) > 0)) ? _wtoi(argv[3]) : WATCH_DEFAULT_EVENTS);
+		}
+		if (_wcsicmp(L"scan", lpszMode) == 0)
+			return BenchScan(((argc > 2) && (_wtoi(argv[2]) > 0)) ? _wtoi(argv[2]) : SCAN_DEFAULT_FILES, (argc > 3) ? argv[3] : SCAN_DEFAULT_THREADS);
+		if (_wcsicmp(L"restart", lpszMode) == 0)
+			return BenchRestart(((argc > 2) && (_wtoi(argv[2]) >= RESTART_EDITED_FILES)) ? _wtoi(argv[2]) : RESTART_DEFAULT_FILES);
+		if (_wcsicmp(L"replay", lpszMode) == 0)
+			return BenchReplay((argc > 2) ? argv[2] : REPLAY_DEFAULT_TRACE, ((argc > 3) && (_wtoi(argv[3]) > 0)) ? _wtoi(argv[3]) : IntelliDiskNotifySettleTime);
+	}
+	wprintf(L"Parameters:\n");
+	wprintf(L" -load <server> <port> <connections> [slow downloads] [server process id] [subscribers] [files]\n");
+	wprintf(L" -churn <server> <port> [cycles] [server process id]\n");
+	wprintf(L" -throughput <server> <port> [MiB per transfer] [RTT ms,...] [frame KiB,...]\n");
+	wprintf(L" -pipeline <server> <port> [MiB file size] [fetch ms per MiB] [client ms per MiB]\n");
+	wprintf(L" -smallfiles <server> <port> [files]\n");
+	wprintf(L" -store <server> <port> [MiB per transfer]\n");
+	wprintf(L" -batch <server> <port> [MiB file size] [batch size,...]\n");
+	wprintf(L" -migration <server> <port> [hold seconds]\n");
+	wprintf(L" -resume <server> <port> [MiB file size] [kills]\n");
+	wprintf(L" -dedup <server> <port> [MiB corpus] [copies] [Mbit/s]\n");
+	wprintf(L" -crc32c [MiB per run]\n");
+	wprintf(L" -chunker [MiB per run]\n");
+	wprintf(L" -sha256 [MiB per run]\n");
+	wprintf(L" -edits [MiB file size]\n");
+	wprintf(L" -diff [entries]\n");
+	wprintf(L" -watch [files] [writes]\n");
+	wprintf(L" -scan [files] [threads,...]\n");
+	wprintf(L" -restart [files]\n");
+	wprintf(L" -replay [trace file] [settle ms]\n");
+	return 1;
+}
@@ -0,0 +1,11 @@
+DROP TABLE IF EXISTS `schema_version`;
+DROP TABLE IF EXISTS `upload_session`;
+DROP TABLE IF EXISTS `chunk`;
+DROP TABLE IF EXISTS `filedata`;
+DROP TABLE IF EXISTS `filename`;
+CREATE TABLE `filename` (`filename_id` BIGINT NOT NULL AUTO_INCREMENT, `filepath` VARCHAR(256) NOT NULL, `filesize` BIGINT NOT NULL, PRIMARY KEY(`filename_id`)) ENGINE=InnoDB;
+CREATE TABLE `filedata` (`filedata_id` BIGINT NOT NULL AUTO_INCREMENT, `filename_id` BIGINT NOT NULL, `content` LONGTEXT NOT NULL, `base64` BIGINT NOT NULL, PRIMARY KEY(`filedata_id`), FOREIGN KEY filedata_fk(filename_id) REFERENCES filename(filename_id)) ENGINE=InnoDB;
+CREATE UNIQUE INDEX index_filepath ON `filename`(`filepath`);
+INSERT INTO `filename` (`filepath`, `filesize`) VALUES ('IntelliBench-v1.bin', 1024 * 65531);
+SET SESSION cte_max_recursion_depth = 1024;
+INSERT INTO `filedata` (`filename_id`, `content`, `base64`) WITH RECURSIVE `rows` (`n`) AS (SELECT 1 UNION ALL SELECT `n` + 1 FROM `rows` WHERE `n` < 1024) SELECT LAST_INSERT_ID(), REPLACE(TO_BASE64(LEFT(REPEAT(UNHEX(SHA2(CAST(`n` AS CHAR), 256)), 2048), 65531)), '\n', ''), 65531 FROM `rows` ORDER BY `n`;
@@ -0,0 +1,51 @@
+@echo off
+rem Runs the load test against the IntelliHost.exe running on this machine and keeps its output in Results\
+rem Usage: LoadTest.cmd [connections] [slow downloads] [subscribers] [files] [port]
+rem Run it from an elevated prompt, as it widens the dynamic port range for the loopback connections.
+setlocal
+set CONNECTIONS=%~1
+if "%CONNECTIONS%"=="" set CONNECTIONS=50000
+set SLOW_DOWNLOADS=%~2
+if "%SLOW_DOWNLOADS%"=="" set SLOW_DOWNLOADS=64
+set SUBSCRIBERS=%~3
+if "%SUBSCRIBERS%"=="" set SUBSCRIBERS=8
+set FILES=%~4
+if "%FILES%"=="" set FILES=5000
+set PORT=%~5
+if "%PORT%"=="" set PORT=8080
+if "%INTELLIBENCH%"=="" set INTELLIBENCH=%~dp0x64\Release\IntelliBench.exe
+
+set SERVER_PID=
+for /f "tokens=2 delims=," %%P in ('tasklist /fi "imagename eq IntelliHost.exe" /fo csv /nh') do set SERVER_PID=%%~P
+if "%SERVER_PID%"=="" (
+	echo IntelliHost.exe is not running
+	exit /b 1
+)
+
+netsh int ipv4 set dynamicport tcp start=10000 num=55535 >nul || (
+	echo Cannot widen the dynamic port range, run from an elevated prompt
+	exit /b 1
+)
+
+if not exist "%~dp0Results" mkdir "%~dp0Results"
+for /f %%T in ('powershell -NoProfile -Command "Get-Date -Format yyyyMMdd-HHmmss"') do set STAMP=%%T
+set RESULTS=%~dp0Results\LoadTest-%STAMP%.txt
+
+rem What was measured: the machine, the commit and the command line
+(
+	echo IntelliBench -load 127.0.0.1 %PORT% %CONNECTIONS% %SLOW_DOWNLOADS% %SERVER_PID% %SUBSCRIBERS% %FILES%
+	echo Started %DATE% %TIME%
+	ver
+	echo Processors: %NUMBER_OF_PROCESSORS%
+	powershell -NoProfile -Command "'Memory: {0:N1} GiB' -f ((Get-CimInstance Win32_ComputerSystem).TotalPhysicalMemory / 1GB)"
+	git -C "%~dp0" rev-parse HEAD 2>nul
+	echo.
+) > "%RESULTS%"
+
+"%INTELLIBENCH%" -load 127.0.0.1 %PORT% %CONNECTIONS% %SLOW_DOWNLOADS% %SERVER_PID% %SUBSCRIBERS% %FILES% >> "%RESULTS%" 2>&1
+set RESULT=%ERRORLEVEL%
+echo Exit code %RESULT% >> "%RESULTS%"
+
+type "%RESULTS%"
+echo Results written to %RESULTS%
+exit /b %RESULT%
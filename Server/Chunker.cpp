@@ -0,0 +1,91 @@
+/* Copyright (C) 2022-2026 Stefan-Mihai MOGA
+This file is part of IntelliDisk application developed by Stefan-Mihai MOGA.
+IntelliDisk is an alternative Windows version to the famous Microsoft OneDrive!
+
+IntelliDisk is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the Open
+Source Initiative, either version 3 of the License, or any later version.
+
+IntelliDisk is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+IntelliDisk. If not, see <http://www.opensource.org/licenses/gpl-3.0.html>*/
+
+#include "pch.h"
+#include "Chunker.h"
+#include <array>
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#endif
+
+typedef std::array<uint64_t, 256> GEAR_TABLE;
+
+/**
+ * @brief Builds the gear table at compile time
+ * @details One pseudo-random 64-bit value per byte value (splitmix64 from a fixed seed),
+ *          so every client and server cuts the same data at the same places
+ * @return The 256-entry table
+ */
+static constexpr GEAR_TABLE BuildGearTable()
+{
+	GEAR_TABLE pTable = {};
+	uint64_t nState = 0x496E74656C6C6944;  // "IntelliD"
+	for (size_t nIndex = 0; nIndex < 256; nIndex++)
+	{
+		nState += 0x9E3779B97F4A7C15;
+		uint64_t nValue = nState;
+		nValue = (nValue ^ (nValue >> 30)) * 0xBF58476D1CE4E5B9;
+		nValue = (nValue ^ (nValue >> 27)) * 0x94D049BB133111EB;
+		pTable[nIndex] = nValue ^ (nValue >> 31);
+	}
+	return pTable;
+}
+
+static constexpr GEAR_TABLE g_pGearTable = BuildGearTable();
+
+/**
+ * @brief Returns a mask of the top nBits bits; the gear hash mixes the most bytes into its top bits
+ */
+static uint64_t TopBitsMask(const unsigned int nBits)
+{
+	return (nBits == 0) ? 0 : (~0ULL << (64 - nBits));
+}
+
+CContentChunker::CContentChunker(const unsigned int nMinSize, const unsigned int nAvgSize, const unsigned int nMaxSize)
+{
+	m_nMaxSize = min(max(nMaxSize, 64U), (unsigned int)CHUNKER_MAX_SIZE);
+	m_nMinSize = min(nMinSize, m_nMaxSize);
+	unsigned int nBits = 0;
+	while ((nBits < 30) && ((2U << nBits) <= nAvgSize))
+		nBits++;
+	m_nAvgSize = min(max(1U << nBits, m_nMinSize), m_nMaxSize);
+	m_nMaskSmall = TopBitsMask(min(nBits + 2, 63U));
+	m_nMaskLarge = TopBitsMask((nBits > 2) ? nBits - 2 : 0);
+}
+
+size_t CContentChunker::FindBoundary(const unsigned char* buffer, const size_t length) const
+{
+	if (length <= m_nMinSize)
+		return length;
+	const size_t nEnd = min(length, (size_t)m_nMaxSize);
+	const size_t nNormal = min(nEnd, (size_t)m_nAvgSize);
+	uint64_t nHash = 0;
+	size_t nIndex = m_nMinSize;
+	// The hash only depends on the last 64 bytes, so lanes could scan in parallel, but an AVX2 gather version measured slower; keep the scalar loop
+	for (; nIndex < nNormal; nIndex++)
+	{
+		nHash = (nHash << 1) + g_pGearTable[buffer[nIndex]];
+		if ((nHash & m_nMaskSmall) == 0)
+			return nIndex + 1;
+	}
+	for (; nIndex < nEnd; nIndex++)
+	{
+		nHash = (nHash << 1) + g_pGearTable[buffer[nIndex]];
+		if ((nHash & m_nMaskLarge) == 0)
+			return nIndex + 1;
+	}
+	return nEnd;
+}
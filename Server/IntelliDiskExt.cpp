@@ -17,6 +17,7 @@ IntelliDisk. If not, see <http://www.opensource.org/licenses/gpl-3.0.html>*/
 #include "IntelliDiskExt.h"
 #include "IntelliDiskINI.h"
 #include "IntelliDiskSQL.h"
+#include "NotifyQueue.h"
 
 #ifdef _DEBUG
 #define new DEBUG_NEW
@@ -24,6 +25,7 @@ IntelliDisk. If not, see <http://www.opensource.org/licenses/gpl-3.0.html>*/
 
 // Protocol control characters for communication handshake
 // Same as client-side protocol for bidirectional communication
+#define SOH 0x01  // Start of Header - marks the beginning of an extended data frame
 #define STX 0x02  // Start of Text - marks the beginning of a data packet
 #define ETX 0x03  // End of Text - marks the end of a data packet
 #define EOT 0x04  // End of Transmission - signals end of communication
@@ -31,14 +33,8 @@ IntelliDisk. If not, see <http://www.opensource.org/licenses/gpl-3.0.html>*/
 #define ACK 0x06  // Acknowledgment - confirms successful receipt
 #define NAK 0x15  // Negative Acknowledgment - indicates transmission error
 
-// File event identifiers for client notification queue
-#define ID_STOP_PROCESS 0x01   // Stop processing (not used server-side)
-#define ID_FILE_DOWNLOAD 0x02  // Notify client to download file
-#define ID_FILE_UPLOAD 0x03    // Notify client to upload file (not used)
-#define ID_FILE_DELETE 0x04    // Notify client to delete file
-
-constexpr auto NOTIFY_FILE_SIZE = 0x10000;      // Max queue size per client
 constexpr auto MAX_SOCKET_CONNECTIONS = 0x10000; // Max concurrent clients
+constexpr auto CONNECTION_PAGE_SIZE = 0x400;     // Slots the connection table grows by
 
 // === GLOBAL SERVER STATE ===
 // Server lifecycle flag - controls all client threads
@@ -47,37 +43,142 @@ bool g_bServerRunning = false;
 // Main server socket that accepts incoming connections
 CWSocket g_pServerSocket;
 
-// Client connection management
-int g_nSocketCount = 0;  // Total number of connected clients
-CWSocket g_pClientSocket[MAX_SOCKET_CONNECTIONS];  // Socket for each client
-int g_nThreadCount = 0;  // Total number of active threads
-DWORD m_dwThreadID[MAX_SOCKET_CONNECTIONS] = { 0, };  // Thread IDs
-HANDLE g_hThreadArray[MAX_SOCKET_CONNECTIONS] = { nullptr, };  // Thread handles
+// === EVENT-DRIVEN WORKER POOL ===
+// Clients are served by a fixed number of worker threads waiting on one
+// I/O completion port, instead of one thread per client
+constexpr auto MAX_WORKER_THREADS = 64;          // Upper bound for the worker pool
+constexpr ULONG_PTR SHUTDOWN_KEY = (ULONG_PTR)-1; // Completion key that stops a worker
+
+HANDLE g_hCompletionPort = nullptr;  // Completion port shared by all client sockets
+HANDLE g_hAcceptThread = nullptr;    // CreateDatabase (accept loop) thread handle
+DWORD m_dwAcceptThreadID = 0;        // CreateDatabase thread ID
+int g_nThreadCount = 0;  // Number of worker threads
+DWORD m_dwThreadID[MAX_WORKER_THREADS] = { 0, };  // Worker thread IDs
+HANDLE g_hThreadArray[MAX_WORKER_THREADS] = { nullptr, };  // Worker thread handles
+
+// === TRANSFER POOL ===
+// Uploads, downloads and manifests run on a second, bounded pool, so a burst of
+// long transfers never holds every worker while other clients wait to log in,
+// ping, delete or be told about a change. A worker that reads a transfer command
+// (or pops a download notification) hands the connection over, still CONNECTION_BUSY,
+// and the transfer worker finishes the step. Transfers beyond the pool size queue
+// on its completion port.
+constexpr auto MAX_TRANSFER_THREADS = 16;        // Upper bound for the transfer pool
+
+HANDLE g_hTransferPort = nullptr;    // Completion port of the transfer pool (connection keys only)
+int g_nTransferThreadCount = 0;      // Number of transfer threads
+HANDLE g_hTransferThreadArray[MAX_TRANSFER_THREADS] = { nullptr, };  // Transfer thread handles
+
+// Connection states - a worker may only talk to a client it moved from IDLE to BUSY
+#define CONNECTION_FREE 0    // Slot on the free list (or never used)
+#define CONNECTION_IDLE 1    // Waiting for a command or a notification
+#define CONNECTION_BUSY 2    // Owned by a worker thread
+#define CONNECTION_CLOSED 3  // Socket closed, slot released once its receive has completed
+
+// Completion keys and broadcast targets carry the slot generation next to the slot index,
+// so a key that outlived its connection never reaches the client that reuses the slot
+static_assert(MAX_SOCKET_CONNECTIONS <= 0x10000, "the slot index must fit in 16 bits");
+#define MAKE_CONNECTION_KEY(nIndex, nGeneration) ((((ULONG_PTR)(nGeneration)) << 16) | (ULONG_PTR)(nIndex))
+#define CONNECTION_INDEX(nKey) ((int)((nKey) & 0xFFFF))
+#define CONNECTION_GENERATION(nKey) ((LONG)(((nKey) >> 16) & 0xFFFF))
 
 // === PER-CLIENT NOTIFICATION QUEUE ARCHITECTURE ===
-// Each connected client has its own notification queue to receive
-// file change events from other clients (multi-client sync mechanism)
+// Each connected client has its own notification queue (CNotifyQueue) to receive
+// file change events from other clients (multi-client sync mechanism).
+// Any worker may push, only the worker serving the client pops; both take the
+// queue's SRWLOCK for the few instructions they need. An idle queue allocates
+// nothing and a pending path costs one deque entry; paths are interned in g_pPathTable.
+// Events for a path that is still pending are merged into its entry:
+// the last event wins, so a delete cancels a pending download.
+
+// Notification counters, TRACEd when the server stops
+NOTIFY_COUNTERS g_pNotifyCounters;
+
+// Pending notifications per client before it is switched to a full resync (IntelliDisk.xml)
+int g_nNotifyQueueLimit = IntelliDiskNotifyQueueLimit;
 
-// Single file event item
+// Milliseconds a path must stay quiet before its notification is sent (IntelliDisk.xml)
+int g_nNotifySettleTime = IntelliDiskNotifySettleTime;
+
+// === NOTIFICATION WAKE-UPS ===
+// Connections whose next notification is still settling are dispatched again by WakeThread
+HANDLE g_hWakeThread = nullptr;      // WakeThread handle
+SRWLOCK g_pWakeLock = SRWLOCK_INIT;  // Protects g_pWakeList, g_bWakeRunning and CONNECTION_STATE::nWakeTime
+CONDITION_VARIABLE g_pWakeChanged = CONDITION_VARIABLE_INIT; // An earlier wake-up was scheduled, or the thread stops
+std::multimap<ULONGLONG, int> g_pWakeList; // Tick count -> socket index
+bool g_bWakeRunning = false;
+
+// Interned file paths shared by all notification queues
+typedef struct {
+	SRWLOCK pLock;                 // Protects the table
+	std::unordered_map<std::wstring, unsigned int> pPathIndex; // Path -> ID
+	std::vector<std::wstring> pPathList; // ID -> path
+} PATH_TABLE;
+
+PATH_TABLE g_pPathTable = { SRWLOCK_INIT, };
+
+// Per-client connection state, kept in the connection table next to the client's socket
 typedef struct {
-	int nFileEvent;           // Event type: ID_FILE_DOWNLOAD or ID_FILE_DELETE
-	std::wstring strFilePath; // Affected file path
-} NOTIFY_FILE_DATA;
+	volatile LONG nState;       // CONNECTION_FREE, CONNECTION_IDLE, CONNECTION_BUSY or CONNECTION_CLOSED
+	volatile LONG nGeneration;  // 1..0xFFFF, advanced each time the slot is released (never 0)
+	volatile LONG bRecvPending; // Zero-byte receive outstanding on the completion port
+	OVERLAPPED pOverlapped;     // Used by the zero-byte receive
+	SRWLOCK pLock;              // Serializes notifications with the release of the slot
+	int nSessionPosition;       // Position in g_pSessionList (-1 = not authenticated)
+	std::wstring strComputerID; // Client's unique machine identifier
+	CNotifyQueue pNotifyQueue;  // Pending file events for this client
+	volatile LONG bNeedsResync; // Queue overflowed - send the file manifest instead of the events
+	volatile LONG bOverflowed;  // Queue overflowed without PROTOCOL_RESYNC - disconnect the client
+	std::string strTransferCommand; // Transfer command read by a worker, run by the transfer pool ("" = none)
+	int nTransferEvent;         // Download notification popped by a worker, sent by the transfer pool (0 = none)
+	std::wstring strTransferPath; // File path of nTransferEvent
+	ULONGLONG nWakeTime;        // Tick count of the earliest wake-up in g_pWakeList (0 = none)
+	bool bIsConnected;          // Logged in with a valid ComputerID
+	PROTOCOL_OPTIONS pProtocolOptions; // Negotiated during the handshake (legacy stop-and-wait until the client asks for more)
+} CONNECTION_STATE;
 
-// Complete notification queue for one client
-// Uses producer-consumer pattern with circular buffer
+// === CONNECTION TABLE ===
+// The table grows by pages of CONNECTION_PAGE_SIZE slots as clients arrive, up to MAX_SOCKET_CONNECTIONS,
+// so an idle server holds one page instead of every slot. A page is never moved or freed while the
+// server runs, so workers index their slots without g_pSlotLock.
+// Slots of closed connections go back to a free list and are reused by the next Accept()
 typedef struct {
-	HANDLE hOccupiedSemaphore;  // Count of items in queue
-	HANDLE hEmptySemaphore;      // Count of free slots
-	HANDLE hResourceMutex;       // Protects queue data structure
-	int nNextIn;                 // Write pointer (circular)
-	int nNextOut;                // Read pointer (circular)
-	NOTIFY_FILE_DATA arrNotifyData[NOTIFY_FILE_SIZE];  // Circular buffer
-} NOTIFY_FILE_ITEM;
-
-// Array of notification queues - one per client
-// g_pThreadData[i] corresponds to g_pClientSocket[i]
-NOTIFY_FILE_ITEM* g_pThreadData[MAX_SOCKET_CONNECTIONS];
+	CWSocket pClientSocket[CONNECTION_PAGE_SIZE];            // Socket for each client
+	CONNECTION_STATE pConnectionState[CONNECTION_PAGE_SIZE]; // State for each client
+} CONNECTION_PAGE;
+
+SRWLOCK g_pSlotLock = SRWLOCK_INIT;  // Protects g_pFreeSlots, g_nSlotCount and the allocation of pages
+std::unique_ptr<CONNECTION_PAGE> g_pConnectionPages[MAX_SOCKET_CONNECTIONS / CONNECTION_PAGE_SIZE];
+std::vector<int> g_pFreeSlots;       // Released slots, reused LIFO
+int g_nSlotCount = 0;                // Slots ever handed out (high-water mark)
+volatile LONG g_nConnectionCount = 0; // Open connections
+
+// Authenticated sessions - the only connections that receive broadcasts
+SRWLOCK g_pSessionLock = SRWLOCK_INIT;  // Protects g_pSessionList and nSessionPosition
+std::vector<ULONG_PTR> g_pSessionList;  // Connection keys, in no particular order
+
+void DispatchConnection(const int nSocketIndex);
+void DispatchNotification(const int nSocketIndex);
+
+/**
+ * @brief Returns the socket of a client
+ * @param nSocketIndex Index of the client socket (below g_nSlotCount)
+ * @return The socket in the connection table
+ */
+CWSocket& GetClientSocket(const int nSocketIndex)
+{
+	return g_pConnectionPages[nSocketIndex / CONNECTION_PAGE_SIZE]->pClientSocket[nSocketIndex % CONNECTION_PAGE_SIZE];
+}
+
+/**
+ * @brief Returns the connection state of a client
+ * @param nSocketIndex Index of the client socket (below g_nSlotCount)
+ * @return The state in the connection table
+ */
+CONNECTION_STATE& GetConnectionState(const int nSocketIndex)
+{
+	return g_pConnectionPages[nSocketIndex / CONNECTION_PAGE_SIZE]->pConnectionState[nSocketIndex % CONNECTION_PAGE_SIZE];
+}
 
 // === DATABASE AND AUTHENTICATION CONFIGURATION ===
 // Loaded from IntelliDisk.xml at server startup
@@ -124,7 +225,61 @@ std::string wstring_to_utf8(const std::wstring& wide_string)
 }
 
 const int MAX_BUFFER = 0x10000;
-bool g_bIsConnected[MAX_SOCKET_CONNECTIONS];
+const DWORD FRAME_TIMEOUT = 30000;  // Time to wait (ms) for a windowed data frame or its acknowledgement
+
+// Protocol options of a client until it asks for more
+const PROTOCOL_OPTIONS LEGACY_PROTOCOL = { 1, 0, 0, LEGACY_FRAME_SIZE };
+
+// Data path counters shared by all client threads
+DATAPATH_COUNTERS g_pDataPathCounters;
+
+/**
+ * @brief Returns the protocol options negotiated with a client
+ * @param nSocketIndex Index of the client socket
+ * @return The negotiated options
+ */
+const PROTOCOL_OPTIONS& GetProtocolOptions(const int nSocketIndex)
+{
+	return GetConnectionState(nSocketIndex).pProtocolOptions;
+}
+
+/**
+ * @brief Allocates the frame slots of a transfer according to the negotiated options
+ * @param pOptions Protocol options negotiated during the handshake
+ * @param nReadAheadSize Bytes a producer may fill into the slots of frames not sent yet (0 = none)
+ */
+CFrameWindow::CFrameWindow(const PROTOCOL_OPTIONS& pOptions, const unsigned int nReadAheadSize)
+{
+	m_nFlags = pOptions.nFlags;
+	m_nWindowSize = ((pOptions.nFlags & PROTOCOL_WINDOW) != 0) ? pOptions.nWindowSize : 0;
+	m_nFrameSize = ((m_nWindowSize > 0) && ((pOptions.nFlags & PROTOCOL_LARGE_FRAME) != 0)) ? pOptions.nFrameSize : LEGACY_FRAME_SIZE;
+	m_nSlotCount = (m_nWindowSize > 0) ? m_nWindowSize : 1;
+	if (nReadAheadSize > 0)
+		m_nSlotCount += max(nReadAheadSize / m_nFrameSize, 1U);
+	// Slots live on the heap; a legacy packet (STX, length, payload, ETX, LRC) fits in the slot as well
+	m_nSlotSize = sizeof(FRAME_HEADER) + max(m_nFrameSize, (unsigned int)MAX_BUFFER);
+	m_nBaseSequence = m_nNextSequence = 0;
+	m_pStorage.resize((size_t)(m_nSlotCount + 1) * m_nSlotSize);
+	m_nSlotLength.assign(m_nSlotCount, -1);
+	m_nRetryCount.assign(m_nSlotCount, 0);
+	g_pDataPathCounters.nAllocations++;
+}
+
+/**
+ * @brief Computes the checksum carried in a frame header
+ * @details With PROTOCOL_CRC32C the CRC covers the header fields before nChecksum and the payload,
+ *          so a damaged sequence number or length is detected as well; otherwise the LRC of the payload
+ * @param pHeader Frame header (nLength must be set)
+ * @param pPayload Frame payload
+ * @return The checksum to store in or compare with pHeader->nChecksum
+ */
+unsigned int CFrameWindow::GetChecksum(const FRAME_HEADER* pHeader, const unsigned char* pPayload) const
+{
+	if ((m_nFlags & PROTOCOL_CRC32C) == 0)
+		return calcLRC(pPayload, pHeader->nLength);
+	const uint32_t nCRC = calcCRC32C((const unsigned char*)pHeader, offsetof(FRAME_HEADER, nChecksum));
+	return calcCRC32C(pPayload, pHeader->nLength, nCRC);
+}
 
 // Hexadecimal conversion helpers
 const char HEX_MAP[] = { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F' };
@@ -204,14 +359,17 @@ bool ReadBuffer(const int nSocketIndex, CWSocket& pApplicationSocket, unsigned c
 			else
 				return false;
 		}
-		nLength = 0;
 		do {
+			nLength = 0;
 			while (pApplicationSocket.IsReadible(1000) &&
-				((nIndex = pApplicationSocket.Receive(pBuffer + nIndex, MAX_BUFFER - nLength)) > 0))
+				((nIndex = pApplicationSocket.Receive(pBuffer + nLength, MAX_BUFFER - nLength)) > 0))
 			{
 				nLength += nIndex;
 				TRACE(_T("Buffer Received %s\n"), dumpHEX(pBuffer, nLength).c_str());
 				nReturn = (pBuffer[nLength - 1] == calcLRC(&pBuffer[3], (nLength - 5))) ? ACK : NAK;
+				// Answer as soon as the whole packet is here instead of waiting for the line to go idle
+				if ((nLength >= 5) && (nLength >= 5 + (pBuffer[1] * 0x100) + pBuffer[2]))
+					break;
 			}
 			VERIFY(pApplicationSocket.Send(&nReturn, sizeof(nReturn)) == 1);
 			TRACE(_T("%s Sent\n"), ((ACK == nReturn) ? _T("ACK") : _T("NAK")));
@@ -220,7 +378,7 @@ bool ReadBuffer(const int nSocketIndex, CWSocket& pApplicationSocket, unsigned c
 		{
 			unsigned char chEOT = ACK;
 			if (pApplicationSocket.IsReadible(1000) &&
-				((nLength = pApplicationSocket.Receive(&chEOT, sizeof(chEOT))) > 0) &&
+				((nIndex = pApplicationSocket.Receive(&chEOT, sizeof(chEOT))) > 0) &&
 				(EOT == chEOT))
 			{
 				TRACE(_T("EOT Received\n"));
@@ -237,7 +395,7 @@ bool ReadBuffer(const int nSocketIndex, CWSocket& pApplicationSocket, unsigned c
 		TRACE(_T("%s\n"), lpszErrorMessage);
 		pException->Delete();
 		pApplicationSocket.Close();
-		g_bIsConnected[nSocketIndex] = false;
+		GetConnectionState(nSocketIndex).bIsConnected = false;
 		return false;
 	}
 	TRACE(_T("ReadBuffer: %s\n"), ((ACK == nReturn) ? _T("true") : _T("false")));
@@ -254,25 +412,23 @@ bool ReadBuffer(const int nSocketIndex, CWSocket& pApplicationSocket, unsigned c
  * @param SendEOT Whether to send an EOT handshake
  * @return true on successful write and protocol validation, false otherwise
  */
-#pragma warning(suppress: 6262)
 bool WriteBuffer(const int nSocketIndex, CWSocket& pApplicationSocket, const unsigned char* pBuffer, const int nLength, const bool SendENQ, const bool SendEOT)
 {
 	int nCount = 0;
 	unsigned char nReturn = ACK;
-	unsigned char pPacket[MAX_BUFFER] = { 0, };
 
 	try
 	{
-		ASSERT(nLength <= (sizeof(pPacket) - 5));
+		ASSERT(nLength <= LEGACY_FRAME_SIZE);
 		if (SendENQ && pApplicationSocket.IsWritable(1000))
 		{
 			unsigned char chENQ = ENQ;
 			TRACE(_T("ENQ Sent\n"));
 			VERIFY(pApplicationSocket.Send(&chENQ, sizeof(chENQ)) == 1);
-			ZeroMemory(pPacket, sizeof(pPacket));
-			nCount = MAX_BUFFER;
-			if (((nCount = pApplicationSocket.Receive(pPacket, nCount)) > 0) &&
-				(ACK == pPacket[nCount - 1]))
+			unsigned char pReply[0x10] = { 0, };
+			nCount = sizeof(pReply);
+			if (((nCount = pApplicationSocket.Receive(pReply, nCount)) > 0) &&
+				(ACK == pReply[nCount - 1]))
 			{
 				TRACE(_T("ACK Received\n"));
 				nCount = 0;
@@ -280,17 +436,17 @@ bool WriteBuffer(const int nSocketIndex, CWSocket& pApplicationSocket, const uns
 			else
 				return false;
 		}
-		ZeroMemory(pPacket, sizeof(pPacket));
-		CopyMemory(&pPacket[3], pBuffer, nLength);
-		pPacket[0] = STX;
-		pPacket[1] = (char)(nLength / 0x100);
-		pPacket[2] = nLength % 0x100;
-		pPacket[3 + nLength] = ETX;
-		pPacket[4 + nLength] = calcLRC(pBuffer, nLength);
+		// Header and trailer are sent around the caller's buffer without copying it
+		unsigned char pHeader[3] = { STX, (unsigned char)(nLength / 0x100), (unsigned char)(nLength % 0x100) };
+		unsigned char pTrailer[2] = { ETX, calcLRC(pBuffer, nLength) };
+		WSABUF pPacket[3] = {
+			{ sizeof(pHeader), (char*)pHeader },
+			{ (ULONG)nLength, (char*)pBuffer },
+			{ sizeof(pTrailer), (char*)pTrailer } };
 		do {
-			if (pApplicationSocket.Send(pPacket, (5 + nLength)) == (5 + nLength))
+			if (pApplicationSocket.Send(pPacket, _countof(pPacket)) == (5 + nLength))
 			{
-				TRACE(_T("Buffer Sent %s\n"), dumpHEX(pPacket, (5 + nLength)).c_str());
+				TRACE(_T("Buffer Sent %s\n"), dumpHEX(pBuffer, nLength).c_str());
 				VERIFY(pApplicationSocket.Receive(&nReturn, sizeof(nReturn)) == 1);
 				TRACE(_T("%s Received\n"), ((ACK == nReturn) ? _T("ACK") : _T("NAK")));
 			}
@@ -310,7 +466,7 @@ bool WriteBuffer(const int nSocketIndex, CWSocket& pApplicationSocket, const uns
 		TRACE(_T("%s\n"), lpszErrorMessage);
 		pException->Delete();
 		pApplicationSocket.Close();
-		g_bIsConnected[nSocketIndex] = false;
+		GetConnectionState(nSocketIndex).bIsConnected = false;
 		return false;
 	}
 	TRACE(_T("WriteBuffer: %s\n"), ((ACK == nReturn) ? _T("true") : _T("false")));
@@ -318,414 +474,154 @@ bool WriteBuffer(const int nSocketIndex, CWSocket& pApplicationSocket, const uns
 }
 
 /**
- * @brief Pushes a file event notification into the per-client queue
- * @param nSocketIndex Index of the client socket
- * @param nFileEvent The file event type (ID_FILE_UPLOAD, ID_FILE_DOWNLOAD, ID_FILE_DELETE)
- * @param strFilePath The file path associated with the event
- * 
- * MULTI-CLIENT SYNCHRONIZATION:
- * =============================
- * When Client A uploads/deletes a file, the server calls PushNotification()
- * for all OTHER clients (B, C, D...) to notify them of the change.
- * Each client's IntelliDiskThread will pop events from its queue and
- * send NotifyDownload or NotifyDelete commands to keep clients in sync.
+ * @brief Receives exactly nLength bytes from the socket
+ * @param pApplicationSocket The socket to read from
+ * @param pBuffer Buffer to store received data
+ * @param nLength Number of bytes to receive
+ * @return true if all bytes arrived before FRAME_TIMEOUT, false otherwise
  */
-void PushNotification(const int& nSocketIndex, const int nFileEvent, const std::wstring& strFilePath)
+bool ReceiveBuffer(CWSocket& pApplicationSocket, void* pBuffer, const int nLength)
 {
-	NOTIFY_FILE_ITEM* pThreadData = g_pThreadData[nSocketIndex];
-	// Verify queue is initialized before accessing
-	if ((pThreadData->hResourceMutex != nullptr) &&
-		(pThreadData->hEmptySemaphore != nullptr) &&
-		(pThreadData->hOccupiedSemaphore != nullptr))
+	int nIndex = 0;
+	while (nIndex < nLength)
 	{
-		// Wait for free space in queue
-		WaitForSingleObject(pThreadData->hEmptySemaphore, INFINITE);
-		// Lock queue for thread-safe access
-		WaitForSingleObject(pThreadData->hResourceMutex, INFINITE);
-
-		TRACE(_T("[PushNotification] nFileEvent = %d, strFilePath = \"%s\"\n"), nFileEvent, strFilePath.c_str());
-		// Add item to circular queue
-		pThreadData->arrNotifyData[pThreadData->nNextIn].nFileEvent = nFileEvent;
-		pThreadData->arrNotifyData[pThreadData->nNextIn].strFilePath = strFilePath;
-		pThreadData->nNextIn++;
-		pThreadData->nNextIn %= NOTIFY_FILE_SIZE;  // Wrap around
-
-		// Release lock and signal item available
-		ReleaseSemaphore(pThreadData->hResourceMutex, 1, nullptr);
-		ReleaseSemaphore(pThreadData->hOccupiedSemaphore, 1, nullptr);
+		if (!pApplicationSocket.IsReadible(FRAME_TIMEOUT))
+			return false;
+		const int nCount = pApplicationSocket.Receive((unsigned char*)pBuffer + nIndex, nLength - nIndex);
+		if (nCount <= 0)
+			return false;
+		nIndex += nCount;
 	}
+	return true;
 }
 
 /**
- * @brief Pops a file event notification from the per-client queue
- * @param nSocketIndex Index of the client socket
- * @param nFileEvent [out] The file event type
- * @param strFilePath [out] The file path associated with the event
+ * @brief Reads one acknowledgement of a windowed data frame and updates the window
+ * @details ACK slides the window up to the acknowledged frame (cumulative),
+ *          NAK resends only the damaged frame (selective)
+ * @param pApplicationSocket The socket to read from
+ * @param pFrameWindow Sliding window state of the current transfer
+ * @return true on success, false on timeout or too many retransmissions
  */
-void PopNotification(const int& nSocketIndex, int& nFileEvent, std::wstring& strFilePath)
+bool ReceiveFrameAck(CWSocket& pApplicationSocket, CFrameWindow& pFrameWindow)
 {
-	NOTIFY_FILE_ITEM* pThreadData = g_pThreadData[nSocketIndex];
-	if ((pThreadData->hResourceMutex != nullptr) &&
-		(pThreadData->hEmptySemaphore != nullptr) &&
-		(pThreadData->hOccupiedSemaphore != nullptr))
-	{
-		// Wait for item to be available in queue
-		WaitForSingleObject(pThreadData->hOccupiedSemaphore, INFINITE);
-		// Lock queue for thread-safe access
-		WaitForSingleObject(pThreadData->hResourceMutex, INFINITE);
+	FRAME_ACK pFrameAck = { 0, };
+	if (!ReceiveBuffer(pApplicationSocket, &pFrameAck, sizeof(pFrameAck)))
+		return false;
 
-		// Remove item from circular queue (FIFO)
-		nFileEvent = pThreadData->arrNotifyData[pThreadData->nNextOut].nFileEvent;
-		strFilePath = pThreadData->arrNotifyData[pThreadData->nNextOut].strFilePath;
-		pThreadData->nNextOut++;
-		pThreadData->nNextOut %= NOTIFY_FILE_SIZE;  // Wrap around
-		TRACE(_T("[PopNotification] nFileEvent = %d, strFilePath = \"%s\"\n"), nFileEvent, strFilePath.c_str());
+	// Ignore acknowledgements for frames that are no longer in flight
+	const unsigned int nOffset = pFrameAck.nSequence - pFrameWindow.m_nBaseSequence;
+	if (nOffset >= (pFrameWindow.m_nNextSequence - pFrameWindow.m_nBaseSequence))
+		return true;
 
-		// Release lock and signal free space available
-		ReleaseSemaphore(pThreadData->hResourceMutex, 1, nullptr);
-		ReleaseSemaphore(pThreadData->hEmptySemaphore, 1, nullptr);
+	if (ACK == pFrameAck.nReturn)
+	{
+		TRACE(_T("ACK %u Received\n"), pFrameAck.nSequence);
+		while (pFrameWindow.m_nBaseSequence != pFrameAck.nSequence + 1)
+			pFrameWindow.m_nSlotLength[pFrameWindow.m_nBaseSequence++ % pFrameWindow.m_nSlotCount] = -1;
 	}
+	else
+	{
+		TRACE(_T("NAK %u Received\n"), pFrameAck.nSequence);
+		const unsigned int nSlot = pFrameAck.nSequence % pFrameWindow.m_nSlotCount;
+		if (++pFrameWindow.m_nRetryCount[nSlot] > 3)  // Retry up to 3 times
+			return false;
+		const int nFrameLength = (int)sizeof(FRAME_HEADER) + pFrameWindow.m_nSlotLength[nSlot];
+		if (pApplicationSocket.Send(pFrameWindow.GetSlot(pFrameAck.nSequence), nFrameLength) != nFrameLength)
+			return false;
+	}
+	return true;
 }
 
 /**
- * @brief Main thread function for handling a single IntelliDisk client connection
- * @details Handles protocol negotiation, file commands (upload, download, delete),
- *          and notification queue processing for the client
- * @param lpParam Pointer to the socket index (int*)
- * @return 0 on thread exit
- * 
- * ARCHITECTURE: PER-CLIENT THREAD
- * ================================
- * Each connected client gets its own thread that:
- * 1. Manages client authentication (IntelliDisk + machine ID)
- * 2. Processes client-initiated commands (Upload, Download, Delete, Ping, Close)
- * 3. Monitors per-client notification queue for multi-client sync events
- * 4. Broadcasts file changes to other clients via PushNotification()
- * 
- * COMMAND PROTOCOL:
- * =================
- * Client -> Server:
- *   - "IntelliDisk" + MachineID: Initial handshake
- *   - "Upload" + filepath: Store file in database
- *   - "Download" + filepath: Retrieve file from database
- *   - "Delete" + filepath: Remove file from database
- *   - "Ping": Keep-alive message
- *   - "Close": Graceful disconnect
- * 
- * Server -> Client (Push Notifications):
- *   - "Restart": Server shutting down
- *   - "NotifyDownload" + filepath: Another client uploaded - download to sync
- *   - "NotifyDelete" + filepath: Another client deleted - delete to sync
+ * @brief Waits for a free slot in the window and returns its payload area
+ * @details Data read straight into this area and passed to WriteFrame is sent without any copy.
+ *          Without PROTOCOL_WINDOW the single slot is returned and WriteFrame sends it through WriteBuffer
+ * @param nSocketIndex Index of the client socket in the global socket array
+ * @param pApplicationSocket The socket to read acknowledgements from
+ * @param pFrameWindow Sliding window state of the current transfer
+ * @return Payload area of the next frame, or nullptr on error
  */
-#pragma warning(suppress: 6262)
-DWORD WINAPI IntelliDiskThread(LPVOID lpParam)
+unsigned char* ReserveFrame(const int nSocketIndex, CWSocket& pApplicationSocket, CFrameWindow& pFrameWindow)
 {
-	unsigned char pBuffer[MAX_BUFFER] = { 0, };
-	int nLength = 0;
-	// Get socket index from parameter (passed by CreateDatabase)
-	const int nSocketIndex = *(int*)(lpParam);
-	TRACE(_T("nSocketIndex = %d\n"), (nSocketIndex));
-	CWSocket& pApplicationSocket = g_pClientSocket[nSocketIndex];
-	ASSERT(pApplicationSocket.IsCreated());
-	std::wstring strComputerID;  // Client's unique machine identifier
-
-	// === INITIALIZE PER-CLIENT NOTIFICATION QUEUE ===
-	// Each client needs its own queue to receive sync notifications
-	g_pThreadData[nSocketIndex] = new NOTIFY_FILE_ITEM;
-	ASSERT(g_pThreadData[nSocketIndex] != nullptr);
-	NOTIFY_FILE_ITEM* pThreadData = g_pThreadData[nSocketIndex];
-	ASSERT(pThreadData != nullptr);
-	// Create synchronization objects for producer-consumer queue
-	pThreadData->hOccupiedSemaphore = CreateSemaphore(nullptr, 0, NOTIFY_FILE_SIZE, nullptr);  // Items in queue
-	pThreadData->hEmptySemaphore = CreateSemaphore(nullptr, NOTIFY_FILE_SIZE, NOTIFY_FILE_SIZE, nullptr);  // Free slots
-	pThreadData->hResourceMutex = CreateSemaphore(nullptr, 1, 1, nullptr);  // Queue mutex
-	// Initialize circular queue pointers
-	pThreadData->nNextIn = pThreadData->nNextOut = 0;
-
-	g_bIsConnected[nSocketIndex] = false;
-
-	while (g_bServerRunning)
-	{
-		try
-		{
-			if (!pApplicationSocket.IsCreated())
-				break;  // Socket closed, exit thread
-
-			if (pApplicationSocket.IsReadible(1000))
-			{
-				// === CLIENT COMMAND RECEIVED ===
-				nLength = sizeof(pBuffer);
-				ZeroMemory(pBuffer, sizeof(pBuffer));
-				if (ReadBuffer(nSocketIndex, pApplicationSocket, pBuffer, nLength, true, false))
-				{
-					const std::string strCommand = (char*) &pBuffer[3];
-					if (strCommand.compare("IntelliDisk") == 0)
-					{
-						// HANDSHAKE: Client sends "IntelliDisk" + machine ID for authentication
-						TRACE(_T("Client connected!\n"));
-						nLength = sizeof(pBuffer);
-						ZeroMemory(pBuffer, sizeof(pBuffer));
-						if (ReadBuffer(nSocketIndex, pApplicationSocket, pBuffer, nLength, false, true))
-						{
-							strComputerID = utf8_to_wstring((char*) &pBuffer[3]);
-							TRACE(_T("Logged In: %s!\n"), strComputerID.c_str());
-							g_bIsConnected[nSocketIndex] = true;
-						}
-					}
-					else
-					{
-						if (strCommand.compare("Close") == 0)
-						{
-							// CLIENT DISCONNECT: Graceful shutdown
-							nLength = sizeof(pBuffer);
-							ZeroMemory(pBuffer, sizeof(pBuffer));
-							if (((nLength = pApplicationSocket.Receive(pBuffer, nLength)) > 0) &&
-								(EOT == pBuffer[nLength - 1]))
-							{
-								TRACE(_T("EOT Received\n"));
-							}
-							pApplicationSocket.Close();
-							TRACE(_T("Logged Out: %s!\n"), strComputerID.c_str());
-							break;
-						}
-						else
-						{
-							if (strCommand.compare("Ping") == 0)
-							{
-								nLength = sizeof(pBuffer);
-								ZeroMemory(pBuffer, sizeof(pBuffer));
-								if (((nLength = pApplicationSocket.Receive(pBuffer, nLength)) > 0) &&
-									(EOT == pBuffer[nLength - 1]))
-								{
-									TRACE(_T("EOT Received\n"));
-								}
-								TRACE(_T("Ping!\n"));
-							}
-							else
-							{
-								if (strCommand.compare("Download") == 0)
-								{
-									nLength = sizeof(pBuffer);
-									ZeroMemory(pBuffer, sizeof(pBuffer));
-									if (ReadBuffer(nSocketIndex, pApplicationSocket, pBuffer, nLength, false, false))
-									{
-										const std::wstring& strFilePath = utf8_to_wstring((char*) &pBuffer[3]);
-										TRACE(_T("Downloading %s...\n"), strFilePath.c_str());
-										VERIFY(DownloadFile(nSocketIndex, pApplicationSocket, strFilePath));
-									}
-								}
-								else
-								{
-									if (strCommand.compare("Upload") == 0)
-									{
-										nLength = sizeof(pBuffer);
-										ZeroMemory(pBuffer, sizeof(pBuffer));
-										if (ReadBuffer(nSocketIndex, pApplicationSocket, pBuffer, nLength, false, false))
-										{
-											const std::wstring& strFilePath = utf8_to_wstring((char*) &pBuffer[3]);
-											TRACE(_T("Uploading %s...\n"), strFilePath.c_str());
-											// Store file in MySQL database
-											VERIFY(UploadFile(nSocketIndex, pApplicationSocket, strFilePath));
-
-											// === BROADCAST TO ALL OTHER CLIENTS ===
-											// Notify all other clients to download this file for sync
-											for (int nThreadIndex = 0; nThreadIndex < g_nSocketCount; nThreadIndex++)
-											{
-												if (nThreadIndex != nSocketIndex) // Skip current client
-													PushNotification(nThreadIndex, ID_FILE_DOWNLOAD, strFilePath);
-											}
-										}
-									}
-									else
-									{
-										if (strCommand.compare("Delete") == 0)
-										{
-											nLength = sizeof(pBuffer);
-											ZeroMemory(pBuffer, sizeof(pBuffer));
-											if (ReadBuffer(nSocketIndex, pApplicationSocket, pBuffer, nLength, false, false))
-											{
-												const std::wstring& strFilePath = utf8_to_wstring((char*) &pBuffer[3]);
-												TRACE(_T("Deleting %s...\n"), strFilePath.c_str());
-												// Remove file from MySQL database
-												VERIFY(DeleteFile(nSocketIndex, pApplicationSocket, strFilePath));
-
-												// === BROADCAST TO ALL OTHER CLIENTS ===
-												// Notify all other clients to delete this file for sync
-												for (int nThreadIndex = 0; nThreadIndex < g_nSocketCount; nThreadIndex++)
-												{
-													if (nThreadIndex != nSocketIndex) // Skip current client
-														PushNotification(nThreadIndex, ID_FILE_DELETE, strFilePath);
-												}
-											}
-										}
-									}
-								}
-							}
-						}
-					}
-				}
-			}
-			else
-			{
-				// === NO DATA AVAILABLE - CHECK NOTIFICATION QUEUE ===
-				// If server is stopping, notify client to restart
-				if (!g_bServerRunning)
-				{
-					// Send restart command to client for graceful shutdown
-					const std::string strCommand = "Restart";
-					nLength = (int)strCommand.length() + 1;
-					if (WriteBuffer(nSocketIndex, pApplicationSocket, (unsigned char*)strCommand.c_str(), nLength, true, true))
-					{
-						TRACE(_T("Restart!\n"));
-					}
-				}
-				else
-				{
-					// Process queued notifications for this client
-					// Check if there are pending file sync notifications
-					if (pThreadData->nNextIn != pThreadData->nNextOut)
-					{
-						// Dequeue notification and send to client
-						int nFileEvent = 0;
-						std::wstring strFilePath;
-						PopNotification(nSocketIndex, nFileEvent, strFilePath);
+	if (!pFrameWindow.IsEnabled())
+		return pFrameWindow.GetSlot(0) + sizeof(FRAME_HEADER);
 
-						if (ID_FILE_DOWNLOAD == nFileEvent)
-						{
-							// Another client uploaded - tell this client to download
-							const std::string strCommand = "NotifyDownload";
-							nLength = (int)strCommand.length() + 1;
-							if (WriteBuffer(nSocketIndex, pApplicationSocket, (unsigned char*)strCommand.c_str(), nLength, true, false))
-							{
-								const std::string strFileName = wstring_to_utf8(strFilePath);
-								nLength = (int)strFileName.length() + 1;
-								if (WriteBuffer(nSocketIndex, pApplicationSocket, (unsigned char*)strFileName.c_str(), nLength, false, false))
-								{
-									TRACE(_T("Downloading %s...\n"), strFilePath.c_str());
-									VERIFY(DownloadFile(nSocketIndex, pApplicationSocket, strFilePath));
-								}
-							}
-						}
-						else if (ID_FILE_DELETE == nFileEvent)
-						{
-							const std::string strCommand = "NotifyDelete";
-							nLength = (int)strCommand.length() + 1;
-							if (WriteBuffer(nSocketIndex, pApplicationSocket, (unsigned char*)strCommand.c_str(), nLength, true, false))
-							{
-								const std::string strFileName = wstring_to_utf8(strFilePath);
-								nLength = (int)strFileName.length() + 1;
-								if (WriteBuffer(nSocketIndex, pApplicationSocket, (unsigned char*)strFileName.c_str(), nLength, false, false))
-								{
-									TRACE(_T("Deleting %s...\n"), strFilePath.c_str());
-								}
-							}
-						}
-					}
-				}
-			}
-		}
-		catch (CWSocketException* pException)
+	try
+	{
+		while ((pFrameWindow.m_nNextSequence - pFrameWindow.m_nBaseSequence) >= pFrameWindow.m_nWindowSize)
 		{
-			const int nErrorLength = 0x100;
-			TCHAR lpszErrorMessage[nErrorLength] = { 0, };
-			pException->GetErrorMessage(lpszErrorMessage, nErrorLength);
-			TRACE(_T("%s\n"), lpszErrorMessage);
-			pException->Delete();
-			pApplicationSocket.Close();
-			g_bIsConnected[nSocketIndex] = false;
-			break;
+			if (!ReceiveFrameAck(pApplicationSocket, pFrameWindow))
+				return nullptr;
 		}
 	}
-
-	// Cleanup per-thread resources
-	if (pThreadData->hResourceMutex != nullptr)
-	{
-		VERIFY(CloseHandle(pThreadData->hResourceMutex));
-		pThreadData->hResourceMutex = nullptr;
-	}
-	if (pThreadData->hEmptySemaphore != nullptr)
-	{
-		VERIFY(CloseHandle(pThreadData->hEmptySemaphore));
-		pThreadData->hEmptySemaphore = nullptr;
-	}
-	if (pThreadData->hOccupiedSemaphore != nullptr)
+	catch (CWSocketException* pException)
 	{
-		VERIFY(CloseHandle(pThreadData->hOccupiedSemaphore));
-		pThreadData->hOccupiedSemaphore = nullptr;
+		const int nErrorLength = 0x100;
+		TCHAR lpszErrorMessage[nErrorLength] = { 0, };
+		pException->GetErrorMessage(lpszErrorMessage, nErrorLength);
+		TRACE(_T("%s\n"), lpszErrorMessage);
+		pException->Delete();
+		pApplicationSocket.Close();
+		GetConnectionState(nSocketIndex).bIsConnected = false;
+		return nullptr;
 	}
-	delete g_pThreadData[nSocketIndex];
-	g_pThreadData[nSocketIndex] = nullptr;
-
-	TRACE(_T("exiting...\n"));
-	return 0;
+	return pFrameWindow.GetSlot(pFrameWindow.m_nNextSequence) + sizeof(FRAME_HEADER);
 }
 
-int g_nServicePort = IntelliDiskPort;
-
 /**
- * @brief Main server thread for accepting client connections and launching handler threads
- * @details Loads configuration from INI file, binds the server socket, and enters the accept loop.
- *          Creates a new IntelliDiskThread for each incoming client connection
- * @param lpParam Unused parameter
- * @return 0 on success, non-zero on error
- * 
- * SERVER LIFECYCLE:
- * =================
- * 1. Load service port and database settings from IntelliDisk.xml
- * 2. Bind server socket to port (default 8080)
- * 3. Listen for incoming connections (backlog = 65536)
- * 4. Accept loop:
- *    - Accept() blocks until client connects
- *    - Create new IntelliDiskThread for each client
- *    - Increment socket/thread counters
- * 5. Shutdown: Close server socket and wait for threads
+ * @brief Sends one data frame, keeping up to the window size of frames in flight
+ * @details Falls back to WriteBuffer when the client did not negotiate PROTOCOL_WINDOW
+ * @param nSocketIndex Index of the client socket in the global socket array
+ * @param pApplicationSocket The socket to write to
+ * @param pFrameWindow Sliding window state of the current transfer
+ * @param pBuffer Buffer containing data to send
+ * @param nLength Length of data to send
+ * @return true if the frame was sent, false otherwise
  */
-DWORD WINAPI CreateDatabase(LPVOID lpParam)
+bool WriteFrame(const int nSocketIndex, CWSocket& pApplicationSocket, CFrameWindow& pFrameWindow, const unsigned char* pBuffer, const int nLength)
 {
-	UNREFERENCED_PARAMETER(lpParam);
+	if (!pFrameWindow.IsEnabled())
+		return WriteBuffer(nSocketIndex, pApplicationSocket, pBuffer, nLength, false, false);
+
 	try
 	{
-		TRACE(_T("CreateDatabase()\n"));
-		// Load configuration from XML settings file
-		g_nServicePort = LoadServicePort();
-		if (!LoadAppSettings(g_strHostName, g_nHostPort, g_strDatabase, g_strUsername, g_strPassword))
+		ASSERT(nLength <= pFrameWindow.GetFrameSize());
+		// Step 1: Block only while the window is full (no-op after ReserveFrame)
+		while ((pFrameWindow.m_nNextSequence - pFrameWindow.m_nBaseSequence) >= pFrameWindow.m_nWindowSize)
 		{
-			// Configuration load failed but continue with defaults
-			// return (DWORD)-1;
+			if (!ReceiveFrameAck(pApplicationSocket, pFrameWindow))
+				return false;
 		}
-
-		// Bind server socket to port and start listening
-		g_pServerSocket.CreateAndBind(g_nServicePort, SOCK_STREAM, AF_INET);
-		if (g_pServerSocket.IsCreated())
+		// Step 2: Build the frame in its slot, where it stays until acknowledged;
+		// the payload is already in place when the caller filled the slot returned by ReserveFrame
+		const unsigned int nSequence = pFrameWindow.m_nNextSequence++;
+		const unsigned int nSlot = nSequence % pFrameWindow.m_nSlotCount;
+		unsigned char* pFrame = pFrameWindow.GetSlot(nSequence);
+		FRAME_HEADER* pHeader = (FRAME_HEADER*)pFrame;
+		ZeroMemory(pHeader, sizeof(FRAME_HEADER));
+		pHeader->nStart = SOH;
+		pHeader->nSequence = nSequence;
+		pHeader->nLength = nLength;
+		if (pBuffer != pFrame + sizeof(FRAME_HEADER))
 		{
-			g_bServerRunning = true;
-			g_pServerSocket.Listen(MAX_SOCKET_CONNECTIONS);  // Backlog = 65536
-
-			// === ACCEPT LOOP ===
-			// Accept incoming connections until server stops
-			while (g_bServerRunning)
-			{
-				// Block until client connects (or StopProcessingThread interrupts)
-				g_pServerSocket.Accept(g_pClientSocket[g_nSocketCount]);
-
-				if (g_bServerRunning)
-				{
-					// Create new thread to handle this client
-					const int nSocketIndex = g_nSocketCount;
-					g_hThreadArray[g_nThreadCount] = CreateThread(nullptr, 0, IntelliDiskThread, (int*)&nSocketIndex, 0, &m_dwThreadID[g_nThreadCount]);
-					ASSERT(g_hThreadArray[g_nThreadCount] != nullptr);
-					g_nSocketCount++;
-					g_nThreadCount++;
-				}
-				else
-				{
-					// Server stopping - close the socket that unblocked Accept()
-					g_pClientSocket[g_nSocketCount].Close();
-					g_nSocketCount++;
-				}
-			}
+			CopyMemory(pFrame + sizeof(FRAME_HEADER), pBuffer, nLength);
+			g_pDataPathCounters.nCopiedBytes += nLength;
+		}
+		pHeader->nChecksum = pFrameWindow.GetChecksum(pHeader, pFrame + sizeof(FRAME_HEADER));
+		pFrameWindow.m_nSlotLength[nSlot] = nLength;
+		pFrameWindow.m_nRetryCount[nSlot] = 0;
+		// Step 3: Send the frame without waiting for its acknowledgement
+		const int nFrameLength = (int)sizeof(FRAME_HEADER) + nLength;
+		if (pApplicationSocket.Send(pFrame, nFrameLength) != nFrameLength)
+			return false;
+		TRACE(_T("Frame %u Sent\n"), nSequence);
+		// Step 4: Consume acknowledgements that have already arrived
+		while ((pFrameWindow.m_nBaseSequence != pFrameWindow.m_nNextSequence) && pApplicationSocket.IsReadible(0))
+		{
+			if (!ReceiveFrameAck(pApplicationSocket, pFrameWindow))
+				return false;
 		}
-		g_pServerSocket.Close();
 	}
 	catch (CWSocketException* pException)
 	{
@@ -734,60 +630,1345 @@ DWORD WINAPI CreateDatabase(LPVOID lpParam)
 		pException->GetErrorMessage(lpszErrorMessage, nErrorLength);
 		TRACE(_T("%s\n"), lpszErrorMessage);
 		pException->Delete();
+		pApplicationSocket.Close();
+		GetConnectionState(nSocketIndex).bIsConnected = false;
+		return false;
 	}
-	return 0;
-}
-
-/**
- * @brief Starts the main server processing thread
- * @details Creates and launches the CreateDatabase thread which accepts client connections
- */
-void StartProcessingThread()
-{
-	TRACE(_T("StartProcessingThread()\n"));
-	g_hThreadArray[g_nThreadCount] = CreateThread(nullptr, 0, CreateDatabase, nullptr, 0, &m_dwThreadID[g_nThreadCount]);
-	ASSERT(g_hThreadArray[g_nThreadCount] != nullptr);
-	g_nThreadCount++;
+	return true;
 }
 
 /**
- * @brief Stops the server processing thread and closes all client sockets
- * @details Sets server running flag to false, connects to self to unblock accept(),
- *          waits for all threads to complete, and closes all client connections
- * 
- * GRACEFUL SHUTDOWN SEQUENCE:
- * ===========================
- * 1. Set g_bServerRunning = false to signal all threads to stop
- * 2. Connect to self (localhost) to unblock Accept() call
- * 3. Wait for all client threads to exit (they'll see g_bServerRunning == false)
- * 4. Close all client sockets
- * 5. Reset counters
+ * @brief Waits until every data frame sent through the window has been acknowledged
+ * @param nSocketIndex Index of the client socket in the global socket array
+ * @param pApplicationSocket The socket to read acknowledgements from
+ * @param pFrameWindow Sliding window state of the current transfer
+ * @return true if all frames were acknowledged, false otherwise
  */
-void StopProcessingThread()
+bool FlushFrames(const int nSocketIndex, CWSocket& pApplicationSocket, CFrameWindow& pFrameWindow)
 {
-	CWSocket pClosingSocket;
 	try
 	{
-		TRACE(_T("StopProcessingThread()\n"));
-		if (g_bServerRunning)
+		while (pFrameWindow.m_nBaseSequence != pFrameWindow.m_nNextSequence)
 		{
-			// Step 1: Signal all threads to stop
+			if (!ReceiveFrameAck(pApplicationSocket, pFrameWindow))
+				return false;
+		}
+	}
+	catch (CWSocketException* pException)
+	{
+		const int nErrorLength = 0x100;
+		TCHAR lpszErrorMessage[nErrorLength] = { 0, };
+		pException->GetErrorMessage(lpszErrorMessage, nErrorLength);
+		TRACE(_T("%s\n"), lpszErrorMessage);
+		pException->Delete();
+		pApplicationSocket.Close();
+		GetConnectionState(nSocketIndex).bIsConnected = false;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Receives the next data frame in sequence order
+ * @details Every valid frame is acknowledged immediately (cumulative ACK), a damaged
+ *          frame is NAKed on its own while the frames behind it are kept in the window.
+ *          Falls back to ReadBuffer when the client did not negotiate PROTOCOL_WINDOW
+ * @param nSocketIndex Index of the client socket in the global socket array
+ * @param pApplicationSocket The socket to read from
+ * @param pFrameWindow Sliding window state of the current transfer
+ * @param pPayload [out] Points to the payload, valid until the next call
+ * @param nLength [out] Length of the payload
+ * @return true on success, false otherwise
+ */
+bool ReadFrame(const int nSocketIndex, CWSocket& pApplicationSocket, CFrameWindow& pFrameWindow, unsigned char*& pPayload, int& nLength)
+{
+	if (!pFrameWindow.IsEnabled())
+	{
+		unsigned char* pBuffer = pFrameWindow.GetSlot(0);
+		nLength = (int)pFrameWindow.m_nSlotSize;
+		if (!ReadBuffer(nSocketIndex, pApplicationSocket, pBuffer, nLength, false, false))
+			return false;
+		pPayload = &pBuffer[3];
+		nLength -= 5;
+		return true;
+	}
+
+	try
+	{
+		const unsigned int nMaxLength = pFrameWindow.m_nFrameSize;
+		const unsigned int nBaseSlot = pFrameWindow.m_nBaseSequence % pFrameWindow.m_nSlotCount;
+		while (pFrameWindow.m_nSlotLength[nBaseSlot] < 0)
+		{
+			FRAME_HEADER pHeader = { 0, };
+			if (!ReceiveBuffer(pApplicationSocket, &pHeader, sizeof(pHeader)) ||
+				(SOH != pHeader.nStart) || (pHeader.nLength > nMaxLength))
+			{
+				TRACE(_T("Invalid frame header!\n"));
+				return false;
+			}
+			// Duplicates of frames already delivered are read into the scratch slot and only acknowledged again
+			const unsigned int nSlot = pHeader.nSequence % pFrameWindow.m_nSlotCount;
+			const bool bInWindow = (pHeader.nSequence - pFrameWindow.m_nBaseSequence) < pFrameWindow.m_nWindowSize;
+			unsigned char* pFrame = bInWindow ? pFrameWindow.GetSlot(pHeader.nSequence) : pFrameWindow.GetScratch();
+			if (!ReceiveBuffer(pApplicationSocket, pFrame + sizeof(FRAME_HEADER), pHeader.nLength))
+				return false;
+			TRACE(_T("Frame %u Received\n"), pHeader.nSequence);
+
+			FRAME_ACK pFrameAck = { ACK, 0 };
+			if (pHeader.nChecksum == pFrameWindow.GetChecksum(&pHeader, pFrame + sizeof(FRAME_HEADER)))
+			{
+				if (bInWindow)
+					pFrameWindow.m_nSlotLength[nSlot] = pHeader.nLength;
+				// Acknowledge every frame received without a gap since the window base
+				unsigned int nSequence = pFrameWindow.m_nBaseSequence;
+				while (((nSequence - pFrameWindow.m_nBaseSequence) < pFrameWindow.m_nWindowSize) &&
+					(pFrameWindow.m_nSlotLength[nSequence % pFrameWindow.m_nSlotCount] >= 0))
+					nSequence++;
+				pFrameAck.nSequence = nSequence - 1;
+			}
+			else
+			{
+				if (bInWindow && (++pFrameWindow.m_nRetryCount[nSlot] > 3))  // Retry up to 3 times
+					return false;
+				pFrameAck.nReturn = NAK;
+				pFrameAck.nSequence = pHeader.nSequence;
+			}
+			VERIFY(pApplicationSocket.Send(&pFrameAck, sizeof(pFrameAck)) == sizeof(pFrameAck));
+			TRACE(_T("%s %u Sent\n"), ((ACK == pFrameAck.nReturn) ? _T("ACK") : _T("NAK")), pFrameAck.nSequence);
+		}
+		// Deliver the frame at the window base; its slot is reused only after the next call
+		pPayload = pFrameWindow.GetSlot(pFrameWindow.m_nBaseSequence) + sizeof(FRAME_HEADER);
+		nLength = pFrameWindow.m_nSlotLength[nBaseSlot];
+		pFrameWindow.m_nSlotLength[nBaseSlot] = -1;
+		pFrameWindow.m_nRetryCount[nBaseSlot] = 0;
+		pFrameWindow.m_nBaseSequence++;
+	}
+	catch (CWSocketException* pException)
+	{
+		const int nErrorLength = 0x100;
+		TCHAR lpszErrorMessage[nErrorLength] = { 0, };
+		pException->GetErrorMessage(lpszErrorMessage, nErrorLength);
+		TRACE(_T("%s\n"), lpszErrorMessage);
+		pException->Delete();
+		pApplicationSocket.Close();
+		GetConnectionState(nSocketIndex).bIsConnected = false;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Returns the ID of a file path, adding it to the shared path table if needed
+ * @param strFilePath The file path
+ * @return The path ID (stable for the lifetime of the server)
+ */
+unsigned int InternPath(const std::wstring& strFilePath)
+{
+	AcquireSRWLockShared(&g_pPathTable.pLock);
+	auto pFound = g_pPathTable.pPathIndex.find(strFilePath);
+	const bool bFound = (pFound != g_pPathTable.pPathIndex.end());
+	const unsigned int nPathID = bFound ? pFound->second : 0;
+	ReleaseSRWLockShared(&g_pPathTable.pLock);
+	if (bFound)
+		return nPathID;
+
+	AcquireSRWLockExclusive(&g_pPathTable.pLock);
+	auto pInserted = g_pPathTable.pPathIndex.emplace(strFilePath, (unsigned int)g_pPathTable.pPathList.size());
+	if (pInserted.second)
+		g_pPathTable.pPathList.push_back(strFilePath);
+	const unsigned int nNewPathID = pInserted.first->second;
+	ReleaseSRWLockExclusive(&g_pPathTable.pLock);
+	return nNewPathID;
+}
+
+/**
+ * @brief Returns the file path of an interned path ID
+ * @param nPathID The path ID returned by InternPath()
+ * @return The file path
+ */
+std::wstring GetInternedPath(const unsigned int nPathID)
+{
+	AcquireSRWLockShared(&g_pPathTable.pLock);
+	const std::wstring strFilePath = g_pPathTable.pPathList[nPathID];
+	ReleaseSRWLockShared(&g_pPathTable.pLock);
+	return strFilePath;
+}
+
+/**
+ * @brief Pushes a file event notification into the per-client queue
+ * @param nConnectionKey Slot index and generation of the client (MAKE_CONNECTION_KEY)
+ * @param nFileEvent The file event type (ID_FILE_UPLOAD, ID_FILE_DOWNLOAD, ID_FILE_DELETE)
+ * @param strFilePath The file path associated with the event
+ * 
+ * MULTI-CLIENT SYNCHRONIZATION:
+ * =============================
+ * When Client A uploads/deletes a file, the server calls PushNotification()
+ * for all OTHER clients (B, C, D...) to notify them of the change.
+ * The notification wakes the client's connection on the worker pool, which
+ * sends NotifyDownload or NotifyDelete commands to keep clients in sync.
+ * If the client has not been sent an event for this path yet, the pending event
+ * is replaced instead. An event waits until its path has been quiet for
+ * g_nNotifySettleTime (WakeThread dispatches it then), so a burst of edits costs
+ * one transfer per client even when the client keeps up with every edit.
+ * Producers only share the connection lock, which keeps ReleaseConnection() out.
+ *
+ * BACKPRESSURE:
+ * =============
+ * The producer never waits for the client. When a queue reaches g_nNotifyQueueLimit,
+ * its events are discarded and the client is flagged for a full resync: it gets the
+ * file manifest ("NotifyResync", see SendManifest) and downloads what it is missing.
+ * Clients without PROTOCOL_RESYNC cannot be told what they missed, so they are sent
+ * "Restart" and disconnected instead of losing events silently. Until the worker starts
+ * the resync, the queue drops further events (the manifest covers them).
+ */
+void PushNotification(const ULONG_PTR nConnectionKey, const int nFileEvent, const std::wstring& strFilePath)
+{
+	const int nSocketIndex = CONNECTION_INDEX(nConnectionKey);
+	CONNECTION_STATE& pConnection = GetConnectionState(nSocketIndex);
+	AcquireSRWLockShared(&pConnection.pLock);
+	// Verify the key still names an open connection
+	if ((pConnection.nGeneration == CONNECTION_GENERATION(nConnectionKey)) &&
+		((pConnection.nState == CONNECTION_IDLE) || (pConnection.nState == CONNECTION_BUSY)))
+	{
+		TRACE(_T("[PushNotification] nFileEvent = %d, strFilePath = \"%s\"\n"), nFileEvent, strFilePath.c_str());
+		const unsigned int nPathID = InternPath(strFilePath);
+		int nPreviousEvent = 0;
+		int nDiscarded = 0;
+		const int nResult = pConnection.pNotifyQueue.Push(nPathID, nFileEvent, g_nNotifyQueueLimit, GetTickCount64(), g_nNotifySettleTime, nPreviousEvent, nDiscarded);
+		CountNotification(g_pNotifyCounters, nResult, nFileEvent, nPreviousEvent, nDiscarded);
+		switch (nResult)
+		{
+			case NOTIFY_OVERFLOW:
+				// The client does not keep up - replace the queued events with one full resync,
+				// or with a disconnect when the client cannot take a manifest
+				if ((GetConnectionState(nSocketIndex).pProtocolOptions.nFlags & PROTOCOL_RESYNC) != 0)
+				{
+					InterlockedExchange(&pConnection.bNeedsResync, TRUE);
+					TRACE(_T("[PushNotification] queue overflow, nSocketIndex = %d needs a full resync\n"), nSocketIndex);
+				}
+				else
+				{
+					InterlockedExchange(&pConnection.bOverflowed, TRUE);
+					TRACE(_T("[PushNotification] queue overflow, nSocketIndex = %d will be disconnected\n"), nSocketIndex);
+				}
+				break;
+			case NOTIFY_DROPPED:
+				// The manifest about to be sent, or the reconnect, covers this change
+				break;
+		}
+
+		// Wake the connection if no worker is serving it right now, or once the event has settled
+		DispatchNotification(nSocketIndex);
+	}
+	ReleaseSRWLockShared(&pConnection.pLock);
+}
+
+/**
+ * @brief Pops a file event notification from the per-client queue
+ * @param nSocketIndex Index of the client socket
+ * @param nFileEvent [out] The file event type
+ * @param strFilePath [out] The file path associated with the event
+ * @return true if an event was popped, false if the queue is empty or its oldest event is still settling
+ */
+bool PopNotification(const int nSocketIndex, int& nFileEvent, std::wstring& strFilePath)
+{
+	NOTIFY_FILE_NODE pNode = { 0, 0, 0, 0 };
+	if (!GetConnectionState(nSocketIndex).pNotifyQueue.Pop(pNode, GetTickCount64()))
+		return false;
+	nFileEvent = pNode.nFileEvent;
+	strFilePath = GetInternedPath(pNode.nPathID);
+	TRACE(_T("[PopNotification] nFileEvent = %d, strFilePath = \"%s\"\n"), nFileEvent, strFilePath.c_str());
+	return true;
+}
+
+/**
+ * @brief Checks whether a client has notifications ready to be sent
+ * @param nSocketIndex Index of the client socket
+ * @return true if a settled notification (or a full resync, or a disconnect) is pending
+ */
+bool HasNotification(const int nSocketIndex)
+{
+	CNotifyQueue& pNotifyQueue = GetConnectionState(nSocketIndex).pNotifyQueue;
+	if (pNotifyQueue.GetCount() > 0)
+	{
+		const ULONGLONG nReadyTime = pNotifyQueue.GetReadyTime();
+		if ((nReadyTime != 0) && (nReadyTime <= GetTickCount64()))
+			return true;
+	}
+	return (GetConnectionState(nSocketIndex).bNeedsResync != FALSE) ||
+		(GetConnectionState(nSocketIndex).bOverflowed != FALSE);
+}
+
+/**
+ * @brief Schedules a connection to be dispatched by WakeThread
+ * @param nSocketIndex Index of the client socket
+ * @param nWakeTime Tick count of the wake-up
+ * @details A connection keeps only its earliest wake-up; when that one fires, the
+ *          connection schedules its next one (DispatchNotification)
+ */
+void ScheduleConnection(const int nSocketIndex, const ULONGLONG nWakeTime)
+{
+	CONNECTION_STATE& pConnection = GetConnectionState(nSocketIndex);
+	AcquireSRWLockExclusive(&g_pWakeLock);
+	if (g_bWakeRunning && ((0 == pConnection.nWakeTime) || (nWakeTime < pConnection.nWakeTime)))
+	{
+		pConnection.nWakeTime = nWakeTime;
+		// Only a new earliest wake-up shortens the wait of WakeThread
+		if (g_pWakeList.empty() || (nWakeTime < g_pWakeList.begin()->first))
+			WakeConditionVariable(&g_pWakeChanged);
+		g_pWakeList.emplace(nWakeTime, nSocketIndex);
+	}
+	ReleaseSRWLockExclusive(&g_pWakeLock);
+}
+
+/**
+ * @brief Dispatches a connection with a notification ready, or schedules it for when the next one is
+ * @param nSocketIndex Index of the client socket
+ */
+void DispatchNotification(const int nSocketIndex)
+{
+	if (HasNotification(nSocketIndex))
+	{
+		DispatchConnection(nSocketIndex);
+		return;
+	}
+	const ULONGLONG nReadyTime = GetConnectionState(nSocketIndex).pNotifyQueue.GetReadyTime();
+	if (nReadyTime != 0)
+		ScheduleConnection(nSocketIndex, nReadyTime);
+}
+
+/**
+ * @brief Wake-up thread: dispatches the connections whose next notification has settled
+ * @param lpParam Unused parameter
+ * @return 0 on thread exit
+ * @details Entries replaced by an earlier wake-up, or left by the previous connection of a slot,
+ *          no longer match CONNECTION_STATE::nWakeTime and are skipped
+ */
+DWORD WINAPI WakeThread(LPVOID lpParam)
+{
+	UNREFERENCED_PARAMETER(lpParam);
+	AcquireSRWLockExclusive(&g_pWakeLock);
+	while (g_bWakeRunning)
+	{
+		const ULONGLONG nNow = GetTickCount64();
+		if (g_pWakeList.empty() || (g_pWakeList.begin()->first > nNow))
+		{
+			const DWORD dwTimeout = g_pWakeList.empty() ? INFINITE : (DWORD)(g_pWakeList.begin()->first - nNow);
+			SleepConditionVariableSRW(&g_pWakeChanged, &g_pWakeLock, dwTimeout, 0);
+			continue;
+		}
+		const auto pWakeUp = g_pWakeList.begin();
+		const int nSocketIndex = pWakeUp->second;
+		CONNECTION_STATE& pConnection = GetConnectionState(nSocketIndex);
+		const bool bCurrent = (pConnection.nWakeTime == pWakeUp->first);
+		g_pWakeList.erase(pWakeUp);
+		if (!bCurrent)
+			continue;
+		pConnection.nWakeTime = 0;
+		ReleaseSRWLockExclusive(&g_pWakeLock);
+
+		// Same as PushNotification: the connection lock keeps ReleaseConnection() out
+		AcquireSRWLockShared(&pConnection.pLock);
+		if ((pConnection.nState == CONNECTION_IDLE) || (pConnection.nState == CONNECTION_BUSY))
+			DispatchNotification(nSocketIndex);
+		ReleaseSRWLockShared(&pConnection.pLock);
+		AcquireSRWLockExclusive(&g_pWakeLock);
+	}
+	g_pWakeList.clear();
+	ReleaseSRWLockExclusive(&g_pWakeLock);
+	TRACE(_T("exiting...\n"));
+	return 0;
+}
+
+/**
+ * @brief Adds an authenticated client to the broadcast list
+ * @param nSocketIndex Index of the client socket
+ */
+void AddSession(const int nSocketIndex)
+{
+	CONNECTION_STATE& pConnection = GetConnectionState(nSocketIndex);
+	AcquireSRWLockExclusive(&g_pSessionLock);
+	if (pConnection.nSessionPosition < 0)
+	{
+		pConnection.nSessionPosition = (int)g_pSessionList.size();
+		g_pSessionList.push_back(MAKE_CONNECTION_KEY(nSocketIndex, pConnection.nGeneration));
+	}
+	ReleaseSRWLockExclusive(&g_pSessionLock);
+}
+
+/**
+ * @brief Removes a client from the broadcast list (swap with the last entry)
+ * @param nSocketIndex Index of the client socket
+ */
+void RemoveSession(const int nSocketIndex)
+{
+	CONNECTION_STATE& pConnection = GetConnectionState(nSocketIndex);
+	AcquireSRWLockExclusive(&g_pSessionLock);
+	const int nPosition = pConnection.nSessionPosition;
+	if (nPosition >= 0)
+	{
+		const ULONG_PTR nLastKey = g_pSessionList.back();
+		g_pSessionList[nPosition] = nLastKey;
+		GetConnectionState(CONNECTION_INDEX(nLastKey)).nSessionPosition = nPosition;
+		g_pSessionList.pop_back();
+		pConnection.nSessionPosition = -1;
+	}
+	ReleaseSRWLockExclusive(&g_pSessionLock);
+}
+
+/**
+ * @brief Notifies every other authenticated client of a file change
+ * @param nSocketIndex Index of the client that made the change (skipped)
+ * @param nFileEvent The file event type (ID_FILE_DOWNLOAD, ID_FILE_DELETE)
+ * @param strFilePath The file path associated with the event
+ * @details Works on a snapshot of the session list, so clients may log in or out meanwhile;
+ *          the generation in each key keeps a reused slot from receiving the notification
+ */
+void BroadcastNotification(const int nSocketIndex, const int nFileEvent, const std::wstring& strFilePath)
+{
+	AcquireSRWLockShared(&g_pSessionLock);
+	const std::vector<ULONG_PTR> pSessionList(g_pSessionList);
+	ReleaseSRWLockShared(&g_pSessionLock);
+
+	for (const ULONG_PTR nConnectionKey : pSessionList)
+	{
+		if (CONNECTION_INDEX(nConnectionKey) != nSocketIndex) // Skip current client
+			PushNotification(nConnectionKey, nFileEvent, strFilePath);
+	}
+}
+
+/**
+ * @brief Returns a closed connection's slot to the free list
+ * @param nSocketIndex Index of the client socket
+ * @details Called by both the worker that closed the connection and the completion of its
+ *          zero-byte receive; whichever comes last releases the slot, because the kernel owns
+ *          the OVERLAPPED until the receive has completed
+ */
+void ReleaseConnection(const int nSocketIndex)
+{
+	CONNECTION_STATE& pConnection = GetConnectionState(nSocketIndex);
+	if (InterlockedCompareExchange(&pConnection.bRecvPending, FALSE, FALSE) != FALSE)
+		return;
+
+	bool bReleased = false;
+	AcquireSRWLockExclusive(&pConnection.pLock);
+	if (InterlockedCompareExchange(&pConnection.nState, CONNECTION_FREE, CONNECTION_CLOSED) == CONNECTION_CLOSED)
+	{
+		// New generation: keys held by broadcasts or the completion port no longer match
+		pConnection.nGeneration = (pConnection.nGeneration % 0xFFFF) + 1;
+		// Drop notifications the client did not get (no producer holds the lock now)
+		pConnection.pNotifyQueue.Clear();
+		bReleased = true;
+	}
+	ReleaseSRWLockExclusive(&pConnection.pLock);
+
+	if (bReleased)
+	{
+		AcquireSRWLockExclusive(&g_pSlotLock);
+		g_pFreeSlots.push_back(nSocketIndex);
+		ReleaseSRWLockExclusive(&g_pSlotLock);
+		InterlockedDecrement(&g_nConnectionCount);
+		TRACE(_T("nSocketIndex = %d released, %d connections\n"), nSocketIndex, g_nConnectionCount);
+	}
+}
+
+/**
+ * @brief Marks a connection closed and releases its slot if nothing refers to it any more
+ * @param nSocketIndex Index of the client socket (socket already closed)
+ */
+void CloseConnection(const int nSocketIndex)
+{
+	RemoveSession(nSocketIndex);
+	InterlockedExchange(&GetConnectionState(nSocketIndex).nState, CONNECTION_CLOSED);
+	ReleaseConnection(nSocketIndex);
+}
+
+/**
+ * @brief Takes a slot for the next accepted client
+ * @return Slot index, or -1 if MAX_SOCKET_CONNECTIONS clients are connected
+ */
+int AllocateSlot()
+{
+	int nSocketIndex = -1;
+	AcquireSRWLockExclusive(&g_pSlotLock);
+	if (!g_pFreeSlots.empty())
+	{
+		nSocketIndex = g_pFreeSlots.back();
+		g_pFreeSlots.pop_back();
+	}
+	else if (g_nSlotCount < MAX_SOCKET_CONNECTIONS)
+	{
+		// Grow the table by a page when the last one is full
+		if (g_nSlotCount % CONNECTION_PAGE_SIZE == 0)
+		{
+			g_pConnectionPages[g_nSlotCount / CONNECTION_PAGE_SIZE] = std::make_unique<CONNECTION_PAGE>();
+			TRACE(_T("Connection table grown to %d slots\n"), g_nSlotCount + CONNECTION_PAGE_SIZE);
+		}
+		nSocketIndex = g_nSlotCount++;
+		GetConnectionState(nSocketIndex).nGeneration = 1;
+	}
+	ReleaseSRWLockExclusive(&g_pSlotLock);
+	return nSocketIndex;
+}
+
+/**
+ * @brief Posts a zero-byte receive so the completion port reports when the client sends data
+ * @param nSocketIndex Index of the client socket
+ * @return true if a receive is outstanding, false if the socket is gone
+ *
+ * A zero-byte receive costs no buffer while the client is idle; the actual
+ * command is read with the blocking ReadBuffer() once a worker owns the connection.
+ */
+bool ArmConnection(const int nSocketIndex)
+{
+	CONNECTION_STATE& pConnection = GetConnectionState(nSocketIndex);
+	// Only one receive may be outstanding per connection
+	if (InterlockedCompareExchange(&pConnection.bRecvPending, TRUE, FALSE) != FALSE)
+		return true;
+
+	ZeroMemory(&pConnection.pOverlapped, sizeof(pConnection.pOverlapped));
+	WSABUF pEmptyBuffer = { 0, nullptr };
+	DWORD dwFlags = 0;
+	if ((WSARecv(GetClientSocket(nSocketIndex), &pEmptyBuffer, 1, nullptr, &dwFlags, &pConnection.pOverlapped, nullptr) == SOCKET_ERROR) &&
+		(WSAGetLastError() != WSA_IO_PENDING))
+	{
+		TRACE(_T("WSARecv() failed: %d\n"), WSAGetLastError());
+		InterlockedExchange(&pConnection.bRecvPending, FALSE);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Hands an idle connection to the worker pool
+ * @param nSocketIndex Index of the client socket
+ * @details Does nothing if a worker is already serving the connection;
+ *          that worker checks the queue again before it goes idle
+ */
+void DispatchConnection(const int nSocketIndex)
+{
+	if (InterlockedCompareExchange(&GetConnectionState(nSocketIndex).nState, CONNECTION_BUSY, CONNECTION_IDLE) == CONNECTION_IDLE)
+	{
+		VERIFY(PostQueuedCompletionStatus(g_hCompletionPort, 0, MAKE_CONNECTION_KEY(nSocketIndex, GetConnectionState(nSocketIndex).nGeneration), nullptr));
+	}
+}
+
+/**
+ * @brief Moves the rest of a connection step from a worker to the transfer pool
+ * @param nSocketIndex Index of the client socket (the caller owns it: CONNECTION_BUSY)
+ * @details The connection stays CONNECTION_BUSY; the transfer worker runs the transfer
+ *          stored in its CONNECTION_STATE, finishes the step and re-arms the receive
+ * @return true if it was queued, false if the transfer pool is not running (the caller runs the transfer)
+ */
+bool HandOverTransfer(const int nSocketIndex)
+{
+	return (g_hTransferPort != nullptr) &&
+		PostQueuedCompletionStatus(g_hTransferPort, 0, MAKE_CONNECTION_KEY(nSocketIndex, GetConnectionState(nSocketIndex).nGeneration), nullptr);
+}
+
+/**
+ * @brief Tells whether a command moves file contents (run by the transfer pool)
+ * @param strCommand The command name
+ * @return true for "Upload", "Download" and "DownloadRange"
+ */
+bool IsTransferCommand(const std::string& strCommand)
+{
+	return (strCommand.compare("Upload") == 0) || (strCommand.compare("Download") == 0) || (strCommand.compare("DownloadRange") == 0);
+}
+
+/**
+ * @brief Reads the name of the next command sent by a client
+ * @param nSocketIndex Index of the client socket
+ * @param pApplicationSocket The client socket (readable)
+ * @param strCommand [out] The command name
+ * @return true on success, false if no valid packet arrived
+ */
+#pragma warning(suppress: 6262)
+bool ReadCommand(const int nSocketIndex, CWSocket& pApplicationSocket, std::string& strCommand)
+{
+	unsigned char pBuffer[MAX_BUFFER] = { 0, };
+	int nLength = sizeof(pBuffer);
+	if (!ReadBuffer(nSocketIndex, pApplicationSocket, pBuffer, nLength, true, false))
+		return false;
+	strCommand = (char*) &pBuffer[3];
+	return true;
+}
+
+/**
+ * @brief Handles one command sent by a client
+ * @param nSocketIndex Index of the client socket
+ * @param pApplicationSocket The client socket
+ * @param strCommand The command name (ReadCommand)
+ * @details Reads the arguments of the command, answers it and, for uploads and deletes,
+ *          broadcasts the change to the other clients
+ *
+ * COMMAND PROTOCOL:
+ * =================
+ * Client -> Server:
+ *   - "IntelliDisk" + MachineID [+ PROTOCOL_OPTIONS]: Initial handshake
+ *   - "Upload" + filepath: Store file in database
+ *   - "Download" + filepath: Retrieve file from database
+ *   - "DownloadRange" + filepath + RANGE_REQUEST: Retrieve part of a file (PROTOCOL_RANGE)
+ *   - "Delete" + filepath: Remove file from database
+ *   - "Ping": Keep-alive message
+ *   - "Close": Graceful disconnect
+ * 
+ * Server -> Client:
+ *   - "IntelliDisk" + PROTOCOL_OPTIONS: Accepted options (only if the client sent its own)
+ */
+#pragma warning(suppress: 6262)
+void ProcessCommand(const int nSocketIndex, CWSocket& pApplicationSocket, const std::string& strCommand)
+{
+	unsigned char pBuffer[MAX_BUFFER] = { 0, };
+	int nLength = sizeof(pBuffer);
+	std::wstring& strComputerID = GetConnectionState(nSocketIndex).strComputerID;
+	if (!strCommand.empty())
+	{
+		if (strCommand.compare("IntelliDisk") == 0)
+		{
+			// HANDSHAKE: Client sends "IntelliDisk" + machine ID for authentication
+			TRACE(_T("Client connected!\n"));
+			nLength = sizeof(pBuffer);
+			ZeroMemory(pBuffer, sizeof(pBuffer));
+			if (ReadBuffer(nSocketIndex, pApplicationSocket, pBuffer, nLength, false, true))
+			{
+				strComputerID = utf8_to_wstring((char*) &pBuffer[3]);
+				TRACE(_T("Logged In: %s!\n"), strComputerID.c_str());
+				GetConnectionState(nSocketIndex).bIsConnected = true;
+				AddSession(nSocketIndex);
+
+				// NEGOTIATION: Newer clients append their protocol options after the machine ID
+				const size_t nMachineIDLength = strlen((char*) &pBuffer[3]) + 1;
+				if ((size_t)(nLength - 5) >= nMachineIDLength + sizeof(PROTOCOL_OPTIONS))
+				{
+					PROTOCOL_OPTIONS pClientOptions = { 0, };
+					CopyMemory(&pClientOptions, &pBuffer[3 + nMachineIDLength], sizeof(pClientOptions));
+					PROTOCOL_OPTIONS& pOptions = GetConnectionState(nSocketIndex).pProtocolOptions;
+					pOptions.nVersion = min(pClientOptions.nVersion, (unsigned int)PROTOCOL_VERSION);
+					pOptions.nFlags = pClientOptions.nFlags & (PROTOCOL_WINDOW | PROTOCOL_CRC32C | PROTOCOL_LARGE_FRAME | PROTOCOL_RESYNC | PROTOCOL_DEDUP | PROTOCOL_CDC | PROTOCOL_RANGE | PROTOCOL_RESUME | PROTOCOL_RESULT);
+					if ((pOptions.nFlags & PROTOCOL_DEDUP) == 0)
+						pOptions.nFlags &= ~PROTOCOL_CDC;
+					pOptions.nWindowSize = min(pClientOptions.nWindowSize, (unsigned int)MAX_WINDOW_SIZE);
+					pOptions.nFrameSize = LEGACY_FRAME_SIZE;
+					// Large frames need the 32-bit length of windowed frames; the window shrinks so the bytes in flight stay bounded
+					if ((pOptions.nFlags & PROTOCOL_LARGE_FRAME) != 0)
+					{
+						pOptions.nFrameSize = min(max(pClientOptions.nFrameSize, (unsigned int)LEGACY_FRAME_SIZE), (unsigned int)MAX_FRAME_SIZE);
+						pOptions.nWindowSize = min(pOptions.nWindowSize, (unsigned int)MAX_WINDOW_BYTES / pOptions.nFrameSize);
+					}
+					if (0 == pOptions.nWindowSize)
+						pOptions.nFlags &= ~(PROTOCOL_WINDOW | PROTOCOL_LARGE_FRAME);
+					TRACE(_T("Protocol v%u, flags = 0x%08X, window = %u, frame = %u, CRC32C = %s\n"), pOptions.nVersion, pOptions.nFlags, pOptions.nWindowSize, pOptions.nFrameSize, IsCRC32CAccelerated() ? _T("hardware") : _T("slice-by-8"));
+
+					// Answer with the accepted options
+					std::vector<unsigned char> pReply(strCommand.begin(), strCommand.end());
+					pReply.push_back(0);
+					pReply.insert(pReply.end(), (const unsigned char*)&pOptions, (const unsigned char*)&pOptions + sizeof(pOptions));
+					VERIFY(WriteBuffer(nSocketIndex, pApplicationSocket, pReply.data(), (int)pReply.size(), true, true));
+				}
+			}
+		}
+		else
+		{
+			if (strCommand.compare("Close") == 0)
+			{
+				// CLIENT DISCONNECT: Graceful shutdown
+				nLength = sizeof(pBuffer);
+				ZeroMemory(pBuffer, sizeof(pBuffer));
+				if (((nLength = pApplicationSocket.Receive(pBuffer, nLength)) > 0) &&
+					(EOT == pBuffer[nLength - 1]))
+				{
+					TRACE(_T("EOT Received\n"));
+				}
+				pApplicationSocket.Close();
+				GetConnectionState(nSocketIndex).bIsConnected = false;
+				TRACE(_T("Logged Out: %s!\n"), strComputerID.c_str());
+			}
+			else
+			{
+				if (strCommand.compare("Ping") == 0)
+				{
+					nLength = sizeof(pBuffer);
+					ZeroMemory(pBuffer, sizeof(pBuffer));
+					if (((nLength = pApplicationSocket.Receive(pBuffer, nLength)) > 0) &&
+						(EOT == pBuffer[nLength - 1]))
+					{
+						TRACE(_T("EOT Received\n"));
+					}
+					TRACE(_T("Ping!\n"));
+				}
+				else
+				{
+					if (strCommand.compare("Download") == 0)
+					{
+						nLength = sizeof(pBuffer);
+						ZeroMemory(pBuffer, sizeof(pBuffer));
+						if (ReadBuffer(nSocketIndex, pApplicationSocket, pBuffer, nLength, false, false))
+						{
+							const std::wstring& strFilePath = utf8_to_wstring((char*) &pBuffer[3]);
+							TRACE(_T("Downloading %s...\n"), strFilePath.c_str());
+							VERIFY(DownloadFile(nSocketIndex, pApplicationSocket, strFilePath));
+						}
+					}
+					else if (strCommand.compare("DownloadRange") == 0)
+					{
+						// File path, then the RANGE_REQUEST
+						nLength = sizeof(pBuffer);
+						ZeroMemory(pBuffer, sizeof(pBuffer));
+						if (ReadBuffer(nSocketIndex, pApplicationSocket, pBuffer, nLength, false, false))
+						{
+							const std::wstring& strFilePath = utf8_to_wstring((char*) &pBuffer[3]);
+							RANGE_REQUEST pRequest = { 0, };
+							nLength = sizeof(pBuffer);
+							ZeroMemory(pBuffer, sizeof(pBuffer));
+							if (ReadBuffer(nSocketIndex, pApplicationSocket, pBuffer, nLength, false, false) &&
+								(nLength - 5 == (int)sizeof(pRequest)))
+							{
+								CopyMemory(&pRequest, &pBuffer[3], sizeof(pRequest));
+								TRACE(_T("Downloading %s from %llu...\n"), strFilePath.c_str(), pRequest.nOffset);
+								VERIFY(DownloadRange(nSocketIndex, pApplicationSocket, strFilePath, pRequest));
+							}
+						}
+					}
+					else
+					{
+						if (strCommand.compare("Upload") == 0)
+						{
+							nLength = sizeof(pBuffer);
+							ZeroMemory(pBuffer, sizeof(pBuffer));
+							if (ReadBuffer(nSocketIndex, pApplicationSocket, pBuffer, nLength, false, false))
+							{
+								const std::wstring& strFilePath = utf8_to_wstring((char*) &pBuffer[3]);
+								TRACE(_T("Uploading %s...\n"), strFilePath.c_str());
+								// Store file in MySQL database
+								if (UploadFile(nSocketIndex, pApplicationSocket, strFilePath))
+								{
+									// === BROADCAST TO ALL OTHER CLIENTS ===
+									// Notify all other clients to download this file for sync
+									BroadcastNotification(nSocketIndex, ID_FILE_DOWNLOAD, strFilePath);
+								}
+							}
+						}
+						else
+						{
+							if (strCommand.compare("Delete") == 0)
+							{
+								nLength = sizeof(pBuffer);
+								ZeroMemory(pBuffer, sizeof(pBuffer));
+								if (ReadBuffer(nSocketIndex, pApplicationSocket, pBuffer, nLength, false, false))
+								{
+									const std::wstring& strFilePath = utf8_to_wstring((char*) &pBuffer[3]);
+									TRACE(_T("Deleting %s...\n"), strFilePath.c_str());
+									// Remove file from MySQL database
+									if (DeleteFile(nSocketIndex, pApplicationSocket, strFilePath))
+									{
+										// === BROADCAST TO ALL OTHER CLIENTS ===
+										// Notify all other clients to delete this file for sync
+										BroadcastNotification(nSocketIndex, ID_FILE_DELETE, strFilePath);
+									}
+								}
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+/**
+ * @brief Sends one queued notification to a client
+ * @param nSocketIndex Index of the client socket
+ * @param pApplicationSocket The client socket
+ * @param nFileEvent The file event type (PopNotification)
+ * @param strFilePath The file path associated with the event
+ *
+ * Server -> Client (Push Notifications):
+ *   - "NotifyDownload" + filepath: Another client uploaded - download to sync
+ *   - "NotifyDelete" + filepath: Another client deleted - delete to sync
+ */
+void ProcessNotification(const int nSocketIndex, CWSocket& pApplicationSocket, const int nFileEvent, const std::wstring& strFilePath)
+{
+	int nLength = 0;
+	g_pNotifyCounters.nSent++;
+
+	if (ID_FILE_DOWNLOAD == nFileEvent)
+	{
+		// Another client uploaded - tell this client to download
+		const std::string strCommand = "NotifyDownload";
+		nLength = (int)strCommand.length() + 1;
+		if (WriteBuffer(nSocketIndex, pApplicationSocket, (unsigned char*)strCommand.c_str(), nLength, true, false))
+		{
+			const std::string strFileName = wstring_to_utf8(strFilePath);
+			nLength = (int)strFileName.length() + 1;
+			if (WriteBuffer(nSocketIndex, pApplicationSocket, (unsigned char*)strFileName.c_str(), nLength, false, false))
+			{
+				TRACE(_T("Downloading %s...\n"), strFilePath.c_str());
+				// With PROTOCOL_RANGE the client learns the version, so it can resume the download if it breaks off
+				if ((GetProtocolOptions(nSocketIndex).nFlags & PROTOCOL_RANGE) != 0)
+				{
+					const RANGE_REQUEST pRequest = { 0, 0, 0 };
+					VERIFY(DownloadRange(nSocketIndex, pApplicationSocket, strFilePath, pRequest));
+				}
+				else
+				{
+					VERIFY(DownloadFile(nSocketIndex, pApplicationSocket, strFilePath));
+				}
+			}
+		}
+	}
+	else if (ID_FILE_DELETE == nFileEvent)
+	{
+		const std::string strCommand = "NotifyDelete";
+		nLength = (int)strCommand.length() + 1;
+		if (WriteBuffer(nSocketIndex, pApplicationSocket, (unsigned char*)strCommand.c_str(), nLength, true, false))
+		{
+			const std::string strFileName = wstring_to_utf8(strFilePath);
+			nLength = (int)strFileName.length() + 1;
+			if (WriteBuffer(nSocketIndex, pApplicationSocket, (unsigned char*)strFileName.c_str(), nLength, false, false))
+			{
+				TRACE(_T("Deleting %s...\n"), strFilePath.c_str());
+			}
+		}
+	}
+}
+
+/**
+ * @brief Runs one step of a client connection on a worker thread
+ * @param nSocketIndex Index of the client socket (the caller owns it: CONNECTION_BUSY)
+ * @param bTransferPool true on a transfer thread, which first runs the transfer handed over to it
+ * @details Handles the pending command, if any, then the queued notifications, and
+ *          returns the connection to CONNECTION_IDLE with a new zero-byte receive armed.
+ *          The step never waits for an idle client, so a spurious wake-up costs one select().
+ *          On a worker the step ends early when it reaches a transfer (HandOverTransfer).
+ * 
+ * ARCHITECTURE: EVENT-DRIVEN WORKER POOL
+ * ======================================
+ * Idle clients hold no thread: each one only has a zero-byte receive outstanding on
+ * the completion port. A worker picks up the connection when:
+ * 1. The client sends a command (the zero-byte receive completes)
+ * 2. Another client changed a file (PushNotification() dispatches it)
+ * 3. The server is stopping (StopProcessingThread() dispatches it to send "Restart")
+ * CONNECTION_BUSY guarantees that only one worker talks to a client at a time.
+ * Uploads, downloads and manifests move to the transfer pool (TransferThread) with the
+ * connection still busy, so the workers stay free for short commands and notifications.
+ */
+void ProcessConnection(const int nSocketIndex, const bool bTransferPool)
+{
+	CWSocket& pApplicationSocket = GetClientSocket(nSocketIndex);
+	CONNECTION_STATE& pConnection = GetConnectionState(nSocketIndex);
+	try
+	{
+		// === TRANSFER HANDED OVER BY A WORKER ===
+		if (bTransferPool)
+		{
+			std::string strCommand;
+			strCommand.swap(pConnection.strTransferCommand);
+			const int nFileEvent = pConnection.nTransferEvent;
+			pConnection.nTransferEvent = 0;
+			if (g_bServerRunning && pApplicationSocket.IsCreated())
+			{
+				if (!strCommand.empty())
+					ProcessCommand(nSocketIndex, pApplicationSocket, strCommand);
+				else if (nFileEvent != 0)
+					ProcessNotification(nSocketIndex, pApplicationSocket, nFileEvent, pConnection.strTransferPath);
+			}
+		}
+
+		if (g_bServerRunning && pApplicationSocket.IsCreated() && pApplicationSocket.IsReadible(0))
+		{
+			// === CLIENT COMMAND RECEIVED (or the client went away) ===
+			char nPeek = 0;
+			std::string strCommand;
+			if (pApplicationSocket.Receive(&nPeek, sizeof(nPeek), MSG_PEEK) == 0)
+			{
+				TRACE(_T("Connection closed: %s\n"), pConnection.strComputerID.c_str());
+				pApplicationSocket.Close();
+				GetConnectionState(nSocketIndex).bIsConnected = false;
+			}
+			else if (ReadCommand(nSocketIndex, pApplicationSocket, strCommand))
+			{
+				if (!bTransferPool && IsTransferCommand(strCommand))
+				{
+					pConnection.strTransferCommand = strCommand;
+					if (HandOverTransfer(nSocketIndex))
+						return;
+					pConnection.strTransferCommand.clear();
+				}
+				ProcessCommand(nSocketIndex, pApplicationSocket, strCommand);
+			}
+		}
+
+		// === FULL RESYNC AFTER A QUEUE OVERFLOW ===
+		if (g_bServerRunning && pApplicationSocket.IsCreated() && !pApplicationSocket.IsReadible(0) &&
+			(pConnection.bNeedsResync != FALSE))
+		{
+			// The manifest lists every file, so the transfer pool sends it
+			if (!bTransferPool && HandOverTransfer(nSocketIndex))
+				return;
+			// Cleared before the manifest is read, so later changes are queued again
+			InterlockedExchange(&pConnection.bNeedsResync, FALSE);
+			pConnection.pNotifyQueue.Resume();
+			g_pNotifyCounters.nResyncs++;
+			VERIFY(SendManifest(nSocketIndex, pApplicationSocket));
+		}
+
+		// === DISCONNECT AFTER A QUEUE OVERFLOW ===
+		// The client has no resync, so it is told to reconnect rather than left out of date
+		if (g_bServerRunning && pApplicationSocket.IsCreated() &&
+			(InterlockedExchange(&pConnection.bOverflowed, FALSE) != FALSE))
+		{
+			const std::string strCommand = "Restart";
+			const int nLength = (int)strCommand.length() + 1;
+			if (WriteBuffer(nSocketIndex, pApplicationSocket, (unsigned char*)strCommand.c_str(), nLength, true, true))
+			{
+				TRACE(_T("Restart after a queue overflow: %s\n"), pConnection.strComputerID.c_str());
+			}
+			pApplicationSocket.Close();
+			GetConnectionState(nSocketIndex).bIsConnected = false;
+		}
+
+		// === PROCESS QUEUED NOTIFICATIONS ===
+		// A command from the client takes precedence; it is handled on the next step
+		while (g_bServerRunning && pApplicationSocket.IsCreated() &&
+			HasNotification(nSocketIndex) && !pApplicationSocket.IsReadible(0))
+		{
+			int nFileEvent = 0;
+			std::wstring strFilePath;
+			if (!PopNotification(nSocketIndex, nFileEvent, strFilePath))
+				break;
+			if (!bTransferPool && (ID_FILE_DOWNLOAD == nFileEvent))
+			{
+				pConnection.nTransferEvent = nFileEvent;
+				pConnection.strTransferPath = strFilePath;
+				if (HandOverTransfer(nSocketIndex))
+					return;
+				pConnection.nTransferEvent = 0;
+			}
+			ProcessNotification(nSocketIndex, pApplicationSocket, nFileEvent, strFilePath);
+		}
+
+		// If server is stopping, notify client to restart
+		if (!g_bServerRunning && pApplicationSocket.IsCreated())
+		{
+			// Send restart command to client for graceful shutdown
+			const std::string strCommand = "Restart";
+			const int nLength = (int)strCommand.length() + 1;
+			if (WriteBuffer(nSocketIndex, pApplicationSocket, (unsigned char*)strCommand.c_str(), nLength, true, true))
+			{
+				TRACE(_T("Restart!\n"));
+			}
+			pApplicationSocket.Close();
+			GetConnectionState(nSocketIndex).bIsConnected = false;
+		}
+	}
+	catch (CWSocketException* pException)
+	{
+		const int nErrorLength = 0x100;
+		TCHAR lpszErrorMessage[nErrorLength] = { 0, };
+		pException->GetErrorMessage(lpszErrorMessage, nErrorLength);
+		TRACE(_T("%s\n"), lpszErrorMessage);
+		pException->Delete();
+		pApplicationSocket.Close();
+		GetConnectionState(nSocketIndex).bIsConnected = false;
+	}
+
+	if (!pApplicationSocket.IsCreated())
+	{
+		// Closing the socket cancels the outstanding receive; its completion releases the slot
+		TRACE(_T("nSocketIndex = %d closed\n"), nSocketIndex);
+		CloseConnection(nSocketIndex);
+		return;
+	}
+
+	InterlockedExchange(&pConnection.nState, CONNECTION_IDLE);
+	if (!ArmConnection(nSocketIndex))
+	{
+		// Take the connection back to close it, unless a dispatch already did
+		if (InterlockedCompareExchange(&pConnection.nState, CONNECTION_BUSY, CONNECTION_IDLE) == CONNECTION_IDLE)
+		{
+			pApplicationSocket.Close();
+			GetConnectionState(nSocketIndex).bIsConnected = false;
+			CloseConnection(nSocketIndex);
+		}
+		return;
+	}
+	// A notification pushed while this worker was busy could not dispatch the connection;
+	// one that is still settling is dispatched by WakeThread
+	DispatchNotification(nSocketIndex);
+}
+
+/**
+ * @brief Worker thread serving client connections from the completion port
+ * @param lpParam Unused parameter
+ * @return 0 on thread exit
+ * @details Completion key = MAKE_CONNECTION_KEY(socket index, generation); a null overlapped
+ *          pointer means the connection was dispatched (already CONNECTION_BUSY), otherwise its
+ *          zero-byte receive completed. SHUTDOWN_KEY ends the thread.
+ */
+DWORD WINAPI IntelliDiskThread(LPVOID lpParam)
+{
+	UNREFERENCED_PARAMETER(lpParam);
+	while (true)
+	{
+		DWORD dwBytesTransferred = 0;
+		ULONG_PTR nCompletionKey = 0;
+		LPOVERLAPPED pOverlapped = nullptr;
+		const BOOL bResult = GetQueuedCompletionStatus(g_hCompletionPort, &dwBytesTransferred, &nCompletionKey, &pOverlapped, INFINITE);
+		if (SHUTDOWN_KEY == nCompletionKey)
+			break;
+		if (!bResult && (pOverlapped == nullptr))
+			break;  // Completion port closed
+
+		const int nSocketIndex = CONNECTION_INDEX(nCompletionKey);
+		CONNECTION_STATE& pConnection = GetConnectionState(nSocketIndex);
+		if (pOverlapped != nullptr)
+		{
+			// Zero-byte receive completed: data arrived, the client closed, or the socket was closed
+			InterlockedExchange(&pConnection.bRecvPending, FALSE);
+			if (InterlockedCompareExchange(&pConnection.nState, CONNECTION_BUSY, CONNECTION_IDLE) != CONNECTION_IDLE)
+			{
+				// Another worker serves it and re-arms the receive, or it is closed and can be released
+				ReleaseConnection(nSocketIndex);
+				continue;
+			}
+		}
+		else if (pConnection.nGeneration != CONNECTION_GENERATION(nCompletionKey))
+			continue;  // Dispatched to a connection that no longer exists
+		ProcessConnection(nSocketIndex, false);
+	}
+	TRACE(_T("exiting...\n"));
+	return 0;
+}
+
+/**
+ * @brief Transfer thread finishing the connection steps handed over by the workers
+ * @param lpParam Unused parameter
+ * @return 0 on thread exit
+ * @details Completion key = MAKE_CONNECTION_KEY(socket index, generation) of a connection
+ *          that stays CONNECTION_BUSY while it is queued. SHUTDOWN_KEY ends the thread.
+ */
+DWORD WINAPI TransferThread(LPVOID lpParam)
+{
+	UNREFERENCED_PARAMETER(lpParam);
+	while (true)
+	{
+		DWORD dwBytesTransferred = 0;
+		ULONG_PTR nCompletionKey = 0;
+		LPOVERLAPPED pOverlapped = nullptr;
+		const BOOL bResult = GetQueuedCompletionStatus(g_hTransferPort, &dwBytesTransferred, &nCompletionKey, &pOverlapped, INFINITE);
+		if (SHUTDOWN_KEY == nCompletionKey)
+			break;
+		if (!bResult)
+			break;  // Completion port closed
+
+		const int nSocketIndex = CONNECTION_INDEX(nCompletionKey);
+		ASSERT(GetConnectionState(nSocketIndex).nGeneration == CONNECTION_GENERATION(nCompletionKey));
+		ProcessConnection(nSocketIndex, true);
+	}
+	TRACE(_T("exiting...\n"));
+	return 0;
+}
+
+/**
+ * @brief Prepares an accepted client for the worker pool
+ * @param nSocketIndex Index of the accepted client socket (from AllocateSlot)
+ * @return true if the connection is registered with the completion port;
+ *         otherwise the caller closes the socket and calls CloseConnection()
+ */
+bool OpenConnection(const int nSocketIndex)
+{
+	InterlockedIncrement(&g_nConnectionCount);
+	TRACE(_T("nSocketIndex = %d, %d connections\n"), nSocketIndex, g_nConnectionCount);
+	GetConnectionState(nSocketIndex).bIsConnected = false;
+	GetConnectionState(nSocketIndex).pProtocolOptions = LEGACY_PROTOCOL;
+
+	CONNECTION_STATE& pConnection = GetConnectionState(nSocketIndex);
+	pConnection.bRecvPending = FALSE;
+	pConnection.nSessionPosition = -1;
+	pConnection.strComputerID.clear();
+	pConnection.bNeedsResync = FALSE;
+	pConnection.bOverflowed = FALSE;
+	// A wake-up left by the previous connection of the slot no longer matches
+	AcquireSRWLockExclusive(&g_pWakeLock);
+	pConnection.nWakeTime = 0;
+	ReleaseSRWLockExclusive(&g_pWakeLock);
+	// === INITIALIZE PER-CLIENT NOTIFICATION QUEUE ===
+	// Each client needs its own queue to receive sync notifications
+	pConnection.pNotifyQueue.Clear();
+	pConnection.nState = CONNECTION_IDLE;
+
+	// Completion key = socket index + slot generation
+	if (CreateIoCompletionPort((HANDLE)(SOCKET)GetClientSocket(nSocketIndex), g_hCompletionPort, MAKE_CONNECTION_KEY(nSocketIndex, pConnection.nGeneration), 0) == nullptr)
+	{
+		TRACE(_T("CreateIoCompletionPort() failed: %d\n"), GetLastError());
+		return false;
+	}
+	return ArmConnection(nSocketIndex);
+}
+
+/**
+ * @brief Releases the notifications a client did not get
+ * @param nSocketIndex Index of the client socket (no worker may serve it)
+ */
+void FreeConnection(const int nSocketIndex)
+{
+	GetConnectionState(nSocketIndex).pNotifyQueue.Clear();
+}
+
+int g_nServicePort = IntelliDiskPort;
+
+/**
+ * @brief Main server thread for accepting client connections
+ * @details Loads configuration from INI file, binds the server socket, and enters the accept loop.
+ *          Registers each incoming client with the completion port served by the worker pool
+ * @param lpParam Unused parameter
+ * @return 0 on success, non-zero on error
+ * 
+ * SERVER LIFECYCLE:
+ * =================
+ * 1. Load service port and database settings from IntelliDisk.xml
+ * 2. Bind server socket to port (default 8080)
+ * 3. Size the database connection pool and listen for incoming connections (backlog = 65536)
+ * 4. Accept loop:
+ *    - Take a free slot from the connection table (AllocateSlot)
+ *    - Accept() blocks until client connects
+ *    - Register the client with the completion port (OpenConnection)
+ *    - Turn the client away if all MAX_SOCKET_CONNECTIONS slots are in use
+ * 5. Shutdown: Close server socket
+ */
+DWORD WINAPI CreateDatabase(LPVOID lpParam)
+{
+	UNREFERENCED_PARAMETER(lpParam);
+	try
+	{
+		TRACE(_T("CreateDatabase()\n"));
+		// Load configuration from XML settings file
+		g_nServicePort = LoadServicePort();
+		g_nNotifyQueueLimit = LoadNotifyQueueLimit();
+		g_nNotifySettleTime = LoadNotifySettleTime();
+		g_nUploadBatchSize = LoadUploadBatchSize();
+		g_nFetchDelay = LoadFetchDelay();
+		g_bDatabasePool = (LoadDatabasePool() != 0);
+		int nMinSize = 0, nAvgSize = 0, nMaxSize = 0;
+		LoadChunkSizes(nMinSize, nAvgSize, nMaxSize);  // Falls back to the defaults on error
+		g_pContentChunker = CContentChunker(nMinSize, nAvgSize, nMaxSize);
+		TRACE(_T("Chunk sizes: %u / %u / %u\n"), g_pContentChunker.GetMinSize(), g_pContentChunker.GetAvgSize(), g_pContentChunker.GetMaxSize());
+		if (!LoadAppSettings(g_strHostName, g_nHostPort, g_strDatabase, g_strUsername, g_strPassword))
+		{
+			// Configuration load failed but continue with defaults
+			// return (DWORD)-1;
+		}
+
+		// Bind server socket to port and start listening
+		g_pServerSocket.CreateAndBind(g_nServicePort, SOCK_STREAM, AF_INET);
+		if (g_pServerSocket.IsCreated())
+		{
+			// One database connection per worker and transfer thread; they are opened on first use and kept between file operations
+			if (!InitConnectionPool(g_nThreadCount + g_nTransferThreadCount, g_strHostName, g_nHostPort, g_strDatabase, g_strUsername, g_strPassword))
+			{
+				TRACE(_T("Database pool not available\n"));
+			}
+			// Bring the tables up to date before the first file operation
+			UpgradeDatabase();
+			StartGarbageCollector();
+			g_bServerRunning = true;
+			g_pServerSocket.Listen(MAX_SOCKET_CONNECTIONS);  // Backlog = 65536
+
+			// === ACCEPT LOOP ===
+			// Accept incoming connections until server stops
+			while (g_bServerRunning)
+			{
+				const int nSocketIndex = AllocateSlot();
+				if (nSocketIndex < 0)
+				{
+					// Connection table full - accept and close so the client retries later
+					CWSocket pRejectedSocket;
+					g_pServerSocket.Accept(pRejectedSocket);
+					pRejectedSocket.Close();
+					TRACE(_T("Connection rejected: %d clients connected\n"), g_nConnectionCount);
+					continue;
+				}
+
+				// Block until client connects (or StopProcessingThread interrupts)
+				g_pServerSocket.Accept(GetClientSocket(nSocketIndex));
+
+				if (g_bServerRunning)
+				{
+					// Hand the client to the worker pool
+					if (!OpenConnection(nSocketIndex))
+					{
+						GetClientSocket(nSocketIndex).Close();
+						CloseConnection(nSocketIndex);
+					}
+				}
+				else
+				{
+					// Server stopping - close the socket that unblocked Accept()
+					GetClientSocket(nSocketIndex).Close();
+				}
+			}
+		}
+		g_pServerSocket.Close();
+	}
+	catch (CWSocketException* pException)
+	{
+		const int nErrorLength = 0x100;
+		TCHAR lpszErrorMessage[nErrorLength] = { 0, };
+		pException->GetErrorMessage(lpszErrorMessage, nErrorLength);
+		TRACE(_T("%s\n"), lpszErrorMessage);
+		pException->Delete();
+	}
+	return 0;
+}
+
+/**
+ * @brief Starts the main server processing thread
+ * @details Creates the completion port, the worker pool (two threads per processor),
+ *          the transfer pool (one thread per processor), the wake-up thread and the CreateDatabase thread which accepts client connections
+ */
+void StartProcessingThread()
+{
+	TRACE(_T("StartProcessingThread()\n"));
+	g_hCompletionPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 0);
+	ASSERT(g_hCompletionPort != nullptr);
+
+	// Workers block while they transfer a file, so keep more of them than processors
+	SYSTEM_INFO pSystemInfo = { 0, };
+	GetSystemInfo(&pSystemInfo);
+	g_nThreadCount = min(max((int)pSystemInfo.dwNumberOfProcessors * 2, 2), MAX_WORKER_THREADS);
+	for (int nIndex = 0; nIndex < g_nThreadCount; nIndex++)
+	{
+		g_hThreadArray[nIndex] = CreateThread(nullptr, 0, IntelliDiskThread, nullptr, 0, &m_dwThreadID[nIndex]);
+		ASSERT(g_hThreadArray[nIndex] != nullptr);
+	}
+	TRACE(_T("%d worker threads\n"), g_nThreadCount);
+
+	// Transfers get one thread per processor: they wait on the network and the database, and more of them only split the bandwidth
+	g_hTransferPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 0);
+	ASSERT(g_hTransferPort != nullptr);
+	g_nTransferThreadCount = min(max((int)pSystemInfo.dwNumberOfProcessors, 2), MAX_TRANSFER_THREADS);
+	for (int nIndex = 0; nIndex < g_nTransferThreadCount; nIndex++)
+	{
+		g_hTransferThreadArray[nIndex] = CreateThread(nullptr, 0, TransferThread, nullptr, 0, nullptr);
+		ASSERT(g_hTransferThreadArray[nIndex] != nullptr);
+	}
+	TRACE(_T("%d transfer threads\n"), g_nTransferThreadCount);
+	// Only the transfer threads run downloads, one at a time each, so a fetch thread is never waited for
+	StartFetchThreads(g_nTransferThreadCount);
+
+	// Notifications that are still settling wake their connection later
+	AcquireSRWLockExclusive(&g_pWakeLock);
+	g_bWakeRunning = true;
+	ReleaseSRWLockExclusive(&g_pWakeLock);
+	g_hWakeThread = CreateThread(nullptr, 0, WakeThread, nullptr, 0, nullptr);
+	ASSERT(g_hWakeThread != nullptr);
+	TRACE(_T("%u bytes per connection, %u bytes per pending notification\n"), (unsigned int)sizeof(CONNECTION_STATE), (unsigned int)sizeof(NOTIFY_FILE_NODE));
+
+	g_hAcceptThread = CreateThread(nullptr, 0, CreateDatabase, nullptr, 0, &m_dwAcceptThreadID);
+	ASSERT(g_hAcceptThread != nullptr);
+}
+
+/**
+ * @brief Stops the server processing thread and closes all client sockets
+ * @details Sets server running flag to false, connects to self to unblock accept(),
+ *          lets the workers send "Restart" to every client, stops the workers and
+ *          closes all client connections
+ * 
+ * GRACEFUL SHUTDOWN SEQUENCE:
+ * ===========================
+ * 1. Set g_bServerRunning = false to signal all threads to stop
+ * 2. Connect to self (localhost) to unblock Accept() call and wait for the accept thread
+ * 3. Stop the wake-up thread, then dispatch every idle connection; the worker sends "Restart" and closes it
+ *    (busy connections do the same when their current step ends)
+ * 4. Queue one SHUTDOWN_KEY per worker (after the dispatches), wait for the workers,
+ *    then the same for the transfer threads, and close the database connection pool
+ * 5. Close all client sockets, free the queues and reset the connection table
+ */
+void StopProcessingThread()
+{
+	CWSocket pClosingSocket;
+	try
+	{
+		TRACE(_T("StopProcessingThread()\n"));
+		if (g_bServerRunning)
+		{
+			// Step 1: Signal all threads to stop
 			g_bServerRunning = false;
 
 			// Step 2: Unblock Accept() by connecting to ourselves
 			pClosingSocket.CreateAndConnect(IntelliDiskIP, g_nServicePort);
+			WaitForSingleObject(g_hAcceptThread, INFINITE);
+			VERIFY(CloseHandle(g_hAcceptThread));
+			g_hAcceptThread = nullptr;
+
+			// Step 3: No more wake-ups, then let the workers say goodbye to every client
+			AcquireSRWLockExclusive(&g_pWakeLock);
+			g_bWakeRunning = false;
+			WakeConditionVariable(&g_pWakeChanged);
+			ReleaseSRWLockExclusive(&g_pWakeLock);
+			WaitForSingleObject(g_hWakeThread, INFINITE);
+			VERIFY(CloseHandle(g_hWakeThread));
+			g_hWakeThread = nullptr;
+			for (int nIndex = 0; nIndex < g_nSlotCount; nIndex++)
+				DispatchConnection(nIndex);
 
-			// Step 3: Wait for all threads to complete
+			// Step 4: Stop the worker pool
+			for (int nIndex = 0; nIndex < g_nThreadCount; nIndex++)
+				VERIFY(PostQueuedCompletionStatus(g_hCompletionPort, 0, SHUTDOWN_KEY, nullptr));
 			WaitForMultipleObjects(g_nThreadCount, g_hThreadArray, TRUE, INFINITE);
+			for (int nIndex = 0; nIndex < g_nThreadCount; nIndex++)
+			{
+				VERIFY(CloseHandle(g_hThreadArray[nIndex]));
+				g_hThreadArray[nIndex] = nullptr;
+			}
+
+			// Then the transfer pool: the workers hand nothing over any more, and the
+			// transfers queued before the SHUTDOWN_KEYs still send "Restart"
+			for (int nIndex = 0; nIndex < g_nTransferThreadCount; nIndex++)
+				VERIFY(PostQueuedCompletionStatus(g_hTransferPort, 0, SHUTDOWN_KEY, nullptr));
+			WaitForMultipleObjects(g_nTransferThreadCount, g_hTransferThreadArray, TRUE, INFINITE);
+			for (int nIndex = 0; nIndex < g_nTransferThreadCount; nIndex++)
+			{
+				VERIFY(CloseHandle(g_hTransferThreadArray[nIndex]));
+				g_hTransferThreadArray[nIndex] = nullptr;
+			}
 
-			// Step 4: Close unblocking socket
+			// Close unblocking socket
 			pClosingSocket.Close();
 
+			// No worker holds a database connection any more
+			StopDatabaseUpgrade();
+			StopGarbageCollector();
+			StopFetchThreads();
+			CloseConnectionPool();
+
 			// Step 5: Close all client sockets and reset counters
-			for (int nIndex = 0; nIndex < g_nSocketCount; nIndex++)
-				g_pClientSocket[nIndex].Close();
-			g_nSocketCount = 0;
+			for (int nIndex = 0; nIndex < g_nSlotCount; nIndex++)
+			{
+				GetClientSocket(nIndex).Close();
+				FreeConnection(nIndex);
+				GetConnectionState(nIndex).nState = CONNECTION_FREE;
+				GetConnectionState(nIndex).bRecvPending = FALSE;
+				GetConnectionState(nIndex).nSessionPosition = -1;
+			}
+			VERIFY(CloseHandle(g_hCompletionPort));
+			g_hCompletionPort = nullptr;
+			VERIFY(CloseHandle(g_hTransferPort));
+			g_hTransferPort = nullptr;
+			g_pSessionList.clear();
+			g_pFreeSlots.clear();
+			for (auto& pConnectionPage : g_pConnectionPages)
+				pConnectionPage.reset();
+			g_nSlotCount = 0;
+			g_nConnectionCount = 0;
 			g_nThreadCount = 0;
+			g_nTransferThreadCount = 0;
+			TRACE(_T("Notifications: %llu pushed, %llu coalesced, %llu cancelled, %llu sent, %llu dropped, %llu overflows, %llu resyncs\n"),
+				g_pNotifyCounters.nPushed.load(), g_pNotifyCounters.nCoalesced.load(),
+				g_pNotifyCounters.nCancelled.load(), g_pNotifyCounters.nSent.load(),
+				g_pNotifyCounters.nDropped.load(), g_pNotifyCounters.nOverflows.load(),
+				g_pNotifyCounters.nResyncs.load());
 		}
 	}
 	catch (CWSocketException* pException)
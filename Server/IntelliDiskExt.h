@@ -19,33 +19,49 @@ IntelliDisk. If not, see <http://www.opensource.org/licenses/gpl-3.0.html>*/
 #define __INTELLIDISK_EXT__
 
 #include "SocMFC.h"
+#include "CRC32C.h"
+#include "IntelliDiskProtocol.h"
+#include <atomic>
 
 /**
- * @brief Calculates the Longitudinal Redundancy Check (LRC) for a buffer.
- *        Used for simple data integrity verification in protocol packets.
- * @param buffer Pointer to the buffer.
- * @param length Number of bytes to process.
- * @return The computed LRC value.
+ * @brief Sliding window state for one file transfer.
+ *        The sender keeps unacknowledged frames for selective retransmission;
+ *        the receiver keeps frames that arrived out of order until they can be delivered.
+ *        A window size of zero falls back to the legacy stop-and-wait ReadBuffer/WriteBuffer.
  */
-inline unsigned char calcLRC(const unsigned char* buffer, const int length)
+class CFrameWindow
 {
-	unsigned char nLRC = 0;
-	for (int i = 0; i < length; nLRC = nLRC ^ buffer[i], i++);
-	return nLRC;
-}
+public:
+	CFrameWindow(const PROTOCOL_OPTIONS& pOptions, const unsigned int nReadAheadSize = 0);
+
+	bool IsEnabled() const { return m_nWindowSize > 0; }
+	int GetFrameSize() const { return (int)m_nFrameSize; }
+	unsigned int GetChecksum(const FRAME_HEADER* pHeader, const unsigned char* pPayload) const;
+	unsigned char* GetSlot(const unsigned int nSequence) { return &m_pStorage[(nSequence % m_nSlotCount) * m_nSlotSize]; }
+	unsigned char* GetScratch() { return &m_pStorage[m_nSlotCount * m_nSlotSize]; }
+
+public:
+	unsigned int m_nFlags;              // Negotiated PROTOCOL_xxx feature bits
+	unsigned int m_nWindowSize;         // Frames in flight (0 = stop-and-wait)
+	unsigned int m_nFrameSize;          // Maximum payload of one frame
+	unsigned int m_nSlotCount;          // Number of frame slots (window size or one, plus the read-ahead slots)
+	unsigned int m_nSlotSize;           // Bytes per slot (header + maximum payload)
+	unsigned int m_nBaseSequence;       // Oldest frame not yet acknowledged (sender) or delivered (receiver)
+	unsigned int m_nNextSequence;       // Next frame to be sent (sender)
+	std::vector<unsigned char> m_pStorage; // Slots followed by one scratch slot
+	std::vector<int> m_nSlotLength;     // Payload length stored in each slot (-1 = empty)
+	std::vector<int> m_nRetryCount;     // Retransmissions requested for each slot
+};
 
 /**
- * @brief Calculates the LRC for a vector of bytes.
- * @param buffer Vector of bytes.
- * @return The computed LRC value.
+ * @brief Data path counters, TRACEd after each transfer to show how often payloads are copied.
  */
-inline unsigned char calcLRC(const std::vector<unsigned char>& buffer)
-{
-	unsigned char nLRC = 0;
-	for (auto i = buffer.begin(); i != buffer.end(); ++i)
-		nLRC = nLRC ^ *i;
-	return nLRC;
-}
+typedef struct {
+	std::atomic<unsigned long long> nCopiedBytes; // Payload bytes copied into a frame slot before sending
+	std::atomic<unsigned long long> nAllocations; // Frame windows allocated (one per transfer)
+} DATAPATH_COUNTERS;
+
+extern DATAPATH_COUNTERS g_pDataPathCounters;
 
 /**
  * @brief Converts a UTF-8 encoded std::string to std::wstring.
@@ -85,6 +101,54 @@ bool ReadBuffer(const int nSocketIndex, CWSocket& pApplicationSocket, unsigned c
  */
 bool WriteBuffer(const int nSocketIndex, CWSocket& pApplicationSocket, const unsigned char* pBuffer, const int nLength, const bool SendENQ, const bool SendEOT);
 
+/**
+ * @brief Returns the protocol options negotiated with a client.
+ * @param nSocketIndex Index of the client socket.
+ * @return The negotiated options (legacy stop-and-wait for old clients).
+ */
+const PROTOCOL_OPTIONS& GetProtocolOptions(const int nSocketIndex);
+
+/**
+ * @brief Waits for a free slot in the window and returns its payload area.
+ *        Filling it in place and passing it to WriteFrame sends the frame without copying the payload.
+ * @param nSocketIndex Index of the client socket.
+ * @param pApplicationSocket The socket to read acknowledgements from.
+ * @param pFrameWindow Sliding window state of the current transfer.
+ * @return Payload area of the next frame (GetFrameSize() bytes), or nullptr on error.
+ */
+unsigned char* ReserveFrame(const int nSocketIndex, CWSocket& pApplicationSocket, CFrameWindow& pFrameWindow);
+
+/**
+ * @brief Sends one data frame, keeping up to the window size of frames in flight.
+ * @param nSocketIndex Index of the client socket.
+ * @param pApplicationSocket The socket to write to.
+ * @param pFrameWindow Sliding window state of the current transfer.
+ * @param pBuffer Buffer containing data to send.
+ * @param nLength Length of data to send.
+ * @return true if the frame was sent, false otherwise.
+ */
+bool WriteFrame(const int nSocketIndex, CWSocket& pApplicationSocket, CFrameWindow& pFrameWindow, const unsigned char* pBuffer, const int nLength);
+
+/**
+ * @brief Waits until every data frame sent through the window has been acknowledged.
+ * @param nSocketIndex Index of the client socket.
+ * @param pApplicationSocket The socket to read acknowledgements from.
+ * @param pFrameWindow Sliding window state of the current transfer.
+ * @return true if all frames were acknowledged, false otherwise.
+ */
+bool FlushFrames(const int nSocketIndex, CWSocket& pApplicationSocket, CFrameWindow& pFrameWindow);
+
+/**
+ * @brief Receives the next data frame in sequence order.
+ * @param nSocketIndex Index of the client socket.
+ * @param pApplicationSocket The socket to read from.
+ * @param pFrameWindow Sliding window state of the current transfer.
+ * @param pPayload [out] Points to the payload, valid until the next call.
+ * @param nLength [out] Length of the payload.
+ * @return true on success, false otherwise.
+ */
+bool ReadFrame(const int nSocketIndex, CWSocket& pApplicationSocket, CFrameWindow& pFrameWindow, unsigned char*& pPayload, int& nLength);
+
 /**
  * @brief Starts the main server processing thread for accepting client connections.
  */
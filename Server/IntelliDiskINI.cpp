@@ -15,6 +15,7 @@ IntelliDisk. If not, see <http://www.opensource.org/licenses/gpl-3.0.html>*/
 
 #include "pch.h"
 #include "IntelliDiskINI.h"
+#include "Chunker.h"
 
 #ifdef _DEBUG
 #define new DEBUG_NEW
@@ -140,6 +141,211 @@ const int LoadServicePort()
 	return nServicePort;
 }
 
+/**
+ * @brief Loads the per-client notification queue limit from the IntelliDisk XML settings file
+ * @return The limit, or the default IntelliDiskNotifyQueueLimit if missing or invalid
+ */
+const int LoadNotifyQueueLimit()
+{
+	int nNotifyQueueLimit = IntelliDiskNotifyQueueLimit;  // Default fallback value
+	TRACE(_T("LoadNotifyQueueLimit\n"));
+	try {
+		// Initialize COM for XML parsing (required by CXMLAppSettings)
+		const HRESULT hr{ CoInitialize(nullptr) };
+		if (FAILED(hr))
+			return nNotifyQueueLimit;  // COM initialization failed, use default
+
+		// Open XML settings file (create if not exists, read/write mode)
+		CXMLAppSettings pAppSettings(GetAppSettingsFilePath(), true, true);
+		// Read queue limit from [IntelliDisk] section
+		nNotifyQueueLimit = pAppSettings.GetInt(IntelliDiskSection, _T("NotifyQueueLimit"));
+		if (nNotifyQueueLimit <= 0)
+			nNotifyQueueLimit = IntelliDiskNotifyQueueLimit;
+	}
+	catch (CAppSettingsException& pException)
+	{
+		// XML parsing error or setting not found - log and return default
+		const int nErrorLength = 0x100;
+		TCHAR lpszErrorMessage[nErrorLength] = { 0, };
+		pException.GetErrorMessage(lpszErrorMessage, nErrorLength);
+		TRACE(_T("%s\n"), lpszErrorMessage);
+	}
+	return nNotifyQueueLimit;
+}
+
+/**
+ * @brief Loads the notification settle time from the IntelliDisk XML settings file
+ * @return The settle time in milliseconds (0 = none), or the default IntelliDiskNotifySettleTime if missing or invalid
+ */
+const int LoadNotifySettleTime()
+{
+	int nNotifySettleTime = IntelliDiskNotifySettleTime;  // Default fallback value
+	TRACE(_T("LoadNotifySettleTime\n"));
+	try {
+		// Initialize COM for XML parsing (required by CXMLAppSettings)
+		const HRESULT hr{ CoInitialize(nullptr) };
+		if (FAILED(hr))
+			return nNotifySettleTime;  // COM initialization failed, use default
+
+		// Open XML settings file (create if not exists, read/write mode)
+		CXMLAppSettings pAppSettings(GetAppSettingsFilePath(), true, true);
+		// Read settle time from [IntelliDisk] section; 0 sends every event at once
+		nNotifySettleTime = pAppSettings.GetInt(IntelliDiskSection, _T("NotifySettleTime"));
+		if (nNotifySettleTime < 0)
+			nNotifySettleTime = IntelliDiskNotifySettleTime;
+	}
+	catch (CAppSettingsException& pException)
+	{
+		// XML parsing error or setting not found - log and return default
+		const int nErrorLength = 0x100;
+		TCHAR lpszErrorMessage[nErrorLength] = { 0, };
+		pException.GetErrorMessage(lpszErrorMessage, nErrorLength);
+		TRACE(_T("%s\n"), lpszErrorMessage);
+	}
+	return nNotifySettleTime;
+}
+
+/**
+ * @brief Loads the number of file chunks inserted per database round trip from the IntelliDisk XML settings file
+ * @return The batch size, or the default IntelliDiskUploadBatchSize if missing or invalid
+ */
+const int LoadUploadBatchSize()
+{
+	int nUploadBatchSize = IntelliDiskUploadBatchSize;  // Default fallback value
+	TRACE(_T("LoadUploadBatchSize\n"));
+	try {
+		// Initialize COM for XML parsing (required by CXMLAppSettings)
+		const HRESULT hr{ CoInitialize(nullptr) };
+		if (FAILED(hr))
+			return nUploadBatchSize;  // COM initialization failed, use default
+
+		// Open XML settings file (create if not exists, read/write mode)
+		CXMLAppSettings pAppSettings(GetAppSettingsFilePath(), true, true);
+		// Read batch size from [IntelliDisk] section
+		nUploadBatchSize = pAppSettings.GetInt(IntelliDiskSection, _T("UploadBatchSize"));
+		if (nUploadBatchSize <= 0)
+			nUploadBatchSize = IntelliDiskUploadBatchSize;
+	}
+	catch (CAppSettingsException& pException)
+	{
+		// XML parsing error or setting not found - log and return default
+		const int nErrorLength = 0x100;
+		TCHAR lpszErrorMessage[nErrorLength] = { 0, };
+		pException.GetErrorMessage(lpszErrorMessage, nErrorLength);
+		TRACE(_T("%s\n"), lpszErrorMessage);
+	}
+	return nUploadBatchSize;
+}
+
+/**
+ * @brief Loads the delay injected into the fetch stage of downloads from the IntelliDisk XML settings file
+ * @return The delay in milliseconds per MiB read, or the default IntelliDiskFetchDelay if missing or invalid
+ * @details Stands in for a slow or remote database when downloads are benchmarked (IntelliBench -pipeline)
+ */
+const int LoadFetchDelay()
+{
+	int nFetchDelay = IntelliDiskFetchDelay;  // Default fallback value
+	TRACE(_T("LoadFetchDelay\n"));
+	try {
+		// Initialize COM for XML parsing (required by CXMLAppSettings)
+		const HRESULT hr{ CoInitialize(nullptr) };
+		if (FAILED(hr))
+			return nFetchDelay;  // COM initialization failed, use default
+
+		// Open XML settings file (create if not exists, read/write mode)
+		CXMLAppSettings pAppSettings(GetAppSettingsFilePath(), true, true);
+		// Read fetch delay from [IntelliDisk] section
+		nFetchDelay = pAppSettings.GetInt(IntelliDiskSection, _T("FetchDelay"));
+		if (nFetchDelay < 0)
+			nFetchDelay = IntelliDiskFetchDelay;
+	}
+	catch (CAppSettingsException& pException)
+	{
+		// XML parsing error or setting not found - log and return default
+		const int nErrorLength = 0x100;
+		TCHAR lpszErrorMessage[nErrorLength] = { 0, };
+		pException.GetErrorMessage(lpszErrorMessage, nErrorLength);
+		TRACE(_T("%s\n"), lpszErrorMessage);
+	}
+	return nFetchDelay;
+}
+
+/**
+ * @brief Loads whether database connections are kept open between file operations from the IntelliDisk XML settings file
+ * @return 0 to log in for each file operation, otherwise the default IntelliDiskDatabasePool
+ * @details Switching the pool off brings back the login per file operation, for the comparison of IntelliBench -smallfiles
+ */
+const int LoadDatabasePool()
+{
+	int nDatabasePool = IntelliDiskDatabasePool;  // Default fallback value
+	TRACE(_T("LoadDatabasePool\n"));
+	try {
+		// Initialize COM for XML parsing (required by CXMLAppSettings)
+		const HRESULT hr{ CoInitialize(nullptr) };
+		if (FAILED(hr))
+			return nDatabasePool;  // COM initialization failed, use default
+
+		// Open XML settings file (create if not exists, read/write mode)
+		CXMLAppSettings pAppSettings(GetAppSettingsFilePath(), true, true);
+		// Read the pool switch from [IntelliDisk] section; only an explicit 0 turns the pool off
+		if (pAppSettings.GetInt(IntelliDiskSection, _T("DatabasePool")) == 0)
+			nDatabasePool = 0;
+	}
+	catch (CAppSettingsException& pException)
+	{
+		// XML parsing error or setting not found - log and return default
+		const int nErrorLength = 0x100;
+		TCHAR lpszErrorMessage[nErrorLength] = { 0, };
+		pException.GetErrorMessage(lpszErrorMessage, nErrorLength);
+		TRACE(_T("%s\n"), lpszErrorMessage);
+	}
+	return nDatabasePool;
+}
+
+/**
+ * @brief Loads the content-defined chunk sizes from the IntelliDisk XML settings file
+ * @param nMinSize [out] Smallest chunk, or CHUNKER_MIN_SIZE on error
+ * @param nAvgSize [out] Average chunk, or CHUNKER_AVG_SIZE on error
+ * @param nMaxSize [out] Largest chunk, or CHUNKER_MAX_SIZE on error
+ * @return true on success, false on error
+ */
+bool LoadChunkSizes(int& nMinSize, int& nAvgSize, int& nMaxSize)
+{
+	nMinSize = CHUNKER_MIN_SIZE;  // Default fallback values
+	nAvgSize = CHUNKER_AVG_SIZE;
+	nMaxSize = CHUNKER_MAX_SIZE;
+	TRACE(_T("LoadChunkSizes\n"));
+	try {
+		// Initialize COM for XML parsing (required by CXMLAppSettings)
+		const HRESULT hr{ CoInitialize(nullptr) };
+		if (FAILED(hr))
+			return false;  // COM initialization failed, use defaults
+
+		// Open XML settings file (create if not exists, read/write mode)
+		CXMLAppSettings pAppSettings(GetAppSettingsFilePath(), true, true);
+		// Read chunk sizes from [IntelliDisk] section; CContentChunker clamps them to a usable range
+		const int nMinSetting = pAppSettings.GetInt(IntelliDiskSection, _T("ChunkMinSize"));
+		const int nAvgSetting = pAppSettings.GetInt(IntelliDiskSection, _T("ChunkAvgSize"));
+		const int nMaxSetting = pAppSettings.GetInt(IntelliDiskSection, _T("ChunkMaxSize"));
+		if ((nMinSetting > 0) && (nAvgSetting > 0) && (nMaxSetting > 0))
+		{
+			nMinSize = nMinSetting;
+			nAvgSize = nAvgSetting;
+			nMaxSize = nMaxSetting;
+		}
+	}
+	catch (CAppSettingsException& pException)
+	{
+		// XML parsing error or setting not found - log and return defaults
+		const int nErrorLength = 0x100;
+		TCHAR lpszErrorMessage[nErrorLength] = { 0, };
+		pException.GetErrorMessage(lpszErrorMessage, nErrorLength);
+		TRACE(_T("%s\n"), lpszErrorMessage);
+		return false;
+	}
+	return true;
+}
+
 /**
  * @brief Saves the service port to the IntelliDisk XML settings file
  * @param nServicePort The service port number to save
@@ -33,6 +33,31 @@ IntelliDisk. If not, see <http://www.opensource.org/licenses/gpl-3.0.html>*/
    */
 #define IntelliDiskSection _T("IntelliDisk")
 
+/**
+ * @brief Default number of pending notifications per client before it needs a full resync.
+ */
+#define IntelliDiskNotifyQueueLimit 4096
+
+/**
+ * @brief Default milliseconds a file path must stay quiet before its notification is sent.
+ */
+#define IntelliDiskNotifySettleTime 1000
+
+/**
+ * @brief Default number of file chunks inserted per database round trip during an upload.
+ */
+#define IntelliDiskUploadBatchSize 16
+
+/**
+ * @brief Default milliseconds the fetch stage of a download waits per MiB read (0 = none; for benchmarks only).
+ */
+#define IntelliDiskFetchDelay 0
+
+/**
+ * @brief Default for keeping database connections open between file operations (0 = log in for each one; for benchmarks only).
+ */
+#define IntelliDiskDatabasePool 1
+
    /**
 	* @brief Loads the service port from the IntelliDisk XML settings file.
 	* @return The service port number, or the default IntelliDiskPort on error.
@@ -46,6 +71,45 @@ const int LoadServicePort();
  */
 bool SaveServicePort(const int nServicePort);
 
+/**
+ * @brief Loads the per-client notification queue limit from the IntelliDisk XML settings file.
+ * @return The limit, or the default IntelliDiskNotifyQueueLimit on error.
+ */
+const int LoadNotifyQueueLimit();
+
+/**
+ * @brief Loads the notification settle time from the IntelliDisk XML settings file.
+ * @return The settle time in milliseconds (0 = none), or the default IntelliDiskNotifySettleTime on error.
+ */
+const int LoadNotifySettleTime();
+
+/**
+ * @brief Loads the number of file chunks inserted per database round trip from the IntelliDisk XML settings file.
+ * @return The batch size, or the default IntelliDiskUploadBatchSize on error.
+ */
+const int LoadUploadBatchSize();
+
+/**
+ * @brief Loads the delay injected into the fetch stage of downloads from the IntelliDisk XML settings file.
+ * @return The delay in milliseconds per MiB, or the default IntelliDiskFetchDelay on error.
+ */
+const int LoadFetchDelay();
+
+/**
+ * @brief Loads whether database connections are pooled from the IntelliDisk XML settings file.
+ * @return 0 to log in for each file operation, otherwise the default IntelliDiskDatabasePool.
+ */
+const int LoadDatabasePool();
+
+/**
+ * @brief Loads the content-defined chunk sizes from the IntelliDisk XML settings file.
+ * @param nMinSize [out] Smallest chunk, or the default CHUNKER_MIN_SIZE on error.
+ * @param nAvgSize [out] Average chunk, or the default CHUNKER_AVG_SIZE on error.
+ * @param nMaxSize [out] Largest chunk, or the default CHUNKER_MAX_SIZE on error.
+ * @return true on success, false on error.
+ */
+bool LoadChunkSizes(int& nMinSize, int& nAvgSize, int& nMaxSize);
+
 /**
  * @brief Loads database and server connection settings from the IntelliDisk XML file.
  * @param strHostName [out] Host name for the database/server.
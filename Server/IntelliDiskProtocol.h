@@ -0,0 +1,160 @@
+/* Copyright (C) 2022-2026 Stefan-Mihai MOGA
+This file is part of IntelliDisk application developed by Stefan-Mihai MOGA.
+IntelliDisk is an alternative Windows version to the famous Microsoft OneDrive!
+
+IntelliDisk is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the Open
+Source Initiative, either version 3 of the License, or any later version.
+
+IntelliDisk is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+IntelliDisk. If not, see <http://www.opensource.org/licenses/gpl-3.0.html>*/
+
+#pragma once
+
+#ifndef __INTELLIDISK_PROTOCOL__
+#define __INTELLIDISK_PROTOCOL__
+
+// Wire format shared by the server and IntelliBench; kept free of MFC so the benchmark can use it
+
+#include "Chunker.h"
+#include <vector>
+
+/**
+ * @brief Calculates the Longitudinal Redundancy Check (LRC) for a buffer.
+ *        Used for simple data integrity verification in protocol packets.
+ * @param buffer Pointer to the buffer.
+ * @param length Number of bytes to process.
+ * @return The computed LRC value.
+ */
+inline unsigned char calcLRC(const unsigned char* buffer, const int length)
+{
+	unsigned char nLRC = 0;
+	for (int i = 0; i < length; nLRC = nLRC ^ buffer[i], i++);
+	return nLRC;
+}
+
+/**
+ * @brief Calculates the LRC for a vector of bytes.
+ * @param buffer Vector of bytes.
+ * @return The computed LRC value.
+ */
+inline unsigned char calcLRC(const std::vector<unsigned char>& buffer)
+{
+	unsigned char nLRC = 0;
+	for (auto i = buffer.begin(); i != buffer.end(); ++i)
+		nLRC = nLRC ^ *i;
+	return nLRC;
+}
+
+// Protocol features negotiated during the "IntelliDisk" handshake
+#define PROTOCOL_VERSION 11            // Version announced by this server
+#define PROTOCOL_WINDOW 0x00000001     // Sequence-numbered data frames with several frames in flight
+#define PROTOCOL_CRC32C 0x00000002     // Data frames carry a CRC32C instead of the LRC
+#define PROTOCOL_LARGE_FRAME 0x00000004 // Data frames carry up to nFrameSize bytes (requires PROTOCOL_WINDOW)
+#define PROTOCOL_RESYNC 0x00000008     // Server may send "NotifyResync" + file manifest instead of dropped notifications
+#define PROTOCOL_DEDUP 0x00000010      // Uploads announce their chunk hashes first and send only the chunks the server lacks
+// 0x00000020 was PROTOCOL_DELTA (rsync-style delta uploads), superseded by PROTOCOL_CDC; not to be reused
+#define PROTOCOL_CDC 0x00000040        // Deduplicated uploads use content-defined chunks and announce their lengths (requires PROTOCOL_DEDUP)
+#define PROTOCOL_RANGE 0x00000080      // Downloads go through "DownloadRange", which can start at an offset of a given file version
+#define PROTOCOL_RESUME 0x00000100     // Uploads open an upload session, so a broken-off upload continues from its last checkpoint
+#define PROTOCOL_RESULT 0x00000200     // Uploads end with an UPLOAD_RESULT once the server verified and published the file (or failed to)
+
+constexpr auto MAX_WINDOW_SIZE = 64;   // Upper bound for the number of data frames in flight
+constexpr auto LEGACY_FRAME_SIZE = 0x10000 - 5;  // Payload of a legacy STX/ETX packet (16-bit length)
+constexpr auto MAX_FRAME_SIZE = 0x400000;        // Upper bound for the payload of one data frame (4 MiB)
+constexpr auto MAX_WINDOW_BYTES = 0x1000000;     // Upper bound for the payload bytes in flight per transfer (16 MiB)
+constexpr auto DEDUP_CHUNK_SIZE = LEGACY_FRAME_SIZE; // Largest stored chunk (fixed chunk size without PROTOCOL_CDC), keyed by its SHA256
+constexpr auto DEDUP_HASHES_PER_PACKET = LEGACY_FRAME_SIZE / 32; // Chunk hashes per packet of the have/need exchange
+constexpr unsigned long long UPLOAD_CHECKPOINT_SIZE = 64 * 1024 * 1024; // Bytes received between two checkpoints of a resumable upload
+static_assert(CHUNKER_MAX_SIZE <= DEDUP_CHUNK_SIZE, "A content-defined chunk must fit a chunk slot");
+
+#pragma pack(push, 1)
+/**
+ * @brief Capability block exchanged during the "IntelliDisk" handshake.
+ *        Newer clients append it after the NUL terminator of the machine ID;
+ *        the server answers with the options it accepts. Old clients send none and get no answer.
+ */
+typedef struct {
+	unsigned int nVersion;    // Protocol version
+	unsigned int nFlags;      // PROTOCOL_xxx feature bits
+	unsigned int nWindowSize; // Number of data frames allowed in flight
+	unsigned int nFrameSize;  // Maximum payload of one data frame (PROTOCOL_LARGE_FRAME)
+} PROTOCOL_OPTIONS;
+
+/**
+ * @brief Header of an extended (sequence-numbered) data frame, followed by the payload.
+ */
+typedef struct {
+	unsigned char nStart;       // SOH - marks an extended frame
+	unsigned char nReserved[3]; // Always zero
+	unsigned int nSequence;     // Frame sequence number within the transfer
+	unsigned int nLength;       // Payload length
+	unsigned int nChecksum;     // CRC32C of the header and payload (PROTOCOL_CRC32C), otherwise LRC of the payload
+} FRAME_HEADER;
+
+/**
+ * @brief Acknowledgement of an extended data frame.
+ *        ACK is cumulative (all frames up to nSequence arrived), NAK is selective (resend nSequence only).
+ */
+typedef struct {
+	unsigned char nReturn;  // ACK or NAK
+	unsigned int nSequence; // Acknowledged frame sequence number
+} FRAME_ACK;
+
+/**
+ * @brief Entry of the have/need exchange with PROTOCOL_CDC, where the chunks differ in length.
+ */
+typedef struct {
+	unsigned char pHash[32];  // SHA256 of the chunk
+	unsigned int nLength;     // Length of the chunk
+} CHUNK_ENTRY;
+
+/**
+ * @brief Request of a "DownloadRange", sent after the file path.
+ */
+typedef struct {
+	unsigned long long nOffset;  // First byte wanted
+	unsigned long long nLength;  // Bytes wanted, 0 for the rest of the file
+	long long nVersion;          // Version the bytes before nOffset came from, 0 for the current one
+} RANGE_REQUEST;
+
+/**
+ * @brief Answer to a "DownloadRange" (also sent by pushed downloads with PROTOCOL_RANGE), followed by the data frames
+ *        and the SHA256 of the bytes sent. The server starts at zero when it cannot serve the offset.
+ */
+typedef struct {
+	unsigned long long nFileLength;  // Length of the whole file
+	long long nVersion;              // Version the bytes come from
+	unsigned long long nOffset;      // First byte sent
+	unsigned long long nLength;      // Bytes sent
+} RANGE_REPLY;
+
+/**
+ * @brief Upload session of PROTOCOL_RESUME, exchanged after the file length of an upload.
+ *        The client sends the token of the upload that broke off (0 for a new one), the server answers
+ *        with the token of this upload and the offset the client continues from.
+ */
+typedef struct {
+	unsigned long long nToken;   // Session token, 0 if none
+	unsigned long long nOffset;  // Bytes the server already committed (server answer only)
+} UPLOAD_SESSION;
+
+#define UPLOAD_PUBLISHED 0  // The new version is stored and visible to other clients
+#define UPLOAD_FAILED 1     // Verification or the database failed; the previous version stays
+
+/**
+ * @brief Answer of PROTOCOL_RESULT to the SHA256 that ends an upload.
+ */
+typedef struct {
+	unsigned long long nStatus;   // UPLOAD_PUBLISHED or UPLOAD_FAILED
+	unsigned long long nVersion;  // Published version, 0 on failure
+} UPLOAD_RESULT;
+#pragma pack(pop)
+
+constexpr auto DEDUP_ENTRIES_PER_PACKET = LEGACY_FRAME_SIZE / (int)sizeof(CHUNK_ENTRY); // Chunk entries per packet with PROTOCOL_CDC
+
+#endif
@@ -18,29 +18,57 @@ IntelliDisk. If not, see <http://www.opensource.org/licenses/gpl-3.0.html>*/
 #include "IntelliDiskINI.h"
 #include "IntelliDiskSQL.h"
 #include "SHA256.h"
-#include "base64.h"
 
 #ifdef _DEBUG
 #define new DEBUG_NEW
 #endif
 
+std::atomic<int> g_nSchemaVersion = DATABASE_SCHEMA_VERSION; // Layout of the `filedata` table (see UpgradeDatabase)
+std::atomic<bool> g_bBase64Rows = false; // DATABASE_SCHEMA_MIGRATING: some rows still hold Base64 in `content`
+SRWLOCK g_pSchemaLock = SRWLOCK_INIT; // Held shared by statements that name a `filedata` content column, exclusively while the migration swaps them
+int g_nUploadBatchSize = IntelliDiskUploadBatchSize;
+int g_nFetchDelay = IntelliDiskFetchDelay;
+bool g_bDatabasePool = (IntelliDiskDatabasePool != 0);
+CContentChunker g_pContentChunker;
+
+constexpr __int64 UNPUBLISHED_VERSION = -1; // `current_version` of a file whose first upload has not been published yet
+
+/**
+ * @brief Keeps the schema migration from dropping or renaming a `filedata` content column while a statement that names it runs.
+ * @details Only the statements that pick their SQL text from the schema take it, for as long as they run.
+ *          Once the schema is at DATABASE_SCHEMA_VERSION nothing changes any more and the lock is skipped.
+ */
+class CSchemaLock
+{
+public:
+	CSchemaLock() : m_bLocked(g_nSchemaVersion != DATABASE_SCHEMA_VERSION) { if (m_bLocked) AcquireSRWLockShared(&g_pSchemaLock); }
+	~CSchemaLock() { if (m_bLocked) ReleaseSRWLockShared(&g_pSchemaLock); }
+	CSchemaLock(const CSchemaLock&) = delete;
+	CSchemaLock& operator=(const CSchemaLock&) = delete;
+
+private:
+	const bool m_bLocked;
+};
+
 /**
  * @brief ODBC accessor for inserting a row into the `filename` table
- * @details Maps parameters for filepath and filesize to SQL placeholders
+ * @details Maps parameters for filepath, filesize and current version to SQL placeholders
  */
 class CFilenameInsertAccessor
 {
 public:
 	TCHAR m_lpszFilepath[4000];  // File path (relative to IntelliDisk root)
 	__int64 m_nFilesize;          // Total file size in bytes
+	__int64 m_nCurrentVersion;    // 0, or UNPUBLISHED_VERSION while a resumable upload is under way
 
 	BEGIN_ODBC_PARAM_MAP(CFilenameInsertAccessor)
 		SET_ODBC_PARAM_TYPE(SQL_PARAM_INPUT)
 		ODBC_PARAM_ENTRY(1, m_lpszFilepath)
 		ODBC_PARAM_ENTRY(2, m_nFilesize)
+		ODBC_PARAM_ENTRY(3, m_nCurrentVersion)
 	END_ODBC_PARAM_MAP()
 
-	DEFINE_ODBC_COMMAND(CFilenameInsertAccessor, _T("INSERT INTO `filename` (`filepath`, `filesize`) VALUES (?, ?);"))
+	DEFINE_ODBC_COMMAND(CFilenameInsertAccessor, _T("INSERT INTO `filename` (`filepath`, `filesize`, `current_version`) VALUES (?, ?, ?);"))
 
 		void ClearRecord() noexcept { memset(this, 0, sizeof(*this)); }
 };
@@ -51,21 +79,20 @@ public:
 class CFilenameInsert : public CODBC::CAccessor<CFilenameInsertAccessor>
 {
 public:
-	bool Execute(CODBC::CConnection& pDbConnect, const std::wstring& lpszFilepath, const __int64& nFilesize)
+	bool Execute(POOLED_CONNECTION& pDbConnect, const std::wstring& lpszFilepath, const __int64& nFilesize, const __int64 nCurrentVersion = 0)
 	{
 		ClearRecord();
-		CODBC::CStatement statement;
-		SQLRETURN nRet = statement.Create(pDbConnect);
-		ODBC_CHECK_RETURN_FALSE(nRet, statement);
-		nRet = statement.Prepare(GetDefaultCommand());
-		ODBC_CHECK_RETURN_FALSE(nRet, statement);
+		CODBC::CStatement* statement = PrepareStatement(pDbConnect, reinterpret_cast<LPCTSTR>(GetDefaultCommand()));
+		if (statement == nullptr)
+			return false;
 #pragma warning(suppress: 26485)
 		_tcscpy_s(m_lpszFilepath, _countof(m_lpszFilepath), lpszFilepath.c_str());
 		m_nFilesize = nFilesize;
-		nRet = BindParameters(statement);
-		ODBC_CHECK_RETURN_FALSE(nRet, statement);
-		nRet = statement.Execute();
-		ODBC_CHECK_RETURN_FALSE(nRet, statement);
+		m_nCurrentVersion = nCurrentVersion;
+		SQLRETURN nRet = BindParameters(*statement);
+		ODBC_CHECK_RETURN_FALSE(nRet, (*statement));
+		nRet = statement->Execute();
+		ODBC_CHECK_RETURN_FALSE(nRet, (*statement));
 		return true;
 	}
 };
@@ -94,20 +121,18 @@ public:
 class CFilenameSelect : public CODBC::CAccessor<CFilenameSelectAccessor>
 {
 public:
-	bool Execute(CODBC::CConnection& pDbConnect, const std::wstring& lpszFilepath)
+	bool Execute(POOLED_CONNECTION& pDbConnect, const std::wstring& lpszFilepath)
 	{
 		ClearRecord();
-		CODBC::CStatement statement;
-		SQLRETURN nRet = statement.Create(pDbConnect);
-		ODBC_CHECK_RETURN_FALSE(nRet, statement);
-		nRet = statement.Prepare(GetDefaultCommand());
-		ODBC_CHECK_RETURN_FALSE(nRet, statement);
+		CODBC::CStatement* statement = PrepareStatement(pDbConnect, reinterpret_cast<LPCTSTR>(GetDefaultCommand()));
+		if (statement == nullptr)
+			return false;
 #pragma warning(suppress: 26485)
 		_tcscpy_s(m_lpszFilepath, _countof(m_lpszFilepath), lpszFilepath.c_str());
-		nRet = BindParameters(statement);
-		ODBC_CHECK_RETURN_FALSE(nRet, statement);
-		nRet = statement.Execute();
-		ODBC_CHECK_RETURN_FALSE(nRet, statement);
+		SQLRETURN nRet = BindParameters(*statement);
+		ODBC_CHECK_RETURN_FALSE(nRet, (*statement));
+		nRet = statement->Execute();
+		ODBC_CHECK_RETURN_FALSE(nRet, (*statement));
 		return true;
 	}
 };
@@ -125,79 +150,223 @@ public:
 		ODBC_PARAM_ENTRY(1, m_nFilesize)
 	END_ODBC_PARAM_MAP()
 
-	DEFINE_ODBC_COMMAND(CFilenameUpdateAccessor, _T("UPDATE `filename` SET `filesize` = ? WHERE `filename_id` = @last_filename_id;"))
+	DEFINE_ODBC_COMMAND(CFilenameUpdateAccessor, _T("UPDATE `filename` SET `filesize` = ?, `current_version` = @staging_version WHERE `filename_id` = @last_filename_id;"))
 
 		void ClearRecord() noexcept { memset(this, 0, sizeof(*this)); }
 };
 
 /**
- * @brief Executes an UPDATE for the `filename` table.
+ * @brief Executes an UPDATE for the `filename` table that publishes the uploaded version.
  */
 class CFilenameUpdate : public CODBC::CAccessor<CFilenameUpdateAccessor>
 {
 public:
-	bool Execute(CODBC::CConnection& pDbConnect, const __int64& nFilesize)
+	bool Execute(POOLED_CONNECTION& pDbConnect, const __int64& nFilesize)
 	{
 		ClearRecord();
-		CODBC::CStatement statement;
-		SQLRETURN nRet = statement.Create(pDbConnect);
-		ODBC_CHECK_RETURN_FALSE(nRet, statement);
-		nRet = statement.Prepare(GetDefaultCommand());
-		ODBC_CHECK_RETURN_FALSE(nRet, statement);
+		CODBC::CStatement* statement = PrepareStatement(pDbConnect, reinterpret_cast<LPCTSTR>(GetDefaultCommand()));
+		if (statement == nullptr)
+			return false;
 #pragma warning(suppress: 26485)
 		m_nFilesize = nFilesize;
-		nRet = BindParameters(statement);
-		ODBC_CHECK_RETURN_FALSE(nRet, statement);
-		nRet = statement.Execute();
-		ODBC_CHECK_RETURN_FALSE(nRet, statement);
+		SQLRETURN nRet = BindParameters(*statement);
+		ODBC_CHECK_RETURN_FALSE(nRet, (*statement));
+		nRet = statement->Execute();
+		ODBC_CHECK_RETURN_FALSE(nRet, (*statement));
 		return true;
 	}
 };
 
+constexpr int HASH_BATCH_FACTOR = 64; // `filedata` rows only hold a hash, so many more fit in one INSERT than chunks
+
 /**
- * @brief ODBC accessor for inserting a row into the `filedata` table
- * @details Stores Base64-encoded file chunks with their decoded size
+ * @brief Collects the chunk hashes of an upload and INSERTs them into the `filedata` table several rows per round trip.
+ * @details The rows reference the `chunk` table, in file order, under the staging version of the upload,
+ *          and record the file offset of their chunk for range downloads.
+ *          The hashes and offsets are bound column-wise as parameter arrays (SQL_ATTR_PARAMSET_SIZE),
+ *          so one Execute of the prepared statement stores the whole batch, in order.
  */
-class CFiledataInsertAccessor
+class CFiledataBatchInsert
 {
 public:
-	TCHAR m_lpszContent[0x20000];  // Base64-encoded file chunk (max ~128KB)
-	__int64 m_nBase64;              // Size of decoded (original) data
+	CFiledataBatchInsert(const int nBatchSize) :
+		m_nBatchSize(max(nBatchSize, 1) * HASH_BATCH_FACTOR), m_nCount(0), m_nBatches(0), m_nFileOffset(0),
+		m_pHashes(m_nBatchSize), m_nHashLength(m_nBatchSize, (SQLLEN)sizeof(CHUNK_HASH)), m_nOffsets(m_nBatchSize, 0) {}
 
-	BEGIN_ODBC_PARAM_MAP(CFiledataInsertAccessor)
-		SET_ODBC_PARAM_TYPE(SQL_PARAM_INPUT)
-		ODBC_PARAM_ENTRY(1, m_lpszContent)
-		ODBC_PARAM_ENTRY(2, m_nBase64)
-	END_ODBC_PARAM_MAP()
+	/**
+	 * @brief Adds the next chunk of the file, INSERTing the batch when it is full.
+	 * @param pDbConnect The pooled connection.
+	 * @param pHash SHA256 of the chunk.
+	 * @param nLength Length of the chunk; the next chunk starts after it.
+	 * @return true on success, false on failure.
+	 */
+	bool Append(POOLED_CONNECTION& pDbConnect, const CHUNK_HASH& pHash, const int nLength)
+	{
+		m_nOffsets[m_nCount] = m_nFileOffset;
+		m_pHashes[m_nCount++] = pHash;
+		m_nFileOffset += nLength;
+		return (m_nCount < m_nBatchSize) || Flush(pDbConnect);
+	}
+
+	/**
+	 * @brief INSERTs the rows collected so far.
+	 * @param pDbConnect The pooled connection.
+	 * @return true on success, false on failure.
+	 */
+	bool Flush(POOLED_CONNECTION& pDbConnect)
+	{
+		if (m_nCount == 0)
+			return true;
+		// The rows hold no data of their own; the content column is `content_blob` until the migration renames it
+		CSchemaLock pSchemaLock;
+		LPCTSTR lpszSQL = (g_nSchemaVersion == DATABASE_SCHEMA_MIGRATING) ?
+			_T("INSERT INTO `filedata` (`filename_id`, `version`, `chunk_hash`, `chunk_offset`, `content_blob`) VALUES (@last_filename_id, @staging_version, ?, ?, '');") :
+			_T("INSERT INTO `filedata` (`filename_id`, `version`, `chunk_hash`, `chunk_offset`, `content`) VALUES (@last_filename_id, @staging_version, ?, ?, '');");
+		CODBC::CStatement* statement = PrepareStatement(pDbConnect, lpszSQL);
+		if (statement == nullptr)
+			return false;
+		SQLRETURN nRet = statement->SetAttrU(SQL_ATTR_PARAM_BIND_TYPE, SQL_PARAM_BIND_BY_COLUMN);
+		ODBC_CHECK_RETURN_FALSE(nRet, (*statement));
+		nRet = statement->SetAttrU(SQL_ATTR_PARAMSET_SIZE, (SQLUINTEGER)m_nCount);
+		ODBC_CHECK_RETURN_FALSE(nRet, (*statement));
+		nRet = statement->BindParameter(1, SQL_PARAM_INPUT, SQL_C_BINARY, SQL_BINARY, sizeof(CHUNK_HASH), 0, m_pHashes.data(), sizeof(CHUNK_HASH), m_nHashLength.data());
+		ODBC_CHECK_RETURN_FALSE(nRet, (*statement));
+		nRet = statement->BindParameter(2, SQL_PARAM_INPUT, SQL_C_SBIGINT, SQL_BIGINT, 0, 0, m_nOffsets.data(), sizeof(__int64), nullptr);
+		ODBC_CHECK_RETURN_FALSE(nRet, (*statement));
+		nRet = statement->Execute();
+		ODBC_CHECK_RETURN_FALSE(nRet, (*statement));
+		// Other users of the cached statement expect a single parameter set
+		nRet = statement->SetAttrU(SQL_ATTR_PARAMSET_SIZE, 1);
+		ODBC_CHECK_RETURN_FALSE(nRet, (*statement));
+		m_nCount = 0;
+		m_nBatches++;
+		return true;
+	}
 
-	DEFINE_ODBC_COMMAND(CFiledataInsertAccessor, _T("INSERT INTO `filedata` (`filename_id`, `content`, `base64`) VALUES (@last_filename_id, ?, ?);"))
+	int GetBatchCount() const { return m_nBatches; }
 
-		void ClearRecord() noexcept { memset(this, 0, sizeof(*this)); }
+	/**
+	 * @brief Returns the file offset of the next chunk, i.e. the bytes covered by the rows so far.
+	 */
+	__int64 GetFileOffset() const { return m_nFileOffset; }
+
+	/**
+	 * @brief Starts the rows at a file offset, where a resumed upload continues.
+	 */
+	void SetFileOffset(const __int64 nFileOffset) { m_nFileOffset = nFileOffset; }
+
+private:
+	const int m_nBatchSize;               // Rows per INSERT
+	int m_nCount;                         // Rows collected so far
+	int m_nBatches;                       // INSERTs executed
+	__int64 m_nFileOffset;                // File offset of the next chunk
+	std::vector<CHUNK_HASH> m_pHashes;    // m_nBatchSize chunk hashes
+	std::vector<SQLLEN> m_nHashLength;    // Length indicator of each hash
+	std::vector<__int64> m_nOffsets;      // File offset of each chunk
 };
 
 /**
- * @brief Executes an INSERT for the `filedata` table.
+ * @brief Collects the chunks a client sent and INSERTs the ones not stored yet into the `chunk` table,
+ *        several rows per round trip.
+ * @details Chunks are assembled in place in the next slot (ReserveChunk), then bound column-wise
+ *          as arrays of SQL_C_BINARY parameters. A chunk another upload stored meanwhile is kept as is.
+ *          New chunks start without references; the upload adds them at a checkpoint or when it publishes its version.
  */
-class CFiledataInsert : public CODBC::CAccessor<CFiledataInsertAccessor>
+class CChunkBatchInsert
 {
 public:
-	bool Execute(CODBC::CConnection& pDbConnect, const std::wstring& lpszContent, const __int64& nBase64)
+	CChunkBatchInsert(const int nBatchSize) :
+		m_nBatchSize(max(nBatchSize, 1)), m_nCount(0), m_nBatches(0),
+		m_pHashes(m_nBatchSize), m_nHashLength(m_nBatchSize, (SQLLEN)sizeof(CHUNK_HASH)),
+		m_pContent((size_t)m_nBatchSize * DEDUP_CHUNK_SIZE), m_nContentLength(m_nBatchSize, 0) {}
+
+	/**
+	 * @brief Returns the slot the next chunk is assembled in (DEDUP_CHUNK_SIZE bytes).
+	 */
+	unsigned char* ReserveChunk() { return &m_pContent[(size_t)m_nCount * DEDUP_CHUNK_SIZE]; }
+
+	/**
+	 * @brief Adds the chunk assembled in the reserved slot, INSERTing the batch when it is full.
+	 * @param pDbConnect The pooled connection.
+	 * @param pHash SHA256 of the chunk.
+	 * @param nLength Length of the chunk.
+	 * @return true on success, false on failure.
+	 */
+	bool Append(POOLED_CONNECTION& pDbConnect, const CHUNK_HASH& pHash, const int nLength)
 	{
-		ClearRecord();
-		CODBC::CStatement statement;
-		SQLRETURN nRet = statement.Create(pDbConnect);
-		ODBC_CHECK_RETURN_FALSE(nRet, statement);
-		nRet = statement.Prepare(GetDefaultCommand());
-		ODBC_CHECK_RETURN_FALSE(nRet, statement);
-#pragma warning(suppress: 26485)
-		_tcscpy_s(m_lpszContent, _countof(m_lpszContent), lpszContent.c_str());
-		m_nBase64 = nBase64;
-		nRet = BindParameters(statement);
-		ODBC_CHECK_RETURN_FALSE(nRet, statement);
-		nRet = statement.Execute();
-		ODBC_CHECK_RETURN_FALSE(nRet, statement);
+		ASSERT((nLength >= 0) && (nLength <= DEDUP_CHUNK_SIZE));
+		m_pHashes[m_nCount] = pHash;
+		m_nContentLength[m_nCount++] = nLength;
+		return (m_nCount < m_nBatchSize) || Flush(pDbConnect);
+	}
+
+	/**
+	 * @brief INSERTs the chunks collected so far.
+	 * @param pDbConnect The pooled connection.
+	 * @return true on success, false on failure.
+	 */
+	bool Flush(POOLED_CONNECTION& pDbConnect)
+	{
+		if (m_nCount == 0)
+			return true;
+		CODBC::CStatement* statement = PrepareStatement(pDbConnect, _T("INSERT INTO `chunk` (`chunk_hash`, `refcount`, `content`) VALUES (?, 0, ?) ON DUPLICATE KEY UPDATE `refcount` = `refcount`;"));
+		if (statement == nullptr)
+			return false;
+		SQLRETURN nRet = statement->SetAttrU(SQL_ATTR_PARAM_BIND_TYPE, SQL_PARAM_BIND_BY_COLUMN);
+		ODBC_CHECK_RETURN_FALSE(nRet, (*statement));
+		nRet = statement->SetAttrU(SQL_ATTR_PARAMSET_SIZE, (SQLUINTEGER)m_nCount);
+		ODBC_CHECK_RETURN_FALSE(nRet, (*statement));
+		nRet = statement->BindParameter(1, SQL_PARAM_INPUT, SQL_C_BINARY, SQL_BINARY, sizeof(CHUNK_HASH), 0, m_pHashes.data(), sizeof(CHUNK_HASH), m_nHashLength.data());
+		ODBC_CHECK_RETURN_FALSE(nRet, (*statement));
+		nRet = statement->BindParameter(2, SQL_PARAM_INPUT, SQL_C_BINARY, SQL_LONGVARBINARY, DEDUP_CHUNK_SIZE, 0, m_pContent.data(), DEDUP_CHUNK_SIZE, m_nContentLength.data());
+		ODBC_CHECK_RETURN_FALSE(nRet, (*statement));
+		nRet = statement->Execute();
+		ODBC_CHECK_RETURN_FALSE(nRet, (*statement));
+		// Other users of the cached statement expect a single parameter set
+		nRet = statement->SetAttrU(SQL_ATTR_PARAMSET_SIZE, 1);
+		ODBC_CHECK_RETURN_FALSE(nRet, (*statement));
+		m_nCount = 0;
+		m_nBatches++;
+		return true;
+	}
+
+	int GetBatchCount() const { return m_nBatches; }
+
+private:
+	const int m_nBatchSize;               // Chunks per INSERT
+	int m_nCount;                         // Chunks collected so far
+	int m_nBatches;                       // INSERTs executed
+	std::vector<CHUNK_HASH> m_pHashes;    // SHA256 of each slot
+	std::vector<SQLLEN> m_nHashLength;    // Length indicator of each hash
+	std::vector<BYTE> m_pContent;         // m_nBatchSize slots of DEDUP_CHUNK_SIZE bytes
+	std::vector<SQLLEN> m_nContentLength; // Length indicator of each slot
+};
+
+/**
+ * @brief Runs a SELECT on the statement prepared for it on a pooled connection.
+ *        Replaces CODBC::CCommand, which allocates and prepares a new statement on every Open.
+ */
+template <class TAccessor>
+class CPooledCommand : public CODBC::CAccessor<TAccessor>
+{
+public:
+	bool Open(POOLED_CONNECTION& pDbConnect, _In_opt_ CODBC::SQL_ATTRIBUTE* pAttributes = nullptr, _In_ ULONG nAttributes = 0, _In_opt_ LPCTSTR lpszSQL = nullptr)
+	{
+		if (lpszSQL == nullptr)
+			lpszSQL = reinterpret_cast<LPCTSTR>(TAccessor::GetDefaultCommand());
+		m_pCommand = PrepareStatement(pDbConnect, lpszSQL, pAttributes, nAttributes);
+		if (m_pCommand == nullptr)
+			return false;
+		SQLRETURN nRet = this->BindParameters(*m_pCommand);
+		ODBC_CHECK_RETURN_FALSE(nRet, (*m_pCommand));
+		nRet = m_pCommand->Execute();
+		ODBC_CHECK_RETURN_FALSE(nRet, (*m_pCommand));
+		nRet = this->BindColumns(*m_pCommand);
+		ODBC_CHECK_RETURN_FALSE(nRet, (*m_pCommand));
 		return true;
 	}
+
+	CODBC::CStatement* m_pCommand = nullptr; // Owned by the pooled connection
 };
 
 /**
@@ -224,19 +393,18 @@ public:
 /**
  * @brief Executes a SELECT for the file size and returns it.
  */
-class CFilesizeSelect : public CODBC::CCommand<CODBC::CAccessor<CFilesizeSelectAccessor>>
+class CFilesizeSelect : public CPooledCommand<CFilesizeSelectAccessor>
 {
 public:
-	bool Iterate(const CODBC::CConnection& pDbConnect, ULONGLONG& nFileLength, _In_ bool bBind = true, _In_opt_ CODBC::SQL_ATTRIBUTE* pAttributes = nullptr, _In_ ULONG nAttributes = 0)
+	bool Iterate(POOLED_CONNECTION& pDbConnect, ULONGLONG& nFileLength, _In_opt_ CODBC::SQL_ATTRIBUTE* pAttributes = nullptr, _In_ ULONG nAttributes = 0)
 	{
 		nFileLength = 0;
-#pragma warning(suppress: 26477)
-		SQLRETURN nRet{ Open(pDbConnect, GetDefaultCommand(), bBind, pAttributes, nAttributes) };
-		ODBC_CHECK_RETURN_FALSE(nRet, m_Command);
+		if (!Open(pDbConnect, pAttributes, nAttributes))
+			return false;
 		while (true)
 		{
 			ClearRecord();
-			nRet = m_Command.FetchNext();
+			const SQLRETURN nRet = m_pCommand->FetchNext();
 			if (!SQL_SUCCEEDED(nRet))
 				break;
 			nFileLength = m_nFilesize;
@@ -247,317 +415,2468 @@ public:
 
 /**
  * @brief ODBC accessor for selecting file data from the `filedata` table
- * @details Retrieves Base64-encoded chunks ordered by filedata_id for sequential streaming
+ * @details Retrieves the binary chunks of the current version ordered by filedata_id for sequential streaming.
+ *          Rows stored before the chunk store hold their data inline, newer rows reference the `chunk` table.
+ *          The column is not bound: CFiledataSelect reads it with SQLGetData into the read-ahead pipeline
  */
 class CFiledataSelectAccessor
 {
 public:
-	TCHAR m_lpszContent[0x20000];  // Base64-encoded file chunk
-	__int64 m_nBase64;              // Size of decoded (original) data
-
 	BEGIN_ODBC_PARAM_MAP(CFiledataSelectAccessor)
 	END_ODBC_PARAM_MAP()
 
 	BEGIN_ODBC_COLUMN_MAP(CFiledataSelectAccessor)
-		ODBC_COLUMN_ENTRY(1, m_lpszContent)
-		ODBC_COLUMN_ENTRY(2, m_nBase64)
 	END_ODBC_COLUMN_MAP()
 
-	DEFINE_ODBC_COMMAND(CFiledataSelectAccessor, _T("SELECT `content`, `base64` FROM `filedata` WHERE `filename_id` = @last_filename_id ORDER BY `filedata_id` ASC;"))
+	DEFINE_ODBC_COMMAND(CFiledataSelectAccessor, _T("SELECT IF(`filedata`.`chunk_hash` IS NULL, `filedata`.`content`, `chunk`.`content`) FROM `filedata` LEFT JOIN `chunk` ON `chunk`.`chunk_hash` = `filedata`.`chunk_hash` WHERE `filedata`.`filename_id` = @last_filename_id AND `filedata`.`version` = (SELECT `current_version` FROM `filename` WHERE `filename_id` = @last_filename_id) ORDER BY `filedata`.`filedata_id` ASC;"))
 
 		void ClearRecord() noexcept { memset(this, 0, sizeof(*this)); }
 };
 
+constexpr auto READ_AHEAD_SIZE = 0x400000; // Bytes a download fetches from the database ahead of the socket (4 MiB)
+
 /**
- * @brief Executes a SELECT for file data and streams it to the client socket.
+ * @brief Fetch stage of a download, queued on the fetch threads.
  */
-class CFiledataSelect : public CODBC::CCommand<CODBC::CAccessor<CFiledataSelectAccessor>>
-{
-public:
-	bool Iterate(const CODBC::CConnection& pDbConnect, const int nSocketIndex, CWSocket& pApplicationSocket, SHA256& pSHA256, _In_ bool bBind = true, _In_opt_ CODBC::SQL_ATTRIBUTE* pAttributes = nullptr, _In_ ULONG nAttributes = 0)
-	{
-#pragma warning(suppress: 26477)
-		SQLRETURN nRet{ Open(pDbConnect, GetDefaultCommand(), bBind, pAttributes, nAttributes) };
-		ODBC_CHECK_RETURN_FALSE(nRet, m_Command);
-		// Iterate through all file data chunks for this file
-		while (true)
-		{
-			ClearRecord();
-			nRet = m_Command.FetchNext();
-			if (!SQL_SUCCEEDED(nRet))
-				break;
-			TRACE(_T("m_nBase64 = %lld\n"), m_nBase64);
-			// Decode Base64 data back to binary
-			std::string decoded = base64_decode(wstring_to_utf8(m_lpszContent));
-			ASSERT((size_t)m_nBase64 == decoded.length());
-			// Send chunk to client and update SHA256 hash
-			if (WriteBuffer(nSocketIndex, pApplicationSocket, (unsigned char*)decoded.data(), (int)decoded.length(), false, false))
-			{
-				pSHA256.update((unsigned char*)decoded.data(), decoded.length());
-			}
-			else
-			{
-				return false;
-			}
-		}
-		return true;
-	}
-};
+typedef struct {
+	LPTHREAD_START_ROUTINE lpFetch; // The fetch stage
+	LPVOID lpParam;                 // Parameter of the fetch stage
+	HANDLE hDone;                   // Signaled once the fetch stage returned
+} FETCH_JOB;
 
-const int MAX_BUFFER = 0x10000;
+HANDLE g_hFetchPort = nullptr;      // Completion port that queues fetch stages for the fetch threads
+std::vector<HANDLE> g_hFetchThreads; // Threads that run the fetch stages, one per worker
 
 /**
- * @brief Establishes a connection to the MySQL database using ODBC.
- *        Loads connection settings from the application configuration.
- * @return true on success, false on failure.
+ * @brief Fetch thread: runs the queued fetch stages one after the other until a null job arrives.
  */
-bool ConnectToDatabase(CODBC::CEnvironment& pEnvironment, CODBC::CConnection& pConnection)
+DWORD WINAPI FetchThread(LPVOID lpParam)
 {
-	CODBC::String sConnectionOutString;
-	TCHAR sConnectionInString[0x100];
-
-	// Load database configuration from INI file
-	std::wstring strHostName;
-	int nHostPort = 3306;
-	std::wstring strDatabase;
-	std::wstring strUsername;
-	std::wstring strPassword;
-	if (!LoadAppSettings(strHostName, nHostPort, strDatabase, strUsername, strPassword))
-		return false;
-	const std::wstring strHostPort = utf8_to_wstring(std::to_string(nHostPort));
-
-	// Create ODBC environment handle
-	SQLRETURN nRet = pEnvironment.Create();
-	ODBC_CHECK_RETURN_FALSE(nRet, pEnvironment);
-
-	// Set ODBC version to 3.80
-	nRet = pEnvironment.SetAttr(SQL_ATTR_ODBC_VERSION, SQL_OV_ODBC3_80);
-	ODBC_CHECK_RETURN_FALSE(nRet, pEnvironment);
-
-	// Enable connection pooling for better performance
-	nRet = pEnvironment.SetAttrU(SQL_ATTR_CONNECTION_POOLING, SQL_CP_DEFAULT);
-	ODBC_CHECK_RETURN_FALSE(nRet, pEnvironment);
-
-	// Create database connection handle
-	nRet = pConnection.Create(pEnvironment);
-	ODBC_CHECK_RETURN_FALSE(nRet, pConnection);
+	UNREFERENCED_PARAMETER(lpParam);
+	DWORD nBytes = 0;
+	ULONG_PTR nCompletionKey = 0;
+	LPOVERLAPPED lpOverlapped = nullptr;
+	while (GetQueuedCompletionStatus(g_hFetchPort, &nBytes, &nCompletionKey, &lpOverlapped, INFINITE) && (lpOverlapped != nullptr))
+	{
+		FETCH_JOB* pJob = (FETCH_JOB*)lpOverlapped;
+		pJob->lpFetch(pJob->lpParam);
+		// The job lives on the stack of the send stage, which returns once this is signaled
+		VERIFY(SetEvent(pJob->hDone));
+	}
+	return 0;
+}
 
-	// Build MySQL connection string with credentials
-	_stprintf_s(sConnectionInString, _countof(sConnectionInString), _T("Driver={MySQL ODBC 8.0 Unicode Driver};Server=%s;Port=%s;Database=%s;User=%s;Password=%s;"),
-		strHostName.c_str(), strHostPort.c_str(), strDatabase.c_str(), strUsername.c_str(), strPassword.c_str());
-	// Establish connection to MySQL database
-	nRet = pConnection.DriverConnect(const_cast<SQLTCHAR*>(reinterpret_cast<const SQLTCHAR*>(sConnectionInString)), sConnectionOutString);
-	ODBC_CHECK_RETURN_FALSE(nRet, pConnection);
+void StartFetchThreads(const int nThreadCount)
+{
+	g_hFetchPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 0);
+	ASSERT(g_hFetchPort != nullptr);
+	for (int nIndex = 0; nIndex < nThreadCount; nIndex++)
+	{
+		HANDLE hThread = CreateThread(nullptr, 0, FetchThread, nullptr, 0, nullptr);
+		ASSERT(hThread != nullptr);
+		if (hThread != nullptr)
+			g_hFetchThreads.push_back(hThread);
+	}
+	TRACE(_T("%d fetch threads\n"), (int)g_hFetchThreads.size());
+}
 
-	return true;
+void StopFetchThreads()
+{
+	if (g_hFetchPort == nullptr)
+		return;
+	for (size_t nIndex = 0; nIndex < g_hFetchThreads.size(); nIndex++)
+		VERIFY(PostQueuedCompletionStatus(g_hFetchPort, 0, 0, nullptr));
+	for (HANDLE hThread : g_hFetchThreads)
+	{
+		WaitForSingleObject(hThread, INFINITE);
+		VERIFY(CloseHandle(hThread));
+	}
+	g_hFetchThreads.clear();
+	VERIFY(CloseHandle(g_hFetchPort));
+	g_hFetchPort = nullptr;
 }
 
 /**
- * @brief Handles the download of a file from the server to a client.
- *        Streams file data from the database to the client socket, with SHA256 integrity check.
- * @param nSocketIndex Index of the client socket.
- * @param pApplicationSocket The socket to write to.
- * @param strFilePath The file path to download.
- * @return true on success, false on failure.
+ * @brief Bounded ring between the fetch thread that reads a download from the database and the worker that sends it.
+ * @details The ring is made of the frame slots: the fetch stage fills the payload of the slot of the next frame
+ *          while the send stage passes the filled slots to WriteFrame, which sends them in place.
+ *          A slot is reused once its frame is acknowledged, so the window needs READ_AHEAD_SIZE of slots
+ *          beyond the frames in flight. The wait for the next rows overlaps the wait for the client instead of adding to it.
+ *          Either stage can stop the other: Finish ends the data, Cancel makes the fetch stage give up.
  */
-#pragma warning(suppress: 6262)
-bool DownloadFile(const int nSocketIndex, CWSocket& pApplicationSocket, const std::wstring& strFilePath)
+class CReadAheadPipeline
 {
-	CODBC::CEnvironment pEnvironment;
-	CODBC::CConnection pConnection;
-	SHA256 pSHA256;
+public:
+	CReadAheadPipeline(CFrameWindow& pFrameWindow) :
+		m_pFrameWindow(pFrameWindow), m_nBlockSize(pFrameWindow.GetFrameSize()), m_nBlockCount(pFrameWindow.m_nSlotCount),
+		m_nFirstSequence(pFrameWindow.m_nNextSequence), m_pLength(m_nBlockCount, 0)
+	{
+		ASSERT(m_nBlockCount > (pFrameWindow.IsEnabled() ? pFrameWindow.m_nWindowSize : 1));
+		InitializeSRWLock(&m_pLock);
+		InitializeConditionVariable(&m_pNotEmpty);
+		InitializeConditionVariable(&m_pNotFull);
+	}
 
-	std::array<CODBC::SQL_ATTRIBUTE, 2> attributes
-	{ {
- #pragma warning(suppress: 26490)
-	  { SQL_ATTR_CONCURRENCY,        reinterpret_cast<SQLPOINTER>(SQL_CONCUR_ROWVER), SQL_IS_INTEGER },
- #pragma warning(suppress: 26490)
-	  { SQL_ATTR_CURSOR_SENSITIVITY, reinterpret_cast<SQLPOINTER>(SQL_INSENSITIVE),   SQL_IS_INTEGER }
-	} };
-#pragma warning(suppress: 26472)
+	/**
+	 * @brief Returns the free part of the slot being filled, waiting while every other slot is queued or in flight (fetch stage).
+	 * @param nAvailable [out] Free bytes in the slot.
+	 * @return The free space, nullptr when the send stage gave up.
+	 */
+	unsigned char* GetWriteBuffer(int& nAvailable)
+	{
+		AcquireSRWLockExclusive(&m_pLock);
+		while (!m_bCancelled && (m_nTail - m_nReleased >= m_nBlockCount))
+			SleepConditionVariableSRW(&m_pNotFull, &m_pLock, INFINITE, 0);
+		const bool bCancelled = m_bCancelled;
+		ReleaseSRWLockExclusive(&m_pLock);
+		if (bCancelled)
+			return nullptr;
+		nAvailable = m_nBlockSize - m_nTailLength;
+		return GetBlock(m_nTail) + m_nTailLength;
+	}
 
-	ULONGLONG nFileLength = 0;
-	CFilenameSelect pFilenameSelect;
-	CFilesizeSelect pFilesizeSelect;
-	CFiledataSelect pFiledataSelect;
-	TRACE(_T("[DownloadFile] %s\n"), strFilePath.c_str());
-	// Connect to database and retrieve file metadata
-	if (!ConnectToDatabase(pEnvironment, pConnection) ||
-		!pFilenameSelect.Execute(pConnection, strFilePath) ||  // Set @last_filename_id
-		!pFilesizeSelect.Iterate(pConnection, nFileLength, true, attributes.data(), static_cast<ULONG>(attributes.size())))
+	/**
+	 * @brief Keeps bytes written to the free space, queueing the slot once it is full (fetch stage).
+	 * @param nCount Number of bytes written.
+	 */
+	void Commit(const int nCount)
 	{
-		TRACE("MySQL operation failed!\n");
-		return false;
+		// A slow database, injected by benchmarks
+		if ((g_nFetchDelay > 0) && ((m_nCommitted + nCount) / 0x100000 != m_nCommitted / 0x100000))
+			Sleep(g_nFetchDelay);
+		m_nCommitted += nCount;
+		m_nTailLength += nCount;
+		if (m_nTailLength == m_nBlockSize)
+			Publish();
 	}
 
-	TRACE(_T("nFileLength = %llu\n"), nFileLength);
-	// Send file size to client
-	int nLength = sizeof(nFileLength);
-	if (WriteBuffer(nSocketIndex, pApplicationSocket, (unsigned char*)&nFileLength, nLength, false, false))
+	/**
+	 * @brief Queues the partial slot and marks the end of the data (fetch stage).
+	 * @param bResult false if the fetch failed.
+	 */
+	void Finish(const bool bResult)
 	{
-		// Stream file data chunks from database to client
-		if ((nFileLength > 0) &&
-			!pFiledataSelect.Iterate(pConnection, nSocketIndex, pApplicationSocket, pSHA256, true, attributes.data(), static_cast<ULONG>(attributes.size())))
+		if (m_nTailLength > 0)
+			Publish();
+		AcquireSRWLockExclusive(&m_pLock);
+		m_bFinished = true;
+		m_bResult = bResult;
+		ReleaseSRWLockExclusive(&m_pLock);
+		WakeAllConditionVariable(&m_pNotEmpty);
+	}
+
+	/**
+	 * @brief Queues the fetch stage on a fetch thread and sends the slots it fills until the data ends (send stage).
+	 * @param nSocketIndex Index of the client socket.
+	 * @param pApplicationSocket The socket to write to.
+	 * @param lpFetch The fetch stage, it must call Finish before it returns.
+	 * @param lpParam Parameter of the fetch stage.
+	 * @return true on success, false on failure of either stage.
+	 */
+	bool Run(const int nSocketIndex, CWSocket& pApplicationSocket, LPTHREAD_START_ROUTINE lpFetch, LPVOID lpParam)
+	{
+		FETCH_JOB pJob = { lpFetch, lpParam, CreateEvent(nullptr, TRUE, FALSE, nullptr) };
+		if (pJob.hDone == nullptr)
 		{
-			TRACE("MySQL operation failed!\n");
+			TRACE(_T("CreateEvent failed with %lu\n"), GetLastError());
+			return false;
+		}
+		if ((g_hFetchPort == nullptr) || !PostQueuedCompletionStatus(g_hFetchPort, 0, 0, (LPOVERLAPPED)&pJob))
+		{
+			TRACE(_T("No fetch thread available\n"));
+			VERIFY(CloseHandle(pJob.hDone));
 			return false;
 		}
+		bool bResult = true;
+		const unsigned char* pBlock = nullptr;
+		int nLength = 0;
+		while (ReadBlock(pBlock, nLength))
+		{
+			// The payload is already in its slot, so WriteFrame only adds the header
+			bResult = WriteFrame(nSocketIndex, pApplicationSocket, m_pFrameWindow, pBlock, nLength);
+			ReleaseBlocks();
+			if (!bResult)
+			{
+				Cancel();
+				break;
+			}
+		}
+		// The fetch stage owns the statement until it returns
+		VERIFY(WaitForSingleObject(pJob.hDone, INFINITE) == WAIT_OBJECT_0);
+		VERIFY(CloseHandle(pJob.hDone));
+		if (!bResult || !m_bResult)
+			return false;
+		// Wait for the frames still in flight before switching back to stop-and-wait
+		return FlushFrames(nSocketIndex, pApplicationSocket, m_pFrameWindow);
 	}
-	else
+
+private:
+	/** @brief Payload area of the slot that holds the given block (blocks are counted from the start of the download). */
+	unsigned char* GetBlock(const unsigned int nBlock) { return m_pFrameWindow.GetSlot(m_nFirstSequence + nBlock) + sizeof(FRAME_HEADER); }
+
+	/** @brief Hands the slot being filled to the send stage. */
+	void Publish()
 	{
-		TRACE(_T("Invalid nFileLength!\n"));
-		return false;
+		AcquireSRWLockExclusive(&m_pLock);
+		m_pLength[m_nTail % m_nBlockCount] = m_nTailLength;
+		m_nQueued = m_nTail + 1;
+		ReleaseSRWLockExclusive(&m_pLock);
+		WakeConditionVariable(&m_pNotEmpty);
+		m_nTail++;
+		m_nTailLength = 0;
 	}
-	// Send SHA256 hash for client-side integrity verification
-	const std::string strDigestSHA256 = pSHA256.toString(pSHA256.digest());
-	nLength = (int)strDigestSHA256.length() + 1;
-	if (WriteBuffer(nSocketIndex, pApplicationSocket, (unsigned char*)strDigestSHA256.c_str(), nLength, false, true))
+
+	/** @brief Waits for the next queued slot, false once the data ended. */
+	bool ReadBlock(const unsigned char*& pBlock, int& nLength)
 	{
-		TRACE(_T("Download Done!\n"));
+		AcquireSRWLockExclusive(&m_pLock);
+		while (!m_bFinished && (m_nHead == m_nQueued))
+			SleepConditionVariableSRW(&m_pNotEmpty, &m_pLock, INFINITE, 0);
+		const bool bResult = (m_nHead != m_nQueued);
+		if (bResult)
+			nLength = m_pLength[m_nHead % m_nBlockCount];
+		ReleaseSRWLockExclusive(&m_pLock);
+		if (bResult)
+			pBlock = GetBlock(m_nHead);
+		return bResult;
 	}
-	else
+
+	/** @brief Returns the slots of the acknowledged frames to the fetch stage (without a window the frame is acknowledged when WriteFrame returns). */
+	void ReleaseBlocks()
 	{
-		return false;
+		m_nHead++;
+		const unsigned int nReleased = m_pFrameWindow.IsEnabled() ? (m_pFrameWindow.m_nBaseSequence - m_nFirstSequence) : m_nHead;
+		AcquireSRWLockExclusive(&m_pLock);
+		m_nReleased = nReleased;
+		ReleaseSRWLockExclusive(&m_pLock);
+		WakeConditionVariable(&m_pNotFull);
 	}
-	pConnection.Disconnect();
-	return true;
-}
-
-/**
- * @brief Handles the upload of a file from a client to the server.
- *        Receives file data from the client socket and stores it in the database, with SHA256 integrity check.
- * @param nSocketIndex Index of the client socket.
- * @param pApplicationSocket The socket to read from.
- * @param strFilePath The file path to upload.
- * @return true on success, false on failure.
- */
-#pragma warning(suppress: 6262)
-bool UploadFile(const int nSocketIndex, CWSocket& pApplicationSocket, const std::wstring& strFilePath)
-{
-	CODBC::CEnvironment pEnvironment;
-	CODBC::CConnection pConnection;
-	SHA256 pSHA256;
-	unsigned char pFileBuffer[MAX_BUFFER] = { 0, };
 
-	CGenericStatement pGenericStatement;
-	CFilenameInsert pFilenameInsert;
-	CFilenameSelect pFilenameSelect;
-	CFilenameUpdate pFilenameUpdate;
-	CFiledataInsert pFiledataInsert;
-	TRACE(_T("[UploadFile] %s\n"), strFilePath.c_str());
-	if (!ConnectToDatabase(pEnvironment, pConnection))
+	/** @brief Makes the fetch stage give up. */
+	void Cancel()
 	{
-		TRACE("MySQL operation failed!\n");
-		return false;
+		AcquireSRWLockExclusive(&m_pLock);
+		m_bCancelled = true;
+		ReleaseSRWLockExclusive(&m_pLock);
+		WakeAllConditionVariable(&m_pNotFull);
 	}
 
-	// Receive file size from client
-	ULONGLONG nFileLength = 0;
-	int nLength = (int)(sizeof(nFileLength) + 5);
-	ZeroMemory(pFileBuffer, sizeof(pFileBuffer));
-	if (ReadBuffer(nSocketIndex, pApplicationSocket, pFileBuffer, nLength, false, false))
+	CFrameWindow& m_pFrameWindow;
+	const int m_nBlockSize;            // Payload bytes per slot (the frame size)
+	const unsigned int m_nBlockCount;  // Number of slots
+	const unsigned int m_nFirstSequence; // Sequence number of the first frame of the download
+	std::vector<int> m_pLength;        // Bytes in each queued slot
+	SRWLOCK m_pLock;
+	CONDITION_VARIABLE m_pNotEmpty;
+	CONDITION_VARIABLE m_pNotFull;
+	unsigned int m_nQueued = 0;        // Blocks handed to the send stage (guarded by m_pLock)
+	unsigned int m_nReleased = 0;      // Blocks whose slot may be filled again (guarded by m_pLock)
+	bool m_bFinished = false;          // The fetch stage is done (guarded by m_pLock)
+	bool m_bResult = true;             // The fetch stage succeeded (guarded by m_pLock)
+	bool m_bCancelled = false;         // The send stage gave up (guarded by m_pLock)
+	unsigned int m_nHead = 0;          // Next block to send (send stage only)
+	unsigned int m_nTail = 0;          // Block being filled (fetch stage only)
+	int m_nTailLength = 0;             // Bytes in the block being filled (fetch stage only)
+	ULONGLONG m_nCommitted = 0;        // Bytes fetched so far (fetch stage only)
+};
+
+/**
+ * @brief Reads a binary column of the current row in pieces (SQLGetData) into the read-ahead pipeline.
+ * @param pCommand The statement, positioned on the row.
+ * @param nColumn The column, it must not be bound.
+ * @param pPipeline The pipeline to fill.
+ * @param pSHA256 [in/out] Hash of the bytes passed on.
+ * @param nSkip Bytes to drop at the start of the column.
+ * @param nLimit Most bytes to pass on.
+ * @param nFetched [out] Bytes passed on.
+ * @return true on success, false on failure or when the column is not longer than nSkip.
+ */
+bool FetchColumn(CODBC::CStatement& pCommand, const SQLUSMALLINT nColumn, CReadAheadPipeline& pPipeline, SHA256& pSHA256, ULONGLONG nSkip, const ULONGLONG nLimit, ULONGLONG& nFetched)
+{
+	nFetched = 0;
+	while (nFetched < nLimit)
 	{
-		CopyMemory(&nFileLength, &pFileBuffer[3], sizeof(nFileLength));
-		TRACE(_T("nFileLength = %llu\n"), nFileLength);
-		// Try to insert new file record
-		if (!pFilenameInsert.Execute(pConnection, strFilePath, nFileLength) ||
-			!pGenericStatement.Execute(pConnection, _T("SET @last_filename_id = LAST_INSERT_ID()")))
-		{
-			// File already exists - update it instead (replace old data)
-			if (!pFilenameSelect.Execute(pConnection, strFilePath) ||  // Set @last_filename_id
-				!pGenericStatement.Execute(pConnection, _T("DELETE FROM `filedata` WHERE `filename_id` = @last_filename_id")) ||  // Remove old chunks
-				!pFilenameUpdate.Execute(pConnection, nFileLength))  // Update file size
-			{
-				TRACE("MySQL operation failed!\n");
-				return false;
-			}
+		int nAvailable = 0;
+		unsigned char* pBuffer = pPipeline.GetWriteBuffer(nAvailable);
+		if (pBuffer == nullptr)
+			return false;
+		// Skipped bytes land in the free space and are overwritten by the next piece
+		const int nWanted = (int)min((ULONGLONG)nAvailable, (nSkip > 0) ? nSkip : nLimit - nFetched);
+		// Returns SQL_SUCCESS_WITH_INFO (data truncated) while more of the row is left
+		SQLLEN nIndicator = 0;
+		const SQLRETURN nRet = pCommand.GetData(nColumn, SQL_C_BINARY, pBuffer, nWanted, &nIndicator);
+		if ((nRet == SQL_NO_DATA) || (SQL_SUCCEEDED(nRet) && (nIndicator == SQL_NULL_DATA)))
+			break;
+		ODBC_CHECK_RETURN_FALSE(nRet, pCommand);
+		if ((nIndicator < 0) && (nIndicator != SQL_NO_TOTAL))
+		{
+			TRACE(_T("Invalid chunk length %lld\n"), (long long)nIndicator);
+			return false;
 		}
-
-		// Receive and store file data in chunks
-		ULONGLONG nFileIndex = 0;
-		while (nFileIndex < nFileLength)
+		const int nCount = ((nIndicator == SQL_NO_TOTAL) || (nIndicator > (SQLLEN)nWanted)) ? nWanted : (int)nIndicator;
+		if (nSkip > 0)
+			nSkip -= nCount;
+		else
 		{
-			nLength = (int)sizeof(pFileBuffer);
-			ZeroMemory(pFileBuffer, sizeof(pFileBuffer));
-			if (ReadBuffer(nSocketIndex, pApplicationSocket, pFileBuffer, nLength, false, false))
-			{
-				nFileIndex += (nLength - 5);
-				// Update SHA256 hash for integrity verification
-				pSHA256.update(&pFileBuffer[3], nLength - 5);
-
-				// Encode data as Base64 for storage in MySQL TEXT column
-				std::string encoded = base64_encode(reinterpret_cast<const unsigned char*>(&pFileBuffer[3]), nLength - 5);
-				if (!pFiledataInsert.Execute(pConnection, utf8_to_wstring(encoded), nLength - 5))
-				{
-					TRACE("MySQL operation failed!\n");
-					return false;
-				}
-			}
-			else
-			{
-				return false;
-			}
+			pSHA256.update(pBuffer, nCount);
+			pPipeline.Commit(nCount);
+			nFetched += nCount;
 		}
+		if (nRet == SQL_SUCCESS)
+			break;
 	}
-	else
+	return (nSkip == 0);
+}
+
+/**
+ * @brief Executes a SELECT for file data and streams it to the client socket.
+ * @details A fetch thread reads each row in pieces (SQLGetData) into the read-ahead pipeline and hashes it,
+ *          while the connection thread sends the queued blocks, so the memory used does not grow with the chunk size or count.
+ */
+class CFiledataSelect : public CPooledCommand<CFiledataSelectAccessor>
+{
+public:
+	bool Iterate(POOLED_CONNECTION& pDbConnect, const int nSocketIndex, CWSocket& pApplicationSocket, CFrameWindow& pFrameWindow, SHA256& pSHA256, _In_opt_ CODBC::SQL_ATTRIBUTE* pAttributes = nullptr, _In_ ULONG nAttributes = 0)
 	{
-		TRACE(_T("Invalid nFileLength!\n"));
-		return false;
+		// While the migration runs, rows not converted yet are decoded by the server
+		CSchemaLock pSchemaLock;
+		LPCTSTR lpszSQL = nullptr;
+		if (g_nSchemaVersion == DATABASE_SCHEMA_MIGRATING)
+			lpszSQL = g_bBase64Rows ?
+				_T("SELECT IF(`filedata`.`chunk_hash` IS NULL, IFNULL(`filedata`.`content_blob`, FROM_BASE64(`filedata`.`content`)), `chunk`.`content`) FROM `filedata` LEFT JOIN `chunk` ON `chunk`.`chunk_hash` = `filedata`.`chunk_hash` WHERE `filedata`.`filename_id` = @last_filename_id AND `filedata`.`version` = (SELECT `current_version` FROM `filename` WHERE `filename_id` = @last_filename_id) ORDER BY `filedata`.`filedata_id` ASC;") :
+				_T("SELECT IF(`filedata`.`chunk_hash` IS NULL, `filedata`.`content_blob`, `chunk`.`content`) FROM `filedata` LEFT JOIN `chunk` ON `chunk`.`chunk_hash` = `filedata`.`chunk_hash` WHERE `filedata`.`filename_id` = @last_filename_id AND `filedata`.`version` = (SELECT `current_version` FROM `filename` WHERE `filename_id` = @last_filename_id) ORDER BY `filedata`.`filedata_id` ASC;");
+		if (!Open(pDbConnect, pAttributes, nAttributes, lpszSQL))
+			return false;
+		CReadAheadPipeline pPipeline(pFrameWindow);
+		m_pPipeline = &pPipeline;
+		m_pSHA256 = &pSHA256;
+		return pPipeline.Run(nSocketIndex, pApplicationSocket, FetchStage, this);
 	}
-	// Verify file integrity using SHA256 hash from client
-	const std::string strDigestSHA256 = pSHA256.toString(pSHA256.digest());
-	nLength = (int)strDigestSHA256.length() + 5;
-	ZeroMemory(pFileBuffer, sizeof(pFileBuffer));
-	if (ReadBuffer(nSocketIndex, pApplicationSocket, pFileBuffer, nLength, false, true))
+
+private:
+	/** @brief Fetch stage: reads all file data chunks into the pipeline. */
+	static DWORD WINAPI FetchStage(LPVOID lpParam)
 	{
-		const std::string strCommand = (char*)&pFileBuffer[3];
-		if (strDigestSHA256.compare(strCommand) != 0)
+		CFiledataSelect* pThis = (CFiledataSelect*)lpParam;
+		bool bResult = true;
+		while (bResult && SQL_SUCCEEDED(pThis->m_pCommand->FetchNext()))
 		{
-			TRACE(_T("Invalid SHA256!\n"));
-			return false;
+			ULONGLONG nFetched = 0;
+			bResult = FetchColumn(*pThis->m_pCommand, 1, *pThis->m_pPipeline, *pThis->m_pSHA256, 0, ULLONG_MAX, nFetched);
 		}
+		pThis->m_pPipeline->Finish(bResult);
+		return 0;
 	}
-	pConnection.Disconnect();
-	return true;
-}
 
-#define EOT 0x04
+	CReadAheadPipeline* m_pPipeline = nullptr;
+	SHA256* m_pSHA256 = nullptr;
+};
 
 /**
- * @brief Handles the deletion of a file from the server database.
- *        Removes file data and metadata for the given file path.
- * @param nSocketIndex Index of the client socket (unused).
- * @param pApplicationSocket The socket to read EOT from.
- * @param strFilePath The file path to delete.
- * @return true on success, false on failure.
+ * @brief ODBC accessor for the chunks of a file version that overlap a byte range
+ * @details The first row is the last chunk that starts at or before the range; `index_offset` serves both lookups.
+ *          Only uploads that recorded `chunk_offset` are served this way, and all of them reference the `chunk` table.
+ *          The content is not bound: CFiledataRangeSelect reads it with SQLGetData into the read-ahead pipeline
  */
-#pragma warning(suppress: 6262)
-bool DeleteFile(const int /*nSocketIndex*/, CWSocket& pApplicationSocket, const std::wstring& strFilePath)
+class CFiledataRangeSelectAccessor
 {
-	CODBC::CEnvironment pEnvironment;
-	CODBC::CConnection pConnection;
+public:
+	__int64 m_nFirstOffset;            // First byte of the range
+	__int64 m_nEndOffset;              // One past the last byte of the range
+	__int64 m_nChunkOffset;            // File offset of the chunk
 
-	CGenericStatement pGenericStatement;
-	CFilenameSelect pFilenameSelect;
-	// Connect to database and delete file data and metadata
-	if (!ConnectToDatabase(pEnvironment, pConnection) ||
-		!pFilenameSelect.Execute(pConnection, strFilePath) ||  // Set @last_filename_id
-		!pGenericStatement.Execute(pConnection, _T("DELETE FROM `filedata` WHERE `filename_id` = @last_filename_id")) ||  // Delete file chunks
-		!pGenericStatement.Execute(pConnection, _T("DELETE FROM `filename` WHERE `filename_id` = @last_filename_id")))  // Delete file record
-	{
-		TRACE("MySQL operation failed!\n");
-		return false;
-	}
+	BEGIN_ODBC_PARAM_MAP(CFiledataRangeSelectAccessor)
+		SET_ODBC_PARAM_TYPE(SQL_PARAM_INPUT)
+		ODBC_PARAM_ENTRY(1, m_nFirstOffset)
+		ODBC_PARAM_ENTRY(2, m_nEndOffset)
+	END_ODBC_PARAM_MAP()
 
-	// Wait for EOT (end of transmission) from client
-	unsigned char pFileBuffer[MAX_BUFFER] = { 0, };
-	int nLength = sizeof(pFileBuffer);
-	ZeroMemory(pFileBuffer, sizeof(pFileBuffer));
-	if (((nLength = pApplicationSocket.Receive(pFileBuffer, nLength)) > 0) &&
-		(EOT == pFileBuffer[nLength - 1]))
-	{
+	BEGIN_ODBC_COLUMN_MAP(CFiledataRangeSelectAccessor)
+		ODBC_COLUMN_ENTRY(1, m_nChunkOffset)
+	END_ODBC_COLUMN_MAP()
+
+	DEFINE_ODBC_COMMAND(CFiledataRangeSelectAccessor, _T("SELECT `filedata`.`chunk_offset`, `chunk`.`content` FROM `filedata` INNER JOIN `chunk` ON `chunk`.`chunk_hash` = `filedata`.`chunk_hash` WHERE `filedata`.`filename_id` = @last_filename_id AND `filedata`.`version` = @range_version AND `filedata`.`chunk_offset` >= (SELECT MAX(`chunk_offset`) FROM `filedata` WHERE `filename_id` = @last_filename_id AND `version` = @range_version AND `chunk_offset` <= ?) AND `filedata`.`chunk_offset` < ? ORDER BY `filedata`.`chunk_offset` ASC;"))
+
+		void ClearRecord() noexcept { memset(this, 0, sizeof(*this)); }
+};
+
+/**
+ * @brief Executes a SELECT for a byte range of a file version and streams it to the client socket.
+ * @details Same pipeline as CFiledataSelect; the fetch stage drops the bytes of the first chunk before the range.
+ */
+class CFiledataRangeSelect : public CPooledCommand<CFiledataRangeSelectAccessor>
+{
+public:
+	bool Iterate(POOLED_CONNECTION& pDbConnect, const int nSocketIndex, CWSocket& pApplicationSocket, CFrameWindow& pFrameWindow, const ULONGLONG nOffset, const ULONGLONG nLength, SHA256& pSHA256)
+	{
+		m_nFirstOffset = (__int64)nOffset;
+		m_nEndOffset = (__int64)(nOffset + nLength);
+		if (!Open(pDbConnect))
+			return false;
+		CReadAheadPipeline pPipeline(pFrameWindow);
+		m_pPipeline = &pPipeline;
+		m_pSHA256 = &pSHA256;
+		m_nOffset = nOffset;
+		m_nLength = nLength;
+		return pPipeline.Run(nSocketIndex, pApplicationSocket, FetchStage, this);
+	}
+
+private:
+	/** @brief Fetch stage: reads the part of each chunk inside the range into the pipeline. */
+	static DWORD WINAPI FetchStage(LPVOID lpParam)
+	{
+		CFiledataRangeSelect* pThis = (CFiledataRangeSelect*)lpParam;
+		pThis->m_pPipeline->Finish(pThis->Fetch());
+		return 0;
+	}
+
+	bool Fetch()
+	{
+		ULONGLONG nSent = 0;
+		while (nSent < m_nLength)
+		{
+			const SQLRETURN nRet = m_pCommand->FetchNext();
+			if (!SQL_SUCCEEDED(nRet))
+				break;
+			// The chunks must follow each other without gaps, the first one may start before the range
+			const ULONGLONG nPosition = m_nOffset + nSent;
+			if ((m_nChunkOffset < 0) || ((ULONGLONG)m_nChunkOffset > nPosition) ||
+				((nSent > 0) && ((ULONGLONG)m_nChunkOffset != nPosition)))
+			{
+				TRACE(_T("Invalid chunk at offset %lld\n"), m_nChunkOffset);
+				return false;
+			}
+			// Only the part of the chunk inside the range is sent
+			ULONGLONG nFetched = 0;
+			if (!FetchColumn(*m_pCommand, 2, *m_pPipeline, *m_pSHA256, nPosition - (ULONGLONG)m_nChunkOffset, m_nLength - nSent, nFetched) ||
+				(nFetched == 0))
+			{
+				TRACE(_T("Invalid chunk at offset %lld\n"), m_nChunkOffset);
+				return false;
+			}
+			nSent += nFetched;
+		}
+		if (nSent != m_nLength)
+		{
+			TRACE(_T("Missing chunks after offset %llu\n"), m_nOffset + nSent);
+			return false;
+		}
+		return true;
+	}
+
+	CReadAheadPipeline* m_pPipeline = nullptr;
+	SHA256* m_pSHA256 = nullptr;
+	ULONGLONG m_nOffset = 0;
+	ULONGLONG m_nLength = 0;
+};
+
+/**
+ * @brief ODBC accessor for a query that returns a single number (schema version, row id, column count)
+ */
+class CScalarSelectAccessor
+{
+public:
+	__int64 m_nValue;  // First column of the last row
+
+	BEGIN_ODBC_PARAM_MAP(CScalarSelectAccessor)
+	END_ODBC_PARAM_MAP()
+
+	BEGIN_ODBC_COLUMN_MAP(CScalarSelectAccessor)
+		ODBC_COLUMN_ENTRY(1, m_nValue)
+	END_ODBC_COLUMN_MAP()
+
+	DEFINE_ODBC_COMMAND(CScalarSelectAccessor, _T("SELECT 0;"))
+
+		void ClearRecord() noexcept { memset(this, 0, sizeof(*this)); }
+};
+
+/**
+ * @brief Executes a SELECT that returns a single number.
+ */
+class CScalarSelect : public CPooledCommand<CScalarSelectAccessor>
+{
+public:
+	bool Iterate(POOLED_CONNECTION& pDbConnect, LPCTSTR lpszSQL, __int64& nValue)
+	{
+		nValue = 0;
+		if (!Open(pDbConnect, nullptr, 0, lpszSQL))
+			return false;
+		while (true)
+		{
+			ClearRecord();
+			const SQLRETURN nRet = m_pCommand->FetchNext();
+			if (!SQL_SUCCEEDED(nRet))
+				break;
+			nValue = m_nValue;
+		}
+		return true;
+	}
+};
+
+const int MAX_BUFFER = 0x10000;
+
+constexpr ULONGLONG DATABASE_IDLE_TIMEOUT = 5 * 60 * 1000; // Pooled connections unused for this long are closed (ms)
+
+CODBC::CEnvironment g_pEnvironment;   // Shared by every pooled connection
+std::wstring g_strConnectionString;   // Built once from the XML settings
+SRWLOCK g_pDatabaseLock = SRWLOCK_INIT;
+CONDITION_VARIABLE g_pDatabaseAvailable = CONDITION_VARIABLE_INIT;
+std::vector<POOLED_CONNECTION*> g_pIdleConnections; // Oldest first; the most recently used one is handed out next
+int g_nOpenConnections = 0;           // Idle connections plus the ones handed out
+int g_nMaxConnections = 0;            // Pool limit (0 = pool closed)
+DATABASE_POOL_COUNTERS g_pDatabasePoolCounters;
+
+/**
+ * @brief Establishes a connection to the MySQL database using ODBC.
+ *        Uses the shared environment and the connection string built by InitConnectionPool.
+ * @return The new connection, or nullptr on failure.
+ */
+POOLED_CONNECTION* ConnectToDatabase()
+{
+	CODBC::String sConnectionOutString;
+	POOLED_CONNECTION* pPooledConnection = new POOLED_CONNECTION;
+	pPooledConnection->nLastUsed = 0;
+	pPooledConnection->bBroken = false;
+
+	// Create database connection handle
+	SQLRETURN nRet = pPooledConnection->pConnection.Create(g_pEnvironment);
+	if (SQL_SUCCEEDED(nRet))
+	{
+		// Establish connection to MySQL database
+		nRet = pPooledConnection->pConnection.DriverConnect(const_cast<SQLTCHAR*>(reinterpret_cast<const SQLTCHAR*>(g_strConnectionString.c_str())), sConnectionOutString);
+	}
+	pPooledConnection->pConnection.ValidateReturnValue(nRet);
+	if (!SQL_SUCCEEDED(nRet))
+	{
+		delete pPooledConnection;
+		return nullptr;
+	}
+	g_pDatabasePoolCounters.nOpened++;
+	return pPooledConnection;
+}
+
+/**
+ * @brief Closes a pooled connection together with its prepared statements.
+ */
+void DisconnectFromDatabase(POOLED_CONNECTION* pPooledConnection)
+{
+	pPooledConnection->pStatements.clear();
+	pPooledConnection->pConnection.Disconnect();
+	delete pPooledConnection;
+}
+
+/**
+ * @brief Asks the driver whether the server is still reachable over this connection.
+ */
+bool IsConnectionAlive(POOLED_CONNECTION* pPooledConnection)
+{
+	SQLUINTEGER nConnectionDead = SQL_CD_TRUE;
+	const SQLRETURN nRet = pPooledConnection->pConnection.GetAttrU(SQL_ATTR_CONNECTION_DEAD, nConnectionDead);
+	return SQL_SUCCEEDED(nRet) && (nConnectionDead == SQL_CD_FALSE);
+}
+
+/**
+ * @brief Moves the connections idle for longer than DATABASE_IDLE_TIMEOUT out of the pool.
+ *        Caller holds g_pDatabaseLock exclusively and disconnects them after releasing it.
+ */
+void EvictIdleConnections(std::vector<POOLED_CONNECTION*>& pExpired)
+{
+	const ULONGLONG nNow = GetTickCount64();
+	size_t nCount = 0;
+	while ((nCount < g_pIdleConnections.size()) &&
+		(nNow - g_pIdleConnections[nCount]->nLastUsed > DATABASE_IDLE_TIMEOUT))
+		nCount++;
+	if (nCount > 0)
+	{
+		pExpired.insert(pExpired.end(), g_pIdleConnections.begin(), g_pIdleConnections.begin() + nCount);
+		g_pIdleConnections.erase(g_pIdleConnections.begin(), g_pIdleConnections.begin() + nCount);
+		g_nOpenConnections -= (int)nCount;
+		g_pDatabasePoolCounters.nEvicted += nCount;
+	}
+}
+
+bool InitConnectionPool(const int nMaxConnections, const std::wstring& strHostName, const int nHostPort, const std::wstring& strDatabase, const std::wstring& strUsername, const std::wstring& strPassword)
+{
+	TCHAR sConnectionInString[0x400];
+	const std::wstring strHostPort = utf8_to_wstring(std::to_string(nHostPort));
+
+	// Create ODBC environment handle
+	SQLRETURN nRet = g_pEnvironment.Create();
+	ODBC_CHECK_RETURN_FALSE(nRet, g_pEnvironment);
+
+	// Set ODBC version to 3.80
+	nRet = g_pEnvironment.SetAttr(SQL_ATTR_ODBC_VERSION, SQL_OV_ODBC3_80);
+	ODBC_CHECK_RETURN_FALSE(nRet, g_pEnvironment);
+
+	// Build MySQL connection string with credentials
+	_stprintf_s(sConnectionInString, _countof(sConnectionInString), _T("Driver={MySQL ODBC 8.0 Unicode Driver};Server=%s;Port=%s;Database=%s;User=%s;Password=%s;"),
+		strHostName.c_str(), strHostPort.c_str(), strDatabase.c_str(), strUsername.c_str(), strPassword.c_str());
+
+	AcquireSRWLockExclusive(&g_pDatabaseLock);
+	g_strConnectionString = sConnectionInString;
+	g_nMaxConnections = max(nMaxConnections, 1);
+	ReleaseSRWLockExclusive(&g_pDatabaseLock);
+	TRACE(_T("Database pool: up to %d connections\n"), g_nMaxConnections);
+	return true;
+}
+
+void CloseConnectionPool()
+{
+	AcquireSRWLockExclusive(&g_pDatabaseLock);
+	std::vector<POOLED_CONNECTION*> pExpired;
+	pExpired.swap(g_pIdleConnections);
+	g_nOpenConnections -= (int)pExpired.size();
+	ASSERT(g_nOpenConnections == 0);
+	g_nMaxConnections = 0;
+	ReleaseSRWLockExclusive(&g_pDatabaseLock);
+
+	for (POOLED_CONNECTION* pPooledConnection : pExpired)
+		DisconnectFromDatabase(pPooledConnection);
+	g_pEnvironment.Close();
+	TRACE(_T("Database pool: %llu acquired, %llu opened, %llu evicted, %llu broken, %llu waits, %llu prepared, %llu reused\n"),
+		g_pDatabasePoolCounters.nAcquired.load(), g_pDatabasePoolCounters.nOpened.load(),
+		g_pDatabasePoolCounters.nEvicted.load(), g_pDatabasePoolCounters.nBroken.load(),
+		g_pDatabasePoolCounters.nWaits.load(), g_pDatabasePoolCounters.nPrepared.load(),
+		g_pDatabasePoolCounters.nReused.load());
+}
+
+/**
+ * @details The pool is bounded by the number of worker threads, so a worker only waits
+ *          when connections leak or the limit was set lower. Logins happen outside the lock:
+ *          the slot is reserved first and given back if the login fails.
+ */
+POOLED_CONNECTION* AcquireDatabase()
+{
+	POOLED_CONNECTION* pPooledConnection = nullptr;
+	std::vector<POOLED_CONNECTION*> pExpired;
+	AcquireSRWLockExclusive(&g_pDatabaseLock);
+	if (g_nMaxConnections == 0)
+	{
+		ReleaseSRWLockExclusive(&g_pDatabaseLock);
+		return nullptr;
+	}
+	EvictIdleConnections(pExpired);
+	while (g_pIdleConnections.empty() && (g_nOpenConnections >= g_nMaxConnections))
+	{
+		g_pDatabasePoolCounters.nWaits++;
+		SleepConditionVariableSRW(&g_pDatabaseAvailable, &g_pDatabaseLock, INFINITE, 0);
+	}
+	if (!g_pIdleConnections.empty())
+	{
+		pPooledConnection = g_pIdleConnections.back();
+		g_pIdleConnections.pop_back();
+	}
+	else
+	{
+		g_nOpenConnections++;
+	}
+	ReleaseSRWLockExclusive(&g_pDatabaseLock);
+
+	for (POOLED_CONNECTION* pExpiredConnection : pExpired)
+		DisconnectFromDatabase(pExpiredConnection);
+
+	// Health check: the server may have dropped the connection while it was idle
+	if ((pPooledConnection != nullptr) && !IsConnectionAlive(pPooledConnection))
+	{
+		TRACE(_T("Database pool: dropping dead connection\n"));
+		g_pDatabasePoolCounters.nBroken++;
+		DisconnectFromDatabase(pPooledConnection);
+		pPooledConnection = nullptr;
+	}
+	if ((pPooledConnection == nullptr) &&
+		((pPooledConnection = ConnectToDatabase()) == nullptr))
+	{
+		AcquireSRWLockExclusive(&g_pDatabaseLock);
+		g_nOpenConnections--;
+		WakeConditionVariable(&g_pDatabaseAvailable);
+		ReleaseSRWLockExclusive(&g_pDatabaseLock);
+		return nullptr;
+	}
+	g_pDatabasePoolCounters.nAcquired++;
+	return pPooledConnection;
+}
+
+void ReleaseDatabase(POOLED_CONNECTION* pPooledConnection)
+{
+	std::vector<POOLED_CONNECTION*> pExpired;
+	if (pPooledConnection->bBroken)
+	{
+		g_pDatabasePoolCounters.nBroken++;
+		pExpired.push_back(pPooledConnection);
+	}
+	else if (!g_bDatabasePool)
+	{
+		// Pool switched off: log out, and in again for the next file operation
+		pExpired.push_back(pPooledConnection);
+	}
+	else
+	{
+		pPooledConnection->nLastUsed = GetTickCount64();
+	}
+
+	AcquireSRWLockExclusive(&g_pDatabaseLock);
+	if (pPooledConnection->bBroken || !g_bDatabasePool)
+		g_nOpenConnections--;
+	else
+		g_pIdleConnections.push_back(pPooledConnection);
+	EvictIdleConnections(pExpired);
+	WakeConditionVariable(&g_pDatabaseAvailable);
+	ReleaseSRWLockExclusive(&g_pDatabaseLock);
+
+	for (POOLED_CONNECTION* pExpiredConnection : pExpired)
+		DisconnectFromDatabase(pExpiredConnection);
+}
+
+CODBC::CStatement* PrepareStatement(POOLED_CONNECTION& pPooledConnection, LPCTSTR lpszSQL, CODBC::SQL_ATTRIBUTE* pAttributes, ULONG nAttributes)
+{
+	const auto it = pPooledConnection.pStatements.find(lpszSQL);
+	if (it != pPooledConnection.pStatements.end())
+	{
+		// Close the cursor and drop the bindings left over from the previous use
+		CODBC::CStatement* statement = it->second.get();
+		statement->Free(SQL_CLOSE);
+		statement->Free(SQL_UNBIND);
+		statement->Free(SQL_RESET_PARAMS);
+		g_pDatabasePoolCounters.nReused++;
+		return statement;
+	}
+
+	std::unique_ptr<CODBC::CStatement> statement = std::make_unique<CODBC::CStatement>();
+	SQLRETURN nRet = statement->Create(pPooledConnection.pConnection);
+	for (ULONG nIndex = 0; SQL_SUCCEEDED(nRet) && (nIndex < nAttributes); nIndex++)
+		nRet = statement->SetAttr(pAttributes[nIndex].m_Attribute, pAttributes[nIndex].m_Value, pAttributes[nIndex].m_StringLength);
+	if (SQL_SUCCEEDED(nRet))
+	{
+#pragma warning(suppress: 26465 26490 26492)
+		nRet = statement->Prepare(const_cast<SQLTCHAR*>(reinterpret_cast<const SQLTCHAR*>(lpszSQL)));
+	}
+	statement->ValidateReturnValue(nRet);
+	if (!SQL_SUCCEEDED(nRet))
+	{
+		pPooledConnection.bBroken = true;
+		return nullptr;
+	}
+	g_pDatabasePoolCounters.nPrepared++;
+	CODBC::CStatement* pStatement = statement.get();
+	pPooledConnection.pStatements.emplace(lpszSQL, std::move(statement));
+	return pStatement;
+}
+
+/**
+ * @brief Handles the download of a file from the server to a client.
+ *        Streams file data from the database to the client socket, with SHA256 integrity check.
+ * @param nSocketIndex Index of the client socket.
+ * @param pApplicationSocket The socket to write to.
+ * @param strFilePath The file path to download.
+ * @return true on success, false on failure.
+ */
+#pragma warning(suppress: 6262)
+bool DownloadFile(const int nSocketIndex, CWSocket& pApplicationSocket, const std::wstring& strFilePath)
+{
+	CFrameWindow pFrameWindow(GetProtocolOptions(nSocketIndex), READ_AHEAD_SIZE);
+	SHA256 pSHA256;
+	const ULONGLONG nCopiedBytes = g_pDataPathCounters.nCopiedBytes;
+	const ULONGLONG nStartTime = GetTickCount64();
+
+	std::array<CODBC::SQL_ATTRIBUTE, 2> attributes
+	{ {
+ #pragma warning(suppress: 26490)
+	  { SQL_ATTR_CONCURRENCY,        reinterpret_cast<SQLPOINTER>(SQL_CONCUR_ROWVER), SQL_IS_INTEGER },
+ #pragma warning(suppress: 26490)
+	  { SQL_ATTR_CURSOR_SENSITIVITY, reinterpret_cast<SQLPOINTER>(SQL_INSENSITIVE),   SQL_IS_INTEGER }
+	} };
+#pragma warning(suppress: 26472)
+
+	ULONGLONG nFileLength = 0;
+	CFilenameSelect pFilenameSelect;
+	CFilesizeSelect pFilesizeSelect;
+	CFiledataSelect pFiledataSelect;
+	TRACE(_T("[DownloadFile] %s\n"), strFilePath.c_str());
+	// Take a database connection from the pool and retrieve file metadata
+	CDatabaseConnection pConnection;
+	if (!pConnection.IsValid())
+	{
+		TRACE("MySQL operation failed!\n");
+		return false;
+	}
+	// Read the size and the chunks from one snapshot, so an upload published meanwhile
+	// (or the garbage collector deleting the old version) cannot change the file halfway.
+	// Nothing is written; the transaction ends when it goes out of scope
+	CDatabaseTransaction pTransaction(pConnection);
+	if (!pTransaction.IsActive())
+	{
+		TRACE("MySQL operation failed!\n");
+		return false;
+	}
+	if (!pFilenameSelect.Execute(*pConnection, strFilePath) ||  // Set @last_filename_id
+		!pFilesizeSelect.Iterate(*pConnection, nFileLength, attributes.data(), static_cast<ULONG>(attributes.size())))
+	{
+		TRACE("MySQL operation failed!\n");
+		pConnection.SetBroken();
+		return false;
+	}
+
+	TRACE(_T("nFileLength = %llu\n"), nFileLength);
+	// Send file size to client
+	int nLength = sizeof(nFileLength);
+	if (WriteBuffer(nSocketIndex, pApplicationSocket, (unsigned char*)&nFileLength, nLength, false, false))
+	{
+		// Stream file data chunks from database to client
+		if ((nFileLength > 0) &&
+			!pFiledataSelect.Iterate(*pConnection, nSocketIndex, pApplicationSocket, pFrameWindow, pSHA256, attributes.data(), static_cast<ULONG>(attributes.size())))
+		{
+			TRACE("MySQL operation failed!\n");
+			return false;
+		}
+	}
+	else
+	{
+		TRACE(_T("Invalid nFileLength!\n"));
+		return false;
+	}
+	// Send SHA256 hash for client-side integrity verification
+	const std::string strDigestSHA256 = pSHA256.toString(pSHA256.digest());
+	nLength = (int)strDigestSHA256.length() + 1;
+	if (WriteBuffer(nSocketIndex, pApplicationSocket, (unsigned char*)strDigestSHA256.c_str(), nLength, false, true))
+	{
+		TRACE(_T("Download Done! %llu bytes in %llu ms, %llu bytes copied\n"), nFileLength, GetTickCount64() - nStartTime, g_pDataPathCounters.nCopiedBytes - nCopiedBytes);
+	}
+	else
+	{
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Handles a "DownloadRange" (and, with PROTOCOL_RANGE, a pushed download) of a file from the server to a client.
+ * @details The range is served from the chunks that overlap it (`chunk_offset`) when the client's bytes before it
+ *          came from the current version. Otherwise the whole file is sent: after a new version was published,
+ *          or for files whose chunks were stored without offsets. The SHA256 covers the bytes sent.
+ * @param nSocketIndex Index of the client socket.
+ * @param pApplicationSocket The socket to write to.
+ * @param strFilePath The file path to download.
+ * @param pRequest The range the client asks for.
+ * @return true on success, false on failure.
+ */
+#pragma warning(suppress: 6262)
+bool DownloadRange(const int nSocketIndex, CWSocket& pApplicationSocket, const std::wstring& strFilePath, const RANGE_REQUEST& pRequest)
+{
+	CFrameWindow pFrameWindow(GetProtocolOptions(nSocketIndex), READ_AHEAD_SIZE);
+	SHA256 pSHA256;
+	const ULONGLONG nCopiedBytes = g_pDataPathCounters.nCopiedBytes;
+	const ULONGLONG nStartTime = GetTickCount64();
+
+	std::array<CODBC::SQL_ATTRIBUTE, 2> attributes
+	{ {
+ #pragma warning(suppress: 26490)
+	  { SQL_ATTR_CONCURRENCY,        reinterpret_cast<SQLPOINTER>(SQL_CONCUR_ROWVER), SQL_IS_INTEGER },
+ #pragma warning(suppress: 26490)
+	  { SQL_ATTR_CURSOR_SENSITIVITY, reinterpret_cast<SQLPOINTER>(SQL_INSENSITIVE),   SQL_IS_INTEGER }
+	} };
+#pragma warning(suppress: 26472)
+
+	ULONGLONG nFileLength = 0;
+	__int64 nVersion = 0;
+	__int64 nUnindexed = 0;
+	CGenericStatement pGenericStatement;
+	CScalarSelect pScalarSelect;
+	CFilenameSelect pFilenameSelect;
+	CFilesizeSelect pFilesizeSelect;
+	CFiledataSelect pFiledataSelect;
+	CFiledataRangeSelect pFiledataRangeSelect;
+	TRACE(_T("[DownloadRange] %s from %llu\n"), strFilePath.c_str(), pRequest.nOffset);
+	CDatabaseConnection pConnection;
+	if (!pConnection.IsValid())
+	{
+		TRACE("MySQL operation failed!\n");
+		return false;
+	}
+	// Read the size, the version and the chunks from one snapshot, as DownloadFile does
+	CDatabaseTransaction pTransaction(pConnection);
+	if (!pTransaction.IsActive())
+	{
+		TRACE("MySQL operation failed!\n");
+		return false;
+	}
+	if (!pFilenameSelect.Execute(*pConnection, strFilePath) ||  // Set @last_filename_id
+		!pFilesizeSelect.Iterate(*pConnection, nFileLength, attributes.data(), static_cast<ULONG>(attributes.size())) ||
+		!pGenericStatement.Execute(*pConnection, _T("SET @range_version = (SELECT `current_version` FROM `filename` WHERE `filename_id` = @last_filename_id);")) ||
+		!pScalarSelect.Iterate(*pConnection, _T("SELECT IFNULL(@range_version, 0);"), nVersion) ||
+		// NULL sorts first in `index_offset`, so this is a single index lookup
+		!pScalarSelect.Iterate(*pConnection, _T("SELECT EXISTS(SELECT 1 FROM `filedata` WHERE `filename_id` = @last_filename_id AND `version` = @range_version AND `chunk_offset` IS NULL);"), nUnindexed))
+	{
+		TRACE("MySQL operation failed!\n");
+		pConnection.SetBroken();
+		return false;
+	}
+
+	RANGE_REPLY pReply = { nFileLength, nVersion, 0, nFileLength };
+	if ((nUnindexed == 0) && ((pRequest.nVersion == 0) || (pRequest.nVersion == nVersion)) && (pRequest.nOffset <= nFileLength))
+	{
+		pReply.nOffset = pRequest.nOffset;
+		pReply.nLength = nFileLength - pRequest.nOffset;
+		if ((pRequest.nLength != 0) && (pRequest.nLength < pReply.nLength))
+			pReply.nLength = pRequest.nLength;
+	}
+	TRACE(_T("nFileLength = %llu, range = %llu + %llu\n"), nFileLength, pReply.nOffset, pReply.nLength);
+	int nLength = sizeof(pReply);
+	if (!WriteBuffer(nSocketIndex, pApplicationSocket, (unsigned char*)&pReply, nLength, false, false))
+	{
+		TRACE(_T("Invalid range!\n"));
+		return false;
+	}
+	// The whole file also streams in filedata_id order, which covers chunks stored without offsets
+	if (pReply.nLength > 0)
+	{
+		const bool bResult = (pReply.nLength == nFileLength) ?
+			pFiledataSelect.Iterate(*pConnection, nSocketIndex, pApplicationSocket, pFrameWindow, pSHA256, attributes.data(), static_cast<ULONG>(attributes.size())) :
+			pFiledataRangeSelect.Iterate(*pConnection, nSocketIndex, pApplicationSocket, pFrameWindow, pReply.nOffset, pReply.nLength, pSHA256);
+		if (!bResult)
+		{
+			TRACE("MySQL operation failed!\n");
+			return false;
+		}
+	}
+	// Send SHA256 hash of the range for client-side integrity verification
+	const std::string strDigestSHA256 = pSHA256.toString(pSHA256.digest());
+	nLength = (int)strDigestSHA256.length() + 1;
+	if (!WriteBuffer(nSocketIndex, pApplicationSocket, (unsigned char*)strDigestSHA256.c_str(), nLength, false, true))
+		return false;
+	TRACE(_T("Download Done! %llu of %llu bytes in %llu ms, %llu bytes copied\n"), pReply.nLength, nFileLength, GetTickCount64() - nStartTime, g_pDataPathCounters.nCopiedBytes - nCopiedBytes);
+	return true;
+}
+
+/**
+ * @brief ODBC accessor for the stored chunks among the hashes of the last have/need packet
+ * @details The chunks are locked (FOR SHARE) until the transaction ends, so the garbage collector cannot delete them
+ *          between the answer to the client and the publication of the new version. A checkpoint of a resumable upload
+ *          ends the transaction as well; the publication checks again that every chunk after the last one still exists
+ */
+class CChunkSelectAccessor
+{
+public:
+	BYTE m_pHash[sizeof(CHUNK_HASH)]; // SHA256 of a stored chunk
+	SQLLEN m_nHashLength;             // Length of the hash in bytes
+
+	BEGIN_ODBC_PARAM_MAP(CChunkSelectAccessor)
+	END_ODBC_PARAM_MAP()
+
+	BEGIN_ODBC_COLUMN_MAP(CChunkSelectAccessor)
+		ODBC_COLUMN_ENTRY_STATUS(1, m_pHash, m_nHashLength)
+	END_ODBC_COLUMN_MAP()
+
+	DEFINE_ODBC_COMMAND(CChunkSelectAccessor, _T("SELECT `chunk`.`chunk_hash` FROM `filedata` INNER JOIN `chunk` ON `chunk`.`chunk_hash` = `filedata`.`chunk_hash` WHERE `filedata`.`filename_id` = @last_filename_id AND `filedata`.`version` = @staging_version AND `filedata`.`filedata_id` >= @packet_first_id FOR SHARE OF `chunk`;"))
+
+		void ClearRecord() noexcept { memset(this, 0, sizeof(*this)); }
+};
+
+/**
+ * @brief Executes a SELECT for the stored chunks and collects their hashes.
+ */
+class CChunkSelect : public CPooledCommand<CChunkSelectAccessor>
+{
+public:
+	bool Iterate(POOLED_CONNECTION& pDbConnect, std::set<CHUNK_HASH>& pStored)
+	{
+		if (!Open(pDbConnect))
+			return false;
+		while (true)
+		{
+			ClearRecord();
+			const SQLRETURN nRet = m_pCommand->FetchNext();
+			if (!SQL_SUCCEEDED(nRet))
+				break;
+			if (m_nHashLength == (SQLLEN)sizeof(CHUNK_HASH))
+			{
+				CHUNK_HASH pHash;
+				CopyMemory(pHash.data(), m_pHash, sizeof(CHUNK_HASH));
+				pStored.insert(pHash);
+			}
+		}
+		return true;
+	}
+};
+
+CHUNK_STORE_COUNTERS g_pChunkStoreCounters;
+
+/**
+ * @brief Receives the chunk hashes of a deduplicated upload and tells the client which chunks to send.
+ * @details Each packet of up to DEDUP_HASHES_PER_PACKET hashes (DEDUP_ENTRIES_PER_PACKET hashes with their lengths
+ *          under PROTOCOL_CDC) is answered with one bit per hash (bit 0 of byte 0 first), set when the chunk is neither
+ *          stored nor requested earlier in this upload. Packets follow until the chunks cover the file.
+ *          The hashes become the `filedata` rows of the staging version.
+ * @param nSocketIndex Index of the client socket.
+ * @param pApplicationSocket The socket to read from.
+ * @param pDbConnect The pooled connection, in the upload transaction.
+ * @param nStartOffset File offset the chunks start at (a resumed upload continues after its last checkpoint).
+ * @param nFileLength Length of the file.
+ * @param bContentDefined Whether the client cuts content-defined chunks and sends their lengths (PROTOCOL_CDC).
+ * @param pHashes [out] The hashes, in file order.
+ * @param pLengths [out] The chunk lengths, in file order.
+ * @param pNeeded [out] Indexes of the chunks the client sends, in file order.
+ * @return true on success, false on failure.
+ */
+#pragma warning(suppress: 6262)
+bool ExchangeChunkHashes(const int nSocketIndex, CWSocket& pApplicationSocket, POOLED_CONNECTION& pDbConnect, const ULONGLONG nStartOffset, const ULONGLONG nFileLength, const bool bContentDefined, std::vector<CHUNK_HASH>& pHashes, std::vector<int>& pLengths, std::vector<ULONGLONG>& pNeeded)
+{
+	unsigned char pBuffer[MAX_BUFFER] = { 0, };
+	CGenericStatement pGenericStatement;
+	CFiledataBatchInsert pFiledataInsert(DEDUP_HASHES_PER_PACKET / HASH_BATCH_FACTOR + 1);
+	CChunkSelect pChunkSelect;
+	std::set<CHUNK_HASH> pRequested;  // Chunks this upload has asked for
+	ULONGLONG nCovered = nStartOffset; // File bytes covered by the chunks received so far
+	pFiledataInsert.SetFileOffset((__int64)nStartOffset);
+	while (nCovered < nFileLength)
+	{
+		int nLength = MAX_BUFFER;
+		if (!ReadBuffer(nSocketIndex, pApplicationSocket, pBuffer, nLength, false, false))
+		{
+			TRACE(_T("Invalid chunk hashes!\n"));
+			return false;
+		}
+		const int nEntrySize = bContentDefined ? (int)sizeof(CHUNK_ENTRY) : (int)sizeof(CHUNK_HASH);
+		const int nCount = (nLength - 5) / nEntrySize;
+		const ULONGLONG nRemaining = (nFileLength - nCovered + DEDUP_CHUNK_SIZE - 1) / DEDUP_CHUNK_SIZE;
+		if ((nCount <= 0) || ((nLength - 5) % nEntrySize != 0) ||
+			(!bContentDefined && (nCount != (int)min(nRemaining, (ULONGLONG)DEDUP_HASHES_PER_PACKET))))
+		{
+			TRACE(_T("Invalid chunk hashes!\n"));
+			return false;
+		}
+
+		// Rows of this packet get ids above every id allocated so far
+		const size_t nFirst = pHashes.size();
+		if (!pGenericStatement.Execute(pDbConnect, _T("SET @packet_first_id = (SELECT IFNULL(MAX(`filedata_id`), 0) + 1 FROM `filedata`);")))
+		{
+			pDbConnect.bBroken = true;
+			return false;
+		}
+		for (int nIndex = 0; nIndex < nCount; nIndex++)
+		{
+			CHUNK_HASH pHash;
+			int nChunkLength = 0;
+			if (bContentDefined)
+			{
+				CHUNK_ENTRY pEntry;
+				CopyMemory(&pEntry, &pBuffer[3 + nIndex * sizeof(CHUNK_ENTRY)], sizeof(CHUNK_ENTRY));
+				CopyMemory(pHash.data(), pEntry.pHash, sizeof(CHUNK_HASH));
+				if ((pEntry.nLength == 0) || (pEntry.nLength > (unsigned int)DEDUP_CHUNK_SIZE) || (pEntry.nLength > nFileLength - nCovered))
+				{
+					TRACE(_T("Invalid chunk length!\n"));
+					return false;
+				}
+				nChunkLength = (int)pEntry.nLength;
+			}
+			else
+			{
+				CopyMemory(pHash.data(), &pBuffer[3 + nIndex * sizeof(CHUNK_HASH)], sizeof(CHUNK_HASH));
+				nChunkLength = (int)min(nFileLength - nCovered, (ULONGLONG)DEDUP_CHUNK_SIZE);
+			}
+			nCovered += nChunkLength;
+			pHashes.push_back(pHash);
+			pLengths.push_back(nChunkLength);
+			if (!pFiledataInsert.Append(pDbConnect, pHash, nChunkLength))
+			{
+				pDbConnect.bBroken = true;
+				return false;
+			}
+		}
+		std::set<CHUNK_HASH> pStored;
+		if (!pFiledataInsert.Flush(pDbConnect) || !pChunkSelect.Iterate(pDbConnect, pStored))
+		{
+			pDbConnect.bBroken = true;
+			return false;
+		}
+
+		std::vector<unsigned char> pBitmap((nCount + 7) / 8, 0);
+		for (int nIndex = 0; nIndex < nCount; nIndex++)
+		{
+			const CHUNK_HASH& pHash = pHashes[nFirst + nIndex];
+			if ((pStored.find(pHash) == pStored.end()) && pRequested.insert(pHash).second)
+			{
+				pBitmap[nIndex / 8] |= (unsigned char)(1 << (nIndex % 8));
+				pNeeded.push_back(nFirst + nIndex);
+			}
+		}
+		if (!WriteBuffer(nSocketIndex, pApplicationSocket, pBitmap.data(), (int)pBitmap.size(), false, false))
+			return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Cuts the bytes of a file into content-defined chunks and queues them,
+ *        with their `filedata` rows, for the batch INSERTs.
+ * @details Bytes collect in the next chunk slot until it holds the largest chunk; the chunker then picks
+ *          the boundary and the bytes after it move on to the following slot.
+ *          The optional SHA256 is fed the chunks as they are cut, so it always covers the rows queued so far.
+ */
+class CChunkAssembler
+{
+public:
+	CChunkAssembler(const CContentChunker& pChunker, CFiledataBatchInsert& pFiledataInsert, CChunkBatchInsert& pChunkInsert, SHA256* pSHA256 = nullptr) :
+		m_pChunker(pChunker), m_pFiledataInsert(pFiledataInsert), m_pChunkInsert(pChunkInsert), m_pSHA256(pSHA256),
+		m_pChunk(pChunkInsert.ReserveChunk()), m_nChunkLength(0), m_nChunkCount(0), m_nRowCount(0) {}
+
+	/**
+	 * @brief Returns the number of chunks cut from the written bytes.
+	 */
+	size_t GetChunkCount() const { return m_nChunkCount; }
+
+	/**
+	 * @brief Returns the number of `filedata` rows queued, i.e. the chunks of the file.
+	 */
+	size_t GetRowCount() const { return m_nRowCount; }
+
+	/**
+	 * @brief Appends bytes to the file, queueing a chunk whenever the slot holds the largest one.
+	 */
+	bool Write(POOLED_CONNECTION& pDbConnect, const unsigned char* pBuffer, const int nLength)
+	{
+		const int nMaxSize = (int)m_pChunker.GetMaxSize();
+		for (int nIndex = 0; nIndex < nLength; )
+		{
+			const int nCount = min(nLength - nIndex, nMaxSize - m_nChunkLength);
+			CopyMemory(m_pChunk + m_nChunkLength, pBuffer + nIndex, nCount);
+			g_pDataPathCounters.nCopiedBytes += nCount;
+			m_nChunkLength += nCount;
+			nIndex += nCount;
+			if ((m_nChunkLength == nMaxSize) && !Cut(pDbConnect))
+				return false;
+		}
+		return true;
+	}
+
+	/**
+	 * @brief Queues the bytes still pending at the end of the file.
+	 */
+	bool Finish(POOLED_CONNECTION& pDbConnect)
+	{
+		while (m_nChunkLength > 0)
+		{
+			if (!Cut(pDbConnect))
+				return false;
+		}
+		return true;
+	}
+
+	/**
+	 * @brief INSERTs the chunks cut so far with their rows; the bytes still pending wait for their boundary.
+	 */
+	bool Flush(POOLED_CONNECTION& pDbConnect)
+	{
+		if (!m_pFiledataInsert.Flush(pDbConnect) || !m_pChunkInsert.Flush(pDbConnect))
+			return false;
+		// The next batch starts over in the first slot
+		unsigned char* pNextChunk = m_pChunkInsert.ReserveChunk();
+		MoveMemory(pNextChunk, m_pChunk, m_nChunkLength);
+		g_pDataPathCounters.nCopiedBytes += m_nChunkLength;
+		m_pChunk = pNextChunk;
+		return true;
+	}
+
+private:
+	bool Cut(POOLED_CONNECTION& pDbConnect)
+	{
+		const int nCut = (int)m_pChunker.FindBoundary(m_pChunk, m_nChunkLength);
+		if (m_pSHA256 != nullptr)
+			m_pSHA256->update(m_pChunk, nCut);
+		SHA256 pChunkSHA256;
+		pChunkSHA256.update(m_pChunk, nCut);
+		const CHUNK_HASH pHash = pChunkSHA256.digest();
+		if (!m_pFiledataInsert.Append(pDbConnect, pHash, nCut) ||
+			!m_pChunkInsert.Append(pDbConnect, pHash, nCut))
+			return false;
+		m_nChunkCount++;
+		m_nRowCount++;
+		// The bytes after the boundary start the next chunk (the slots overlap when a batch holds a single chunk)
+		unsigned char* pNextChunk = m_pChunkInsert.ReserveChunk();
+		MoveMemory(pNextChunk, m_pChunk + nCut, m_nChunkLength - nCut);
+		g_pDataPathCounters.nCopiedBytes += m_nChunkLength - nCut;
+		m_pChunk = pNextChunk;
+		m_nChunkLength -= nCut;
+		return true;
+	}
+
+	const CContentChunker& m_pChunker;       // Picks the chunk boundaries
+	CFiledataBatchInsert& m_pFiledataInsert; // `filedata` rows of the staging version
+	CChunkBatchInsert& m_pChunkInsert;       // Chunks to store
+	SHA256* m_pSHA256;                       // Hash of the file up to the last cut, if any
+	unsigned char* m_pChunk;                 // Slot the next chunk collects in
+	int m_nChunkLength;                      // Bytes collected so far
+	size_t m_nChunkCount;                    // Chunks cut from written bytes
+	size_t m_nRowCount;                      // `filedata` rows queued
+};
+
+/**
+ * @brief ODBC accessor for selecting the upload session the next statements work on
+ */
+class CUploadSessionSetAccessor
+{
+public:
+	__int64 m_nSessionToken;  // Token the client sent, 0 if none
+	__int64 m_nFilesize;      // Length of the uploaded file
+
+	BEGIN_ODBC_PARAM_MAP(CUploadSessionSetAccessor)
+		SET_ODBC_PARAM_TYPE(SQL_PARAM_INPUT)
+		ODBC_PARAM_ENTRY(1, m_nSessionToken)
+		ODBC_PARAM_ENTRY(2, m_nFilesize)
+	END_ODBC_PARAM_MAP()
+
+	DEFINE_ODBC_COMMAND(CUploadSessionSetAccessor, _T("SET @session_token = ?, @session_filesize = ?;"))
+
+		void ClearRecord() noexcept { memset(this, 0, sizeof(*this)); }
+};
+
+/**
+ * @brief Executes a SET of @session_token and @session_filesize.
+ */
+class CUploadSessionSet : public CODBC::CAccessor<CUploadSessionSetAccessor>
+{
+public:
+	bool Execute(POOLED_CONNECTION& pDbConnect, const UPLOAD_SESSION& pSession, const ULONGLONG nFilesize)
+	{
+		ClearRecord();
+		CODBC::CStatement* statement = PrepareStatement(pDbConnect, reinterpret_cast<LPCTSTR>(GetDefaultCommand()));
+		if (statement == nullptr)
+			return false;
+		m_nSessionToken = (__int64)pSession.nToken;
+		m_nFilesize = (__int64)nFilesize;
+		SQLRETURN nRet = BindParameters(*statement);
+		ODBC_CHECK_RETURN_FALSE(nRet, (*statement));
+		nRet = statement->Execute();
+		ODBC_CHECK_RETURN_FALSE(nRet, (*statement));
+		return true;
+	}
+};
+
+static_assert(std::is_trivially_copyable<SHA256>::value, "The SHA256 state is stored as raw bytes");
+
+/**
+ * @brief ODBC accessor for the upload session a client resumes
+ * @details Only a session of the same file and length qualifies; the row stays locked until the upload
+ *          commits, so a second connection with the same token waits instead of writing the same version
+ */
+class CUploadSessionSelectAccessor
+{
+public:
+	__int64 m_nCommittedOffset;      // Bytes committed by the last checkpoint
+	BYTE m_pState[sizeof(SHA256)];   // SHA256 state of these bytes
+	SQLLEN m_nStateLength;           // Length of the state in bytes
+
+	BEGIN_ODBC_PARAM_MAP(CUploadSessionSelectAccessor)
+	END_ODBC_PARAM_MAP()
+
+	BEGIN_ODBC_COLUMN_MAP(CUploadSessionSelectAccessor)
+		ODBC_COLUMN_ENTRY(1, m_nCommittedOffset)
+		ODBC_COLUMN_ENTRY_STATUS(2, m_pState, m_nStateLength)
+	END_ODBC_COLUMN_MAP()
+
+	DEFINE_ODBC_COMMAND(CUploadSessionSelectAccessor, _T("SELECT `committed_offset`, `sha256_state` FROM `upload_session` WHERE `session_token` = @session_token AND `filename_id` = @last_filename_id AND `filesize` = @session_filesize FOR UPDATE;"))
+
+		void ClearRecord() noexcept { memset(this, 0, sizeof(*this)); }
+};
+
+/**
+ * @brief Executes a SELECT for the upload session and restores its SHA256 state.
+ */
+class CUploadSessionSelect : public CPooledCommand<CUploadSessionSelectAccessor>
+{
+public:
+	bool Iterate(POOLED_CONNECTION& pDbConnect, bool& bFound, ULONGLONG& nCommittedOffset, SHA256& pSHA256)
+	{
+		bFound = false;
+		if (!Open(pDbConnect))
+			return false;
+		while (true)
+		{
+			ClearRecord();
+			const SQLRETURN nRet = m_pCommand->FetchNext();
+			if (!SQL_SUCCEEDED(nRet))
+				break;
+			// A state of another size was written by a different build; the upload then starts over
+			if ((m_nCommittedOffset >= 0) && (m_nStateLength == (SQLLEN)sizeof(SHA256)))
+			{
+				bFound = true;
+				nCommittedOffset = (ULONGLONG)m_nCommittedOffset;
+				CopyMemory(&pSHA256, m_pState, sizeof(SHA256));
+			}
+		}
+		return true;
+	}
+};
+
+/**
+ * @brief ODBC accessor for recording a checkpoint of the current upload session
+ */
+class CUploadSessionUpdateAccessor
+{
+public:
+	__int64 m_nCommittedOffset;      // Bytes committed by this checkpoint
+	BYTE m_pState[sizeof(SHA256)];   // SHA256 state of these bytes
+	SQLLEN m_nStateLength;           // Length of the state in bytes
+
+	BEGIN_ODBC_PARAM_MAP(CUploadSessionUpdateAccessor)
+		SET_ODBC_PARAM_TYPE(SQL_PARAM_INPUT)
+		ODBC_PARAM_ENTRY(1, m_nCommittedOffset)
+		ODBC_PARAM_ENTRY_STATUS(2, m_pState, m_nStateLength)
+	END_ODBC_PARAM_MAP()
+
+	DEFINE_ODBC_COMMAND(CUploadSessionUpdateAccessor, _T("UPDATE `upload_session` SET `committed_offset` = ?, `sha256_state` = ? WHERE `session_token` = @session_token;"))
+
+		void ClearRecord() noexcept { memset(this, 0, sizeof(*this)); }
+};
+
+/**
+ * @brief Executes an UPDATE of the upload session.
+ */
+class CUploadSessionUpdate : public CODBC::CAccessor<CUploadSessionUpdateAccessor>
+{
+public:
+	bool Execute(POOLED_CONNECTION& pDbConnect, const ULONGLONG nCommittedOffset, const SHA256& pSHA256)
+	{
+		ClearRecord();
+		CODBC::CStatement* statement = PrepareStatement(pDbConnect, reinterpret_cast<LPCTSTR>(GetDefaultCommand()));
+		if (statement == nullptr)
+			return false;
+		m_nCommittedOffset = (__int64)nCommittedOffset;
+		CopyMemory(m_pState, &pSHA256, sizeof(SHA256));
+		m_nStateLength = (SQLLEN)sizeof(SHA256);
+		SQLRETURN nRet = BindParameters(*statement);
+		ODBC_CHECK_RETURN_FALSE(nRet, (*statement));
+		nRet = statement->Execute();
+		ODBC_CHECK_RETURN_FALSE(nRet, (*statement));
+		return true;
+	}
+};
+
+/**
+ * @brief Commits a resumable upload up to a file offset, so a new connection can continue from there.
+ * @details The `filedata` rows between the previous checkpoint (@counted_offset) and nOffset take their chunk references,
+ *          the session records the offset with the SHA256 state of the bytes before it, and the transaction goes on.
+ *          Rows after nOffset may be committed as well; they are not counted and a resumed upload deletes them.
+ * @param pDbConnect The pooled connection, in the upload transaction.
+ * @param pTransaction The upload transaction.
+ * @param nOffset File offset up to which every chunk is stored.
+ * @param pSHA256 Hash of the file up to nOffset.
+ * @return true on success, false on failure.
+ */
+bool CheckpointUpload(POOLED_CONNECTION& pDbConnect, CDatabaseTransaction& pTransaction, const ULONGLONG nOffset, const SHA256& pSHA256)
+{
+	CGenericStatement pGenericStatement;
+	CScalarSelect pScalarSelect;
+	CUploadSessionUpdate pUploadSessionUpdate;
+	__int64 nMissing = 0;
+	if (!pUploadSessionUpdate.Execute(pDbConnect, nOffset, pSHA256) ||
+		!pGenericStatement.Execute(pDbConnect, _T("SET @checkpoint_offset = (SELECT `committed_offset` FROM `upload_session` WHERE `session_token` = @session_token);")) ||
+		!pScalarSelect.Iterate(pDbConnect, _T("SELECT COUNT(*) FROM `filedata` LEFT JOIN `chunk` ON `chunk`.`chunk_hash` = `filedata`.`chunk_hash` WHERE `filedata`.`filename_id` = @last_filename_id AND `filedata`.`version` = @staging_version AND `filedata`.`chunk_offset` >= @counted_offset AND `filedata`.`chunk_offset` < @checkpoint_offset AND `chunk`.`chunk_hash` IS NULL;"), nMissing))
+		return false;
+	if (nMissing != 0)
+	{
+		TRACE(_T("%lld chunks missing before offset %llu\n"), nMissing, nOffset);
+		return false;
+	}
+	return pGenericStatement.Execute(pDbConnect, _T("UPDATE `chunk` INNER JOIN (SELECT `chunk_hash`, COUNT(*) AS `refs` FROM `filedata` WHERE `filename_id` = @last_filename_id AND `version` = @staging_version AND `chunk_offset` >= @counted_offset AND `chunk_offset` < @checkpoint_offset GROUP BY `chunk_hash`) AS `file_chunks` ON `file_chunks`.`chunk_hash` = `chunk`.`chunk_hash` SET `chunk`.`refcount` = `chunk`.`refcount` + `file_chunks`.`refs`;")) &&
+		pGenericStatement.Execute(pDbConnect, _T("SET @counted_offset = @checkpoint_offset;")) &&
+		pTransaction.Checkpoint();
+}
+
+/**
+ * @brief Tells the client whether its upload was published (PROTOCOL_RESULT)
+ * @param nSocketIndex Index of the client socket.
+ * @param pApplicationSocket The socket to write to.
+ * @param bPublished Whether the new version was committed.
+ * @param nVersion The published version.
+ * @return bPublished, or false if the answer could not be sent.
+ */
+static bool SendUploadResult(const int nSocketIndex, CWSocket& pApplicationSocket, const bool bPublished, const __int64 nVersion)
+{
+	if ((GetProtocolOptions(nSocketIndex).nFlags & PROTOCOL_RESULT) == 0)
+		return bPublished;
+	const UPLOAD_RESULT pResult = { (unsigned long long)(bPublished ? UPLOAD_PUBLISHED : UPLOAD_FAILED), bPublished ? (unsigned long long)nVersion : 0 };
+	return WriteBuffer(nSocketIndex, pApplicationSocket, (const unsigned char*)&pResult, (int)sizeof(pResult), false, true) && bPublished;
+}
+
+/**
+ * @brief Handles the upload of a file from a client to the server.
+ *        Receives file data from the client socket and stores it in the database, with SHA256 integrity check.
+ * @param nSocketIndex Index of the client socket.
+ * @param pApplicationSocket The socket to read from.
+ * @param strFilePath The file path to upload.
+ * @return true on success, false on failure.
+ *
+ * The file is stored as chunks of up to DEDUP_CHUNK_SIZE bytes in the `chunk` table, keyed by their SHA256
+ * and shared by every file version that contains them; `filedata` lists the chunk hashes in file order.
+ * With PROTOCOL_DEDUP the client announces the chunk hashes first (ExchangeChunkHashes) and sends
+ * only the chunks the server lacks; each of them is checked against its hash. The client cuts the chunks,
+ * content-defined with PROTOCOL_CDC, at fixed offsets otherwise. Older clients send the whole file
+ * and the server cuts content-defined chunks itself (CChunkAssembler).
+ * With PROTOCOL_RESUME an upload larger than UPLOAD_CHECKPOINT_SIZE opens an `upload_session` and commits
+ * every UPLOAD_CHECKPOINT_SIZE received bytes (CheckpointUpload); a client that reconnects with the session token
+ * continues after the last checkpoint.
+ * With PROTOCOL_RESULT the client learns whether the file was verified and published (SendUploadResult),
+ * so it only records the file as synced once it is.
+ */
+#pragma warning(suppress: 6262)
+bool UploadFile(const int nSocketIndex, CWSocket& pApplicationSocket, const std::wstring& strFilePath)
+{
+	CFrameWindow pFrameWindow(GetProtocolOptions(nSocketIndex));
+	const bool bDeduplicate = ((GetProtocolOptions(nSocketIndex).nFlags & PROTOCOL_DEDUP) != 0);
+	const bool bContentDefined = ((GetProtocolOptions(nSocketIndex).nFlags & PROTOCOL_CDC) != 0);
+	const bool bResume = ((GetProtocolOptions(nSocketIndex).nFlags & PROTOCOL_RESUME) != 0);
+	SHA256 pSHA256;
+	const ULONGLONG nCopiedBytes = g_pDataPathCounters.nCopiedBytes;
+	const ULONGLONG nStartTime = GetTickCount64();
+	unsigned char pFileBuffer[MAX_BUFFER] = { 0, };
+
+	CGenericStatement pGenericStatement;
+	CFilenameInsert pFilenameInsert;
+	CFilenameSelect pFilenameSelect;
+	CFilenameUpdate pFilenameUpdate;
+	CScalarSelect pScalarSelect;
+	CUploadSessionSet pUploadSessionSet;
+	CUploadSessionSelect pUploadSessionSelect;
+	CFiledataBatchInsert pFiledataInsert(g_nUploadBatchSize);
+	CChunkBatchInsert pChunkInsert(g_nUploadBatchSize);
+	// Without PROTOCOL_DEDUP the whole file passes by and is hashed as it is cut, which a checkpoint can store
+	CChunkAssembler pAssembler(g_pContentChunker, pFiledataInsert, pChunkInsert, bDeduplicate ? nullptr : &pSHA256);
+	TRACE(_T("[UploadFile] %s\n"), strFilePath.c_str());
+	CDatabaseConnection pConnection;
+	if (!pConnection.IsValid())
+	{
+		TRACE("MySQL operation failed!\n");
+		return false;
+	}
+	// Nothing of the upload is visible to other clients until the new version is published;
+	// a client that disconnects halfway leaves the previous version in place (and its last checkpoint, if any)
+	CDatabaseTransaction pTransaction(pConnection);
+	if (!pTransaction.IsActive())
+	{
+		TRACE("MySQL operation failed!\n");
+		return false;
+	}
+
+	// Receive file size from client
+	bool bNewFile = false;
+	bool bResumed = false;
+	UPLOAD_SESSION pSession = { 0, 0 };
+	ULONGLONG nFileLength = 0;
+	ULONGLONG nChunkCount = 0;
+	ULONGLONG nExpected = 0;
+	ULONGLONG nStartOffset = 0;
+	size_t nChunkNumber = 0;
+	int nLength = (int)(sizeof(nFileLength) + 5);
+	ZeroMemory(pFileBuffer, sizeof(pFileBuffer));
+	if (ReadBuffer(nSocketIndex, pApplicationSocket, pFileBuffer, nLength, false, false))
+	{
+		CopyMemory(&nFileLength, &pFileBuffer[3], sizeof(nFileLength));
+		TRACE(_T("nFileLength = %llu\n"), nFileLength);
+		if (bResume)
+		{
+			nLength = (int)(sizeof(pSession) + 5);
+			ZeroMemory(pFileBuffer, sizeof(pFileBuffer));
+			if (!ReadBuffer(nSocketIndex, pApplicationSocket, pFileBuffer, nLength, false, false))
+			{
+				TRACE(_T("Invalid upload session!\n"));
+				return false;
+			}
+			CopyMemory(&pSession, &pFileBuffer[3], sizeof(pSession));
+		}
+		// Small files are not worth a session, they are sent again as a whole
+		const bool bResumable = bResume && (nFileLength > UPLOAD_CHECKPOINT_SIZE);
+		// Try to insert new file record; the first checkpoint commits it, so it stays out of the manifest until published
+		bNewFile = pFilenameInsert.Execute(*pConnection, strFilePath, nFileLength, bResumable ? UNPUBLISHED_VERSION : 0) &&
+			pGenericStatement.Execute(*pConnection, _T("SET @last_filename_id = LAST_INSERT_ID()"));
+		if ((!bNewFile && !pFilenameSelect.Execute(*pConnection, strFilePath)) ||  // File already exists - set @last_filename_id
+			(bResumable && !pUploadSessionSet.Execute(*pConnection, pSession, nFileLength)) ||
+			(bResumable && (pSession.nToken != 0) && !pUploadSessionSelect.Iterate(*pConnection, bResumed, nStartOffset, pSHA256)))
+		{
+			TRACE("MySQL operation failed!\n");
+			pConnection.SetBroken();
+			return false;
+		}
+		if (bResumed)
+		{
+			// Continue the version of the session; the rows after its checkpoint were not counted and are written again
+			TRACE(_T("Resuming upload at offset %llu\n"), nStartOffset);
+			if (!pGenericStatement.Execute(*pConnection, _T("SET @staging_version = (SELECT `staging_version` FROM `upload_session` WHERE `session_token` = @session_token), @counted_offset = (SELECT `committed_offset` FROM `upload_session` WHERE `session_token` = @session_token);")) ||
+				!pGenericStatement.Execute(*pConnection, _T("DELETE FROM `filedata` WHERE `filename_id` = @last_filename_id AND `version` = @staging_version AND `chunk_offset` >= @counted_offset;")))
+			{
+				TRACE("MySQL operation failed!\n");
+				pConnection.SetBroken();
+				return false;
+			}
+		}
+		else if (
+			// The chunks are written under a version of their own; the old chunks stay until it is published.
+			// UUID_SHORT() is unique on this server, the top bit is masked so it fits in a BIGINT
+			!pGenericStatement.Execute(*pConnection, _T("SET @staging_version = UUID_SHORT() & 0x7FFFFFFFFFFFFFFF, @counted_offset = 0, @session_token = 0;")) ||
+			(bResumable && !pGenericStatement.Execute(*pConnection, _T("SET @session_token = UUID_SHORT() & 0x7FFFFFFFFFFFFFFF;"))) ||
+			(bResumable && !pGenericStatement.Execute(*pConnection, _T("INSERT INTO `upload_session` (`session_token`, `filename_id`, `staging_version`, `filesize`, `committed_offset`) VALUES (@session_token, @last_filename_id, @staging_version, @session_filesize, 0);"))))
+		{
+			TRACE("MySQL operation failed!\n");
+			pConnection.SetBroken();
+			return false;
+		}
+		if (bResume)
+		{
+			__int64 nSessionToken = 0;
+			if (!pScalarSelect.Iterate(*pConnection, _T("SELECT @session_token;"), nSessionToken))
+			{
+				TRACE("MySQL operation failed!\n");
+				pConnection.SetBroken();
+				return false;
+			}
+			pSession.nToken = (ULONGLONG)nSessionToken;
+			pSession.nOffset = nStartOffset;
+			if (!WriteBuffer(nSocketIndex, pApplicationSocket, (unsigned char*)&pSession, sizeof(pSession), false, false))
+				return false;
+		}
+
+		// Find out which chunks the client has to send
+		std::vector<CHUNK_HASH> pHashes;
+		std::vector<int> pLengths;
+		std::vector<ULONGLONG> pNeeded;
+		if (bDeduplicate)
+		{
+			if (!ExchangeChunkHashes(nSocketIndex, pApplicationSocket, *pConnection, nStartOffset, nFileLength, bContentDefined, pHashes, pLengths, pNeeded))
+				return false;
+			nChunkCount = pHashes.size();
+			for (const ULONGLONG nChunk : pNeeded)
+				nExpected += pLengths[(size_t)nChunk];
+		}
+		else
+		{
+			nExpected = nFileLength - min(nStartOffset, nFileLength);
+			pFiledataInsert.SetFileOffset((__int64)nStartOffset);
+		}
+
+		// Receive the chunks and assemble them in place in the chunk batch; without PROTOCOL_DEDUP the whole file
+		// arrives and the assembler cuts it
+		SHA256 pChunkSHA256;
+		unsigned char* pChunk = pChunkInsert.ReserveChunk();
+		int nChunkLength = 0;
+		ULONGLONG nFileIndex = 0;
+		ULONGLONG nCheckpointIndex = 0;   // Bytes received up to the last checkpoint
+		std::vector<ULONGLONG> pOffsets;  // File offset of each announced chunk
+		if (bResumable && bDeduplicate)
+		{
+			pOffsets.reserve(pLengths.size());
+			ULONGLONG nOffset = nStartOffset;
+			for (const int nChunkSize : pLengths)
+			{
+				pOffsets.push_back(nOffset);
+				nOffset += nChunkSize;
+			}
+		}
+		while (nFileIndex < nExpected)
+		{
+			unsigned char* pPayload = nullptr;
+			if (!ReadFrame(nSocketIndex, pApplicationSocket, pFrameWindow, pPayload, nLength))
+				return false;
+			if ((ULONGLONG)nLength > nExpected - nFileIndex)
+			{
+				TRACE(_T("Invalid frame length!\n"));
+				return false;
+			}
+			nFileIndex += nLength;
+			if (!bDeduplicate)
+			{
+				// The assembler updates the SHA256 for integrity verification (the whole file only passes by without PROTOCOL_DEDUP)
+				if (!pAssembler.Write(*pConnection, pPayload, nLength))
+				{
+					TRACE("MySQL operation failed!\n");
+					pConnection.SetBroken();
+					return false;
+				}
+				// The bytes not cut yet are sent again after a resume
+				if (bResumable && (nFileIndex - nCheckpointIndex >= UPLOAD_CHECKPOINT_SIZE))
+				{
+					if (!pAssembler.Flush(*pConnection) ||
+						!CheckpointUpload(*pConnection, pTransaction, (ULONGLONG)pFiledataInsert.GetFileOffset(), pSHA256))
+					{
+						TRACE("MySQL operation failed!\n");
+						pConnection.SetBroken();
+						return false;
+					}
+					nCheckpointIndex = nFileIndex;
+				}
+				continue;
+			}
+
+			for (int nIndex = 0; nIndex < nLength; )
+			{
+				const size_t nChunk = (size_t)pNeeded[nChunkNumber];
+				const int nChunkSize = pLengths[nChunk];
+				const int nCount = min(nLength - nIndex, nChunkSize - nChunkLength);
+				CopyMemory(pChunk + nChunkLength, pPayload + nIndex, nCount);
+				g_pDataPathCounters.nCopiedBytes += nCount;
+				pChunkSHA256.update(pPayload + nIndex, nCount);
+				nChunkLength += nCount;
+				nIndex += nCount;
+				if (nChunkLength < nChunkSize)
+					continue;
+
+				const CHUNK_HASH pHash = pChunkSHA256.digest();
+				if (pHash != pHashes[nChunk])
+				{
+					TRACE(_T("Invalid chunk SHA256!\n"));
+					return false;
+				}
+				if (!pChunkInsert.Append(*pConnection, pHash, nChunkLength))
+				{
+					TRACE("MySQL operation failed!\n");
+					pConnection.SetBroken();
+					return false;
+				}
+				pChunkSHA256 = SHA256();
+				nChunkLength = 0;
+				nChunkNumber++;
+				// The chunks received so far cover the file up to the next one the client still has to send
+				const ULONGLONG nReceived = nFileIndex - nLength + nIndex;
+				if (bResumable && (nReceived - nCheckpointIndex >= UPLOAD_CHECKPOINT_SIZE))
+				{
+					const ULONGLONG nOffset = (nChunkNumber < pNeeded.size()) ? pOffsets[(size_t)pNeeded[nChunkNumber]] : nFileLength;
+					if (!pChunkInsert.Flush(*pConnection) ||
+						!CheckpointUpload(*pConnection, pTransaction, nOffset, pSHA256))
+					{
+						TRACE("MySQL operation failed!\n");
+						pConnection.SetBroken();
+						return false;
+					}
+					nCheckpointIndex = nReceived;
+				}
+				pChunk = pChunkInsert.ReserveChunk();
+			}
+		}
+		if (!pAssembler.Finish(*pConnection) || !pFiledataInsert.Flush(*pConnection) || !pChunkInsert.Flush(*pConnection))
+		{
+			TRACE("MySQL operation failed!\n");
+			pConnection.SetBroken();
+			return false;
+		}
+		if (!bDeduplicate)
+		{
+			nChunkCount = pAssembler.GetRowCount();
+			nChunkNumber = pAssembler.GetChunkCount();
+		}
+	}
+	else
+	{
+		TRACE(_T("Invalid nFileLength!\n"));
+		return false;
+	}
+	// Verify file integrity using SHA256 hash from client; with PROTOCOL_DEDUP every chunk was checked instead
+	const std::string strDigestSHA256 = pSHA256.toString(pSHA256.digest());
+	nLength = (int)strDigestSHA256.length() + 5;
+	ZeroMemory(pFileBuffer, sizeof(pFileBuffer));
+	if (!ReadBuffer(nSocketIndex, pApplicationSocket, pFileBuffer, nLength, false, true))
+	{
+		return false;
+	}
+	const std::string strCommand = (char*)&pFileBuffer[3];
+	if (!bDeduplicate && (strDigestSHA256.compare(strCommand) != 0))
+	{
+		TRACE(_T("Invalid SHA256!\n"));
+		SendUploadResult(nSocketIndex, pApplicationSocket, false, 0);
+		return false;
+	}
+
+	// Publish the new version; the row lock makes concurrent uploads of the same file publish one after the other.
+	// The rows before the last checkpoint already hold their chunk references
+	__int64 nFilenameID = 0;
+	__int64 nOldVersion = 0;
+	__int64 nNewVersion = 0;
+	__int64 nMissing = 0;
+	if (!pScalarSelect.Iterate(*pConnection, _T("SELECT `current_version` FROM `filename` WHERE `filename_id` = @last_filename_id FOR UPDATE;"), nOldVersion) ||
+		!pScalarSelect.Iterate(*pConnection, _T("SELECT @last_filename_id;"), nFilenameID) ||
+		!pScalarSelect.Iterate(*pConnection, _T("SELECT @staging_version;"), nNewVersion) ||
+		// A checkpoint released the locks on the chunks the client did not send; lock the rest again and make sure
+		// the garbage collector or a delete did not remove one of them (or one inserted with no reference) meanwhile
+		!pScalarSelect.Iterate(*pConnection, _T("SELECT COUNT(*) FROM `filedata` LEFT JOIN `chunk` ON `chunk`.`chunk_hash` = `filedata`.`chunk_hash` WHERE `filedata`.`filename_id` = @last_filename_id AND `filedata`.`version` = @staging_version AND `filedata`.`chunk_offset` >= @counted_offset AND `chunk`.`chunk_hash` IS NULL FOR SHARE OF `chunk`;"), nMissing))
+	{
+		TRACE("MySQL operation failed!\n");
+		pConnection.SetBroken();
+		SendUploadResult(nSocketIndex, pApplicationSocket, false, 0);
+		return false;
+	}
+	if (nMissing != 0)
+	{
+		// Rolled back; a resumed upload asks for the chunks after its last checkpoint again
+		TRACE(_T("%lld chunks missing, the upload is not published\n"), nMissing);
+		SendUploadResult(nSocketIndex, pApplicationSocket, false, 0);
+		return false;
+	}
+	if (!pGenericStatement.Execute(*pConnection, _T("UPDATE `chunk` INNER JOIN (SELECT `chunk_hash`, COUNT(*) AS `refs` FROM `filedata` WHERE `filename_id` = @last_filename_id AND `version` = @staging_version AND `chunk_offset` >= @counted_offset GROUP BY `chunk_hash`) AS `file_chunks` ON `file_chunks`.`chunk_hash` = `chunk`.`chunk_hash` SET `chunk`.`refcount` = `chunk`.`refcount` + `file_chunks`.`refs`;")) ||
+		!pFilenameUpdate.Execute(*pConnection, nFileLength) ||
+		((pSession.nToken != 0) && !pGenericStatement.Execute(*pConnection, _T("DELETE FROM `upload_session` WHERE `session_token` = @session_token;"))) ||
+		!pTransaction.Commit())
+	{
+		TRACE("MySQL operation failed!\n");
+		pConnection.SetBroken();
+		SendUploadResult(nSocketIndex, pApplicationSocket, false, 0);
+		return false;
+	}
+	// The chunks of the replaced version are released in the background
+	if (!bNewFile && (nOldVersion != UNPUBLISHED_VERSION))
+		QueueGarbageVersion(nFilenameID, nOldVersion);
+	g_pChunkStoreCounters.nUploadedBytes += nFileLength;
+	g_pChunkStoreCounters.nReceivedBytes += nExpected;
+	g_pChunkStoreCounters.nChunks += nChunkCount;
+	g_pChunkStoreCounters.nReceivedChunks += nChunkNumber;
+	TRACE(_T("Upload Done! %llu bytes in %llu ms, %llu bytes received (%llu of %llu chunks), %llu bytes copied, %d batches\n"),
+		nFileLength, GetTickCount64() - nStartTime, nExpected, (ULONGLONG)nChunkNumber, nChunkCount,
+		g_pDataPathCounters.nCopiedBytes - nCopiedBytes, pFiledataInsert.GetBatchCount() + pChunkInsert.GetBatchCount());
+	// The version is published even if the client does not hear about it; it then uploads the file again
+	VERIFY(SendUploadResult(nSocketIndex, pApplicationSocket, true, nNewVersion));
+	return true;
+}
+
+#define EOT 0x04
+
+/**
+ * @brief Handles the deletion of a file from the server database.
+ *        Removes file data and metadata for the given file path.
+ * @param nSocketIndex Index of the client socket (unused).
+ * @param pApplicationSocket The socket to read EOT from.
+ * @param strFilePath The file path to delete.
+ * @return true on success, false on failure.
+ */
+#pragma warning(suppress: 6262)
+bool DeleteFile(const int /*nSocketIndex*/, CWSocket& pApplicationSocket, const std::wstring& strFilePath)
+{
+	CGenericStatement pGenericStatement;
+	CFilenameSelect pFilenameSelect;
+	// Take a database connection from the pool and delete file data and metadata
+	CDatabaseConnection pConnection;
+	if (!pConnection.IsValid())
+	{
+		TRACE("MySQL operation failed!\n");
+		return false;
+	}
+	// The chunk references are released together with the rows that hold them;
+	// the rows an upload session wrote after its last checkpoint hold none
+	CDatabaseTransaction pTransaction(pConnection);
+	if (!pTransaction.IsActive() ||
+		!pFilenameSelect.Execute(*pConnection, strFilePath) ||  // Set @last_filename_id
+		!pGenericStatement.Execute(*pConnection, _T("DELETE `filedata` FROM `filedata` INNER JOIN `upload_session` ON `upload_session`.`filename_id` = `filedata`.`filename_id` AND `upload_session`.`staging_version` = `filedata`.`version` WHERE `filedata`.`filename_id` = @last_filename_id AND `filedata`.`chunk_offset` >= `upload_session`.`committed_offset`;")) ||
+		!pGenericStatement.Execute(*pConnection, _T("DELETE FROM `upload_session` WHERE `filename_id` = @last_filename_id;")) ||
+		!pGenericStatement.Execute(*pConnection, _T("UPDATE `chunk` INNER JOIN (SELECT `chunk_hash`, COUNT(*) AS `refs` FROM `filedata` WHERE `filename_id` = @last_filename_id AND `chunk_hash` IS NOT NULL GROUP BY `chunk_hash`) AS `file_chunks` ON `file_chunks`.`chunk_hash` = `chunk`.`chunk_hash` SET `chunk`.`refcount` = `chunk`.`refcount` - `file_chunks`.`refs`;")) ||
+		!pGenericStatement.Execute(*pConnection, _T("DELETE `chunk` FROM `chunk` INNER JOIN `filedata` ON `filedata`.`chunk_hash` = `chunk`.`chunk_hash` WHERE `filedata`.`filename_id` = @last_filename_id AND `chunk`.`refcount` <= 0;")) ||  // Delete unused chunks
+		!pGenericStatement.Execute(*pConnection, _T("DELETE FROM `filedata` WHERE `filename_id` = @last_filename_id")) ||  // Delete file chunks
+		!pGenericStatement.Execute(*pConnection, _T("DELETE FROM `filename` WHERE `filename_id` = @last_filename_id")) ||  // Delete file record
+		!pTransaction.Commit())
+	{
+		TRACE("MySQL operation failed!\n");
+		pConnection.SetBroken();
+		return false;
+	}
+
+	// Wait for EOT (end of transmission) from client
+	unsigned char pFileBuffer[MAX_BUFFER] = { 0, };
+	int nLength = sizeof(pFileBuffer);
+	ZeroMemory(pFileBuffer, sizeof(pFileBuffer));
+	if (((nLength = pApplicationSocket.Receive(pFileBuffer, nLength)) > 0) &&
+		(EOT == pFileBuffer[nLength - 1]))
+	{
 		TRACE(_T("EOT Received\n"));
 	}
-	pConnection.Disconnect();
 	return true;
 }
+
+/**
+ * @brief ODBC accessor for listing the `filename` table (path and size of every stored file)
+ */
+class CManifestSelectAccessor
+{
+public:
+	TCHAR m_lpszFilepath[4000];  // File path (relative to IntelliDisk root)
+	__int64 m_nFilesize;          // Total file size in bytes
+
+	BEGIN_ODBC_PARAM_MAP(CManifestSelectAccessor)
+	END_ODBC_PARAM_MAP()
+
+	BEGIN_ODBC_COLUMN_MAP(CManifestSelectAccessor)
+		ODBC_COLUMN_ENTRY(1, m_lpszFilepath)
+		ODBC_COLUMN_ENTRY(2, m_nFilesize)
+	END_ODBC_COLUMN_MAP()
+
+	DEFINE_ODBC_COMMAND(CManifestSelectAccessor, _T("SELECT `filepath`, `filesize` FROM `filename` WHERE `current_version` <> -1 ORDER BY `filepath` ASC;"))
+
+		void ClearRecord() noexcept { memset(this, 0, sizeof(*this)); }
+};
+
+/**
+ * @brief Executes a SELECT for the file manifest and packs it as "filepath\0" + 64-bit size entries.
+ */
+class CManifestSelect : public CPooledCommand<CManifestSelectAccessor>
+{
+public:
+	bool Iterate(POOLED_CONNECTION& pDbConnect, std::vector<std::string>& pManifest, ULONGLONG& nFileCount, _In_opt_ CODBC::SQL_ATTRIBUTE* pAttributes = nullptr, _In_ ULONG nAttributes = 0)
+	{
+		nFileCount = 0;
+		if (!Open(pDbConnect, pAttributes, nAttributes))
+			return false;
+		pManifest.emplace_back();
+		while (true)
+		{
+			ClearRecord();
+			const SQLRETURN nRet = m_pCommand->FetchNext();
+			if (!SQL_SUCCEEDED(nRet))
+				break;
+			const std::string strFilePath = wstring_to_utf8(m_lpszFilepath);
+			const ULONGLONG nFileSize = (ULONGLONG)m_nFilesize;
+			// Start a new packet when this entry does not fit in the current one
+			if (pManifest.back().length() + strFilePath.length() + 1 + sizeof(nFileSize) > (size_t)LEGACY_FRAME_SIZE)
+				pManifest.emplace_back();
+			std::string& strPacket = pManifest.back();
+			strPacket.append(strFilePath.c_str(), strFilePath.length() + 1);
+			strPacket.append((const char*)&nFileSize, sizeof(nFileSize));
+			nFileCount++;
+		}
+		if (pManifest.back().empty())
+			pManifest.pop_back();
+		return true;
+	}
+};
+
+/**
+ * @brief Sends the list of stored files to a client that missed notifications.
+ *        The client downloads every file it lacks or holds with a different size.
+ * @param nSocketIndex Index of the client socket.
+ * @param pApplicationSocket The socket to write to.
+ * @return true on success, false on failure.
+ *
+ * "NotifyResync" is followed by the number of files (64-bit) and by packets of
+ * "filepath\0" + 64-bit file size entries, each packet filled up to LEGACY_FRAME_SIZE.
+ */
+bool SendManifest(const int nSocketIndex, CWSocket& pApplicationSocket)
+{
+	ULONGLONG nFileCount = 0;
+	std::vector<std::string> pManifest;
+	CManifestSelect pManifestSelect;
+	// Read the whole manifest first, so a database error cannot break the protocol halfway
+	{
+		CDatabaseConnection pConnection;
+		if (!pConnection.IsValid())
+		{
+			TRACE("MySQL operation failed!\n");
+			return false;
+		}
+		if (!pManifestSelect.Iterate(*pConnection, pManifest, nFileCount))
+		{
+			TRACE("MySQL operation failed!\n");
+			pConnection.SetBroken();
+			return false;
+		}
+	}
+
+	TRACE(_T("[SendManifest] %llu files in %d packets\n"), nFileCount, (int)pManifest.size());
+	const std::string strCommand = "NotifyResync";
+	if (!WriteBuffer(nSocketIndex, pApplicationSocket, (unsigned char*)strCommand.c_str(), (int)strCommand.length() + 1, true, false) ||
+		!WriteBuffer(nSocketIndex, pApplicationSocket, (unsigned char*)&nFileCount, sizeof(nFileCount), false, false))
+		return false;
+	for (const std::string& strPacket : pManifest)
+	{
+		if (!WriteBuffer(nSocketIndex, pApplicationSocket, (unsigned char*)strPacket.data(), (int)strPacket.length(), false, false))
+			return false;
+	}
+	return true;
+}
+
+/**
+ * @brief ODBC accessor for converting a range of Base64 rows of the `filedata` table
+ * @details The server decodes the chunk; `content` is only cleared when FROM_BASE64 succeeded,
+ *          so a row it cannot decode keeps its data (MySQL assigns the columns left to right).
+ */
+class CFiledataMigrateAccessor
+{
+public:
+	__int64 m_nFirstID;  // First filedata_id of the batch
+	__int64 m_nLastID;   // One past the last filedata_id of the batch
+
+	BEGIN_ODBC_PARAM_MAP(CFiledataMigrateAccessor)
+		SET_ODBC_PARAM_TYPE(SQL_PARAM_INPUT)
+		ODBC_PARAM_ENTRY(1, m_nFirstID)
+		ODBC_PARAM_ENTRY(2, m_nLastID)
+	END_ODBC_PARAM_MAP()
+
+	DEFINE_ODBC_COMMAND(CFiledataMigrateAccessor, _T("UPDATE `filedata` SET `content_blob` = FROM_BASE64(`content`), `content` = IF(`content_blob` IS NULL, `content`, NULL) WHERE `filedata_id` >= ? AND `filedata_id` < ? AND `content_blob` IS NULL;"))
+
+		void ClearRecord() noexcept { memset(this, 0, sizeof(*this)); }
+};
+
+/**
+ * @brief Executes an UPDATE that converts one batch of `filedata` rows to binary.
+ */
+class CFiledataMigrate : public CODBC::CAccessor<CFiledataMigrateAccessor>
+{
+public:
+	bool Execute(POOLED_CONNECTION& pDbConnect, const __int64& nFirstID, const __int64& nLastID, ULONGLONG& nRowCount)
+	{
+		ClearRecord();
+		CODBC::CStatement* statement = PrepareStatement(pDbConnect, reinterpret_cast<LPCTSTR>(GetDefaultCommand()));
+		if (statement == nullptr)
+			return false;
+		m_nFirstID = nFirstID;
+		m_nLastID = nLastID;
+		SQLRETURN nRet = BindParameters(*statement);
+		ODBC_CHECK_RETURN_FALSE(nRet, (*statement));
+		nRet = statement->Execute();
+		ODBC_CHECK_RETURN_FALSE(nRet, (*statement));
+		SQLLEN nRows = 0;
+		nRet = statement->RowCount(&nRows);
+		ODBC_CHECK_RETURN_FALSE(nRet, (*statement));
+		nRowCount += (nRows > 0) ? (ULONGLONG)nRows : 0;
+		return true;
+	}
+};
+
+constexpr __int64 MIGRATION_BATCH_SIZE = 256; // `filedata` rows converted per UPDATE (about 16 MB of chunks)
+constexpr int MIGRATION_LOCK_TIMEOUT = 5;      // Seconds the column rename waits for open transactions on `filedata`
+constexpr int MIGRATION_RENAME_ATTEMPTS = 60;  // Renames tried before the migration is left to the next start
+constexpr DWORD MIGRATION_RETRY_DELAY = 1000;  // Milliseconds between rename attempts, for the blocking transactions to end
+
+HANDLE g_hMigrationThread = nullptr;
+std::atomic<bool> g_bMigrationRunning = false;
+
+/**
+ * @brief Runs one step of the schema migration on its own pooled connection.
+ * @param lpszSQL The SQL statement to execute.
+ * @return true on success, false on failure.
+ */
+bool ExecuteMigrationStep(LPCTSTR lpszSQL)
+{
+	CGenericStatement pGenericStatement;
+	POOLED_CONNECTION* pPooledConnection = AcquireDatabase();
+	if (pPooledConnection == nullptr)
+		return false;
+	const bool bResult = pGenericStatement.Execute(*pPooledConnection, lpszSQL);
+	pPooledConnection->bBroken = !bResult;
+	ReleaseDatabase(pPooledConnection);
+	return bResult;
+}
+
+/**
+ * @brief Renames `content_blob` to `content` and records DATABASE_SCHEMA_VERSION under the exclusive schema lock.
+ * @details An upload takes the schema lock for each batch of rows while its transaction stays open, and the rename
+ *          waits for that transaction. So the rename gives up after MIGRATION_LOCK_TIMEOUT seconds and the lock is
+ *          released before the next attempt. The connection is taken before the lock because uploads keep theirs
+ *          while they wait for it.
+ * @return true on success, false on failure.
+ */
+bool RenameContentColumn()
+{
+	CGenericStatement pGenericStatement;
+	POOLED_CONNECTION* pPooledConnection = AcquireDatabase();
+	if (pPooledConnection == nullptr)
+		return false;
+	TCHAR lpszTimeoutSQL[0x40] = { 0, };
+	_stprintf_s(lpszTimeoutSQL, _countof(lpszTimeoutSQL), _T("SET SESSION lock_wait_timeout = %d;"), MIGRATION_LOCK_TIMEOUT);
+	bool bResult = pGenericStatement.Execute(*pPooledConnection, lpszTimeoutSQL);
+	bool bRenamed = false;
+	for (int nAttempt = 0; bResult && !bRenamed && g_bMigrationRunning && (nAttempt < MIGRATION_RENAME_ATTEMPTS); nAttempt++)
+	{
+		if (nAttempt > 0)
+			Sleep(MIGRATION_RETRY_DELAY);
+		AcquireSRWLockExclusive(&g_pSchemaLock);
+		bRenamed = pGenericStatement.Execute(*pPooledConnection, _T("ALTER TABLE `filedata` RENAME COLUMN `content_blob` TO `content`;"));
+		if (bRenamed)
+		{
+			bResult = pGenericStatement.Execute(*pPooledConnection, _T("UPDATE `schema_version` SET `version` = 3;"));
+			if (bResult)
+				g_nSchemaVersion = DATABASE_SCHEMA_VERSION;
+		}
+		ReleaseSRWLockExclusive(&g_pSchemaLock);
+		if (!bRenamed)
+			TRACE(_T("Schema migration: rename attempt %d timed out\n"), nAttempt + 1);
+	}
+	// The pooled connection goes back with the server's lock timeout
+	bResult = bResult && bRenamed && pGenericStatement.Execute(*pPooledConnection, _T("SET SESSION lock_wait_timeout = DEFAULT;"));
+	pPooledConnection->bBroken = !bResult;
+	ReleaseDatabase(pPooledConnection);
+	return bResult;
+}
+
+/**
+ * @brief Converts the Base64 rows of the `filedata` table and finishes the schema migration
+ * @details Runs while the server keeps serving clients:
+ * 1. Convert the rows that existed when the migration started, MIGRATION_BATCH_SIZE ids per
+ *    UPDATE on a connection taken from the pool for that batch only (new uploads are binary already)
+ * 2. Switch the reads to `content_blob` and wait for the downloads that still read `content`
+ * 3. Drop the Base64 columns (online DDL, file operations continue)
+ * 4. Rename `content_blob` to `content` and record DATABASE_SCHEMA_VERSION while no statement names the column;
+ *    an upload whose open transaction holds the table makes the rename time out, so it is retried
+ * Stopping the server interrupts step 1; the next start picks the migration up again.
+ */
+DWORD WINAPI MigrationThread(LPVOID lpParam)
+{
+	UNREFERENCED_PARAMETER(lpParam);
+	const ULONGLONG nStartTime = GetTickCount64();
+	ULONGLONG nRowCount = 0;
+	bool bResult = true;
+	if (g_bBase64Rows)
+	{
+		// Step 1: convert the old rows in batches
+		__int64 nLastID = 0;
+		CScalarSelect pScalarSelect;
+		CFiledataMigrate pFiledataMigrate;
+		POOLED_CONNECTION* pPooledConnection = AcquireDatabase();
+		bResult = (pPooledConnection != nullptr) &&
+			pScalarSelect.Iterate(*pPooledConnection, _T("SELECT IFNULL(MAX(`filedata_id`), 0) FROM `filedata`;"), nLastID);
+		if (pPooledConnection != nullptr)
+		{
+			pPooledConnection->bBroken = !bResult;
+			ReleaseDatabase(pPooledConnection);
+		}
+		for (__int64 nFirstID = 0; bResult && g_bMigrationRunning && (nFirstID <= nLastID); nFirstID += MIGRATION_BATCH_SIZE)
+		{
+			pPooledConnection = AcquireDatabase();
+			bResult = (pPooledConnection != nullptr) &&
+				pFiledataMigrate.Execute(*pPooledConnection, nFirstID, nFirstID + MIGRATION_BATCH_SIZE, nRowCount);
+			if (pPooledConnection != nullptr)
+			{
+				pPooledConnection->bBroken = !bResult;
+				ReleaseDatabase(pPooledConnection);
+			}
+		}
+		if (!bResult || !g_bMigrationRunning)
+		{
+			TRACE(_T("Schema migration stopped after %llu rows\n"), nRowCount);
+			return 0;
+		}
+
+		// Step 2: stop reading `content`; the exclusive lock waits for the downloads that still do
+		AcquireSRWLockExclusive(&g_pSchemaLock);
+		g_bBase64Rows = false;
+		ReleaseSRWLockExclusive(&g_pSchemaLock);
+
+		// Step 3: drop the Base64 columns without blocking uploads and downloads
+		bResult = ExecuteMigrationStep(_T("ALTER TABLE `filedata` DROP COLUMN `content`, DROP COLUMN `base64`, MODIFY COLUMN `content_blob` LONGBLOB NOT NULL, ALGORITHM=INPLACE, LOCK=NONE;"));
+		if (!bResult)
+		{
+			// Some rows could not be decoded - keep reading them through FROM_BASE64
+			AcquireSRWLockExclusive(&g_pSchemaLock);
+			g_bBase64Rows = true;
+			ReleaseSRWLockExclusive(&g_pSchemaLock);
+		}
+	}
+
+	// Step 4: give the binary column its final name
+	if (bResult && g_bMigrationRunning)
+		bResult = RenameContentColumn();
+	TRACE(_T("Schema migration %s: %llu rows converted in %llu ms\n"), bResult ? _T("done") : _T("failed"), nRowCount, GetTickCount64() - nStartTime);
+	return 0;
+}
+
+/**
+ * @brief Runs an ALTER statement unless the information_schema query finds what it adds.
+ * @param pDbConnect The pooled connection.
+ * @param lpszExistsSQL Query that counts the column or index.
+ * @param lpszAlterSQL The DDL statement.
+ * @return true on success, false on failure.
+ */
+bool AlterTableOnce(POOLED_CONNECTION& pDbConnect, LPCTSTR lpszExistsSQL, LPCTSTR lpszAlterSQL)
+{
+	CGenericStatement pGenericStatement;
+	CScalarSelect pScalarSelect;
+	__int64 nCount = 0;
+	return pScalarSelect.Iterate(pDbConnect, lpszExistsSQL, nCount) &&
+		((nCount > 0) || pGenericStatement.Execute(pDbConnect, lpszAlterSQL));
+}
+
+/**
+ * @details Schema versions:
+ * - DATABASE_SCHEMA_BASE64: no version recorded yet. Add the nullable `content_blob` column
+ *   (instant DDL) so new uploads are stored as binary, and record DATABASE_SCHEMA_MIGRATING.
+ * - DATABASE_SCHEMA_MIGRATING: start MigrationThread. `g_bBase64Rows` tells whether the
+ *   Base64 columns still exist (a previous run may have stopped after dropping them).
+ * - DATABASE_SCHEMA_VERSION: nothing to do.
+ * Independent of the chunk layout, the file version columns are added once: existing files
+ * and their chunks start at version 0, uploads are published by switching `current_version`.
+ * The same goes for the `chunk` table: rows stored before it keep their data inline
+ * (`chunk_hash` NULL), newer rows reference a shared chunk. Rows stored before `chunk_offset`
+ * keep it NULL; range downloads of those versions send the whole file. The `upload_session` table
+ * of resumable uploads is created when missing.
+ */
+bool UpgradeDatabase()
+{
+	CGenericStatement pGenericStatement;
+	CScalarSelect pScalarSelect;
+	__int64 nVersion = 0;
+	__int64 nBase64Columns = 0;
+	POOLED_CONNECTION* pPooledConnection = AcquireDatabase();
+	if (pPooledConnection == nullptr)
+	{
+		TRACE("MySQL operation failed!\n");
+		return false;
+	}
+	bool bResult = pGenericStatement.Execute(*pPooledConnection, _T("CREATE TABLE IF NOT EXISTS `schema_version` (`version` INT NOT NULL) ENGINE=InnoDB;")) &&
+		pScalarSelect.Iterate(*pPooledConnection, _T("SELECT IFNULL(MAX(`version`), 0) FROM `schema_version`;"), nVersion);
+	if (bResult && (nVersion == 0))
+	{
+		// Database created before the version table
+		nVersion = DATABASE_SCHEMA_BASE64;
+		bResult = pGenericStatement.Execute(*pPooledConnection, _T("INSERT INTO `schema_version` (`version`) VALUES (1);"));
+	}
+	if (bResult && (nVersion == DATABASE_SCHEMA_BASE64))
+	{
+		bResult = pGenericStatement.Execute(*pPooledConnection, _T("ALTER TABLE `filedata` ADD COLUMN `content_blob` LONGBLOB NULL, MODIFY COLUMN `content` LONGTEXT NULL, MODIFY COLUMN `base64` BIGINT NOT NULL DEFAULT 0;")) &&
+			pGenericStatement.Execute(*pPooledConnection, _T("UPDATE `schema_version` SET `version` = 2;"));
+		if (bResult)
+			nVersion = DATABASE_SCHEMA_MIGRATING;
+	}
+	if (bResult && (nVersion == DATABASE_SCHEMA_MIGRATING))
+	{
+		bResult = pScalarSelect.Iterate(*pPooledConnection, _T("SELECT COUNT(*) FROM `information_schema`.`COLUMNS` WHERE `TABLE_SCHEMA` = DATABASE() AND `TABLE_NAME` = 'filedata' AND `COLUMN_NAME` = 'base64';"), nBase64Columns);
+	}
+	// The columns are added instantly; the index is built online
+	bResult = bResult &&
+		pGenericStatement.Execute(*pPooledConnection, _T("CREATE TABLE IF NOT EXISTS `chunk` (`chunk_hash` BINARY(32) NOT NULL, `refcount` BIGINT NOT NULL, `content` LONGBLOB NOT NULL, PRIMARY KEY(`chunk_hash`)) ENGINE=InnoDB;")) &&
+		AlterTableOnce(*pPooledConnection,
+			_T("SELECT COUNT(*) FROM `information_schema`.`COLUMNS` WHERE `TABLE_SCHEMA` = DATABASE() AND `TABLE_NAME` = 'filedata' AND `COLUMN_NAME` = 'chunk_hash';"),
+			_T("ALTER TABLE `filedata` ADD COLUMN `chunk_hash` BINARY(32) NULL;")) &&
+		AlterTableOnce(*pPooledConnection,
+			_T("SELECT COUNT(*) FROM `information_schema`.`COLUMNS` WHERE `TABLE_SCHEMA` = DATABASE() AND `TABLE_NAME` = 'filedata' AND `COLUMN_NAME` = 'version';"),
+			_T("ALTER TABLE `filedata` ADD COLUMN `version` BIGINT NOT NULL DEFAULT 0;")) &&
+		AlterTableOnce(*pPooledConnection,
+			_T("SELECT COUNT(*) FROM `information_schema`.`STATISTICS` WHERE `TABLE_SCHEMA` = DATABASE() AND `TABLE_NAME` = 'filedata' AND `INDEX_NAME` = 'index_version';"),
+			_T("CREATE INDEX `index_version` ON `filedata` (`filename_id`, `version`) ALGORITHM=INPLACE LOCK=NONE;")) &&
+		AlterTableOnce(*pPooledConnection,
+			_T("SELECT COUNT(*) FROM `information_schema`.`COLUMNS` WHERE `TABLE_SCHEMA` = DATABASE() AND `TABLE_NAME` = 'filename' AND `COLUMN_NAME` = 'current_version';"),
+			_T("ALTER TABLE `filename` ADD COLUMN `current_version` BIGINT NOT NULL DEFAULT 0;")) &&
+		AlterTableOnce(*pPooledConnection,
+			_T("SELECT COUNT(*) FROM `information_schema`.`COLUMNS` WHERE `TABLE_SCHEMA` = DATABASE() AND `TABLE_NAME` = 'filedata' AND `COLUMN_NAME` = 'chunk_offset';"),
+			_T("ALTER TABLE `filedata` ADD COLUMN `chunk_offset` BIGINT NULL AFTER `chunk_hash`;")) &&
+		AlterTableOnce(*pPooledConnection,
+			_T("SELECT COUNT(*) FROM `information_schema`.`STATISTICS` WHERE `TABLE_SCHEMA` = DATABASE() AND `TABLE_NAME` = 'filedata' AND `INDEX_NAME` = 'index_offset';"),
+			_T("CREATE INDEX `index_offset` ON `filedata` (`filename_id`, `version`, `chunk_offset`) ALGORITHM=INPLACE LOCK=NONE;")) &&
+		pGenericStatement.Execute(*pPooledConnection, _T("CREATE TABLE IF NOT EXISTS `upload_session` (`session_token` BIGINT NOT NULL, `filename_id` BIGINT NOT NULL, `staging_version` BIGINT NOT NULL, `filesize` BIGINT NOT NULL, `committed_offset` BIGINT NOT NULL DEFAULT 0, `sha256_state` VARBINARY(255) NULL, `updated` TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP ON UPDATE CURRENT_TIMESTAMP, PRIMARY KEY(`session_token`), INDEX `index_staging` (`staging_version`)) ENGINE=InnoDB;"));
+	pPooledConnection->bBroken = !bResult;
+	ReleaseDatabase(pPooledConnection);
+	if (!bResult)
+	{
+		TRACE("MySQL operation failed!\n");
+		return false;
+	}
+
+	g_nSchemaVersion = (int)nVersion;
+	g_bBase64Rows = (nBase64Columns > 0);
+	TRACE(_T("Database schema version %d\n"), g_nSchemaVersion.load());
+	if (g_nSchemaVersion == DATABASE_SCHEMA_MIGRATING)
+	{
+		g_bMigrationRunning = true;
+		g_hMigrationThread = CreateThread(nullptr, 0, MigrationThread, nullptr, 0, nullptr);
+		ASSERT(g_hMigrationThread != nullptr);
+	}
+	return true;
+}
+
+void StopDatabaseUpgrade()
+{
+	if (g_hMigrationThread != nullptr)
+	{
+		g_bMigrationRunning = false;
+		WaitForSingleObject(g_hMigrationThread, INFINITE);
+		VERIFY(CloseHandle(g_hMigrationThread));
+		g_hMigrationThread = nullptr;
+	}
+}
+
+/**
+ * @brief ODBC accessor for listing the chunk versions that are no longer current
+ * @details Only committed versions are visible, so the chunks of running uploads are never listed;
+ *          neither are the versions of upload sessions, which their checkpoints commit before publishing
+ */
+class CGarbageSelectAccessor
+{
+public:
+	__int64 m_nFilenameID;  // File the chunks belong to
+	__int64 m_nVersion;     // Replaced version
+
+	BEGIN_ODBC_PARAM_MAP(CGarbageSelectAccessor)
+	END_ODBC_PARAM_MAP()
+
+	BEGIN_ODBC_COLUMN_MAP(CGarbageSelectAccessor)
+		ODBC_COLUMN_ENTRY(1, m_nFilenameID)
+		ODBC_COLUMN_ENTRY(2, m_nVersion)
+	END_ODBC_COLUMN_MAP()
+
+	DEFINE_ODBC_COMMAND(CGarbageSelectAccessor, _T("SELECT DISTINCT `filedata`.`filename_id`, `filedata`.`version` FROM `filedata` INNER JOIN `filename` ON `filename`.`filename_id` = `filedata`.`filename_id` WHERE `filedata`.`version` <> `filename`.`current_version` AND NOT EXISTS (SELECT 1 FROM `upload_session` WHERE `upload_session`.`staging_version` = `filedata`.`version`);"))
+
+		void ClearRecord() noexcept { memset(this, 0, sizeof(*this)); }
+};
+
+/**
+ * @brief Executes a SELECT for the replaced versions left over from a previous run
+ *        (or for the versions of another query with the same columns).
+ */
+class CGarbageSelect : public CPooledCommand<CGarbageSelectAccessor>
+{
+public:
+	bool Iterate(POOLED_CONNECTION& pDbConnect, std::deque<GARBAGE_VERSION>& pGarbageVersions, _In_opt_ LPCTSTR lpszSQL = nullptr)
+	{
+		if (!Open(pDbConnect, nullptr, 0, lpszSQL))
+			return false;
+		while (true)
+		{
+			ClearRecord();
+			const SQLRETURN nRet = m_pCommand->FetchNext();
+			if (!SQL_SUCCEEDED(nRet))
+				break;
+			pGarbageVersions.push_back({ m_nFilenameID, m_nVersion });
+		}
+		return true;
+	}
+};
+
+/**
+ * @brief ODBC accessor for selecting the replaced version the next garbage collector statements work on
+ */
+class CGarbageVersionSetAccessor
+{
+public:
+	__int64 m_nFilenameID;  // File the chunks belong to
+	__int64 m_nVersion;     // Replaced version
+
+	BEGIN_ODBC_PARAM_MAP(CGarbageVersionSetAccessor)
+		SET_ODBC_PARAM_TYPE(SQL_PARAM_INPUT)
+		ODBC_PARAM_ENTRY(1, m_nFilenameID)
+		ODBC_PARAM_ENTRY(2, m_nVersion)
+	END_ODBC_PARAM_MAP()
+
+	DEFINE_ODBC_COMMAND(CGarbageVersionSetAccessor, _T("SET @gc_filename_id = ?, @gc_version = ?;"))
+
+		void ClearRecord() noexcept { memset(this, 0, sizeof(*this)); }
+};
+
+/**
+ * @brief Executes a SET of @gc_filename_id and @gc_version.
+ */
+class CGarbageVersionSet : public CODBC::CAccessor<CGarbageVersionSetAccessor>
+{
+public:
+	bool Execute(POOLED_CONNECTION& pDbConnect, const GARBAGE_VERSION& pGarbageVersion)
+	{
+		ClearRecord();
+		CODBC::CStatement* statement = PrepareStatement(pDbConnect, reinterpret_cast<LPCTSTR>(GetDefaultCommand()));
+		if (statement == nullptr)
+			return false;
+		m_nFilenameID = pGarbageVersion.nFilenameID;
+		m_nVersion = pGarbageVersion.nVersion;
+		SQLRETURN nRet = BindParameters(*statement);
+		ODBC_CHECK_RETURN_FALSE(nRet, (*statement));
+		nRet = statement->Execute();
+		ODBC_CHECK_RETURN_FALSE(nRet, (*statement));
+		return true;
+	}
+};
+
+constexpr __int64 GARBAGE_BATCH_SIZE = 256; // `filedata` rows released per transaction (the LIMIT below)
+
+/**
+ * @brief Releases one batch of `filedata` rows of a replaced version in a short transaction:
+ *        the chunks lose a reference per row, the chunks left without references are deleted, then the rows.
+ * @param pGarbageVersion The replaced version.
+ * @param nRowCount [out] Number of `filedata` rows deleted.
+ * @return true on success, false on failure.
+ */
+bool CollectGarbageBatch(const GARBAGE_VERSION& pGarbageVersion, __int64& nRowCount)
+{
+	CGenericStatement pGenericStatement;
+	CGarbageVersionSet pGarbageVersionSet;
+	CScalarSelect pScalarSelect;
+	nRowCount = 0;
+	CDatabaseConnection pConnection;
+	if (!pConnection.IsValid())
+		return false;
+	CDatabaseTransaction pTransaction(pConnection);
+	if (!pTransaction.IsActive() ||
+		!pGarbageVersionSet.Execute(*pConnection, pGarbageVersion) ||
+		!pGenericStatement.Execute(*pConnection, _T("SET @gc_last_id = (SELECT MAX(`filedata_id`) FROM (SELECT `filedata_id` FROM `filedata` WHERE `filename_id` = @gc_filename_id AND `version` = @gc_version ORDER BY `filedata_id` ASC LIMIT 256) AS `batch`);")) ||
+		!pGenericStatement.Execute(*pConnection, _T("UPDATE `chunk` INNER JOIN (SELECT `chunk_hash`, COUNT(*) AS `refs` FROM `filedata` WHERE `filename_id` = @gc_filename_id AND `version` = @gc_version AND `filedata_id` <= @gc_last_id AND `chunk_hash` IS NOT NULL GROUP BY `chunk_hash`) AS `batch_chunks` ON `batch_chunks`.`chunk_hash` = `chunk`.`chunk_hash` SET `chunk`.`refcount` = `chunk`.`refcount` - `batch_chunks`.`refs`;")) ||
+		!pGenericStatement.Execute(*pConnection, _T("DELETE `chunk` FROM `chunk` INNER JOIN `filedata` ON `filedata`.`chunk_hash` = `chunk`.`chunk_hash` WHERE `filedata`.`filename_id` = @gc_filename_id AND `filedata`.`version` = @gc_version AND `filedata`.`filedata_id` <= @gc_last_id AND `chunk`.`refcount` <= 0;")) ||
+		!pGenericStatement.Execute(*pConnection, _T("DELETE FROM `filedata` WHERE `filename_id` = @gc_filename_id AND `version` = @gc_version AND `filedata_id` <= @gc_last_id;")) ||
+		!pScalarSelect.Iterate(*pConnection, _T("SELECT ROW_COUNT();"), nRowCount) ||
+		!pTransaction.Commit())
+	{
+		pConnection.SetBroken();
+		return false;
+	}
+	return true;
+}
+
+constexpr ULONGLONG UPLOAD_SESSION_CHECK_INTERVAL = 60 * 60 * 1000; // How often the garbage collector looks for expired upload sessions (ms)
+
+/**
+ * @brief Ends an upload session nobody resumed for a day: the rows it wrote after its last checkpoint
+ *        are deleted (they hold no chunk references) and the session goes, which leaves its version to the garbage collector.
+ * @param pGarbageVersion The version of the session.
+ * @param bExpired [out] Whether the session was deleted (false if it was resumed meanwhile).
+ * @return true on success, false on failure.
+ */
+bool ExpireUploadSession(const GARBAGE_VERSION& pGarbageVersion, bool& bExpired)
+{
+	CGenericStatement pGenericStatement;
+	CGarbageVersionSet pGarbageVersionSet;
+	CScalarSelect pScalarSelect;
+	__int64 nCount = 0;
+	bExpired = false;
+	CDatabaseConnection pConnection;
+	if (!pConnection.IsValid())
+		return false;
+	CDatabaseTransaction pTransaction(pConnection);
+	if (!pTransaction.IsActive() ||
+		!pGarbageVersionSet.Execute(*pConnection, pGarbageVersion) ||
+		// A resumed session holds the row lock until its next checkpoint, which also renews it
+		!pScalarSelect.Iterate(*pConnection, _T("SELECT COUNT(*) FROM `upload_session` WHERE `filename_id` = @gc_filename_id AND `staging_version` = @gc_version AND `updated` < NOW() - INTERVAL 1 DAY FOR UPDATE;"), nCount) ||
+		((nCount > 0) && !pGenericStatement.Execute(*pConnection, _T("DELETE FROM `filedata` WHERE `filename_id` = @gc_filename_id AND `version` = @gc_version AND `chunk_offset` >= (SELECT `committed_offset` FROM `upload_session` WHERE `filename_id` = @gc_filename_id AND `staging_version` = @gc_version);"))) ||
+		((nCount > 0) && !pGenericStatement.Execute(*pConnection, _T("DELETE FROM `upload_session` WHERE `filename_id` = @gc_filename_id AND `staging_version` = @gc_version;"))) ||
+		!pTransaction.Commit())
+	{
+		pConnection.SetBroken();
+		return false;
+	}
+	bExpired = (nCount > 0);
+	return true;
+}
+
+/**
+ * @brief Ends the upload sessions nobody resumed for a day.
+ * @param pExpired [out] The versions of the deleted sessions, to be collected as garbage.
+ */
+void ExpireUploadSessions(std::deque<GARBAGE_VERSION>& pExpired)
+{
+	std::deque<GARBAGE_VERSION> pSessions;
+	CGarbageSelect pGarbageSelect;
+	POOLED_CONNECTION* pPooledConnection = AcquireDatabase();
+	if (pPooledConnection == nullptr)
+		return;
+	pPooledConnection->bBroken = !pGarbageSelect.Iterate(*pPooledConnection, pSessions, _T("SELECT `filename_id`, `staging_version` FROM `upload_session` WHERE `updated` < NOW() - INTERVAL 1 DAY;"));
+	ReleaseDatabase(pPooledConnection);
+	for (const GARBAGE_VERSION& pGarbageVersion : pSessions)
+	{
+		bool bExpired = false;
+		if (!ExpireUploadSession(pGarbageVersion, bExpired))
+			TRACE(_T("Garbage collector: upload session of file %lld not expired\n"), pGarbageVersion.nFilenameID);
+		else if (bExpired)
+			pExpired.push_back(pGarbageVersion);
+	}
+}
+
+HANDLE g_hCollectorThread = nullptr;
+SRWLOCK g_pGarbageLock = SRWLOCK_INIT;
+CONDITION_VARIABLE g_pGarbageAvailable = CONDITION_VARIABLE_INIT;
+std::deque<GARBAGE_VERSION> g_pGarbageVersions; // Replaced versions waiting to be deleted
+std::atomic<bool> g_bCollectorRunning = false; // Changed under g_pGarbageLock
+
+void QueueGarbageVersion(const __int64 nFilenameID, const __int64 nVersion)
+{
+	AcquireSRWLockExclusive(&g_pGarbageLock);
+	if (g_bCollectorRunning)
+	{
+		g_pGarbageVersions.push_back({ nFilenameID, nVersion });
+		WakeConditionVariable(&g_pGarbageAvailable);
+	}
+	ReleaseSRWLockExclusive(&g_pGarbageLock);
+}
+
+/**
+ * @brief Deletes the chunks of replaced file versions
+ * @details Starts with the versions a previous run left behind, then serves the queue fed by
+ *          UploadFile. Each batch takes a pooled connection for one short transaction only, so the
+ *          uploads and downloads never wait behind a long delete. Versions still queued when the
+ *          server stops are found again by the next start. Expired upload sessions are ended at the
+ *          start and every UPLOAD_SESSION_CHECK_INTERVAL.
+ */
+DWORD WINAPI CollectorThread(LPVOID lpParam)
+{
+	UNREFERENCED_PARAMETER(lpParam);
+	ULONGLONG nVersionCount = 0;
+	ULONGLONG nRowCount = 0;
+	std::deque<GARBAGE_VERSION> pLeftovers;
+	std::deque<GARBAGE_VERSION> pExpired;
+	CGarbageSelect pGarbageSelect;
+	// The versions of the sessions expired now are found again as leftovers
+	ExpireUploadSessions(pExpired);
+	pExpired.clear();
+	ULONGLONG nLastExpiry = GetTickCount64();
+	POOLED_CONNECTION* pPooledConnection = AcquireDatabase();
+	if (pPooledConnection != nullptr)
+	{
+		pPooledConnection->bBroken = !pGarbageSelect.Iterate(*pPooledConnection, pLeftovers);
+		ReleaseDatabase(pPooledConnection);
+	}
+	AcquireSRWLockExclusive(&g_pGarbageLock);
+	g_pGarbageVersions.insert(g_pGarbageVersions.begin(), pLeftovers.begin(), pLeftovers.end());
+	while (true)
+	{
+		while (g_bCollectorRunning && g_pGarbageVersions.empty())
+		{
+			const ULONGLONG nElapsed = GetTickCount64() - nLastExpiry;
+			if (nElapsed >= UPLOAD_SESSION_CHECK_INTERVAL)
+				break;
+			SleepConditionVariableSRW(&g_pGarbageAvailable, &g_pGarbageLock, (DWORD)(UPLOAD_SESSION_CHECK_INTERVAL - nElapsed), 0);
+		}
+		if (!g_bCollectorRunning)
+			break;
+		if (GetTickCount64() - nLastExpiry >= UPLOAD_SESSION_CHECK_INTERVAL)
+		{
+			ReleaseSRWLockExclusive(&g_pGarbageLock);
+			ExpireUploadSessions(pExpired);
+			nLastExpiry = GetTickCount64();
+			AcquireSRWLockExclusive(&g_pGarbageLock);
+			g_pGarbageVersions.insert(g_pGarbageVersions.end(), pExpired.begin(), pExpired.end());
+			pExpired.clear();
+			continue;
+		}
+		const GARBAGE_VERSION pGarbageVersion = g_pGarbageVersions.front();
+		g_pGarbageVersions.pop_front();
+		ReleaseSRWLockExclusive(&g_pGarbageLock);
+
+		__int64 nRows = GARBAGE_BATCH_SIZE;
+		bool bResult = true;
+		while (bResult && (nRows >= GARBAGE_BATCH_SIZE) && g_bCollectorRunning)
+		{
+			bResult = CollectGarbageBatch(pGarbageVersion, nRows);
+			nRowCount += bResult ? (ULONGLONG)max(nRows, (__int64)0) : 0;
+		}
+		if (!bResult)
+			TRACE(_T("Garbage collector: version %lld of file %lld not deleted\n"), pGarbageVersion.nVersion, pGarbageVersion.nFilenameID);
+		nVersionCount++;
+		AcquireSRWLockExclusive(&g_pGarbageLock);
+	}
+	ReleaseSRWLockExclusive(&g_pGarbageLock);
+	TRACE(_T("Garbage collector: %llu versions, %llu rows deleted\n"), nVersionCount, nRowCount);
+	return 0;
+}
+
+void StartGarbageCollector()
+{
+	AcquireSRWLockExclusive(&g_pGarbageLock);
+	g_bCollectorRunning = true;
+	ReleaseSRWLockExclusive(&g_pGarbageLock);
+	g_hCollectorThread = CreateThread(nullptr, 0, CollectorThread, nullptr, 0, nullptr);
+	ASSERT(g_hCollectorThread != nullptr);
+}
+
+void StopGarbageCollector()
+{
+	if (g_hCollectorThread != nullptr)
+	{
+		AcquireSRWLockExclusive(&g_pGarbageLock);
+		g_bCollectorRunning = false;
+		g_pGarbageVersions.clear();
+		WakeConditionVariable(&g_pGarbageAvailable);
+		ReleaseSRWLockExclusive(&g_pGarbageLock);
+		WaitForSingleObject(g_hCollectorThread, INFINITE);
+		VERIFY(CloseHandle(g_hCollectorThread));
+		g_hCollectorThread = nullptr;
+	}
+	const ULONGLONG nReceivedBytes = g_pChunkStoreCounters.nReceivedBytes;
+	TRACE(_T("Chunk store: %llu of %llu chunks received, %llu of %llu bytes (deduplication ratio %.2f)\n"),
+		g_pChunkStoreCounters.nReceivedChunks.load(), g_pChunkStoreCounters.nChunks.load(),
+		nReceivedBytes, g_pChunkStoreCounters.nUploadedBytes.load(),
+		(double)g_pChunkStoreCounters.nUploadedBytes / (double)((nReceivedBytes > 0) ? nReceivedBytes : 1));
+}
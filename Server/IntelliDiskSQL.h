@@ -20,6 +20,11 @@ IntelliDisk. If not, see <http://www.opensource.org/licenses/gpl-3.0.html>*/
 
 #include "SocMFC.h"
 #include "ODBCWrappers.h"
+#include "Chunker.h"
+#include <array>
+#include <atomic>
+#include <deque>
+#include <set>
 
 /**
  * @brief Macro for ODBC error checking. Validates the return value of an ODBC call and returns false if the call failed.
@@ -33,6 +38,235 @@ IntelliDisk. If not, see <http://www.opensource.org/licenses/gpl-3.0.html>*/
 	return false; \
 }
 
+// Layout of the `filedata` table, recorded in the `schema_version` table
+#define DATABASE_SCHEMA_BASE64 1    // `content` LONGTEXT holds Base64 chunks (databases created before the version table)
+#define DATABASE_SCHEMA_MIGRATING 2 // `content_blob` LONGBLOB added, old rows are converted in the background
+#define DATABASE_SCHEMA_VERSION 3   // `content` LONGBLOB holds the raw chunks
+
+/**
+ * @brief SHA256 of a chunk, the key of the `chunk` table.
+ */
+typedef std::array<uint8_t, 32> CHUNK_HASH;
+
+/**
+ * @brief Number of file chunks inserted per database round trip during an upload (IntelliDisk.xml).
+ */
+extern int g_nUploadBatchSize;
+
+/**
+ * @brief Milliseconds the fetch stage of a download waits per MiB read, to benchmark a slow database (IntelliDisk.xml).
+ */
+extern int g_nFetchDelay;
+
+/**
+ * @brief Keep database connections open between file operations; false logs in for each one, to benchmark the pool (IntelliDisk.xml).
+ */
+extern bool g_bDatabasePool;
+
+/**
+ * @brief Cuts the files uploaded without PROTOCOL_DEDUP into content-defined chunks (IntelliDisk.xml).
+ */
+extern CContentChunker g_pContentChunker;
+
+/**
+ * @brief A database connection kept open by the connection pool between file operations.
+ *        Statements prepared on it are kept as well, keyed by their SQL text.
+ */
+typedef struct {
+	CODBC::CConnection pConnection; // Open ODBC connection
+	std::unordered_map<CODBC::String, std::unique_ptr<CODBC::CStatement>> pStatements; // Prepared statements
+	ULONGLONG nLastUsed;            // GetTickCount64() when it went back to the pool
+	bool bBroken;                   // An operation failed - close it instead of reusing it
+} POOLED_CONNECTION;
+
+/**
+ * @brief Connection pool counters, TRACEd when the pool is closed.
+ */
+typedef struct {
+	std::atomic<unsigned long long> nAcquired;  // Connections handed out
+	std::atomic<unsigned long long> nOpened;    // Logins to the database server
+	std::atomic<unsigned long long> nEvicted;   // Connections closed after being idle too long
+	std::atomic<unsigned long long> nBroken;    // Connections closed after a failure or a failed health check
+	std::atomic<unsigned long long> nWaits;     // Times a worker waited for a connection
+	std::atomic<unsigned long long> nPrepared;  // Statements prepared
+	std::atomic<unsigned long long> nReused;    // Executions of an already prepared statement
+} DATABASE_POOL_COUNTERS;
+
+extern DATABASE_POOL_COUNTERS g_pDatabasePoolCounters;
+
+/**
+ * @brief Chunk store counters, TRACEd when the garbage collector stops.
+ */
+typedef struct {
+	std::atomic<unsigned long long> nUploadedBytes; // Size of the uploaded files
+	std::atomic<unsigned long long> nReceivedBytes; // Chunk bytes the clients had to send
+	std::atomic<unsigned long long> nChunks;        // Chunks of the uploaded files
+	std::atomic<unsigned long long> nReceivedChunks; // Chunks the clients had to send
+} CHUNK_STORE_COUNTERS;
+
+extern CHUNK_STORE_COUNTERS g_pChunkStoreCounters;
+
+/**
+ * @brief Creates the shared ODBC environment and sizes the connection pool.
+ *        Connections are opened on demand, the settings are kept for the lifetime of the pool.
+ * @param nMaxConnections Maximum number of open connections.
+ * @param strHostName Host name of the database server.
+ * @param nHostPort Port of the database server.
+ * @param strDatabase Database name.
+ * @param strUsername Username for authentication.
+ * @param strPassword Password for authentication.
+ * @return true on success, false on failure.
+ */
+bool InitConnectionPool(const int nMaxConnections, const std::wstring& strHostName, const int nHostPort, const std::wstring& strDatabase, const std::wstring& strUsername, const std::wstring& strPassword);
+
+/**
+ * @brief Closes every pooled connection and the shared ODBC environment.
+ *        Must not be called while a worker still holds a connection.
+ */
+void CloseConnectionPool();
+
+/**
+ * @brief Takes a healthy connection from the pool, opening a new one when none is idle.
+ *        Waits for a connection to come back when the pool is at its limit.
+ * @return The connection, or nullptr when the database cannot be reached.
+ */
+POOLED_CONNECTION* AcquireDatabase();
+
+/**
+ * @brief Returns a connection to the pool (or closes it if it is broken).
+ * @param pPooledConnection The connection returned by AcquireDatabase.
+ */
+void ReleaseDatabase(POOLED_CONNECTION* pPooledConnection);
+
+/**
+ * @brief Returns the statement prepared for the given SQL text on this connection,
+ *        preparing it the first time. The cursor and bindings of the previous use are reset.
+ * @param pPooledConnection The connection.
+ * @param lpszSQL The SQL statement.
+ * @param pAttributes Statement attributes, applied when the statement is prepared.
+ * @param nAttributes Number of statement attributes.
+ * @return The statement, or nullptr on failure.
+ */
+CODBC::CStatement* PrepareStatement(POOLED_CONNECTION& pPooledConnection, LPCTSTR lpszSQL, CODBC::SQL_ATTRIBUTE* pAttributes = nullptr, ULONG nAttributes = 0);
+
+/**
+ * @brief Brings the database schema up to DATABASE_SCHEMA_VERSION.
+ *        Quick DDL runs right away; rows still stored as Base64 are converted by a background thread.
+ * @return true if the schema version is known, false on failure.
+ */
+bool UpgradeDatabase();
+
+/**
+ * @brief Stops the background schema migration (it resumes on the next start).
+ */
+void StopDatabaseUpgrade();
+
+/**
+ * @brief Chunks of a file version replaced by a newer upload, waiting to be deleted.
+ */
+typedef struct {
+	__int64 nFilenameID; // `filename_id` of the file
+	__int64 nVersion;    // `version` of the replaced chunks
+} GARBAGE_VERSION;
+
+/**
+ * @brief Starts the threads that fetch downloads from the database while the workers send them.
+ *        They are kept for the lifetime of the server, so a download does not create a thread.
+ * @param nThreadCount Number of fetch threads.
+ */
+void StartFetchThreads(const int nThreadCount);
+
+/**
+ * @brief Stops the fetch threads. Must not be called while a download is running.
+ */
+void StopFetchThreads();
+
+/**
+ * @brief Starts the thread that deletes the chunks of replaced file versions.
+ *        Versions left behind by a previous run are collected first.
+ */
+void StartGarbageCollector();
+
+/**
+ * @brief Stops the garbage collector; versions still queued are collected after the next start.
+ */
+void StopGarbageCollector();
+
+/**
+ * @brief Queues the chunks of a replaced file version for deletion.
+ * @param nFilenameID `filename_id` of the file.
+ * @param nVersion The replaced version.
+ */
+void QueueGarbageVersion(const __int64 nFilenameID, const __int64 nVersion);
+
+/**
+ * @brief Holds a pooled connection for the duration of one file operation.
+ */
+class CDatabaseConnection
+{
+public:
+	CDatabaseConnection() { m_pPooledConnection = AcquireDatabase(); }
+	~CDatabaseConnection() { if (m_pPooledConnection != nullptr) ReleaseDatabase(m_pPooledConnection); }
+	CDatabaseConnection(const CDatabaseConnection&) = delete;
+	CDatabaseConnection& operator=(const CDatabaseConnection&) = delete;
+
+	bool IsValid() const { return m_pPooledConnection != nullptr; }
+	void SetBroken() { m_pPooledConnection->bBroken = true; }
+	POOLED_CONNECTION& operator*() { return *m_pPooledConnection; }
+
+private:
+	POOLED_CONNECTION* m_pPooledConnection;
+};
+
+/**
+ * @brief Runs the statements of one file operation in a single transaction on a pooled connection.
+ *        Rolls back unless Commit() was called, then puts the connection back in autocommit mode.
+ */
+class CDatabaseTransaction
+{
+public:
+	CDatabaseTransaction(CDatabaseConnection& pConnection) : m_pConnection(pConnection)
+	{
+		m_bActive = SQL_SUCCEEDED((*m_pConnection).pConnection.SetAttrU(SQL_ATTR_AUTOCOMMIT, SQL_AUTOCOMMIT_OFF));
+		if (!m_bActive)
+			m_pConnection.SetBroken();
+	}
+	~CDatabaseTransaction()
+	{
+		if (m_bActive && !SQL_SUCCEEDED((*m_pConnection).pConnection.RollbackTran()))
+			m_pConnection.SetBroken();
+		if (!SQL_SUCCEEDED((*m_pConnection).pConnection.SetAttrU(SQL_ATTR_AUTOCOMMIT, SQL_AUTOCOMMIT_ON)))
+			m_pConnection.SetBroken();
+	}
+	CDatabaseTransaction(const CDatabaseTransaction&) = delete;
+	CDatabaseTransaction& operator=(const CDatabaseTransaction&) = delete;
+
+	bool IsActive() const { return m_bActive; }
+	bool Commit()
+	{
+		m_bActive = false;
+		if (SQL_SUCCEEDED((*m_pConnection).pConnection.CommitTran()))
+			return true;
+		m_pConnection.SetBroken();
+		return false;
+	}
+	/**
+	 * @brief Commits the work done so far and goes on in a new transaction (autocommit stays off).
+	 */
+	bool Checkpoint()
+	{
+		if (SQL_SUCCEEDED((*m_pConnection).pConnection.CommitTran()))
+			return true;
+		m_bActive = false;
+		m_pConnection.SetBroken();
+		return false;
+	}
+
+private:
+	CDatabaseConnection& m_pConnection;
+	bool m_bActive; // Started and neither committed nor rolled back yet
+};
+
 /**
  * @brief Executes a generic SQL statement (no output expected).
  *        Used for simple SQL commands such as SET, DELETE, etc.
@@ -60,6 +294,23 @@ public:
 		ODBC_CHECK_RETURN_FALSE(nRet, statement);
 		return true;
 	}
+
+	/**
+	 * @brief Executes the given SQL statement on the provided pooled connection.
+	 * @param pDbConnect The pooled connection.
+	 * @param lpszSQL The SQL statement to execute.
+	 * @return true on success, false on failure.
+	 */
+	bool Execute(POOLED_CONNECTION& pDbConnect, LPCTSTR lpszSQL)
+	{
+		CODBC::CStatement* statement = PrepareStatement(pDbConnect, lpszSQL);
+		if (statement == nullptr)
+			return false;
+
+		const SQLRETURN nRet = statement->Execute();
+		ODBC_CHECK_RETURN_FALSE(nRet, (*statement));
+		return true;
+	}
 };
 
 /**
@@ -72,6 +323,17 @@ public:
  */
 bool DownloadFile(const int nSocketIndex, CWSocket& pApplicationSocket, const std::wstring& strFilePath);
 
+/**
+ * @brief Handles a "DownloadRange" of a file from the server to a client (PROTOCOL_RANGE).
+ *        Streams the chunks that overlap the range, or the whole file when the range cannot be served.
+ * @param nSocketIndex Index of the client socket.
+ * @param pApplicationSocket The socket to write to.
+ * @param strFilePath The file path to download.
+ * @param pRequest The range the client asks for.
+ * @return true on success, false on failure.
+ */
+bool DownloadRange(const int nSocketIndex, CWSocket& pApplicationSocket, const std::wstring& strFilePath, const RANGE_REQUEST& pRequest);
+
 /**
  * @brief Handles the upload of a file from a client to the server.
  *        Receives file data from the client socket and stores it in the database, with SHA256 integrity check.
@@ -92,4 +354,12 @@ bool UploadFile(const int nSocketIndex, CWSocket& pApplicationSocket, const std:
  */
 bool DeleteFile(const int nSocketIndex, CWSocket& pApplicationSocket, const std::wstring& strFilePath);
 
+/**
+ * @brief Sends the list of stored files ("NotifyResync" + manifest) to a client that missed notifications.
+ * @param nSocketIndex Index of the client socket.
+ * @param pApplicationSocket The socket to write to.
+ * @return true on success, false on failure.
+ */
+bool SendManifest(const int nSocketIndex, CWSocket& pApplicationSocket);
+
 #endif
@@ -0,0 +1,180 @@
+/* Copyright (C) 2022-2026 Stefan-Mihai MOGA
+This file is part of IntelliDisk application developed by Stefan-Mihai MOGA.
+IntelliDisk is an alternative Windows version to the famous Microsoft OneDrive!
+
+IntelliDisk is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the Open
+Source Initiative, either version 3 of the License, or any later version.
+
+IntelliDisk is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+IntelliDisk. If not, see <http://www.opensource.org/licenses/gpl-3.0.html>*/
+
+#include "pch.h"
+#include "NotifyQueue.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#endif
+
+/**
+ * @brief Creates an empty queue; the path index is only allocated by the first push
+ */
+CNotifyQueue::CNotifyQueue()
+{
+	InitializeSRWLock(&m_pLock);
+	m_nCount = 0;
+	m_bSuspended = false;
+}
+
+/**
+ * @brief Queues an event, or merges it into the pending event for the same path
+ * @param nPathID The file path
+ * @param nFileEvent The event type
+ * @param nLimit Pending events that make the queue full
+ * @param nNow Current tick count
+ * @param nSettleTime Milliseconds the path must stay quiet before the event is sent (0 = at once)
+ * @param nPreviousEvent [out] The replaced event (NOTIFY_MERGED only)
+ * @param nDiscarded [out] The discarded events (NOTIFY_OVERFLOW only)
+ * @return NOTIFY_QUEUED, NOTIFY_MERGED, NOTIFY_OVERFLOW or NOTIFY_DROPPED
+ * @details Pointers into a deque stay valid while elements are only added at the back and removed
+ *          at the front, so the path index points straight at the pending events. A merge moves the
+ *          ready time back, but not past NOTIFY_SETTLE_LIMIT settle times after the first event, so a
+ *          file written without pause is still sent now and then.
+ */
+int CNotifyQueue::Push(const unsigned int nPathID, const int nFileEvent, const int nLimit, const ULONGLONG nNow, const ULONGLONG nSettleTime, int& nPreviousEvent, int& nDiscarded)
+{
+	int nResult = NOTIFY_QUEUED;
+	nPreviousEvent = nDiscarded = 0;
+	AcquireSRWLockExclusive(&m_pLock);
+	if (!m_pPendingPaths)
+		m_pPendingPaths = std::make_unique<std::unordered_map<unsigned int, NOTIFY_FILE_NODE*>>();
+	auto pPending = m_bSuspended ? m_pPendingPaths->end() : m_pPendingPaths->find(nPathID);
+	if (m_bSuspended)
+	{
+		nResult = NOTIFY_DROPPED;
+	}
+	else if (pPending != m_pPendingPaths->end())
+	{
+		// COALESCE: the client has not been told about this path yet - last event wins
+		nResult = NOTIFY_MERGED;
+		nPreviousEvent = pPending->second->nFileEvent;
+		pPending->second->nFileEvent = nFileEvent;
+		pPending->second->nReadyTime = min(nNow + nSettleTime, pPending->second->nFirstTime + NOTIFY_SETTLE_LIMIT * nSettleTime);
+	}
+	else if ((int)m_pEvents.size() >= nLimit)
+	{
+		// OVERFLOW: the client does not keep up
+		nResult = NOTIFY_OVERFLOW;
+		nDiscarded = (int)m_pEvents.size();
+		m_pEvents.clear();
+		m_pPendingPaths->clear();
+		m_bSuspended = true;
+	}
+	else
+	{
+		m_pEvents.push_back({ nPathID, nFileEvent, nNow, nNow + nSettleTime });
+		m_pPendingPaths->emplace(nPathID, &m_pEvents.back());
+	}
+	m_nCount = (LONG)m_pEvents.size();
+	ReleaseSRWLockExclusive(&m_pLock);
+	return nResult;
+}
+
+/**
+ * @brief Takes the oldest event, once it is ready
+ * @param pNode [out] The event
+ * @param nNow Current tick count
+ * @return false if the queue is empty or its oldest event is not ready yet
+ * @details Events leave in the order they were queued: one that is still settling holds back the
+ *          others, at most until NOTIFY_SETTLE_LIMIT settle times after its first event
+ */
+bool CNotifyQueue::Pop(NOTIFY_FILE_NODE& pNode, const ULONGLONG nNow)
+{
+	bool bResult = false;
+	AcquireSRWLockExclusive(&m_pLock);
+	if (!m_pEvents.empty() && (m_pEvents.front().nReadyTime <= nNow))
+	{
+		pNode = m_pEvents.front();
+		// Later events for this path get an entry of their own
+		m_pPendingPaths->erase(pNode.nPathID);
+		m_pEvents.pop_front();
+		bResult = true;
+	}
+	m_nCount = (LONG)m_pEvents.size();
+	ReleaseSRWLockExclusive(&m_pLock);
+	return bResult;
+}
+
+/**
+ * @brief Tick count from which the oldest event may be taken
+ * @return The ready time, or 0 if the queue is empty
+ */
+ULONGLONG CNotifyQueue::GetReadyTime()
+{
+	ULONGLONG nReadyTime = 0;
+	AcquireSRWLockShared(&m_pLock);
+	if (!m_pEvents.empty())
+		nReadyTime = m_pEvents.front().nReadyTime;
+	ReleaseSRWLockShared(&m_pLock);
+	return nReadyTime;
+}
+
+/**
+ * @brief Discards every event and accepts new ones again
+ * @return The discarded events
+ * @details Also frees the memory of the queue, so an idle slot costs no more than a new one
+ */
+int CNotifyQueue::Clear()
+{
+	AcquireSRWLockExclusive(&m_pLock);
+	const int nDiscarded = (int)m_pEvents.size();
+	std::deque<NOTIFY_FILE_NODE>().swap(m_pEvents);
+	m_pPendingPaths.reset();
+	m_nCount = 0;
+	m_bSuspended = false;
+	ReleaseSRWLockExclusive(&m_pLock);
+	return nDiscarded;
+}
+
+/**
+ * @brief Accepts new events again after an overflow
+ */
+void CNotifyQueue::Resume()
+{
+	AcquireSRWLockExclusive(&m_pLock);
+	m_bSuspended = false;
+	ReleaseSRWLockExclusive(&m_pLock);
+}
+
+/**
+ * @brief Counts the result of CNotifyQueue::Push
+ * @param pCounters The counters
+ * @param nResult The result of Push
+ * @param nFileEvent The event pushed
+ * @param nPreviousEvent The replaced event (NOTIFY_MERGED only)
+ * @param nDiscarded The discarded events (NOTIFY_OVERFLOW only)
+ */
+void CountNotification(NOTIFY_COUNTERS& pCounters, const int nResult, const int nFileEvent, const int nPreviousEvent, const int nDiscarded)
+{
+	pCounters.nPushed++;
+	switch (nResult)
+	{
+		case NOTIFY_MERGED:
+			if ((ID_FILE_DOWNLOAD == nPreviousEvent) && (ID_FILE_DELETE == nFileEvent))
+				pCounters.nCancelled++;
+			else
+				pCounters.nCoalesced++;
+			break;
+		case NOTIFY_OVERFLOW:
+			pCounters.nOverflows++;
+			pCounters.nDropped += (unsigned long long)nDiscarded + 1;
+			break;
+		case NOTIFY_DROPPED:
+			pCounters.nDropped++;
+			break;
+	}
+}
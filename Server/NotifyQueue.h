@@ -0,0 +1,137 @@
+/* Copyright (C) 2022-2026 Stefan-Mihai MOGA
+This file is part of IntelliDisk application developed by Stefan-Mihai MOGA.
+IntelliDisk is an alternative Windows version to the famous Microsoft OneDrive!
+
+IntelliDisk is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the Open
+Source Initiative, either version 3 of the License, or any later version.
+
+IntelliDisk is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+IntelliDisk. If not, see <http://www.opensource.org/licenses/gpl-3.0.html>*/
+
+#pragma once
+
+#ifndef __NOTIFY_QUEUE_H__
+#define __NOTIFY_QUEUE_H__
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+
+// File event identifiers for client notification queue
+#define ID_STOP_PROCESS 0x01   // Stop processing (not used server-side)
+#define ID_FILE_DOWNLOAD 0x02  // Notify client to download file
+#define ID_FILE_UPLOAD 0x03    // Notify client to upload file (not used)
+#define ID_FILE_DELETE 0x04    // Notify client to delete file
+
+// Result of CNotifyQueue::Push
+#define NOTIFY_QUEUED 0    // New event at the back of the queue
+#define NOTIFY_MERGED 1    // Replaced the pending event for the same path
+#define NOTIFY_OVERFLOW 2  // The queue was full: its events were discarded and it is suspended
+#define NOTIFY_DROPPED 3   // The queue is suspended, the event was not queued
+
+constexpr auto NOTIFY_SETTLE_LIMIT = 8; // A burst that goes on is sent at the latest this many settle times after its first event
+
+/**
+ * @brief Pending file event of one client.
+ */
+typedef struct {
+	unsigned int nPathID;  // Affected file path (interned by the caller)
+	int nFileEvent;        // Event type, e.g. ID_FILE_DOWNLOAD or ID_FILE_DELETE
+	ULONGLONG nFirstTime;  // Tick count of the first event merged into this one
+	ULONGLONG nReadyTime;  // Tick count from which the event may be sent
+} NOTIFY_FILE_NODE;
+
+/**
+ * @brief Notification counters, TRACEd when the server stops and reported by IntelliBench -replay.
+ */
+typedef struct {
+	std::atomic<unsigned long long> nPushed;    // Events pushed to a client queue
+	std::atomic<unsigned long long> nCoalesced; // Events merged into a pending event for the same path
+	std::atomic<unsigned long long> nCancelled; // Pending downloads replaced by a delete
+	std::atomic<unsigned long long> nSent;      // Events sent to a client
+	std::atomic<unsigned long long> nOverflows; // Queues that hit the limit and were replaced by a resync or a disconnect
+	std::atomic<unsigned long long> nDropped;   // Events not queued (overflow, or resync already pending)
+	std::atomic<unsigned long long> nResyncs;   // Manifests sent
+} NOTIFY_COUNTERS;
+
+/**
+ * @brief Counts the result of CNotifyQueue::Push.
+ * @param pCounters The counters.
+ * @param nResult The result of Push.
+ * @param nFileEvent The event pushed.
+ * @param nPreviousEvent The replaced event (NOTIFY_MERGED only).
+ * @param nDiscarded The discarded events (NOTIFY_OVERFLOW only).
+ */
+void CountNotification(NOTIFY_COUNTERS& pCounters, const int nResult, const int nFileEvent, const int nPreviousEvent, const int nDiscarded);
+
+/**
+ * @brief Notification queue of one client: a FIFO of events under an SRWLOCK, at most one per path.
+ *        Any thread may push, only the thread serving the client pops. An event for a path that is still
+ *        pending replaces it (the last event wins). An event is only sent once its path has been quiet for
+ *        the settle time, so a burst of edits costs one transfer per client even when the client keeps up.
+ *        When the queue is full, its events are discarded and it stays suspended until Resume(), so the
+ *        caller can replace them with a full resync or a disconnect.
+ */
+class CNotifyQueue
+{
+public:
+	CNotifyQueue();
+
+	/**
+	 * @brief Queues an event, or merges it into the pending event for the same path.
+	 * @param nPathID The file path.
+	 * @param nFileEvent The event type.
+	 * @param nLimit Pending events that make the queue full.
+	 * @param nNow Current tick count.
+	 * @param nSettleTime Milliseconds the path must stay quiet before the event is sent (0 = at once).
+	 * @param nPreviousEvent [out] The replaced event (NOTIFY_MERGED only).
+	 * @param nDiscarded [out] The discarded events (NOTIFY_OVERFLOW only).
+	 * @return NOTIFY_QUEUED, NOTIFY_MERGED, NOTIFY_OVERFLOW or NOTIFY_DROPPED.
+	 */
+	int Push(const unsigned int nPathID, const int nFileEvent, const int nLimit, const ULONGLONG nNow, const ULONGLONG nSettleTime, int& nPreviousEvent, int& nDiscarded);
+
+	/**
+	 * @brief Takes the oldest event, once it is ready.
+	 * @param pNode [out] The event.
+	 * @param nNow Current tick count.
+	 * @return false if the queue is empty or its oldest event is not ready yet.
+	 */
+	bool Pop(NOTIFY_FILE_NODE& pNode, const ULONGLONG nNow);
+
+	/**
+	 * @brief Tick count from which the oldest event may be taken.
+	 * @return The ready time, or 0 if the queue is empty.
+	 */
+	ULONGLONG GetReadyTime();
+
+	/**
+	 * @brief Discards every event and accepts new ones again.
+	 * @return The discarded events.
+	 */
+	int Clear();
+
+	/**
+	 * @brief Accepts new events again after an overflow.
+	 */
+	void Resume();
+
+	/**
+	 * @brief Number of pending events, read without the lock.
+	 */
+	int GetCount() const { return m_nCount; }
+
+private:
+	SRWLOCK m_pLock;            // Protects the members below, except m_nCount for readers
+	std::deque<NOTIFY_FILE_NODE> m_pEvents; // Pending events, oldest first
+	std::unique_ptr<std::unordered_map<unsigned int, NOTIFY_FILE_NODE*>> m_pPendingPaths; // Path ID -> event in m_pEvents (allocated on first push)
+	volatile LONG m_nCount;     // Size of m_pEvents
+	bool m_bSuspended;          // Overflowed: events are dropped until Resume()
+};
+
+#endif
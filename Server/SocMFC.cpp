@@ -900,6 +900,20 @@ int CWSocket::Send(_In_reads_bytes_(nBufLen) const void* pBuffer, _In_ int nBufL
 	return nSent;
 }
 
+int CWSocket::Send(_In_reads_(nBufferCount) WSABUF* pBuffers, _In_ int nBufferCount, _In_ int nFlags)
+{
+	//Validate our parameters
+#pragma warning(suppress: 26477)
+	ATLASSERT(IsCreated()); //must have been created first
+
+	//Gather the buffers into a single send, so the caller does not have to copy them into one packet
+	DWORD dwSent{ 0 };
+	if (WSASend(m_hSocket, pBuffers, static_cast<DWORD>(nBufferCount), &dwSent, static_cast<DWORD>(nFlags), nullptr, nullptr) == SOCKET_ERROR)
+		ThrowWSocketException();
+
+	return static_cast<int>(dwSent);
+}
+
 int CWSocket::SendTo(_In_reads_bytes_(nBufLen) const void* pBuf, _In_ int nBufLen, _In_reads_bytes_(nSockAddrLen) const SOCKADDR* pSockAddr, _In_ int nSockAddrLen, _In_ int nFlags)
 {
 	//Validate our parameters
@@ -118,11 +118,20 @@ bool CheckIfDatabaseConnected(const std::wstring& strHostName, const std::wstrin
 	ODBC_CHECK_RETURN_FALSE(nRet, pConnection);
 
 	CGenericStatement pGenericStatement;
+	VERIFY(pGenericStatement.Execute(pConnection, _T("DROP TABLE IF EXISTS `schema_version`;")));
+	VERIFY(pGenericStatement.Execute(pConnection, _T("DROP TABLE IF EXISTS `upload_session`;")));
+	VERIFY(pGenericStatement.Execute(pConnection, _T("DROP TABLE IF EXISTS `chunk`;")));
 	VERIFY(pGenericStatement.Execute(pConnection, _T("DROP TABLE IF EXISTS `filedata`;")));
 	VERIFY(pGenericStatement.Execute(pConnection, _T("DROP TABLE IF EXISTS `filename`;")));
-	VERIFY(pGenericStatement.Execute(pConnection, _T("CREATE TABLE `filename` (`filename_id` BIGINT NOT NULL AUTO_INCREMENT, `filepath` VARCHAR(256) NOT NULL, `filesize` BIGINT NOT NULL, PRIMARY KEY(`filename_id`)) ENGINE=InnoDB;")));
-	VERIFY(pGenericStatement.Execute(pConnection, _T("CREATE TABLE `filedata` (`filedata_id` BIGINT NOT NULL AUTO_INCREMENT, `filename_id` BIGINT NOT NULL, `content` LONGTEXT NOT NULL, `base64` BIGINT NOT NULL, PRIMARY KEY(`filedata_id`), FOREIGN KEY filedata_fk(filename_id) REFERENCES filename(filename_id)) ENGINE=InnoDB;")));
+	VERIFY(pGenericStatement.Execute(pConnection, _T("CREATE TABLE `filename` (`filename_id` BIGINT NOT NULL AUTO_INCREMENT, `filepath` VARCHAR(256) NOT NULL, `filesize` BIGINT NOT NULL, `current_version` BIGINT NOT NULL DEFAULT 0, PRIMARY KEY(`filename_id`)) ENGINE=InnoDB;")));
+	VERIFY(pGenericStatement.Execute(pConnection, _T("CREATE TABLE `filedata` (`filedata_id` BIGINT NOT NULL AUTO_INCREMENT, `filename_id` BIGINT NOT NULL, `version` BIGINT NOT NULL DEFAULT 0, `chunk_hash` BINARY(32) NULL, `chunk_offset` BIGINT NULL, `content` LONGBLOB NOT NULL, PRIMARY KEY(`filedata_id`), FOREIGN KEY filedata_fk(filename_id) REFERENCES filename(filename_id)) ENGINE=InnoDB;")));
 	VERIFY(pGenericStatement.Execute(pConnection, _T("CREATE UNIQUE INDEX index_filepath ON `filename`(`filepath`);")));
+	VERIFY(pGenericStatement.Execute(pConnection, _T("CREATE INDEX index_version ON `filedata`(`filename_id`, `version`);")));
+	VERIFY(pGenericStatement.Execute(pConnection, _T("CREATE INDEX index_offset ON `filedata`(`filename_id`, `version`, `chunk_offset`);")));
+	VERIFY(pGenericStatement.Execute(pConnection, _T("CREATE TABLE `chunk` (`chunk_hash` BINARY(32) NOT NULL, `refcount` BIGINT NOT NULL, `content` LONGBLOB NOT NULL, PRIMARY KEY(`chunk_hash`)) ENGINE=InnoDB;")));
+	VERIFY(pGenericStatement.Execute(pConnection, _T("CREATE TABLE `upload_session` (`session_token` BIGINT NOT NULL, `filename_id` BIGINT NOT NULL, `staging_version` BIGINT NOT NULL, `filesize` BIGINT NOT NULL, `committed_offset` BIGINT NOT NULL DEFAULT 0, `sha256_state` VARBINARY(255) NULL, `updated` TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP ON UPDATE CURRENT_TIMESTAMP, PRIMARY KEY(`session_token`), INDEX `index_staging` (`staging_version`)) ENGINE=InnoDB;")));
+	VERIFY(pGenericStatement.Execute(pConnection, _T("CREATE TABLE `schema_version` (`version` INT NOT NULL) ENGINE=InnoDB;")));
+	VERIFY(pGenericStatement.Execute(pConnection, _T("INSERT INTO `schema_version` (`version`) VALUES (3);")));
 
 	pConnection.Disconnect();
 	return true;
@@ -55,6 +55,8 @@ IntelliDisk. If not, see <http://www.opensource.org/licenses/gpl-3.0.html>*/
 #include <atlsync.h>
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <memory>
 #include <codecvt>
 #include <iostream>
 #include <fstream>